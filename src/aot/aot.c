@@ -0,0 +1,357 @@
+/*
+ * Ahead of time compiler.
+ *
+ * The code of a program image is turned into C, and the system C compiler
+ * turns that into a shared library that the VM runs with -a. The code is
+ * decoded by the VM loader, so the instructions are numbered the same way
+ * here as they are when the VM runs it.
+ *
+ * The start of the code and every instruction that is called by CALL, TRAP
+ * or RAISE to a fixed address begins a C function, which goes on to the
+ * next one. A jump to a fixed address inside the function is a goto, and a
+ * call to a fixed address is a C call, after the return address has been
+ * pushed on the VM stack the same as the interpreter does. The registers
+ * that the function uses and the flags are kept in locals, so the C
+ * compiler can keep them in machine registers and drop the flags that are
+ * never tested. They are put back in the vm_t whenever control leaves the
+ * function.
+ *
+ * Anything that is not known until the program runs is left to the
+ * interpreter: jumps and calls through a register, TRAP, RAISE, TRET, ERET
+ * and PAUSE. The compiled code returns the instruction, and the interpreter
+ * comes back into compiled code at the next entry point it reaches. The
+ * entry points are the function starts, the fixed jump targets, the labels
+ * and the instructions after anything that can come back from the
+ * interpreter. A backward jump also goes back to the interpreter when a
+ * signal has swapped the dispatch table, so that the signal is raised.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "aot.h"
+
+static vm_t vm;
+static uint8_t* starts;      // by instruction: begins a function
+static uint8_t* entries;     // by instruction: the interpreter can come in here
+static const char** names;   // by instruction: the label there, if there is one
+static int* name_lens;
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-o outfile] [-k cfile] image\n", name);
+}
+
+static void* alloc_or_die(size_t size)
+{
+    void* ptr = calloc(1, size);
+
+    if(ptr == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", size);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+static int base_of(size_t k)
+{
+    return opcode_table[vm.insns[k].insn.opcode].base;
+}
+
+/*
+ * The instructions that the compiled code gives back to the interpreter.
+ */
+static int left_to_interpreter(size_t k)
+{
+    switch (base_of(k))
+    {
+        case OP_TRAP:
+        case OP_TRET:
+        case OP_RAISE:
+        case OP_ERET:
+        case OP_PAUSE:
+            return 1;
+        case OP_JMP:
+        case OP_CALL:
+            return vm.insns[k].target == NULL;
+        default:
+            return 0;
+    }
+}
+
+static void find_entries(void)
+{
+    const uint8_t* ptr = vm.image.debug;
+    image_symbol_t rec;
+    const char* sym;
+
+    starts = alloc_or_die(vm.ninsns + 1);
+    entries = alloc_or_die(vm.ninsns + 1);
+    names = alloc_or_die((vm.ninsns + 1) * sizeof(const char*));
+    name_lens = alloc_or_die((vm.ninsns + 1) * sizeof(int));
+
+    starts[0] = entries[0] = 1;
+    for(size_t k = 0; k < vm.ninsns; k++)
+    {
+        int base = base_of(k);
+
+        if(vm.insns[k].target != NULL)
+        {
+            size_t t = vm.insns[k].target - vm.insns;
+
+            entries[t] = 1;
+            if(base == OP_CALL || base == OP_TRAP || base == OP_RAISE)
+                starts[t] = 1;
+        }
+        if(base == OP_CALL || left_to_interpreter(k))
+            entries[k + 1] = 1;
+    }
+
+    while((ptr = image_next_symbol(&vm.image, ptr, &rec, &sym)) != NULL)
+    {
+        const vm_insn_t* insn;
+
+        if(rec.segment != IMAGE_SEG_CODE || (insn = vm_find_insn(&vm, rec.offset)) == NULL)
+            continue;
+        entries[insn - vm.insns] = 1;
+        names[insn - vm.insns] = sym;
+        name_lens[insn - vm.insns] = rec.name_len;
+    }
+
+    // the end of the code is run by the interpreter
+    starts[vm.ninsns] = entries[vm.ninsns] = 0;
+}
+
+/************************
+ * writing the C
+ */
+static uint32_t used_regs(size_t start, size_t end)
+{
+    uint32_t regs = 0;
+
+    for(size_t k = start; k < end; k++)
+        regs |= cgen_regs(&vm.insns[k]);
+    return regs;
+}
+
+/*
+ * One instruction of a function that runs from start to end.
+ */
+static void write_insn(FILE* out, size_t k, size_t start, size_t end, uint32_t regs)
+{
+    const vm_insn_t* insn = &vm.insns[k];
+    const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+    const char* in = "    ";
+    size_t t = (insn->target != NULL)? (size_t)(insn->target - vm.insns): 0;
+
+    if(entries[k])
+        fprintf(out, "L%lu:\n", k);
+    fprintf(out, "    // %08x %s\n", insn->offset, info->name);
+
+    if(info->cond != 0)
+    {
+        fprintf(out, "    if(aot_cond(%d, f))\n    {\n", info->cond);
+        in = "        ";
+    }
+
+    if(left_to_interpreter(k))
+    {
+        fprintf(out, "%snext = &I[%lu];\n%sgoto out;\n", in, k, in);
+        goto done;
+    }
+
+    if(!cgen_data_op(out, in, &vm, k, "f", NULL))
+        goto done;
+
+    fputs(in, out);
+    switch (info->base)
+    {
+        case OP_END:
+            fprintf(out, "vm->status = VM_ENDED;\n%svm->stop_insn = &I[%lu];\n%snext = NULL;\n%sgoto out;\n",
+                    in, k, in, in);
+            break;
+        case OP_JMP:
+            fprintf(out, "f &= ~VM_FLAG_NZCV;\n");
+            if(t < start || t >= end)
+                fprintf(out, "%snext = &I[%lu];\n%sgoto out;\n", in, t, in);
+            else
+            {
+                if(t <= k)
+                    fprintf(out, "%sif(vm->dispatch != vm->handlers)\n%s{\n%s    next = &I[%lu];\n%s    goto out;\n%s}\n",
+                            in, in, in, t, in, in);
+                fprintf(out, "%sgoto L%lu;\n", in, t);
+            }
+            break;
+        case OP_CALL:
+            fprintf(out, "aot_push(vm, &I[%lu], 0x%x);\n", k, insn[1].offset);
+            fprintf(out, "%sf &= ~VM_FLAG_NZCV;\n", in);
+            fprintf(out, "%sif(depth == AOT_MAX_DEPTH)\n%s{\n%s    next = &I[%lu];\n%s    goto out;\n%s}\n",
+                    in, in, in, t, in, in);
+            cgen_spill(out, in, regs);
+            fprintf(out, "%sdepth++;\n%snext = f_%lu(vm, &I[%lu]);\n%sdepth--;\n", in, in, t, t, in);
+            fprintf(out, "%sif(next != &I[%lu])\n%s    return next;\n", in, k + 1, in);
+            cgen_reload(out, in, regs);
+            break;
+        case OP_EXCALL:
+            fprintf(out, "native = vm_find_native(%s);\n", cgen_value(&vm, k, 0, NULL));
+            fprintf(out, "%sif(native == NULL)\n%s    vm_fault(vm, &I[%lu], \"call to an external routine that does not exist\");\n",
+                    in, in, k);
+            fprintf(out, "%sf &= ~VM_FLAG_NZCV;\n", in);
+            cgen_spill(out, in, regs);
+            fprintf(out, "%snative->func(vm, &I[%lu]);\n", in, k);
+            cgen_reload(out, in, regs);
+            break;
+        case OP_RET:
+            fprintf(out, "insn = &I[%lu];\n%sgoto ret;\n", k, in);
+            break;
+        default:
+            fprintf(out, "vm_fault(vm, &I[%lu], \"invalid instruction\");\n", k);
+            break;
+    }
+
+done:
+    if(info->cond != 0)
+        fprintf(out, "    }\n");
+}
+
+static void write_function(FILE* out, size_t start, size_t end)
+{
+    uint32_t regs = used_regs(start, end);
+
+    if(names[start] != NULL)
+        fprintf(out, "// %.*s\n", name_lens[start], names[start]);
+    fprintf(out, "static const vm_insn_t* f_%lu(vm_t* vm, const vm_insn_t* insn)\n{\n", start);
+    fprintf(out, "    const vm_insn_t* I = vm->insns;\n");
+    fprintf(out, "    const vm_insn_t* next;\n");
+    fprintf(out, "    const vm_native_info_t* native;\n");
+    fprintf(out, "    uint32_t f = vm->flags;\n");
+    for(int r = 0; r < VM_NUM_REGS; r++)
+        if(regs & (1u << r))
+            fprintf(out, "    uint64_t r%d = vm->regs[%d];\n", r, r);
+    fprintf(out, "\n    (void)native;\n");
+
+    fprintf(out, "    switch (insn - I)\n    {\n");
+    for(size_t k = start; k < end; k++)
+        if(entries[k])
+            fprintf(out, "        case %lu: goto L%lu;\n", k, k);
+    fprintf(out, "        default: return insn;\n    }\n\n");
+
+    for(size_t k = start; k < end; k++)
+        write_insn(out, k, start, end, regs);
+
+    fprintf(out, "    next = &I[%lu];\n", end);
+    fprintf(out, "out:\n");
+    cgen_spill(out, "    ", regs);
+    fprintf(out, "    return next;\n");
+    fprintf(out, "ret:\n");
+    cgen_spill(out, "    ", regs);
+    fprintf(out, "    return aot_return(vm, insn);\n}\n\n");
+}
+
+static void write_program(FILE* out, const char* image)
+{
+    fprintf(out, "// Compiled from \"%s\" by aot.\n// DO NOT EDIT\n\n", image);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    fprintf(out, "#pragma GCC diagnostic ignored \"-Wunused-label\"\n\n");
+    fprintf(out, "static unsigned depth;\n\n");
+
+    for(size_t k = 0; k < vm.ninsns; k++)
+        if(starts[k])
+            fprintf(out, "static const vm_insn_t* f_%lu(vm_t* vm, const vm_insn_t* insn);\n", k);
+    fprintf(out, "\n");
+
+    for(size_t start = 0; start < vm.ninsns;)
+    {
+        size_t end = start + 1;
+
+        while(end < vm.ninsns && !starts[end])
+            end++;
+        write_function(out, start, end);
+        start = end;
+    }
+
+    size_t nentries = 0;
+    size_t func = 0;
+
+    fprintf(out, "static const aot_entry_t entries[] = {\n");
+    for(size_t k = 0; k < vm.ninsns; k++)
+    {
+        if(starts[k])
+            func = k;
+        if(entries[k])
+        {
+            fprintf(out, "    { %lu, f_%lu },\n", k, func);
+            nentries++;
+        }
+    }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "const aot_program_t aot_program = {\n");
+    fprintf(out, "    AOT_ABI, sizeof(vm_t), %lu, 0x%lxull, %lu, entries\n};\n",
+            vm.image.header->code_size, aot_code_hash(vm.image.code, vm.image.header->code_size), nentries);
+}
+
+int main(int argc, char** argv)
+{
+    const char* outfile = "a.so";
+    const char* keep = NULL;
+    char cfile[] = "/tmp/aotXXXXXX.c";
+    int opt;
+
+    while((opt = getopt(argc, argv, "o:k:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'k':
+                keep = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(vm_load(&vm, argv[optind]))
+        return 1;
+    find_entries();
+
+    FILE* out;
+
+    if(keep != NULL)
+        out = fopen(keep, "w");
+    else
+    {
+        int fd = mkstemps(cfile, 2);
+
+        out = (fd < 0)? NULL: fdopen(fd, "w");
+    }
+    if(out == NULL)
+    {
+        fprintf(stderr, "ERROR: cannot open output file: \"%s\": %s\n", (keep != NULL)? keep: cfile, strerror(errno));
+        vm_unload(&vm);
+        return 1;
+    }
+
+    write_program(out, argv[optind]);
+    fclose(out);
+
+    int ret = cgen_compile((keep != NULL)? keep: cfile, outfile);
+
+    if(keep == NULL)
+        unlink(cfile);
+    vm_unload(&vm);
+    return ret;
+}
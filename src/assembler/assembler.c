@@ -3,28 +3,96 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
 
 #include "assembler.h"
 #include "scanner.h"
 #include "parser.h"
 #include "errors.h"
+#include "sections.h"
+#include "fragment.h"
+#include "objcache.h"
+#include "peephole.h"
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-o outfile] [-j threads] [-c cachedir] [-O] [-L tracelog] infile\n", name);
+    exit(1);
+}
 
 int main(int argc, char** argv)
 {
+    const char* outfile = "a.out";
+    int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char* tracelog = NULL;
+    int opt;
+
+    while((opt = getopt(argc, argv, "o:j:c:OL:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'j':
+                nthreads = atoi(optarg);
+                break;
+            case 'c':
+                set_cache_dir(optarg);
+                break;
+            case 'O':
+                set_optimize(1);
+                break;
+            case 'L':
+                tracelog = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(optind != argc - 1)
+        usage(argv[0]);
+
+    if(nthreads < 1)
+        nthreads = 1;
+
     init_errors(10, stdout);
+    if(log_start(tracelog) && tracelog != NULL)
+        return 1;
     scanner_init();
     init_sections();
-    scanner_open_infile(argv[1]);
 
-    parse_all();
+    fragment_t* root = assemble_files(argv[optind], nthreads);
+
+    size_t relaxed = 0;
+
+    if(get_num_errors() == 0)
+    {
+        link_sections(root);
+        relaxed = relax_code();
+    }
+
+    if(get_num_errors() == 0 && write_image(outfile))
+        inc_error_count();
+
+    // the messages have to be out before the summary
+    log_stop();
 
     int errors = get_num_errors();
 
+    if(errors == 0)
+    {
+        peephole_report(stdout);
+        printf("\nrelaxation saved %lu bytes of code\n", relaxed);
+    }
+
     if(errors != 0)
         printf("\nparse failed: %d errors: %d warnings\n", errors, get_num_warnings());
     else
         printf("\nparse succeeded: %d errors: %d warnings\n", errors, get_num_warnings());
 
     destroy_all_sections();
+    destroy_fragments();
     return errors;
 }
@@ -1,8 +1,11 @@
 #ifndef __ASSEMBLER_H__
 #  define __ASSEMBLER_H__
 
+#  include "arena.h"
+
 void init_sections(void);
 void destroy_all_sections(void);
+arena_t* assembler_arena(void);
 
 #  define MAX_SYMBOL  128
 
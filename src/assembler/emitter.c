@@ -0,0 +1,224 @@
+/*
+ * Byte stream builder for sections.
+ *
+ * A stream is a list of chunks. When a chunk fills up, another one is linked
+ * on the end, so nothing that has been written is ever copied again until
+ * the final image is built. Chunks start small and double in size up to a
+ * limit so that small sections stay small. All of the memory comes from the
+ * assembler arena.
+ *
+ * Values that depend on where a symbol ends up are written as zeros and a
+ * relocation is recorded beside the stream. They are filled in when the
+ * image is laid out.
+ */
+#include "common.h"
+
+#include "assembler.h"
+#include "emitter.h"
+
+#define MIN_CHUNK   256
+#define MAX_CHUNK   (1024 * 64)
+
+/*
+ * Add a chunk to the end of the stream that can hold at least size bytes.
+ */
+static void add_chunk(emit_stream_t* stream, size_t size)
+{
+    size_t csize = (stream->tail == NULL)? MIN_CHUNK: stream->tail->size << 1;
+    emit_chunk_t* chunk;
+
+    if(csize > MAX_CHUNK)
+        csize = MAX_CHUNK;
+    if(csize < size)
+        csize = size;
+
+    chunk = arena_alloc(assembler_arena(), sizeof(emit_chunk_t) + csize);
+    chunk->next = NULL;
+    chunk->size = csize;
+    chunk->used = 0;
+
+    if(stream->tail != NULL)
+        stream->tail->next = chunk;
+    else
+        stream->head = chunk;
+    stream->tail = chunk;
+}
+
+/*
+ * Return a pointer to size bytes at the end of the stream. A write that
+ * does not fit in the current chunk is split between it and a new one, so
+ * this returns as much as is available and the caller loops.
+ */
+static uint8_t* reserve(emit_stream_t* stream, size_t size, size_t* got)
+{
+    emit_chunk_t* chunk = stream->tail;
+
+    if(chunk == NULL || chunk->used == chunk->size)
+    {
+        add_chunk(stream, size);
+        chunk = stream->tail;
+    }
+
+    size_t avail = chunk->size - chunk->used;
+    uint8_t* ptr = &chunk->data[chunk->used];
+
+    *got = (size < avail)? size: avail;
+    chunk->used += *got;
+    stream->size += *got;
+
+    return ptr;
+}
+
+/************************
+ * public interface
+ */
+void emit_init(emit_stream_t* stream)
+{
+    memset(stream, 0, sizeof(emit_stream_t));
+}
+
+void emit_open(emit_cursor_t* cursor, emit_stream_t* stream)
+{
+    cursor->stream = stream;
+}
+
+size_t emit_offset(emit_cursor_t* cursor)
+{
+    return cursor->stream->size;
+}
+
+void emit_bytes(emit_cursor_t* cursor, const void* bytes, size_t size)
+{
+    const uint8_t* src = (const uint8_t*)bytes;
+    size_t got;
+
+    while(size > 0)
+    {
+        uint8_t* ptr = reserve(cursor->stream, size, &got);
+
+        memcpy(ptr, src, got);
+        src += got;
+        size -= got;
+    }
+}
+
+void emit_fill(emit_cursor_t* cursor, int value, size_t count)
+{
+    size_t got;
+
+    while(count > 0)
+    {
+        uint8_t* ptr = reserve(cursor->stream, count, &got);
+
+        memset(ptr, value, got);
+        count -= got;
+    }
+}
+
+/*
+ * Write count copies of a pattern of size bytes. One copy is written and
+ * then doubled with memcpy until the space is full, so a large repeat takes
+ * a handful of copies instead of one per item.
+ */
+void emit_repeat(emit_cursor_t* cursor, const void* pattern, size_t size, size_t count)
+{
+    const uint8_t* pat = (const uint8_t*)pattern;
+    size_t total = size * count;
+    size_t pos = 0;          // bytes of the repeated pattern written so far
+    size_t got;
+
+    // a pattern that is all one byte is a plain fill
+    size_t i;
+    for(i = 1; i < size && pat[i] == pat[0]; i++)
+        ;
+    if(size == 0 || i == size)
+    {
+        emit_fill(cursor, (size == 0)? 0: pat[0], total);
+        return;
+    }
+
+    while(total > 0)
+    {
+        uint8_t* ptr = reserve(cursor->stream, total, &got);
+        size_t done = (got < size)? got: size;
+
+        // a piece may start part way through the pattern
+        for(i = 0; i < done; i++)
+            ptr[i] = pat[(pos + i) % size];
+
+        while(done < got)
+        {
+            size_t len = (done < got - done)? done: got - done;
+
+            memcpy(ptr + done, ptr, len);
+            done += len;
+        }
+
+        pos += got;
+        total -= got;
+    }
+}
+
+/*
+ * Reserve width bytes for the value of a symbol and remember where they are.
+ */
+void emit_reloc(emit_cursor_t* cursor, const char* symbol, int64_t addend, int width)
+{
+    emit_add_reloc(cursor->stream, cursor->stream->size, width, symbol, addend);
+    emit_fill(cursor, 0, width);
+}
+
+/*
+ * Record a relocation for bytes that are already in the stream.
+ */
+void emit_add_reloc(emit_stream_t* stream, size_t offset, int width, const char* symbol, int64_t addend)
+{
+    if(stream->nrelocs + 1 > stream->reloc_cap)
+    {
+        size_t new_cap = (stream->reloc_cap == 0)? 16: stream->reloc_cap << 1;
+
+        stream->relocs = arena_realloc(assembler_arena(), stream->relocs,
+                                       stream->reloc_cap * sizeof(reloc_t), new_cap * sizeof(reloc_t));
+        stream->reloc_cap = new_cap;
+    }
+
+    reloc_t* rel = &stream->relocs[stream->nrelocs++];
+
+    rel->offset = offset;
+    rel->width = width;
+    rel->symbol = arena_strdup(assembler_arena(), symbol);
+    rel->addend = addend;
+}
+
+/*
+ * Copy the whole stream to dest, which must have room for stream->size
+ * bytes.
+ */
+void emit_copy_out(emit_stream_t* stream, uint8_t* dest)
+{
+    for(emit_chunk_t* chunk = stream->head; chunk != NULL; chunk = chunk->next)
+    {
+        memcpy(dest, chunk->data, chunk->used);
+        dest += chunk->used;
+    }
+}
+
+/*
+ * Replace the contents of the stream with size bytes, which can be no more
+ * than it holds now. The chunks that are there are written again, so nothing
+ * is allocated. The relocations are left for the caller to fix.
+ */
+void emit_replace(emit_stream_t* stream, const uint8_t* bytes, size_t size)
+{
+    stream->size = size;
+    for(emit_chunk_t* chunk = stream->head; chunk != NULL; chunk = chunk->next)
+    {
+        if(size > 0)
+            stream->tail = chunk;
+
+        chunk->used = (size < chunk->size)? size: chunk->size;
+        memcpy(chunk->data, bytes, chunk->used);
+        bytes += chunk->used;
+        size -= chunk->used;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef __EMITTER_H__
+#  define __EMITTER_H__
+
+#  include <stdint.h>
+#  include <stddef.h>
+
+/*
+ * For emitter.c
+ */
+typedef struct emit_chunk_t
+{
+    struct emit_chunk_t* next;
+    size_t size;             // capacity of the data area
+    size_t used;             // bytes written to the data area
+    uint8_t data[];
+} emit_chunk_t;
+
+/*
+ * A place in a stream where the value of a symbol is written once the
+ * layout of the program is known.
+ */
+typedef struct
+{
+    size_t offset;           // where the value goes, relative to the stream
+    int width;               // number of bytes in the value: 1, 2, 4 or 8
+    const char* symbol;      // dotted name of the symbol
+    int64_t addend;          // added to the value of the symbol
+} reloc_t;
+
+typedef struct
+{
+    emit_chunk_t* head;      // first chunk, for copying the stream out
+    emit_chunk_t* tail;      // chunk that is being written
+    size_t size;             // total bytes in the stream
+    reloc_t* relocs;         // relocations, in the order they were emitted
+    size_t nrelocs;
+    size_t reloc_cap;
+} emit_stream_t;
+
+/*
+ * The parser holds a cursor on the stream it is writing so that appending
+ * does not need to look anything up.
+ */
+typedef struct
+{
+    emit_stream_t* stream;
+} emit_cursor_t;
+
+void emit_init(emit_stream_t* stream);
+void emit_open(emit_cursor_t* cursor, emit_stream_t* stream);
+size_t emit_offset(emit_cursor_t* cursor);
+void emit_bytes(emit_cursor_t* cursor, const void* bytes, size_t size);
+void emit_fill(emit_cursor_t* cursor, int value, size_t count);
+void emit_repeat(emit_cursor_t* cursor, const void* pattern, size_t size, size_t count);
+void emit_reloc(emit_cursor_t* cursor, const char* symbol, int64_t addend, int width);
+void emit_add_reloc(emit_stream_t* stream, size_t offset, int width, const char* symbol, int64_t addend);
+void emit_copy_out(emit_stream_t* stream, uint8_t* dest);
+void emit_replace(emit_stream_t* stream, const uint8_t* bytes, size_t size);
+
+#endif
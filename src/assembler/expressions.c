@@ -9,6 +9,8 @@
 #include "scanner.h"
 #include "errors.h"
 #include "sections.h"
+#include "symbols.h"
+#include "expressions.h"
 
 /*
  * This expression evaluator is for data definition expressions only. Expressions
@@ -17,15 +19,22 @@
  * An expression can be a number or a simple arithmetic expression consisting of
  * add, subtract, multiply, or divide operations. The binary operations are also
  * permitted on non-float values. The value of each term in the expression must
- * be a constant value. No symbolic values or registers are allowed in these
- * expressions.
+ * be a constant value. A term can name an object that was defined earlier in
+ * the same file with a single constant value, as "name" in the same section or
+ * as "section.name". No registers are allowed in these expressions.
  *
- * After the expression is evaluated, the resulting value is stored in a data
- * structure which can be retrieved by the data_section code.
+ * This implements the shunting yard algorithm. Operators are applied as soon
+ * as they come off of the operator stack, so what is left on the value stack
+ * at the end is the folded value of the whole expression. The value of an
+ * object is folded once, when it is defined, and kept with its symbol, so
+ * naming it again costs a single lookup.
  *
- * The first token that is read is expected to be a number.
+ * The stacks have a fixed size and are reused by every expression, and
+ * numbers are converted from the scanner buffer where they are, so
+ * evaluating an expression does not allocate anything.
  *
- * This implements the shunting yard algorithm.
+ * The expression ends at the first token that cannot continue it, which is
+ * returned to the caller to check.
  */
 
 // operator precidences, where higher precidence is a higher number
@@ -51,255 +60,481 @@ enum
     CPAR = 8,
 };
 
+#define EXPR_STACK_SIZE 64
+
 typedef struct
 {
     int token;
     int prec;
-    union
-    {
-        uint64_t unum;
-        int64_t inum;
-        double fnum;
-    } __attribute__((packed)) value;
+    int unary;
 } stack_item_t;
 
 typedef struct
 {
-    stack_item_t* stack;
-    size_t size;
-    size_t capacity;
+    stack_item_t stack[EXPR_STACK_SIZE];
+    int top;
+} oper_stack_t;
+
+typedef struct
+{
+    expr_value_t stack[EXPR_STACK_SIZE];
     int top;
 } value_stack_t;
 
-static value_stack_t oper_stack = {.stack = NULL,.size = 0,.capacity = 1,.top = 0 };
-static value_stack_t out_stack = {.stack = NULL,.size = 0,.capacity = 1,.top = 0 };
+static __thread oper_stack_t oper_stack;
+static __thread value_stack_t out_stack;
 
-static void init_stacks(void)
-{
-    if(oper_stack.stack != NULL)
-        free(oper_stack.stack);
+// the token that ended the last expression, in case it has to be put back
+static __thread int last_term;
+static __thread char last_term_str[MAX_SYMBOL];
 
-    if(out_stack.stack != NULL)
-        free(out_stack.stack);
+static int push_oper(int token, int prec, int unary)
+{
+    if(oper_stack.top >= EXPR_STACK_SIZE)
+    {
+        syntax("expression is too complex");
+        return 1;
+    }
 
-    oper_stack.size = 0;
-    oper_stack.top = 0;
-    oper_stack.capacity = 1;
-    oper_stack.stack = NULL;
+    stack_item_t* item = &oper_stack.stack[oper_stack.top++];
 
-    out_stack.size = 0;
-    out_stack.top = 0;
-    out_stack.capacity = 1;
-    out_stack.stack = NULL;
+    item->token = token;
+    item->prec = prec;
+    item->unary = unary;
+    return 0;
 }
 
-static void grow_stack(value_stack_t * stack)
+static int push_value(const expr_value_t* val)
 {
-    if(stack->size + 2 > stack->capacity)
-        stack->capacity = stack->capacity << 1;
+    if(out_stack.top >= EXPR_STACK_SIZE)
+    {
+        syntax("expression is too complex");
+        return 1;
+    }
 
-    stack->stack = (stack_item_t *) realloc(stack->stack, stack->capacity * sizeof(stack_item_t));
-    if(stack->stack == NULL)
-        fatal_error("cannot allocate %lu bytes for expression stack", stack->capacity * sizeof(stack_item_t));
+    out_stack.stack[out_stack.top++] = *val;
+    return 0;
 }
 
-static void push(value_stack_t * stack, stack_item_t * val)
+static stack_item_t* peek(void)
 {
-    grow_stack(stack);
-    memcpy((void *)&stack->stack[stack->top], (void *)val, sizeof(stack_item_t));
-    stack->top++;
+    return (oper_stack.top > 0)? &oper_stack.stack[oper_stack.top - 1]: NULL;
 }
 
-static stack_item_t* pop(value_stack_t * stack)
+static double as_float(const expr_value_t* val)
 {
-    stack->top--;
-    if(stack->top < 0)
+    switch (val->type)
     {
-        stack->top = 0;
-        // syntax("expression stack underrun");
-        return NULL;
+        case EXPR_INT:
+            return (double)val->value.inum;
+        case EXPR_UINT:
+            return (double)val->value.unum;
+        default:
+            return val->value.fnum;
     }
-    return &stack->stack[stack->top];
 }
 
-static stack_item_t* peek(value_stack_t * stack)
+/*
+ * Convert a number from the scanner buffer. Hex numbers are unsigned. A
+ * decimal number is signed unless it is too big for that.
+ */
+static int convert_number(int tok, const char* str, expr_value_t* val)
 {
-    if(stack->top <= 0)
-        return &stack->stack[0];
-    else
-        return &stack->stack[stack->top-1];
+    uint64_t num = 0;
+
+    switch (tok)
+    {
+        case TOK_UNUM_LITERAL:
+            val->type = EXPR_UINT;
+            for(const char* ptr = str + 2; *ptr != 0; ptr++)
+            {
+                int digit = (*ptr <= '9')? *ptr - '0': (*ptr | 0x20) - 'a' + 10;
+
+                if(num >> 60)
+                    goto too_large;
+                num = (num << 4) | digit;
+            }
+            val->value.unum = num;
+            break;
+
+        case TOK_INUM_LITERAL:
+            for(const char* ptr = str; *ptr != 0; ptr++)
+            {
+                uint64_t digit = *ptr - '0';
+
+                if(num > (UINT64_MAX - digit) / 10)
+                    goto too_large;
+                num = num * 10 + digit;
+            }
+            val->type = (num > INT64_MAX)? EXPR_UINT: EXPR_INT;
+            val->value.unum = num;
+            break;
+
+        case TOK_FNUM_LITERAL:
+            val->type = EXPR_FLOAT;
+            errno = 0;
+            val->value.fnum = strtod(str, NULL);
+            if(errno == ERANGE)
+                goto too_large;
+            break;
+    }
+
+    return 0;
+
+too_large:
+    syntax("number \"%s\" is out of range", str);
+    return 1;
 }
 
-// returns 1 if the parsing should stop; for example if there is an error. Otherwise, return 0.
-int parse_expression(void)
+/*
+ * A name in an expression has to be an object with a constant value that
+ * has already been defined in this file.
+ */
+static int lookup_value(const char* sec_name, const char* name, expr_value_t* val)
 {
-    stack_item_t item;
-    int finished = 0;
-    int tok;
-    char buffer[MAX_SYMBOL];
-    // this is set when the item read was an operator and cleared when it's not.
-    // It's used to detect if an operator is unary.
-    int flag = 1;
+    symbol_t* sym;
 
-    init_stacks();
+    if(strchr(name, '.') != NULL)
+        sym = find_symbol(name);
+    else
+        sym = find_section_symbol(sec_name, name);
 
-    while(!finished) {
-        tok = scanner_get_token(buffer, sizeof(buffer));
-        // fill in the item
-        switch(tok) {
-            case TOK_UNUM_LITERAL:
-                item.token = tok;
-                item.value.unum = strtol(buffer, NULL, 16);
-                item.prec = 0;
-                push(&out_stack, &item);
-                flag = 0;
-                break;
-            case TOK_INUM_LITERAL:
-                item.token = tok;
-                item.value.inum = strtol(buffer, NULL, 10);
-                item.prec = 0;
-                push(&out_stack, &item);
-                flag = 0;
-                break;
-            case TOK_FNUM_LITERAL:
-                item.token = tok;
-                item.value.fnum = strtod(buffer, NULL);
-                item.prec = 0;
-                push(&out_stack, &item);
-                flag = 0;
-                break;
+    if(sym == NULL)
+    {
+        syntax("\"%s\" is not defined", name);
+        return 1;
+    }
 
-            case TOK_OPAREN:
-                item.token = tok;
-                item.value.unum = 0;
-                item.prec = OPAR;
-                push(&out_stack, &item);
-                flag = 1;
-                break;
-            case TOK_CPAREN:
-                break;
+    if(!sym->has_value)
+    {
+        syntax("\"%s\" does not have a constant value", name);
+        return 1;
+    }
+
+    *val = sym->value;
+    return 0;
+}
+
+static int apply_unary(int tok, expr_value_t* val)
+{
+    switch (tok)
+    {
+        case TOK_MINUS:
+            if(val->type == EXPR_FLOAT)
+                val->value.fnum = -val->value.fnum;
+            else
+                val->value.unum = -val->value.unum;
+            break;
+        case TOK_BWNOT:
+            if(val->type == EXPR_FLOAT)
+            {
+                syntax("operator %s cannot be used on a float", scanner_tok_str(tok));
+                return 1;
+            }
+            val->value.unum = ~val->value.unum;
+            break;
+    }
+
+    return 0;
+}
+
+static int apply_binary(int tok, expr_value_t* left, const expr_value_t* right)
+{
+    if(left->type == EXPR_FLOAT || right->type == EXPR_FLOAT)
+    {
+        double lval = as_float(left);
+        double rval = as_float(right);
 
+        left->type = EXPR_FLOAT;
+        switch (tok)
+        {
             case TOK_PLUS:
-                if(flag) {
-                    while(peek(&oper_stack)->prec > UPLUS) {
-                    }
-                }
-                else {
-                    while(peek(&oper_stack)->prec > ADD) {
-                    }
-                }
+                left->value.fnum = lval + rval;
                 break;
             case TOK_MINUS:
-                if(flag) {
-                    while(peek(&oper_stack)->prec > UMINUS) {
-                    }
-                }
-                else {
-                    while(peek(&oper_stack)->prec > SUB) {
-                    }
-                }
+                left->value.fnum = lval - rval;
                 break;
-            case TOK_BWNOT:
-                if(flag) {
-                    while(peek(&oper_stack)->prec > BUNOT) {
-                    }
-                }
-                else {
-                    // not unary star is a syntax error
-                    expect("number or a semicolon", tok);
-                    return 1;
-                }
-                break;
-
             case TOK_STAR:
-                if(flag) {
-                    // unary star is a syntax error
-                    expect("number or a semicolon", tok);
-                    return 1;
-                }
-                else {
-                    while(peek(&oper_stack)->prec > MUL) {
-                    }
-                }
+                left->value.fnum = lval * rval;
                 break;
             case TOK_SLASH:
-                if(flag) {
-                    // unary slash is a syntax error
-                    expect("number or a semicolon", tok);
-                    return 1;
-                }
-                else {
-                    while(peek(&oper_stack)->prec > DIV) {
-                    }
-                }
+                if(rval == 0.0)
+                    goto div_zero;
+                left->value.fnum = lval / rval;
                 break;
+            default:
+                syntax("operator %s cannot be used on a float", scanner_tok_str(tok));
+                return 1;
+        }
+        return 0;
+    }
 
-            case TOK_BWSHL:
-                if(flag) {
-                    // unary operator is a syntax error
-                    expect("number or a semicolon", tok);
-                    return 1;
-                }
-                else {
-                    while(peek(&oper_stack)->prec > BSHL) {
+    // any unsigned term makes the result unsigned
+    int is_signed = (left->type == EXPR_INT && right->type == EXPR_INT);
+    uint64_t lval = left->value.unum;
+    uint64_t rval = right->value.unum;
+
+    left->type = is_signed? EXPR_INT: EXPR_UINT;
+    switch (tok)
+    {
+        case TOK_PLUS:
+            left->value.unum = lval + rval;
+            break;
+        case TOK_MINUS:
+            left->value.unum = lval - rval;
+            break;
+        case TOK_STAR:
+            left->value.unum = lval * rval;
+            break;
+        case TOK_SLASH:
+            if(rval == 0)
+                goto div_zero;
+            if(is_signed && right->value.inum == -1)
+                left->value.unum = -lval;   // the smallest number divided by -1 overflows
+            else if(is_signed)
+                left->value.inum = left->value.inum / right->value.inum;
+            else
+                left->value.unum = lval / rval;
+            break;
+        case TOK_BWSHL:
+            left->value.unum = (rval > 63)? 0: lval << rval;
+            break;
+        case TOK_BWSHR:
+            if(is_signed)
+                left->value.inum = left->value.inum >> ((rval > 63)? 63: rval);
+            else
+                left->value.unum = (rval > 63)? 0: lval >> rval;
+            break;
+        case TOK_BWAND:
+            left->value.unum = lval & rval;
+            break;
+        case TOK_BWOR:
+            left->value.unum = lval | rval;
+            break;
+        case TOK_BWXOR:
+            left->value.unum = lval ^ rval;
+            break;
+    }
+    return 0;
+
+div_zero:
+    syntax("division by zero in expression");
+    return 1;
+}
+
+/*
+ * Pop the top operator and apply it to the values on the stack.
+ */
+static int reduce(void)
+{
+    stack_item_t* item = &oper_stack.stack[--oper_stack.top];
+
+    if(item->unary)
+        return apply_unary(item->token, &out_stack.stack[out_stack.top - 1]);
+
+    out_stack.top--;
+    return apply_binary(item->token, &out_stack.stack[out_stack.top - 1], &out_stack.stack[out_stack.top]);
+}
+
+/*
+ * Apply everything on the operator stack with a precidence of at least prec,
+ * stopping at an open paren.
+ */
+static int reduce_to(int prec)
+{
+    stack_item_t* item;
+
+    while((item = peek()) != NULL && item->token != TOK_OPAREN && item->prec >= prec)
+    {
+        if(reduce())
+            return 1;
+    }
+
+    return 0;
+}
+
+static int binary_prec(int tok)
+{
+    switch (tok)
+    {
+        case TOK_PLUS:
+            return ADD;
+        case TOK_MINUS:
+            return SUB;
+        case TOK_STAR:
+            return MUL;
+        case TOK_SLASH:
+            return DIV;
+        case TOK_BWSHL:
+            return BSHL;
+        case TOK_BWSHR:
+            return BSHR;
+        case TOK_BWAND:
+            return BAND;
+        case TOK_BWOR:
+            return BOR;
+        case TOK_BWXOR:
+            return BXOR;
+        default:
+            return 0;
+    }
+}
+
+static int evaluate(const char* sec_name, const expr_value_t* first, expr_value_t* result, int* term)
+{
+    expr_value_t val;
+    char buffer[MAX_SYMBOL];
+    char name[MAX_SYMBOL * 2 + 2];
+    int depth = 0;
+    int tok;
+    // this is set when the item read was an operator and cleared when it's not.
+    // It's used to detect if an operator is unary.
+    int flag = 1;
+
+    oper_stack.top = 0;
+    out_stack.top = 0;
+
+    // first can be the same as result, so it is pushed before result is cleared
+    if(first != NULL)
+    {
+        push_value(first);
+        flag = 0;
+    }
+    result->type = EXPR_NONE;
+
+    while(1)
+    {
+        tok = scanner_get_token(buffer, sizeof(buffer));
+        last_term = tok;
+        strcpy(last_term_str, buffer);
+
+        if(flag)
+        {
+            // an operand or a unary operator is expected
+            switch (tok)
+            {
+                case TOK_UNUM_LITERAL:
+                case TOK_INUM_LITERAL:
+                case TOK_FNUM_LITERAL:
+                    if(convert_number(tok, buffer, &val) || push_value(&val))
+                        return 1;
+                    flag = 0;
+                    break;
+
+                case TOK_IDENTIFIER:
+                    strcpy(name, buffer);
+                    tok = scanner_get_token(buffer, sizeof(buffer));
+                    if(tok == TOK_PERIOD)
+                    {
+                        tok = scanner_get_token(buffer, sizeof(buffer));
+                        if(tok != TOK_IDENTIFIER)
+                        {
+                            expect("a name after the period", tok);
+                            return 1;
+                        }
+                        strcat(name, ".");
+                        strcat(name, buffer);
                     }
-                }
-                break;
-            case TOK_BWSHR:
-                if(flag) {
-                    // unary operator is a syntax error
-                    expect("number or a semicolon", tok);
-                    return 1;
-                }
-                else {
-                    while(peek(&oper_stack)->prec > BSHR) {
+                    else
+                        scanner_unget_token(tok, buffer);
+
+                    if(lookup_value(sec_name, name, &val) || push_value(&val))
+                        return 1;
+                    flag = 0;
+                    break;
+
+                case TOK_OPAREN:
+                    if(push_oper(tok, OPAR, 0))
+                        return 1;
+                    depth++;
+                    break;
+
+                case TOK_MINUS:
+                    if(push_oper(tok, UMINUS, 1))
+                        return 1;
+                    break;
+                case TOK_BWNOT:
+                    if(push_oper(tok, BUNOT, 1))
+                        return 1;
+                    break;
+                case TOK_PLUS:
+                    // unary plus does nothing
+                    break;
+
+                default:
+                    // nothing at all is an empty expression
+                    if(out_stack.top == 0 && oper_stack.top == 0)
+                    {
+                        *term = tok;
+                        return 0;
                     }
-                }
-                break;
-            case TOK_BWAND:
-                if(flag) {
-                    // unary operator is a syntax error
-                    expect("number or a semicolon", tok);
+                    expect("a number or a name", tok);
                     return 1;
-                }
-                else {
-                    while(peek(&oper_stack)->prec > BAND) {
-                    }
-                }
-                break;
-            case TOK_BWOR:
-                if(flag) {
-                    // unary operator is a syntax error
-                    expect("number or a semicolon", tok);
+            }
+        }
+        else
+        {
+            // a binary operator is expected, or the end of the expression
+            int prec = binary_prec(tok);
+
+            if(prec != 0)
+            {
+                if(reduce_to(prec) || push_oper(tok, prec, 0))
                     return 1;
-                }
-                else {
-                    while(peek(&oper_stack)->prec > BOR) {
-                    }
-                }
-                break;
-            case TOK_BWXOR:
-                if(flag) {
-                    // unary operator is a syntax error
-                    expect("number or a semicolon", tok);
+                flag = 1;
+            }
+            else if(tok == TOK_CPAREN && depth > 0)
+            {
+                if(reduce_to(0))
                     return 1;
-                }
-                else {
-                    while(peek(&oper_stack)->prec > BXOR) {
-                    }
-                }
+                oper_stack.top--;   // the open paren
+                depth--;
+            }
+            else
                 break;
+        }
+    }
 
+    if(depth > 0)
+    {
+        expect("a close paren", tok);
+        return 1;
+    }
 
-            case TOK_COMMA:
-                break;
+    if(reduce_to(0))
+        return 1;
 
-            case TOK_SEMICOLON:
-                break;
+    *result = out_stack.stack[0];
+    *term = tok;
+    return 0;
+}
 
-            default:
-                expect("number or arithmetic binary operator", tok);
-                return 1;
-        }
-    }
+/*
+ * Parse and fold a constant expression. Names without a section are looked
+ * up in sec_name. The token that ended the expression is returned in term.
+ *
+ * Returns 1 if the parsing should stop; for example if there is an error.
+ * Otherwise, return 0.
+ */
+int parse_expression(const char* sec_name, expr_value_t* result, int* term)
+{
+    return evaluate(sec_name, NULL, result, term);
+}
+
+/*
+ * Same as parse_expression(), for when the first term has already been
+ * parsed by the caller.
+ */
+int continue_expression(const char* sec_name, const expr_value_t* first, expr_value_t* result, int* term)
+{
+    return evaluate(sec_name, first, result, term);
+}
+
+/*
+ * Give the token that ended the last expression back to the scanner, for
+ * when it is the start of whatever comes next.
+ */
+void unget_expression_term(void)
+{
+    scanner_unget_token(last_term, last_term_str);
 }
@@ -1,4 +1,33 @@
 #ifndef __EXPRESSIONS_H__
 #  define __EXPRESSIONS_H__
 
+#  include <stdint.h>
+
+/*
+ * The value of a constant expression. EXPR_NONE is returned when there was
+ * no expression at all, such as for "[]".
+ */
+enum
+{
+    EXPR_NONE,
+    EXPR_INT,
+    EXPR_UINT,
+    EXPR_FLOAT,
+};
+
+typedef struct
+{
+    int type;
+    union
+    {
+        uint64_t unum;
+        int64_t inum;
+        double fnum;
+    } value;
+} expr_value_t;
+
+int parse_expression(const char* sec_name, expr_value_t* result, int* term);
+int continue_expression(const char* sec_name, const expr_value_t* first, expr_value_t* result, int* term);
+void unget_expression_term(void);
+
 #endif
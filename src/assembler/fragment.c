@@ -0,0 +1,271 @@
+/*
+ * Assemble source files in parallel.
+ *
+ * Every file named by an INCLUDE is assembled into its own fragment by the
+ * next free worker thread. The scanner and parser state is per-thread, and
+ * each fragment has its own arena and tables, so the workers never share
+ * anything while they run. When all of the files are done the fragments are
+ * linked by walking the include tree in source order, which makes the output
+ * the same for any number of threads.
+ *
+ * When an object cache is in use, a file that has not changed since it was
+ * last assembled is read back from the cache instead of being parsed.
+ */
+#include <pthread.h>
+#include <limits.h>
+
+#include "common.h"
+
+#include "assembler.h"
+#include "scanner.h"
+#include "parser.h"
+#include "fragment.h"
+#include "objcache.h"
+
+// fragment that the calling thread is assembling
+static __thread fragment_t* current;
+
+// list of all fragments
+static fragment_t* fragments;
+
+// work queue
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_cond = PTHREAD_COND_INITIALIZER;
+static fragment_t** queue;
+static size_t queue_head;
+static size_t queue_tail;
+static size_t queue_cap;
+static int pending;          // fragments queued or being assembled
+
+static fragment_t* create_fragment(const char* fname, fragment_t* parent)
+{
+    fragment_t* frag = calloc(1, sizeof(fragment_t));
+
+    if(frag == NULL)
+        fatal_error("cannot allocate %lu bytes for fragment", sizeof(fragment_t));
+
+    arena_init(&frag->arena, 0);
+    frag->file_name = arena_strdup(&frag->arena, fname);
+    frag->parent = parent;
+    sec_tab_init(&frag->sections);
+    sym_tab_init(&frag->symbols);
+
+    pthread_mutex_lock(&queue_lock);
+    frag->next = fragments;
+    fragments = frag;
+    pthread_mutex_unlock(&queue_lock);
+
+    return frag;
+}
+
+static frag_item_t* add_item(fragment_t* frag, int kind, section_t section, fragment_t* child)
+{
+    if(frag->nitems + 1 > frag->item_cap)
+    {
+        size_t new_cap = (frag->item_cap == 0)? 8: frag->item_cap << 1;
+
+        frag->items = arena_realloc(&frag->arena, frag->items,
+                                    frag->item_cap * sizeof(frag_item_t), new_cap * sizeof(frag_item_t));
+        frag->item_cap = new_cap;
+    }
+
+    frag_item_t* item = &frag->items[frag->nitems++];
+
+    item->kind = kind;
+    item->section = section;
+    item->child = child;
+    item->include_name = NULL;
+
+    return item;
+}
+
+static void submit(fragment_t* frag)
+{
+    pthread_mutex_lock(&queue_lock);
+    if(queue_tail + 1 > queue_cap)
+    {
+        queue_cap = (queue_cap == 0)? 16: queue_cap << 1;
+        queue = realloc(queue, queue_cap * sizeof(fragment_t*));
+        if(queue == NULL)
+            fatal_error("cannot allocate %lu bytes for the work queue", queue_cap * sizeof(fragment_t*));
+    }
+    queue[queue_tail++] = frag;
+    pending++;
+    pthread_cond_signal(&queue_cond);
+    pthread_mutex_unlock(&queue_lock);
+}
+
+static void assemble_fragment(fragment_t* frag)
+{
+    current = frag;
+    if(!load_cached_fragment(frag))
+    {
+        int errors = get_thread_errors();
+
+        if(scanner_open_infile((char*)frag->file_name))
+            inc_error_count();
+        else
+        {
+            parse_all();
+            if(get_thread_errors() == errors)
+                save_cached_fragment(frag);
+        }
+    }
+    current = NULL;
+}
+
+/*
+ * Take fragments from the queue until it is empty and nothing that is still
+ * running can add more.
+ */
+static void* worker(void* arg)
+{
+    (void)arg;
+
+    pthread_mutex_lock(&queue_lock);
+    while(1)
+    {
+        if(queue_head < queue_tail)
+        {
+            fragment_t* frag = queue[queue_head++];
+
+            pthread_mutex_unlock(&queue_lock);
+            assemble_fragment(frag);
+            pthread_mutex_lock(&queue_lock);
+
+            if(--pending == 0)
+                pthread_cond_broadcast(&queue_cond);
+        }
+        else if(pending == 0)
+            break;
+        else
+            pthread_cond_wait(&queue_cond, &queue_lock);
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    return NULL;
+}
+
+/*
+ * Included files are found relative to the file that includes them.
+ */
+static void resolve_name(char* buf, size_t size, const char* fname, const char* parent)
+{
+    const char* slash = strrchr(parent, '/');
+
+    if(fname[0] == '/' || slash == NULL)
+        snprintf(buf, size, "%s", fname);
+    else
+        snprintf(buf, size, "%.*s/%s", (int)(slash - parent), parent, fname);
+}
+
+/************************
+ * public interface
+ */
+fragment_t* current_fragment(void)
+{
+    return current;
+}
+
+arena_t* assembler_arena(void)
+{
+    return &current->arena;
+}
+
+void add_fragment_section(section_t section)
+{
+    add_item(current, FRAG_SECTION, section, NULL);
+}
+
+/*
+ * Find a file named in the file being assembled.
+ */
+void resolve_file_name(char* buf, size_t size, const char* fname)
+{
+    resolve_name(buf, size, fname, current->file_name);
+}
+
+/*
+ * Called by the parser for an INCLUDE. The file is queued to be assembled
+ * and its place in the current file is recorded.
+ */
+void include_file(const char* fname)
+{
+    char name[PATH_MAX];
+    char real[PATH_MAX];
+
+    resolve_name(name, sizeof(name), fname, current->file_name);
+
+    // a file that includes itself, directly or not, would never finish
+    if(realpath(name, real) != NULL)
+    {
+        for(fragment_t* frag = current; frag != NULL; frag = frag->parent)
+        {
+            char other[PATH_MAX];
+
+            if(realpath(frag->file_name, other) != NULL && !strcmp(real, other))
+            {
+                syntax("file \"%s\" includes itself", name);
+                return;
+            }
+        }
+    }
+
+    fragment_t* child = create_fragment(name, current);
+
+    frag_item_t* item = add_item(current, FRAG_INCLUDE, NULL, child);
+
+    item->include_name = arena_strdup(&current->arena, fname);
+    submit(child);
+}
+
+/*
+ * Assemble the file and everything that it includes using up to nthreads
+ * threads. Returns the fragment for the file, which is the root of the
+ * include tree.
+ */
+fragment_t* assemble_files(const char* fname, int nthreads)
+{
+    pthread_t* threads = calloc(nthreads, sizeof(pthread_t));
+    int started = 0;
+
+    if(threads == NULL)
+        fatal_error("cannot allocate %lu bytes for threads", nthreads * sizeof(pthread_t));
+
+    fragment_t* root = create_fragment(fname, NULL);
+
+    submit(root);
+
+    // the calling thread is one of the workers
+    for(int i = 1; i < nthreads; i++)
+    {
+        if(pthread_create(&threads[started], NULL, worker, NULL) == 0)
+            started++;
+    }
+    worker(NULL);
+
+    for(int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    free(queue);
+    queue = NULL;
+    queue_head = queue_tail = queue_cap = 0;
+
+    return root;
+}
+
+void destroy_fragments(void)
+{
+    fragment_t* next;
+
+    for(fragment_t* frag = fragments; frag != NULL; frag = next)
+    {
+        next = frag->next;
+        sec_tab_destroy(&frag->sections);
+        sym_tab_destroy(&frag->symbols);
+        arena_destroy(&frag->arena);
+        free(frag);
+    }
+    fragments = NULL;
+}
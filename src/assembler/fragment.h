@@ -0,0 +1,52 @@
+#ifndef __FRAGMENT_H__
+#  define __FRAGMENT_H__
+
+#  include "arena.h"
+#  include "sections.h"
+#  include "symbols.h"
+
+/*
+ * A fragment holds everything that was assembled from one source file. The
+ * items record, in source order, the sections that the file defined and the
+ * files that it included, so the program can be put back together in the
+ * same order no matter which file finished first.
+ */
+enum
+{
+    FRAG_SECTION,
+    FRAG_INCLUDE,
+};
+
+struct fragment_t;
+
+typedef struct
+{
+    int kind;                // FRAG_SECTION or FRAG_INCLUDE
+    section_t section;
+    struct fragment_t* child;
+    const char* include_name;    // name of the included file as it was written
+} frag_item_t;
+
+typedef struct fragment_t
+{
+    const char* file_name;
+    struct fragment_t* parent;   // the file that included this one
+    struct fragment_t* next;     // list of all fragments, for cleanup
+    arena_t arena;           // everything assembled from the file lives here
+    frag_item_t* items;
+    size_t nitems;
+    size_t item_cap;
+    sec_tab_t sections;      // sections defined in the file
+    sym_tab_t symbols;       // symbols defined in the file
+    uint64_t cache_key;      // hash of the source, for the object cache
+    int no_cache;            // set if the output depends on more than the source
+} fragment_t;
+
+fragment_t* current_fragment(void);
+fragment_t* assemble_files(const char* fname, int nthreads);
+void include_file(const char* fname);
+void resolve_file_name(char* buf, size_t size, const char* fname);
+void add_fragment_section(section_t section);
+void destroy_fragments(void);
+
+#endif
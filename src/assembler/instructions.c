@@ -0,0 +1,180 @@
+/*
+ * Instruction lists and instruction encoding.
+ *
+ * An instruction is an opcode byte followed by its operands. Each operand is
+ * a spec byte that gives its kind and register, and then the value, if the
+ * kind has one. See opcodes.h for the layout of the spec byte.
+ *
+ * The parser appends instructions, labels and pointer maps to a list for
+ * each code section. Nothing is encoded until the section is finished, so
+ * the optimizer can rewrite the list freely. Labels and pointer maps are
+ * only given an offset when the list is encoded, and every reference to a
+ * symbol is written as a relocation, so removing instructions never leaves
+ * anything to fix up.
+ */
+#include "common.h"
+
+#include "assembler.h"
+#include "errors.h"
+#include "sections.h"
+#include "instructions.h"
+
+void insn_init(insn_list_t* list)
+{
+    memset(list, 0, sizeof(insn_list_t));
+}
+
+/*
+ * Add an empty instruction to the end of the list and return it. The
+ * pointer is good until the next one is added.
+ */
+insn_t* insn_append(insn_list_t* list)
+{
+    if(list->count + 1 > list->capacity)
+    {
+        size_t new_cap = (list->capacity == 0)? 64: list->capacity << 1;
+
+        list->insns = arena_realloc(assembler_arena(), list->insns,
+                                    list->capacity * sizeof(insn_t), new_cap * sizeof(insn_t));
+        list->capacity = new_cap;
+    }
+
+    insn_t* insn = &list->insns[list->count++];
+
+    memset(insn, 0, sizeof(insn_t));
+    return insn;
+}
+
+/*
+ * Squeeze out the instructions that were deleted.
+ */
+void insn_compact(insn_list_t* list)
+{
+    size_t out = 0;
+
+    for(size_t i = 0; i < list->count; i++)
+    {
+        if(list->insns[i].kind != INSN_DELETED)
+            list->insns[out++] = list->insns[i];
+    }
+
+    list->count = out;
+}
+
+/*
+ * Number of bytes needed to hold a value that is sign extended.
+ */
+int immediate_size(int64_t value)
+{
+    if(value >= INT8_MIN && value <= INT8_MAX)
+        return 1;
+    if(value >= INT16_MIN && value <= INT16_MAX)
+        return 2;
+    if(value >= INT32_MIN && value <= INT32_MAX)
+        return 4;
+    return 8;
+}
+
+size_t operand_size(const operand_t* opnd)
+{
+    return 1 + opnd->size;
+}
+
+size_t insn_size(const insn_t* insn)
+{
+    size_t size = 0;
+
+    if(insn->kind == INSN_OP)
+    {
+        size = 1;
+        for(int i = 0; i < insn->noperands; i++)
+            size += operand_size(&insn->operands[i]);
+    }
+
+    return size;
+}
+
+/*
+ * The size of an immediate as it is given in the spec byte.
+ */
+int size_code(int size)
+{
+    switch (size)
+    {
+        case 1:
+            return 0;
+        case 2:
+            return 1;
+        case 4:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+static void encode_operand(emit_cursor_t* cursor, const operand_t* opnd)
+{
+    uint8_t spec;
+
+    switch (opnd->kind)
+    {
+        case OPND_IMM:
+        case OPND_IMM_PTR:
+            spec = OPND_SPEC(opnd->kind, size_code(opnd->size));
+            break;
+        default:
+            spec = OPND_SPEC(opnd->kind, opnd->reg);
+            break;
+    }
+
+    emit_bytes(cursor, &spec, 1);
+
+    if(opnd->kind == OPND_FLOAT)
+        emit_bytes(cursor, &opnd->fnum, sizeof(double));
+    else if(opnd->symbol != NULL)
+        emit_reloc(cursor, opnd->symbol, opnd->value, opnd->size);
+    else if(opnd->size > 0)
+        emit_bytes(cursor, &opnd->value, opnd->size);   // the image is little endian
+}
+
+/*
+ * Write the instructions to the section and define the labels and the
+ * pointer maps. Returns non-zero if a label is defined twice.
+ */
+int encode_insns(section_t section, insn_list_t* list)
+{
+    emit_cursor_t cursor;
+    size_t prefix = strlen(section_name(section)) + 1;
+    int errors = 0;
+
+    section_cursor(section, &cursor);
+
+    for(size_t i = 0; i < list->count; i++)
+    {
+        insn_t* insn = &list->insns[i];
+
+        switch (insn->kind)
+        {
+            case INSN_LABEL:
+                if(add_section_entry(section, insn->label + prefix, TYPE_LABEL, NULL))
+                    errors++;
+                break;
+
+            case INSN_PTRMAP:
+                add_section_ptrmap(section, insn->ptr_regs, insn->ptr_depth, insn->ptr_slots);
+                break;
+
+            case INSN_OP:
+            {
+                uint8_t op = (uint8_t)insn->opcode;
+
+                emit_bytes(&cursor, &op, 1);
+                for(int j = 0; j < insn->noperands; j++)
+                    encode_operand(&cursor, &insn->operands[j]);
+                break;
+            }
+        }
+    }
+
+    return errors;
+}
@@ -0,0 +1,64 @@
+#ifndef __INSTRUCTIONS_H__
+#  define __INSTRUCTIONS_H__
+
+#  include <stdint.h>
+#  include <stddef.h>
+
+#  include "opcodes.h"
+#  include "sections.h"
+
+/*
+ * For instructions.c
+ */
+typedef struct
+{
+    int kind;                // OPND_REG, etc.
+    int reg;                 // register number
+    int size;                // bytes in the value that follows the spec byte
+    int64_t value;           // immediate value or offset
+    double fnum;             // for OPND_FLOAT
+    const char* symbol;      // dotted name whose address is added to value, or NULL
+} operand_t;
+
+enum
+{
+    INSN_OP,                 // an instruction
+    INSN_LABEL,              // a label, which takes no space
+    INSN_PTRMAP,             // pointer map for the next instruction
+    INSN_DELETED,            // removed by the optimizer
+};
+
+typedef struct
+{
+    int kind;
+    int opcode;
+    int line;                // source line, for messages
+    const char* label;       // dotted name of a label
+    uint32_t ptr_regs;       // for a pointer map, registers that hold pointers
+    uint32_t ptr_depth;      // entries pushed by the function
+    uint64_t ptr_slots;      // entries of the frame that hold pointers
+    int noperands;
+    operand_t operands[OP_MAX_OPERANDS];
+} insn_t;
+
+/*
+ * The instructions of a code section are kept in a list until the end of
+ * the section so that they can be optimized before they are encoded.
+ */
+typedef struct
+{
+    insn_t* insns;
+    size_t count;
+    size_t capacity;
+} insn_list_t;
+
+void insn_init(insn_list_t* list);
+insn_t* insn_append(insn_list_t* list);
+void insn_compact(insn_list_t* list);
+int immediate_size(int64_t value);
+int size_code(int size);
+size_t operand_size(const operand_t* opnd);
+size_t insn_size(const insn_t* insn);
+int encode_insns(section_t section, insn_list_t* list);
+
+#endif
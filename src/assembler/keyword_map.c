@@ -0,0 +1,270 @@
+
+// This file is generated from tokens.h.
+// DO NOT EDIT
+// Generated: Mon Oct 19 14:19:14 2026
+
+#include <stdlib.h>
+
+
+#include "tokens.h"
+
+
+#include "keyword_map.h"
+
+keyword_map_t keyword_map[] = {
+    {TOK_ALLOCATE, "allocate"},
+    {TOK_AND, "and"},
+    {TOK_BWXOR, "bwxor"},
+    {TOK_CALL, "call"},
+    {TOK_CALLCC, "callcc"},
+    {TOK_CALLCS, "callcs"},
+    {TOK_CALLEE, "callee"},
+    {TOK_CALLEQ, "calleq"},
+    {TOK_CALLGE, "callge"},
+    {TOK_CALLGT, "callgt"},
+    {TOK_CALLHI, "callhi"},
+    {TOK_CALLLE, "callle"},
+    {TOK_CALLLS, "callls"},
+    {TOK_CALLLT, "calllt"},
+    {TOK_CALLMI, "callmi"},
+    {TOK_CALLNE, "callne"},
+    {TOK_CALLPL, "callpl"},
+    {TOK_CALLTE, "callte"},
+    {TOK_CALLVC, "callvc"},
+    {TOK_CALLVS, "callvs"},
+    {TOK_CLC, "clc"},
+    {TOK_CLE, "cle"},
+    {TOK_CLN, "cln"},
+    {TOK_CLT, "clt"},
+    {TOK_CLV, "clv"},
+    {TOK_CLZ, "clz"},
+    {TOK_CMP, "cmp"},
+    {TOK_CODE, "code"},
+    {TOK_DATA, "data"},
+    {TOK_DEC, "dec"},
+    {TOK_END, "end"},
+    {TOK_END_SEC, "end_sec"},
+    {TOK_ERET, "eret"},
+    {TOK_ERETCC, "eretcc"},
+    {TOK_ERETCS, "eretcs"},
+    {TOK_ERETEE, "eretee"},
+    {TOK_ERETEQ, "ereteq"},
+    {TOK_ERETGE, "eretge"},
+    {TOK_ERETGT, "eretgt"},
+    {TOK_ERETHI, "erethi"},
+    {TOK_ERETLE, "eretle"},
+    {TOK_ERETLS, "eretls"},
+    {TOK_ERETLT, "eretlt"},
+    {TOK_ERETMI, "eretmi"},
+    {TOK_ERETNE, "eretne"},
+    {TOK_ERETPL, "eretpl"},
+    {TOK_ERETTE, "erette"},
+    {TOK_ERETVC, "eretvc"},
+    {TOK_ERETVS, "eretvs"},
+    {TOK_EXCALL, "excall"},
+    {TOK_EXCALLCC, "excallcc"},
+    {TOK_EXCALLCS, "excallcs"},
+    {TOK_EXCALLEE, "excallee"},
+    {TOK_EXCALLEQ, "excalleq"},
+    {TOK_EXCALLGE, "excallge"},
+    {TOK_EXCALLGT, "excallgt"},
+    {TOK_EXCALLHI, "excallhi"},
+    {TOK_EXCALLLE, "excallle"},
+    {TOK_EXCALLLS, "excallls"},
+    {TOK_EXCALLLT, "excalllt"},
+    {TOK_EXCALLMI, "excallmi"},
+    {TOK_EXCALLNE, "excallne"},
+    {TOK_EXCALLPL, "excallpl"},
+    {TOK_EXCALLTE, "excallte"},
+    {TOK_EXCALLVC, "excallvc"},
+    {TOK_EXCALLVS, "excallvs"},
+    {TOK_FADD, "fadd"},
+    {TOK_FDIV, "fdiv"},
+    {TOK_FILL, "fill"},
+    {TOK_FLOAT, "float"},
+    {TOK_FMOD, "fmod"},
+    {TOK_FMUL, "fmul"},
+    {TOK_FNEG, "fneg"},
+    {TOK_FREE, "free"},
+    {TOK_FSUB, "fsub"},
+    {TOK_FTI, "fti"},
+    {TOK_FTU, "ftu"},
+    {TOK_IADD, "iadd"},
+    {TOK_IDIV, "idiv"},
+    {TOK_IMOD, "imod"},
+    {TOK_IMUL, "imul"},
+    {TOK_INC, "inc"},
+    {TOK_INCLUDE, "include"},
+    {TOK_INEG, "ineg"},
+    {TOK_INT16, "int16"},
+    {TOK_INT32, "int32"},
+    {TOK_INT64, "int64"},
+    {TOK_INT8, "int8"},
+    {TOK_ISUB, "isub"},
+    {TOK_ITF, "itf"},
+    {TOK_ITU, "itu"},
+    {TOK_JMP, "jmp"},
+    {TOK_JMPCC, "jmpcc"},
+    {TOK_JMPCS, "jmpcs"},
+    {TOK_JMPEE, "jmpee"},
+    {TOK_JMPEQ, "jmpeq"},
+    {TOK_JMPGE, "jmpge"},
+    {TOK_JMPGT, "jmpgt"},
+    {TOK_JMPHI, "jmphi"},
+    {TOK_JMPLE, "jmple"},
+    {TOK_JMPLS, "jmpls"},
+    {TOK_JMPLT, "jmplt"},
+    {TOK_JMPMI, "jmpmi"},
+    {TOK_JMPNE, "jmpne"},
+    {TOK_JMPPL, "jmppl"},
+    {TOK_JMPTE, "jmpte"},
+    {TOK_JMPVC, "jmpvc"},
+    {TOK_JMPVS, "jmpvs"},
+    {TOK_LOAD, "load"},
+    {TOK_MOV, "mov"},
+    {TOK_MOV16, "mov16"},
+    {TOK_MOV32, "mov32"},
+    {TOK_MOV64, "mov64"},
+    {TOK_MOV8, "mov8"},
+    {TOK_MOVB, "movb"},
+    {TOK_MOVB16, "movb16"},
+    {TOK_MOVB32, "movb32"},
+    {TOK_MOVB64, "movb64"},
+    {TOK_MOVB8, "movb8"},
+    {TOK_NOP, "nop"},
+    {TOK_NOT, "not"},
+    {TOK_OR, "or"},
+    {TOK_PAUSE, "pause"},
+    {TOK_POP, "pop"},
+    {TOK_PTRS, "ptrs"},
+    {TOK_PUSH, "push"},
+    {TOK_R0, "r0"},
+    {TOK_R1, "r1"},
+    {TOK_R10, "r10"},
+    {TOK_R11, "r11"},
+    {TOK_R12, "r12"},
+    {TOK_R13, "r13"},
+    {TOK_R14, "r14"},
+    {TOK_R15, "r15"},
+    {TOK_R16, "r16"},
+    {TOK_R17, "r17"},
+    {TOK_R18, "r18"},
+    {TOK_R19, "r19"},
+    {TOK_R2, "r2"},
+    {TOK_R20, "r20"},
+    {TOK_R21, "r21"},
+    {TOK_R22, "r22"},
+    {TOK_R23, "r23"},
+    {TOK_R24, "r24"},
+    {TOK_R25, "r25"},
+    {TOK_R26, "r26"},
+    {TOK_R27, "r27"},
+    {TOK_R28, "r28"},
+    {TOK_R29, "r29"},
+    {TOK_R3, "r3"},
+    {TOK_R30, "r30"},
+    {TOK_R31, "r31"},
+    {TOK_R4, "r4"},
+    {TOK_R5, "r5"},
+    {TOK_R6, "r6"},
+    {TOK_R7, "r7"},
+    {TOK_R8, "r8"},
+    {TOK_R9, "r9"},
+    {TOK_RAISE, "raise"},
+    {TOK_RAISECC, "raisecc"},
+    {TOK_RAISECS, "raisecs"},
+    {TOK_RAISEEE, "raiseee"},
+    {TOK_RAISEEQ, "raiseeq"},
+    {TOK_RAISEGE, "raisege"},
+    {TOK_RAISEGT, "raisegt"},
+    {TOK_RAISEHI, "raisehi"},
+    {TOK_RAISELE, "raisele"},
+    {TOK_RAISELS, "raisels"},
+    {TOK_RAISELT, "raiselt"},
+    {TOK_RAISEMI, "raisemi"},
+    {TOK_RAISENE, "raisene"},
+    {TOK_RAISEPL, "raisepl"},
+    {TOK_RAISETE, "raisete"},
+    {TOK_RAISEVC, "raisevc"},
+    {TOK_RAISEVS, "raisevs"},
+    {TOK_RESUME, "resume"},
+    {TOK_RET, "ret"},
+    {TOK_RETCC, "retcc"},
+    {TOK_RETCS, "retcs"},
+    {TOK_RETEE, "retee"},
+    {TOK_RETEQ, "reteq"},
+    {TOK_RETGE, "retge"},
+    {TOK_RETGT, "retgt"},
+    {TOK_RETHI, "rethi"},
+    {TOK_RETLE, "retle"},
+    {TOK_RETLS, "retls"},
+    {TOK_RETLT, "retlt"},
+    {TOK_RETMI, "retmi"},
+    {TOK_RETNE, "retne"},
+    {TOK_RETPL, "retpl"},
+    {TOK_RETTE, "rette"},
+    {TOK_RETVC, "retvc"},
+    {TOK_RETVS, "retvs"},
+    {TOK_ROL, "rol"},
+    {TOK_ROR, "ror"},
+    {TOK_SEMICOLON, "semicolon"},
+    {TOK_SHL, "shl"},
+    {TOK_SHR, "shr"},
+    {TOK_STC, "stc"},
+    {TOK_STE, "ste"},
+    {TOK_STN, "stn"},
+    {TOK_STORE, "store"},
+    {TOK_STT, "stt"},
+    {TOK_STV, "stv"},
+    {TOK_STZ, "stz"},
+    {TOK_TRAP, "trap"},
+    {TOK_TRAPCC, "trapcc"},
+    {TOK_TRAPCS, "trapcs"},
+    {TOK_TRAPEE, "trapee"},
+    {TOK_TRAPEQ, "trapeq"},
+    {TOK_TRAPGE, "trapge"},
+    {TOK_TRAPGT, "trapgt"},
+    {TOK_TRAPHI, "traphi"},
+    {TOK_TRAPLE, "traple"},
+    {TOK_TRAPLS, "trapls"},
+    {TOK_TRAPLT, "traplt"},
+    {TOK_TRAPMI, "trapmi"},
+    {TOK_TRAPNE, "trapne"},
+    {TOK_TRAPPL, "trappl"},
+    {TOK_TRAPTE, "trapte"},
+    {TOK_TRAPVC, "trapvc"},
+    {TOK_TRAPVS, "trapvs"},
+    {TOK_TRET, "tret"},
+    {TOK_TRETCC, "tretcc"},
+    {TOK_TRETCS, "tretcs"},
+    {TOK_TRETEE, "tretee"},
+    {TOK_TRETEQ, "treteq"},
+    {TOK_TRETGE, "tretge"},
+    {TOK_TRETGT, "tretgt"},
+    {TOK_TRETHI, "trethi"},
+    {TOK_TRETLE, "tretle"},
+    {TOK_TRETLS, "tretls"},
+    {TOK_TRETLT, "tretlt"},
+    {TOK_TRETMI, "tretmi"},
+    {TOK_TRETNE, "tretne"},
+    {TOK_TRETPL, "tretpl"},
+    {TOK_TRETTE, "trette"},
+    {TOK_TRETVC, "tretvc"},
+    {TOK_TRETVS, "tretvs"},
+    {TOK_TST, "tst"},
+    {TOK_UADD, "uadd"},
+    {TOK_UDIV, "udiv"},
+    {TOK_UINT16, "uint16"},
+    {TOK_UINT32, "uint32"},
+    {TOK_UINT64, "uint64"},
+    {TOK_UINT8, "uint8"},
+    {TOK_UMOD, "umod"},
+    {TOK_UMUL, "umul"},
+    {TOK_UNEG, "uneg"},
+    {TOK_USUB, "usub"},
+    {TOK_UTF, "utf"},
+    {TOK_UTI, "uti"},
+};
+
+const size_t num_keywords = (sizeof(keyword_map)/sizeof(keyword_map_t));
+
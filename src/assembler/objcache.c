@@ -0,0 +1,346 @@
+/*
+ * Object cache for incremental assembly.
+ *
+ * After a file is assembled without errors, its fragment is written to the
+ * cache directory: the files that it includes, by the names they were given,
+ * and its sections with their objects, bytes and relocations, in source
+ * order. The cache file is named for a hash of the source text and the cache
+ * format, so a file that has not changed is found again no matter where it
+ * lives, and a file that has changed simply misses.
+ *
+ * Loading a cached fragment puts the sections back the same way the parser
+ * would have, and every include is passed to include_file() again, so an
+ * unchanged file that includes a changed one only causes the changed one to
+ * be parsed. Nothing is resolved until link time, so a fragment does not
+ * depend on any other file.
+ *
+ * The cache file is read into the arena of the fragment and its names are
+ * used where they are, so putting back an object costs one insert into the
+ * symbol table of the file and nothing else.
+ *
+ * Cache files are written to a temporary name and renamed, so a reader never
+ * sees a file that is only partly written. The payload carries a checksum,
+ * and a file that does not check out is ignored and the source is parsed.
+ */
+#include <sys/stat.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "common.h"
+
+#include "assembler.h"
+#include "errors.h"
+#include "sections.h"
+#include "peephole.h"
+#include "fragment.h"
+#include "objcache.h"
+
+#define CACHE_MAGIC     0x434F5056   // "VPOC"
+#define CACHE_VERSION   3
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;            // hash of the source that this was made from
+    uint64_t size;           // bytes in the payload
+    uint64_t checksum;       // hash of the payload
+} cache_header_t;
+
+static const char* cache_dir;
+
+/*
+ * 64 bit FNV-1a, taken a word at a time, which is good enough to tell files
+ * apart and fast enough not to matter next to reading them.
+ */
+static uint64_t hash_bytes(uint64_t hash, const void* data, size_t size)
+{
+    const uint8_t* ptr = data;
+    uint64_t word;
+
+    for(; size >= sizeof(word); ptr += sizeof(word), size -= sizeof(word))
+    {
+        memcpy(&word, ptr, sizeof(word));
+        hash ^= word;
+        hash *= 1099511628211ull;
+    }
+
+    for(size_t i = 0; i < size; i++)
+    {
+        hash ^= ptr[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash;
+}
+
+/*
+ * Read a whole file into memory, from the arena if one is given and from
+ * the heap if not. Returns NULL if it cannot be read.
+ */
+static uint8_t* read_file(const char* fname, size_t* size, arena_t* arena)
+{
+    FILE* fp = fopen(fname, "rb");
+    uint8_t* buf = NULL;
+    long len;
+
+    if(fp == NULL)
+        return NULL;
+
+    if(fseek(fp, 0, SEEK_END) == 0 && (len = ftell(fp)) >= 0 && fseek(fp, 0, SEEK_SET) == 0)
+    {
+        if(arena != NULL)
+            buf = arena_alloc(arena, len + 1);
+        else if((buf = malloc(len + 1)) == NULL)
+            fatal_error("cannot allocate %lu bytes for file", (unsigned long)len + 1);
+
+        if(fread(buf, 1, len, fp) != (size_t)len)
+        {
+            if(arena == NULL)
+                free(buf);
+            buf = NULL;
+        }
+        *size = len;
+    }
+
+    fclose(fp);
+    return buf;
+}
+
+/*
+ * The key covers the source text, the cache format and the options that
+ * change the code, so a change to any of them means a miss.
+ */
+static uint64_t source_key(const uint8_t* src, size_t size)
+{
+    static const char stamp[] = "objcache " __DATE__ " " __TIME__;
+    uint32_t version = CACHE_VERSION;
+    int optimize = get_optimize();
+    uint64_t hash = 14695981039346656037ull;
+
+    hash = hash_bytes(hash, &version, sizeof(version));
+    hash = hash_bytes(hash, &optimize, sizeof(optimize));
+    hash = hash_bytes(hash, stamp, sizeof(stamp));
+    return hash_bytes(hash, src, size);
+}
+
+static void cache_name(char* buf, size_t size, uint64_t key)
+{
+    snprintf(buf, size, "%s/%016llx.obj", cache_dir, (unsigned long long)key);
+}
+
+/*
+ * Put the items of a fragment back from a payload that has been checked.
+ */
+static int load_items(cache_reader_t* rd)
+{
+    size_t nitems = cache_read_u64(rd);
+
+    for(size_t i = 0; i < nitems && !rd->error; i++)
+    {
+        switch (cache_read_u64(rd))
+        {
+            case FRAG_SECTION:
+                if(load_section(rd) == NULL)
+                    rd->error = 1;
+                break;
+            case FRAG_INCLUDE:
+            {
+                const char* name = cache_read_str(rd);
+
+                if(!rd->error)
+                    include_file(name);
+                break;
+            }
+            default:
+                rd->error = 1;
+        }
+    }
+
+    return rd->error;
+}
+
+/************************
+ * public interface
+ */
+
+/*
+ * Turn the cache on. Files are cached in dir, which is created if it does
+ * not exist.
+ */
+void set_cache_dir(const char* dir)
+{
+    if(mkdir(dir, 0777) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Warning: cannot create cache directory \"%s\": %s\n", dir, strerror(errno));
+        inc_warning_count();
+        return;
+    }
+
+    cache_dir = dir;
+}
+
+/*
+ * Fill in the fragment from the cache if the file has been assembled
+ * before. Returns non-zero if it was. The fragment must be current.
+ */
+int load_cached_fragment(fragment_t* frag)
+{
+    char fname[PATH_MAX];
+    size_t size;
+    uint8_t* src;
+
+    if(cache_dir == NULL || (src = read_file(frag->file_name, &size, NULL)) == NULL)
+        return 0;
+
+    frag->cache_key = source_key(src, size);
+    free(src);
+
+    cache_name(fname, sizeof(fname), frag->cache_key);
+
+    // the names in the payload are used in place, so it stays in the arena
+    arena_mark_t mark = arena_mark(&frag->arena);
+    uint8_t* buf = read_file(fname, &size, &frag->arena);
+    cache_header_t* hdr = (cache_header_t*)buf;
+
+    if(buf == NULL || size < sizeof(cache_header_t) || hdr->magic != CACHE_MAGIC || hdr->version != CACHE_VERSION ||
+            hdr->key != frag->cache_key || hdr->size != size - sizeof(cache_header_t) ||
+            hdr->checksum != hash_bytes(14695981039346656037ull, buf + sizeof(cache_header_t), hdr->size))
+    {
+        arena_release(&frag->arena, mark);
+        return 0;
+    }
+
+    cache_reader_t rd = { buf + sizeof(cache_header_t), buf + size, 0 };
+
+    // the payload checked out, so anything wrong now is a real error
+    if(load_items(&rd))
+    {
+        fprintf(stderr, "Error: %s: cache file \"%s\" is not valid\n", frag->file_name, fname);
+        inc_error_count();
+    }
+
+    return 1;
+}
+
+/*
+ * Write a fragment that was just assembled to the cache.
+ */
+void save_cached_fragment(fragment_t* frag)
+{
+    char fname[PATH_MAX];
+    char tname[PATH_MAX];
+    char* payload = NULL;
+    size_t size = 0;
+
+    if(cache_dir == NULL || frag->cache_key == 0 || frag->no_cache)
+        return;
+
+    FILE* mem = open_memstream(&payload, &size);
+
+    if(mem == NULL)
+        fatal_error("cannot open a memory stream for the object cache");
+
+    cache_write_u64(mem, frag->nitems);
+    for(size_t i = 0; i < frag->nitems; i++)
+    {
+        frag_item_t* item = &frag->items[i];
+
+        cache_write_u64(mem, item->kind);
+        if(item->kind == FRAG_SECTION)
+            save_section(item->section, mem);
+        else
+            cache_write_str(mem, item->include_name);
+    }
+    fclose(mem);
+
+    cache_header_t hdr = {
+        CACHE_MAGIC, CACHE_VERSION, frag->cache_key, size,
+        hash_bytes(14695981039346656037ull, payload, size)
+    };
+
+    cache_name(fname, sizeof(fname), frag->cache_key);
+    snprintf(tname, sizeof(tname), "%s/objXXXXXX", cache_dir);
+
+    // the cache is only an optimization, so failing to write it is not an error
+    int fd = mkstemp(tname);
+    FILE* fp = (fd >= 0)? fdopen(fd, "wb"): NULL;
+
+    if(fp == NULL)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+            unlink(tname);
+        }
+        free(payload);
+        return;
+    }
+
+    int ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1 && fwrite(payload, 1, size, fp) == size;
+
+    if(fclose(fp) != 0 || !ok || rename(tname, fname) != 0)
+        unlink(tname);
+    free(payload);
+}
+
+void cache_write_u64(FILE* fp, uint64_t value)
+{
+    fwrite(&value, sizeof(value), 1, fp);
+}
+
+void cache_write_str(FILE* fp, const char* str)
+{
+    size_t len = strlen(str);
+
+    cache_write_u64(fp, len);
+    fwrite(str, 1, len + 1, fp);
+}
+
+void cache_write_bytes(FILE* fp, const void* bytes, size_t size)
+{
+    fwrite(bytes, 1, size, fp);
+}
+
+uint64_t cache_read_u64(cache_reader_t* rd)
+{
+    uint64_t value = 0;
+    const uint8_t* ptr = cache_read_bytes(rd, sizeof(value));
+
+    if(ptr != NULL)
+        memcpy(&value, ptr, sizeof(value));
+
+    return value;
+}
+
+/*
+ * Strings are stored with their terminator, so they are used in place.
+ */
+const char* cache_read_str(cache_reader_t* rd)
+{
+    size_t len = cache_read_u64(rd);
+    const char* str = (const char*)cache_read_bytes(rd, len + 1);
+
+    if(str != NULL && str[len] != 0)
+    {
+        rd->error = 1;
+        return NULL;
+    }
+
+    return str;
+}
+
+const uint8_t* cache_read_bytes(cache_reader_t* rd, size_t size)
+{
+    if(rd->error || size > (size_t)(rd->end - rd->ptr))
+    {
+        rd->error = 1;
+        return NULL;
+    }
+
+    const uint8_t* ptr = rd->ptr;
+
+    rd->ptr += size;
+    return ptr;
+}
@@ -0,0 +1,30 @@
+#ifndef __OBJCACHE_H__
+#  define __OBJCACHE_H__
+
+#  include <stdio.h>
+#  include <stdint.h>
+
+struct fragment_t;
+
+/*
+ * Used to read the parts of a cache file back.
+ */
+typedef struct cache_reader_t
+{
+    const uint8_t* ptr;
+    const uint8_t* end;
+    int error;               // set if the data ran out or was not valid
+} cache_reader_t;
+
+void set_cache_dir(const char* dir);
+int load_cached_fragment(struct fragment_t* frag);
+void save_cached_fragment(struct fragment_t* frag);
+
+void cache_write_u64(FILE* fp, uint64_t value);
+void cache_write_str(FILE* fp, const char* str);
+void cache_write_bytes(FILE* fp, const void* bytes, size_t size);
+uint64_t cache_read_u64(cache_reader_t* rd);
+const char* cache_read_str(cache_reader_t* rd);
+const uint8_t* cache_read_bytes(cache_reader_t* rd, size_t size);
+
+#endif
@@ -3,8 +3,14 @@
 #include <stdint.h>
 #include <string.h>
 
+#include "assembler.h"
 #include "scanner.h"
 #include "errors.h"
+#include "sections.h"
+#include "expressions.h"
+#include "instructions.h"
+#include "peephole.h"
+#include "image.h"
 
 /*
  * There are two kinds of section. CODE and DATA. A DATA section is where data structures are defined and
@@ -13,24 +19,460 @@
  *
  * The names of the sections are used when referencing it. In the end, all references are simply indexes into the
  * contiguous section and the names are thrown away if no debugging information is being stored.
+ *
+ * A code section is a list of instructions and labels. A label is a name by itself and names the instruction
+ * that follows it. Every instruction has a fixed number of operands, given by the opcode table, so no line
+ * endings are needed. Curly braces may be used to group code, but they do not change anything.
+ *
+ *     CODE main
+ *     loop
+ *         IADD R1, R1, 1
+ *         CMP R1, 10
+ *         JMPLT loop
+ *         RET
+ *     END_SEC
+ *
+ * An operand can be a register, "[Rn]" or "[Rn + offset]" for a pointer in a register, a constant expression,
+ * the name of a label or a data object, or either of those last two in square braces for a pointer. A name
+ * without a section is a label in the same section. An expression that starts with a name has to be put in
+ * parens, so that it is not taken to be the address of the name.
+ *
+ * PTRS gives the pointer map of the instruction that follows it, for the garbage collector in the VM. It has
+ * the number of entries that the function has pushed on the stack at that point, and a list of the registers
+ * and the entries of the frame that hold heap pointers there. The entries are numbered from 0, the first
+ * one that the function pushed. Every ALLOCATE, and every CALL that can get to one, needs a map when the
+ * collector is used.
+ *
+ *     PTRS 2 { R0, R4, [1] }
+ *     ALLOCATE R0, 64
+ *
+ * The instructions of a section are collected in a list, optimized if that was asked for, and encoded when
+ * the section ends.
  */
 
+// the instruction tokens are in the same order as the opcodes
+#define TOKEN_OPCODE(tok) ((tok) - TOK_NOP + 1)
+
+static __thread section_t code_section;
+
 /*
- * The CODE keyword has already been scanned.
+ * A name that is not dotted is in the code section.
  */
-int parse_code_section(void)
+static const char* symbol_name(const char* name)
 {
-    char buffer[128];
+    char buffer[MAX_SYMBOL * 2 + 2];
+
+    if(strchr(name, '.') != NULL)
+        return arena_strdup(assembler_arena(), name);
+
+    snprintf(buffer, sizeof(buffer), "%s.%s", section_name(code_section), name);
+    return arena_strdup(assembler_arena(), buffer);
+}
+
+/*
+ * Read a name that may be dotted. The first part has been scanned.
+ */
+static int get_name(char* name, size_t size, const char* first)
+{
+    char buffer[MAX_SYMBOL];
+    int tok = scanner_get_token(buffer, sizeof(buffer));
+
+    strncpy(name, first, size - 1);
+    if(tok != TOK_PERIOD)
+    {
+        scanner_unget_token(tok, buffer);
+        return 0;
+    }
+
+    tok = scanner_get_token(buffer, sizeof(buffer));
+    if(tok != TOK_IDENTIFIER)
+    {
+        expect("a name after the period", tok);
+        return 1;
+    }
+
+    snprintf(name, size, "%s.%s", first, buffer);
+    return 0;
+}
+
+/*
+ * An integer expression, for offsets and addends.
+ */
+static int get_integer(int64_t* value, int* term)
+{
+    expr_value_t val;
+
+    if(parse_expression(section_name(code_section), &val, term))
+        return 1;
+
+    if(val.type == EXPR_NONE || val.type == EXPR_FLOAT)
+    {
+        expect("an integer expression", *term);
+        return 1;
+    }
+
+    *value = val.value.inum;
+    return 0;
+}
+
+/*
+ * A name, with an optional constant added to it, ending with close. If
+ * close is zero, anything can end it and is given back to the scanner.
+ */
+static int get_address(operand_t* opnd, const char* first, int close)
+{
+    char name[MAX_SYMBOL * 2 + 2];
+    char buffer[MAX_SYMBOL];
+    int term;
+
+    if(get_name(name, sizeof(name), first))
+        return 1;
+
+    opnd->symbol = symbol_name(name);
+    opnd->size = 4;         // the widest that a symbol can need in a 4G image
+    opnd->value = 0;
+
+    int tok = scanner_get_token(buffer, sizeof(buffer));
+
+    if(tok == TOK_PLUS || tok == TOK_MINUS)
+    {
+        if(get_integer(&opnd->value, &term))
+            return 1;
+        if(tok == TOK_MINUS)
+            opnd->value = -opnd->value;
+        tok = term;
+        if(close == 0)
+            unget_expression_term();
+    }
+    else if(close == 0)
+        scanner_unget_token(tok, buffer);
+
+    if(close != 0 && tok != close)
+    {
+        expect("a close square brace", tok);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * The open square brace has been scanned.
+ */
+static int get_pointer(operand_t* opnd)
+{
+    char buffer[MAX_SYMBOL];
+    int tok = scanner_get_token(buffer, sizeof(buffer));
+    int term;
+
+    if(tok >= TOK_R0 && tok <= TOK_R31)
+    {
+        opnd->reg = tok - TOK_R0;
+        tok = scanner_get_token(buffer, sizeof(buffer));
+        if(tok == TOK_CSQUARE)
+        {
+            opnd->kind = OPND_REG_PTR;
+            return 0;
+        }
+
+        if(tok != TOK_PLUS && tok != TOK_MINUS)
+        {
+            expect("an offset or a close square brace", tok);
+            return 1;
+        }
+
+        if(get_integer(&opnd->value, &term))
+            return 1;
+        if(tok == TOK_MINUS)
+            opnd->value = -opnd->value;
+
+        if(term != TOK_CSQUARE)
+        {
+            expect("a close square brace", term);
+            return 1;
+        }
+
+        opnd->size = immediate_size(opnd->value);
+        if(opnd->size > 2)
+        {
+            syntax("pointer offset %lld does not fit in 16 bits", (long long)opnd->value);
+            return 1;
+        }
+        opnd->kind = (opnd->size == 1)? OPND_REG_OFS8: OPND_REG_OFS16;
+        return 0;
+    }
+
+    opnd->kind = OPND_IMM_PTR;
+    if(tok == TOK_IDENTIFIER)
+        return get_address(opnd, buffer, TOK_CSQUARE);
+
+    scanner_unget_token(tok, buffer);
+    if(get_integer(&opnd->value, &term))
+        return 1;
+
+    if(term != TOK_CSQUARE)
+    {
+        expect("a close square brace", term);
+        return 1;
+    }
+
+    opnd->size = immediate_size(opnd->value);
+    return 0;
+}
 
+static int get_operand(operand_t* opnd)
+{
+    char buffer[MAX_SYMBOL];
+    expr_value_t val;
+    int term;
     int tok = scanner_get_token(buffer, sizeof(buffer));
 
+    memset(opnd, 0, sizeof(operand_t));
+
+    if(tok >= TOK_R0 && tok <= TOK_R31)
+    {
+        opnd->kind = OPND_REG;
+        opnd->reg = tok - TOK_R0;
+        return 0;
+    }
+
     switch (tok)
     {
-        case TOK_CODE:
-            break;
-        case TOK_DATA:
-            break;
+        case TOK_OSQUARE:
+            return get_pointer(opnd);
+
+        case TOK_IDENTIFIER:
+            opnd->kind = OPND_IMM;
+            return get_address(opnd, buffer, 0);
+
+        default:
+            scanner_unget_token(tok, buffer);
+            if(parse_expression(section_name(code_section), &val, &term))
+                return 1;
+            if(val.type == EXPR_NONE)
+            {
+                expect("an operand", term);
+                return 1;
+            }
+            unget_expression_term();
+
+            if(val.type == EXPR_FLOAT)
+            {
+                opnd->kind = OPND_FLOAT;
+                opnd->fnum = val.value.fnum;
+                opnd->size = sizeof(double);
+            }
+            else
+            {
+                opnd->kind = OPND_IMM;
+                opnd->value = val.value.inum;
+                opnd->size = immediate_size(opnd->value);
+            }
+            return 0;
+    }
+}
+
+static int do_instruction(insn_list_t* list, int tok)
+{
+    const opcode_info_t* info = &opcode_table[TOKEN_OPCODE(tok)];
+    operand_t operands[OP_MAX_OPERANDS];
+    char buffer[MAX_SYMBOL];
+    int line = scanner_get_line();
+
+    for(int i = 0; i < info->noperands; i++)
+    {
+        if(i > 0)
+        {
+            int comma = scanner_get_token(buffer, sizeof(buffer));
+
+            if(comma != TOK_COMMA)
+            {
+                expect("a comma", comma);
+                return 1;
+            }
+        }
+
+        if(get_operand(&operands[i]))
+            return 1;
+
+        if(!(info->operands[i] & OPND_MASK(operands[i].kind)))
+        {
+            syntax("operand %d of %s is not the right kind", i + 1, scanner_tok_str(tok));
+            return 1;
+        }
     }
 
+    insn_t* insn = insn_append(list);
+
+    insn->kind = INSN_OP;
+    insn->opcode = TOKEN_OPCODE(tok);
+    insn->line = line;
+    insn->noperands = info->noperands;
+    memcpy(insn->operands, operands, sizeof(operands));
+    return 0;
+}
+
+static int do_label(insn_list_t* list, const char* first)
+{
+    char name[MAX_SYMBOL * 2 + 2];
+
+    if(get_name(name, sizeof(name), first))
+        return 1;
+
+    if(strchr(name, '.') != NULL)
+    {
+        syntax("label \"%s\" cannot have a section name", name);
+        return 1;
+    }
+
+    insn_t* insn = insn_append(list);
+
+    insn->kind = INSN_LABEL;
+    insn->line = scanner_get_line();
+    insn->label = symbol_name(name);
+    return 0;
+}
+
+/*
+ * The PTRS keyword has been scanned.
+ */
+static int do_ptrmap(insn_list_t* list)
+{
+    char buffer[MAX_SYMBOL];
+    int64_t depth;
+    int64_t slot;
+    int term;
+    int tok;
+    uint32_t regs = 0;
+    uint64_t slots = 0;
+    int line = scanner_get_line();
+
+    if(get_integer(&depth, &term))
+        return 1;
+
+    if(depth < 0 || depth > UINT32_MAX)
+    {
+        syntax("frame depth %lld is out of range", (long long)depth);
+        return 1;
+    }
+
+    if(term != TOK_OCURLY)
+    {
+        expect("an open curly brace", term);
+        return 1;
+    }
+
+    tok = scanner_get_token(buffer, sizeof(buffer));
+    while(tok != TOK_CCURLY)
+    {
+        if(tok >= TOK_R0 && tok <= TOK_R31)
+            regs |= 1u << (tok - TOK_R0);
+        else if(tok == TOK_OSQUARE)
+        {
+            if(get_integer(&slot, &term))
+                return 1;
+
+            if(term != TOK_CSQUARE)
+            {
+                expect("a close square brace", term);
+                return 1;
+            }
+
+            if(slot < 0 || slot >= depth || slot >= IMAGE_FRAME_SLOTS)
+            {
+                syntax("frame entry %lld is not in the first %d entries of the frame",
+                       (long long)slot, (depth < IMAGE_FRAME_SLOTS)? (int)depth: IMAGE_FRAME_SLOTS);
+                return 1;
+            }
+            slots |= 1ull << slot;
+        }
+        else
+        {
+            expect("a register or a frame entry", tok);
+            return 1;
+        }
+
+        tok = scanner_get_token(buffer, sizeof(buffer));
+        if(tok == TOK_COMMA)
+            tok = scanner_get_token(buffer, sizeof(buffer));
+        else if(tok != TOK_CCURLY)
+        {
+            expect("a comma or a close curly brace", tok);
+            return 1;
+        }
+    }
+
+    insn_t* insn = insn_append(list);
+
+    insn->kind = INSN_PTRMAP;
+    insn->line = line;
+    insn->ptr_regs = regs;
+    insn->ptr_depth = (uint32_t)depth;
+    insn->ptr_slots = slots;
+    return 0;
+}
+
+/*
+ * The CODE keyword has already been scanned.
+ */
+int parse_code_section(void)
+{
+    MARK();
+    char buffer[MAX_SYMBOL];
+    insn_list_t list;
+    int finished = 0;
+    int errors = get_thread_errors();
+    int tok = scanner_get_token(buffer, sizeof(buffer));
+
+    if(tok != TOK_IDENTIFIER)
+    {
+        expect("a name for the section", tok);
+        return 1;
+    }
+
+    code_section = add_section(buffer, SEC_TYPE_CODE);
+    if(code_section == NULL)
+        return 1;
+
+    insn_init(&list);
+
+    while(!finished)
+    {
+        tok = scanner_get_token(buffer, sizeof(buffer));
+
+        if(tok >= TOK_NOP && tok <= TOK_FREE)
+            finished = do_instruction(&list, tok);
+        else
+        {
+            switch (tok)
+            {
+                case TOK_IDENTIFIER:
+                    finished = do_label(&list, buffer);
+                    break;
+                case TOK_PTRS:
+                    finished = do_ptrmap(&list);
+                    break;
+                case TOK_OCURLY:
+                case TOK_CCURLY:
+                    break;
+                case TOK_END_SEC:
+                    finished++;
+                    break;
+                default:
+                    expect("an instruction, a label or the end of the section", tok);
+                    finished++;
+                    break;
+            }
+        }
+    }
+
+    if(get_thread_errors() != errors)
+        return 1;
+
+    peephole_optimize(&list);
+
+    if(encode_insns(code_section, &list))
+        return 1;
+
     return 0;
 }
@@ -4,40 +4,37 @@
 #include <string.h>
 #include <errno.h>
 #include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "assembler.h"
 #include "scanner.h"
 #include "errors.h"
 #include "sections.h"
-
-// This allows easy translation from an actual data
-// type to a stream of bytes to write to the section.
-typedef union
-{
-    uint8_t* uchars;
-    uint16_t* ushorts;
-    uint32_t* uints;
-    uint64_t* ulongs;
-    int8_t* chars;
-    int16_t* shorts;
-    int32_t* ints;
-    int64_t* longs;
-    double* floats;
-} __attribute__((packed)) data_union_t;
+#include "fragment.h"
 
 // This tracks the section entry as we build it up.
 typedef struct
 {
     char name[MAX_SYMBOL];
-    char sec_name[MAX_SYMBOL];
+    section_t sec;
+    emit_cursor_t cursor;
     int type;
     size_t each_item;
-    size_t total;
-    int nitems;
-    data_union_t data;
+    size_t nitems;           // zero if the size comes from the initializer
+    int scalar;              // no subscript was given, so a string sets the size
 } data_section_entry_t;
 
-data_section_entry_t data_entry;
+static __thread data_section_entry_t data_entry;
+
+// Items of a list are packed here and written to the section a block at a
+// time.
+#define STAGE_SIZE  4096
+
+static __thread uint8_t stage[STAGE_SIZE];
+static __thread size_t staged;
 
 /*
  * There are two kinds of section. CODE and DATA. A DATA section is where data structures are defined and
@@ -46,13 +43,21 @@ data_section_entry_t data_entry;
  *
  * The names of the sections are used when referencing it. In the end, all references are simply indexes into the
  * contiguous section and the names are thrown away if no debugging information is being stored.
+ *
+ * Initializers are folded to constants by expressions.c and written straight to the section as they are
+ * parsed. The items of a list are packed into a small staging buffer first so that the section is written
+ * in blocks. An entry can also be filled with one repeated value or with the contents of a binary file,
+ * which are each written in a single bulk copy:
+ *
+ *     uint32 ones[4096] = fill 1
+ *     uint8 table[] = include "table.bin"
  */
 
-static void allocate_buffer(void)
+static size_t type_size(int type)
 {
-    size_t size;
+    size_t size = 0;
 
-    switch (data_entry.type)
+    switch (type)
     {
         case TYPE_INT8:
         case TYPE_UINT8:
@@ -79,83 +84,426 @@ static void allocate_buffer(void)
             break;
     }
 
-    data_entry.data.chars = (int8_t *) calloc(data_entry.nitems, size);
-    if(data_entry.data.chars == NULL)
-        fatal_error("cannot allocate %d bytes for section entry", data_entry.nitems * size);
+    return size;
+}
 
+/*
+ * Convert a value to the type of the entry, the way it will be stored. A
+ * value that does not fit is truncated with a warning.
+ */
+static expr_value_t convert_value(const expr_value_t* val)
+{
+    expr_value_t res;
+    int type = data_entry.type;
+
+    if(type == TYPE_FLOAT)
+    {
+        res.type = EXPR_FLOAT;
+        res.value.fnum = (val->type == EXPR_INT)? (double)val->value.inum:
+                         (val->type == EXPR_UINT)? (double)val->value.unum: val->value.fnum;
+        return res;
+    }
+
+    int from_unsigned = (val->type == EXPR_UINT);
+
+    if(val->type == EXPR_FLOAT)
+    {
+        warning("float value %g is truncated to an integer", val->value.fnum);
+        res.value.inum = (int64_t)val->value.fnum;
+    }
+    else
+        res.value.unum = val->value.unum;
+
+    int bits = data_entry.each_item * 8;
+    int is_signed = (type <= TYPE_INT64);
+
+    res.type = is_signed? EXPR_INT: EXPR_UINT;
+    if(bits == 64)
+        return res;
+
+    // an unsigned item can also be given a small negative number
+    int64_t min = -(1ll << (bits - 1));
+    int64_t max = is_signed? (1ll << (bits - 1)) - 1: (1ll << bits) - 1;
+    int fits = from_unsigned? res.value.unum <= (uint64_t)max: (res.value.inum >= min && res.value.inum <= max);
+
+    if(!fits)
+        warning("value %s%llu does not fit in %d bits",
+                (!from_unsigned && res.value.inum < 0)? "-": "",
+                (!from_unsigned && res.value.inum < 0)? -(unsigned long long)res.value.inum:
+                (unsigned long long)res.value.unum, bits);
+
+    res.value.unum &= (1ull << bits) - 1;
+    if(is_signed && (res.value.unum >> (bits - 1)))
+        res.value.unum |= ~0ull << bits;
+
+    return res;
 }
 
-static void write_entry(void)
+static void emit_value(const expr_value_t* val)
 {
-    // write the section to the database
-    add_section_entry(data_entry.sec_name, data_entry.name);
-    add_entry_bytes(data_entry.sec_name, data_entry.name, (void *)&data_entry.data, data_entry.total);
+    if(data_entry.type == TYPE_FLOAT)
+        emit_bytes(&data_entry.cursor, &val->value.fnum, sizeof(double));
+    else
+        emit_bytes(&data_entry.cursor, &val->value.unum, data_entry.each_item);
+}
+
+static void flush_stage(void)
+{
+    emit_bytes(&data_entry.cursor, stage, staged);
+    staged = 0;
+}
+
+static void stage_value(const expr_value_t* val)
+{
+    if(staged + sizeof(uint64_t) > STAGE_SIZE)
+        flush_stage();
+
+    if(data_entry.type == TYPE_FLOAT)
+        memcpy(&stage[staged], &val->value.fnum, sizeof(double));
+    else
+        memcpy(&stage[staged], &val->value.unum, data_entry.each_item);
+    staged += data_entry.each_item;
 }
 
 /*
- * Assignment count be a number, a string, a list of expressions, or a single
- * expression. This has to make sure that the assignment result and the type
- * are compatible.
+ * Define the entry. Everything after this writes its bytes to the section.
  */
-static int do_assignment(void)
+static int define_entry(const expr_value_t* value)
 {
-    MARK();
+    return add_section_entry(data_entry.sec, data_entry.name, data_entry.type, value);
+}
+
+/*
+ * Store zeros for any items that were not initialized.
+ */
+static int finish_entry(size_t count)
+{
+    if(data_entry.nitems == 0)
+        data_entry.nitems = count;
+    else if(count > data_entry.nitems)
+    {
+        syntax("too many initializers for \"%s\"", data_entry.name);
+        return 1;
+    }
+
+    emit_fill(&data_entry.cursor, 0, (data_entry.nitems - count) * data_entry.each_item);
     return 0;
 }
 
 /*
- * A subscript has the form "[number]". Expressions are also allowed.
+ * The definition ends with a semicolon, which is optional at the end of a
+ * line. Anything else is left for the next definition.
  */
-static int do_subscript(void)
+static int end_definition(int tok, const char* buffer)
+{
+    if(tok != TOK_SEMICOLON)
+        scanner_unget_token(tok, buffer);
+    return 0;
+}
+
+/*
+ * The string has been scanned. Each character is one item, and an item
+ * without a subscript is as long as the string, the same as with [].
+ */
+static int do_string(const char* str)
+{
+    size_t len = strlen(str);
+
+    if(data_entry.scalar)
+        data_entry.nitems = 0;
+
+    if(define_entry(NULL))
+        return 1;
+
+    if(data_entry.each_item == 1)
+        emit_bytes(&data_entry.cursor, str, len);
+    else
+    {
+        for(size_t i = 0; i < len; i++)
+        {
+            expr_value_t val = {.type = EXPR_UINT,.value.unum = (uint8_t)str[i] };
+
+            val = convert_value(&val);
+            stage_value(&val);
+        }
+        flush_stage();
+    }
+
+    return finish_entry(len);
+}
+
+/*
+ * The open paren or curly and the first expression of a list have been
+ * scanned. The list ends with close, the matching close paren or curly. An
+ * empty list has no first expression.
+ */
+static int do_list(const expr_value_t* first, int term, int close)
+{
+    const char* sec_name = section_name(data_entry.sec);
+    expr_value_t val;
+    size_t count = 0;
+
+    if(define_entry(NULL))
+        return 1;
+
+    if(first->type != EXPR_NONE)
+    {
+        val = convert_value(first);
+        stage_value(&val);
+        count++;
+    }
+
+    while(term == TOK_COMMA)
+    {
+        if(parse_expression(sec_name, &val, &term))
+            return 1;
+
+        if(val.type == EXPR_NONE)
+        {
+            expect("an expression", term);
+            return 1;
+        }
+
+        val = convert_value(&val);
+        stage_value(&val);
+        count++;
+    }
+
+    flush_stage();
+
+    if(term != close)
+    {
+        expect((close == TOK_CPAREN)? "a comma or a close paren": "a comma or a close curly", term);
+        return 1;
+    }
+
+    return finish_entry(count);
+}
+
+/*
+ * Fill every item with the same value.
+ */
+static int do_fill(void)
+{
+    expr_value_t val;
+    int term;
+
+    if(parse_expression(section_name(data_entry.sec), &val, &term))
+        return 1;
+
+    if(val.type == EXPR_NONE)
+    {
+        expect("an expression", term);
+        return 1;
+    }
+
+    if(data_entry.nitems == 0)
+    {
+        syntax("the size of \"%s\" must be given for a fill", data_entry.name);
+        return 1;
+    }
+
+    val = convert_value(&val);
+    if(define_entry((data_entry.nitems == 1)? &val: NULL))
+        return 1;
+
+    if(data_entry.type == TYPE_FLOAT)
+        emit_repeat(&data_entry.cursor, &val.value.fnum, sizeof(double), data_entry.nitems);
+    else
+        emit_repeat(&data_entry.cursor, &val.value.unum, data_entry.each_item, data_entry.nitems);
+
+    return end_definition(term, "");
+}
+
+/*
+ * Copy the contents of a binary file into the entry. The file is mapped so
+ * that it is copied once, straight into the section. The file is found the
+ * same way as an included source file.
+ */
+static int do_binary(const char* fname)
+{
+    char name[PATH_MAX];
+    struct stat st;
+    int retv = 1;
+
+    resolve_file_name(name, sizeof(name), fname);
+
+    int fd = open(name, O_RDONLY);
+
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        syntax("cannot open binary file \"%s\": %s", name, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    void* data = (size > 0)? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0): NULL;
+
+    close(fd);
+
+    if(data == MAP_FAILED)
+        syntax("cannot map binary file \"%s\": %s", name, strerror(errno));
+    else if(size % data_entry.each_item != 0)
+        syntax("the size of binary file \"%s\" is not a multiple of the item size", name);
+    else if(!define_entry(NULL))
+    {
+        emit_bytes(&data_entry.cursor, data, size);
+        retv = finish_entry(size / data_entry.each_item);
+    }
+
+    if(data != NULL && data != MAP_FAILED)
+        munmap(data, size);
+
+    // the object cache only knows about the source file, so a file that
+    // pulls in other data is always assembled
+    current_fragment()->no_cache = 1;
+
+    return retv;
+}
+
+static int do_scalar(const expr_value_t* value, int term)
+{
+    if(value->type == EXPR_NONE)
+    {
+        expect("an expression", term);
+        return 1;
+    }
+
+    expr_value_t val = convert_value(value);
+
+    // only a single item can be used in a later expression
+    if(define_entry((data_entry.nitems <= 1)? &val: NULL))
+        return 1;
+
+    emit_value(&val);
+    if(finish_entry(1))
+        return 1;
+
+    return end_definition(term, "");
+}
+
+/*
+ * Assignment count be a number, a string, a list of expressions, a single
+ * expression, a fill or a binary file. This has to make sure that the assignment result and the type
+ * are compatible.
+ */
+static int do_assignment(void)
 {
     MARK();
+    const char* sec_name = section_name(data_entry.sec);
     char buffer[MAX_SYMBOL];
+    expr_value_t val;
+    int term;
     int tok = scanner_get_token(buffer, sizeof(buffer));
 
     switch (tok)
     {
-        case TOK_UNUM_LITERAL:
-            data_entry.nitems = (int)strtol(buffer, NULL, 16);
-            if((errno == ERANGE && (data_entry.nitems == (int)LONG_MAX || data_entry.nitems == (int)LONG_MIN)) ||
-               (errno != 0 && data_entry.nitems == 0))
+        case TOK_STRING_LITERAL:
+            if(do_string(buffer))
+                return 1;
+            tok = scanner_get_token(buffer, sizeof(buffer));
+            return end_definition(tok, buffer);
+
+        case TOK_OPAREN:
+            // either a list or an expression that starts with a paren
+            if(parse_expression(sec_name, &val, &term))
+                return 1;
+
+            if(val.type != EXPR_NONE && term == TOK_COMMA)
+            {
+                if(do_list(&val, term, TOK_CPAREN))
+                    return 1;
+                tok = scanner_get_token(buffer, sizeof(buffer));
+                return end_definition(tok, buffer);
+            }
+
+            if(val.type == EXPR_NONE || term != TOK_CPAREN)
             {
-                syntax("cannot convert subscript \"%s\" to number: %s", buffer, strerror(errno));
+                expect("an expression", term);
                 return 1;
             }
-            allocate_buffer();
-            break;
-        case TOK_INUM_LITERAL:
-            data_entry.nitems = (int)strtol(buffer, NULL, 10);
-            if((errno == ERANGE && (data_entry.nitems == (int)LONG_MAX || data_entry.nitems == (int)LONG_MIN)) ||
-               (errno != 0 && data_entry.nitems == 0))
+
+            if(continue_expression(sec_name, &val, &val, &term))
+                return 1;
+            return do_scalar(&val, term);
+
+        case TOK_OCURLY:
+            // always a list
+            if(parse_expression(sec_name, &val, &term) || do_list(&val, term, TOK_CCURLY))
+                return 1;
+            tok = scanner_get_token(buffer, sizeof(buffer));
+            return end_definition(tok, buffer);
+
+        case TOK_FILL:
+            return do_fill();
+
+        case TOK_INCLUDE:
+            tok = scanner_get_token(buffer, sizeof(buffer));
+            if(tok != TOK_STRING_LITERAL)
             {
-                syntax("cannot convert subscript \"%s\" to number: %s", buffer, strerror(errno));
+                expect("the name of a binary file", tok);
                 return 1;
             }
-            allocate_buffer();
-            break;
+            if(do_binary(buffer))
+                return 1;
+            tok = scanner_get_token(buffer, sizeof(buffer));
+            return end_definition(tok, buffer);
+
         default:
-            expect("an integer or an unsigned", tok);
-            return 1;
+            scanner_unget_token(tok, buffer);
+            if(parse_expression(sec_name, &val, &term))
+                return 1;
+            return do_scalar(&val, term);
     }
+}
+
+/*
+ * A subscript has the form "[number]". Expressions are also allowed. The
+ * size can be left out if there is an initializer.
+ */
+static int do_subscript(void)
+{
+    MARK();
+    char buffer[MAX_SYMBOL];
+    expr_value_t val;
+    int tok;
+
+    if(parse_expression(section_name(data_entry.sec), &val, &tok))
+        return 1;
 
-    tok = scanner_get_token(buffer, sizeof(buffer));
     if(tok != TOK_CSQUARE)
     {
         expect("a close square brace", tok);
         return 1;
     }
 
+    if(val.type == EXPR_NONE)
+        data_entry.nitems = 0;
+    else if(val.type == EXPR_FLOAT || val.value.inum <= 0 ||
+            (val.type == EXPR_INT && val.value.inum > INT_MAX) || (val.type == EXPR_UINT && val.value.unum > INT_MAX))
+    {
+        syntax("the size of \"%s\" must be a positive integer", data_entry.name);
+        return 1;
+    }
+    else
+        data_entry.nitems = (size_t)val.value.unum;
+
     tok = scanner_get_token(buffer, sizeof(buffer));
     switch (tok)
     {
-        case TOK_SEMICOLON:
-            return 0;   // finished with the definition
         case TOK_EQUAL:
             return do_assignment();
         default:
-            expect("semicolon or assignment", tok);
-            return 1;
+            if(data_entry.nitems == 0)
+            {
+                syntax("the size of \"%s\" must be given when it has no initializer", data_entry.name);
+                return 1;
+            }
+            if(define_entry(NULL) || finish_entry(0))
+                return 1;
+            return end_definition(tok, buffer);
     }
 
     return 0;   // unreachable
@@ -167,6 +515,9 @@ static int do_data_definition(int type)
     char buffer[MAX_SYMBOL];
 
     data_entry.type = type;
+    data_entry.each_item = type_size(type);
+    data_entry.nitems = 1;
+    data_entry.scalar = 1;
     int tok = scanner_get_token(buffer, sizeof(buffer));
 
     if(tok != TOK_IDENTIFIER)
@@ -184,6 +535,7 @@ static int do_data_definition(int type)
         if(tok == TOK_OSQUARE)
         {
             // parse a subscript with possible assignment
+            data_entry.scalar = 0;
             return do_subscript();
         }
         else if(tok == TOK_EQUAL)
@@ -191,15 +543,12 @@ static int do_data_definition(int type)
             // parse an assignment expression
             return do_assignment();
         }
-        else if(tok == TOK_SEMICOLON)
-        {
-            // finished the definition with no initializer
-            return 0;
-        }
         else
         {
-            expect("a subscript, assignment, or semicolon", tok);
-            return 1;
+            // finished the definition with no initializer
+            if(define_entry(NULL) || finish_entry(0))
+                return 1;
+            return end_definition(tok, buffer);
         }
     }
 
@@ -228,8 +577,13 @@ int parse_data_section(void)
                 {
                     case TOK_IDENTIFIER:
                         // create the new section and save the identifier
-                        strncpy(data_entry.sec_name, buffer, MAX_SYMBOL);
-                        add_section(data_entry.sec_name, SEC_TYPE_DATA);
+                        data_entry.sec = add_section(buffer, SEC_TYPE_DATA);
+                        if(data_entry.sec == NULL)
+                        {
+                            finished++;
+                            break;
+                        }
+                        section_cursor(data_entry.sec, &data_entry.cursor);
                         printf("add section: %s\n", buffer);
                         state = 1;
                         break;
@@ -280,13 +634,7 @@ int parse_data_section(void)
                         break;
                 }
 
-                if(get_num_errors() == 0)
-                {
-                    write_entry();
-                    if(data_entry.data.chars != NULL)
-                        free((void *)data_entry.data.chars);
-                }
-                else
+                if(get_num_errors() != 0)
                     finished++;
 
                 break;
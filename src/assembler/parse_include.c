@@ -5,10 +5,15 @@
 
 #include "scanner.h"
 #include "errors.h"
+#include "fragment.h"
 
 // This will grow as the assembler matures. It will have a way to interrogate the environment and
 // other sources
 
+/*
+ * The included file is not read here. It is queued to be assembled on its
+ * own, possibly at the same time as this one. See fragment.c.
+ */
 int parse_include(void)
 {
     char buffer[128];
@@ -18,6 +23,7 @@ int parse_include(void)
     if(tok == TOK_STRING_LITERAL)
     {
         printf("including \"%s\"\n", buffer);
+        include_file(buffer);
     }
     else
     {
@@ -7,6 +7,7 @@
 
 #include "scanner.h"
 #include "errors.h"
+#include "parser.h"
 #include "parse_section.h"
 #include "parse_include.h"
 
@@ -1,6 +1,6 @@
 #ifndef __PARSER_H__
 #  define __PARSER_H__
 
-int parse_all(void);
+void parse_all(void);
 
 #endif
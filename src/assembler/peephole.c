@@ -0,0 +1,553 @@
+/*
+ * Peephole optimizer.
+ *
+ * When it is turned on with -O, this runs over the instruction list of each
+ * code section after it has been parsed and before it is encoded. It looks
+ * at short runs of instructions and replaces them with something that does
+ * the same thing in less space and time.
+ *
+ * The rules are in a table. Each rule is a function that is given the
+ * position of an instruction and returns non-zero if it changed anything.
+ * Deleted instructions are only marked, so the positions of the labels do
+ * not move while the rules run. The rules are run over the list until
+ * nothing changes, and then the deleted instructions are squeezed out.
+ * Labels are given their offsets and the relocations are made when the list
+ * is encoded, so every reference sees the compacted code.
+ *
+ * A rule never looks across a label, except to follow a jump, since code can
+ * be entered at a label from somewhere else. A branch that is taken clears
+ * the flags, so a rule that removes a jump, or one that sets the flags,
+ * checks that nothing reads them before they are set again.
+ *
+ * Sections are assembled on several threads, so the hit counts are updated
+ * atomically.
+ */
+#include "common.h"
+
+#include "assembler.h"
+#include "errors.h"
+#include "hash_table.h"
+#include "instructions.h"
+#include "peephole.h"
+
+// longest chain of jumps that will be followed
+#define MAX_THREAD_HOPS 32
+// a pass that changes nothing ends the loop long before this
+#define MAX_PASSES 16
+
+HASH_TABLE(label_tab, const char*, size_t, hash_string, compare_string)
+
+typedef struct
+{
+    insn_list_t* list;
+    label_tab_t labels;      // label name to index in the list
+} peep_t;
+
+typedef struct
+{
+    const char* name;
+    int (*apply)(peep_t* peep, size_t index);
+    unsigned long hits;
+} peep_rule_t;
+
+static int optimize_level;
+static unsigned long bytes_saved;
+
+void set_optimize(int level)
+{
+    optimize_level = level;
+}
+
+int get_optimize(void)
+{
+    return optimize_level;
+}
+
+#define INSN(p, i) (&(p)->list->insns[i])
+
+static int is_op(const insn_t* insn, int opcode)
+{
+    return insn->kind == INSN_OP && insn->opcode == opcode;
+}
+
+static int same_operand(const operand_t* a, const operand_t* b)
+{
+    if(a->kind != b->kind || a->reg != b->reg || a->size != b->size || a->value != b->value)
+        return 0;
+
+    if(a->kind == OPND_FLOAT)
+        return a->fnum == b->fnum;
+
+    if(a->symbol == NULL || b->symbol == NULL)
+        return a->symbol == b->symbol;
+
+    return !strcmp(a->symbol, b->symbol);
+}
+
+static int is_pointer(const operand_t* opnd)
+{
+    return OPND_MASK(opnd->kind) & OPC_PTR;
+}
+
+static int uses_register(const operand_t* opnd, int reg)
+{
+    return opnd->kind != OPND_IMM && opnd->kind != OPND_IMM_PTR && opnd->kind != OPND_FLOAT
+           && opnd->reg == reg;
+}
+
+/*
+ * The opcode of a conditional form, where cond is 0 for always.
+ */
+static int cond_opcode(int base, int cond)
+{
+    return (cond == 0)? base: base - NUM_CONDITIONS + cond - 1;
+}
+
+/*
+ * The conditions come in pairs that are the inverse of each other, EQ and
+ * NE, CS and CC, and so on. TE and EE have no inverse.
+ */
+static int invert_cond(int cond)
+{
+    if(cond < 1 || cond > 14)
+        return 0;
+
+    return ((cond - 1) ^ 1) + 1;
+}
+
+/*
+ * Index of the next instruction that has not been deleted, or the end of
+ * the list. Labels are returned.
+ */
+static size_t next_insn(peep_t* peep, size_t index)
+{
+    size_t i = index + 1;
+
+    while(i < peep->list->count && INSN(peep, i)->kind == INSN_DELETED)
+        i++;
+
+    return i;
+}
+
+/*
+ * Index of the next instruction if nothing can jump to it, otherwise the
+ * end of the list.
+ */
+static size_t next_op(peep_t* peep, size_t index)
+{
+    size_t i = next_insn(peep, index);
+
+    if(i < peep->list->count && INSN(peep, i)->kind != INSN_OP)
+        return peep->list->count;
+
+    return i;
+}
+
+/*
+ * If the operand is the plain address of a label in this section, return
+ * the index of the label. Otherwise return the end of the list.
+ */
+static size_t label_index(peep_t* peep, const operand_t* opnd)
+{
+    if(opnd->kind != OPND_IMM || opnd->symbol == NULL || opnd->value != 0)
+        return peep->list->count;
+
+    size_t* index = label_tab_find(&peep->labels, opnd->symbol);
+
+    return (index == NULL)? peep->list->count: *index;
+}
+
+/*
+ * The first instruction that runs after a label.
+ */
+static size_t label_code(peep_t* peep, size_t label)
+{
+    size_t i = label;
+
+    while(i < peep->list->count && INSN(peep, i)->kind != INSN_OP)
+        i++;
+
+    return i;
+}
+
+/*
+ * Is the label right after the instruction, so that jumping to it is the
+ * same as falling through?
+ */
+static int falls_to(peep_t* peep, size_t index, size_t label)
+{
+    for(size_t i = next_insn(peep, index); i < peep->list->count; i = next_insn(peep, i))
+    {
+        if(i == label)
+            return 1;
+        if(INSN(peep, i)->kind != INSN_LABEL)
+            return 0;
+    }
+
+    return 0;
+}
+
+/*
+ * True if the flags are set again before anything reads them after the
+ * instruction. A jump, call or return, or the end of the section, could go
+ * anywhere, so the flags are taken to be live there.
+ */
+static int flags_dead(peep_t* peep, size_t index)
+{
+    for(size_t i = next_insn(peep, index); i < peep->list->count; i = next_insn(peep, i))
+    {
+        insn_t* insn = INSN(peep, i);
+
+        if(insn->kind != INSN_OP)
+            continue;
+
+        int flags = opcode_table[insn->opcode].flags;
+
+        if(flags & OPF_READS_FLAGS)
+            return 0;
+        if(flags & OPF_SETS_FLAGS)
+            return 1;
+        if(insn->opcode == OP_END)
+            return 1;
+        if(flags & (OPF_JUMP | OPF_CALL | OPF_RETURN))
+            return 0;
+    }
+
+    return 0;
+}
+
+static void delete_insn(peep_t* peep, size_t index)
+{
+    INSN(peep, index)->kind = INSN_DELETED;
+}
+
+/*
+ * Replace an instruction, keeping its line number.
+ */
+static void rewrite_insn(peep_t* peep, size_t index, int opcode, const operand_t* operands)
+{
+    insn_t* insn = INSN(peep, index);
+
+    insn->opcode = opcode;
+    insn->noperands = opcode_table[opcode].noperands;
+    if(insn->noperands > 0)
+        memcpy(insn->operands, operands, insn->noperands * sizeof(operand_t));
+}
+
+static size_t list_size(insn_list_t* list)
+{
+    size_t size = 0;
+
+    for(size_t i = 0; i < list->count; i++)
+        size += insn_size(&list->insns[i]);
+
+    return size;
+}
+
+/*
+ * STORE Rx, M
+ * LOAD Rx, M       <- Rx already holds this
+ */
+static int store_load(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+    size_t next = next_op(peep, index);
+
+    if(!is_op(insn, OP_STORE) || next >= peep->list->count)
+        return 0;
+
+    insn_t* load = INSN(peep, next);
+
+    if(!is_op(load, OP_LOAD)
+       || !same_operand(&insn->operands[0], &load->operands[0])
+       || !same_operand(&insn->operands[1], &load->operands[1]))
+        return 0;
+
+    delete_insn(peep, next);
+    return 1;
+}
+
+/*
+ * LOAD Rx, M
+ * STORE Rx, M      <- M already holds this
+ *
+ * The address cannot be taken from Rx, since the load changes it.
+ */
+static int load_store(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+    size_t next = next_op(peep, index);
+
+    if(!is_op(insn, OP_LOAD) || next >= peep->list->count)
+        return 0;
+
+    insn_t* store = INSN(peep, next);
+
+    if(!is_op(store, OP_STORE)
+       || !is_pointer(&insn->operands[1])
+       || uses_register(&insn->operands[1], insn->operands[0].reg)
+       || !same_operand(&insn->operands[0], &store->operands[0])
+       || !same_operand(&insn->operands[1], &store->operands[1]))
+        return 0;
+
+    delete_insn(peep, next);
+    return 1;
+}
+
+/*
+ * PUSH Rx
+ * POP Rx           <- both go
+ *
+ * PUSH V
+ * POP Ry           <- LOAD Ry, V
+ */
+static int push_pop(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+    size_t next = next_op(peep, index);
+
+    if(!is_op(insn, OP_PUSH) || next >= peep->list->count || !is_op(INSN(peep, next), OP_POP))
+        return 0;
+
+    operand_t operands[2];
+
+    operands[0] = INSN(peep, next)->operands[0];
+    operands[1] = insn->operands[0];
+
+    if(same_operand(&operands[0], &operands[1]))
+        delete_insn(peep, index);
+    else
+        rewrite_insn(peep, index, OP_LOAD, operands);
+
+    delete_insn(peep, next);
+    return 1;
+}
+
+/*
+ * INC Rx
+ * DEC Rx           <- both go if the flags they set are not used
+ */
+static int inc_dec(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+    size_t next = next_op(peep, index);
+
+    if(insn->kind != INSN_OP || (insn->opcode != OP_INC && insn->opcode != OP_DEC)
+       || next >= peep->list->count)
+        return 0;
+
+    insn_t* other = INSN(peep, next);
+
+    if(!is_op(other, (insn->opcode == OP_INC)? OP_DEC: OP_INC)
+       || !same_operand(&insn->operands[0], &other->operands[0])
+       || !flags_dead(peep, next))
+        return 0;
+
+    delete_insn(peep, index);
+    delete_insn(peep, next);
+    return 1;
+}
+
+/*
+ * LOAD Rx, Rx
+ */
+static int self_load(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+
+    if(!is_op(insn, OP_LOAD) || !same_operand(&insn->operands[0], &insn->operands[1]))
+        return 0;
+
+    delete_insn(peep, index);
+    return 1;
+}
+
+/*
+ * JMPxx L
+ * L:               <- the jump goes if the flags are not used
+ */
+static int jump_next(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+
+    if(insn->kind != INSN_OP || !(opcode_table[insn->opcode].flags & OPF_JUMP))
+        return 0;
+
+    size_t label = label_index(peep, &insn->operands[0]);
+
+    if(label >= peep->list->count || !falls_to(peep, index, label) || !flags_dead(peep, index))
+        return 0;
+
+    delete_insn(peep, index);
+    return 1;
+}
+
+/*
+ * JMPxx L1
+ * L1: JMP L2       <- JMPxx L2
+ *
+ * The chain is followed to its end. A chain that goes around in a circle is
+ * left alone.
+ */
+static int jump_thread(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+
+    if(insn->kind != INSN_OP || !(opcode_table[insn->opcode].flags & OPF_JUMP))
+        return 0;
+
+    const operand_t* target = &insn->operands[0];
+    int hops = 0;
+
+    while(hops < MAX_THREAD_HOPS)
+    {
+        size_t code = label_code(peep, label_index(peep, target));
+
+        if(code >= peep->list->count || !is_op(INSN(peep, code), OP_JMP)
+           || INSN(peep, code)->operands[0].kind != OPND_IMM)
+            break;
+
+        target = &INSN(peep, code)->operands[0];
+        hops++;
+    }
+
+    if(hops == 0 || hops == MAX_THREAD_HOPS || same_operand(target, &insn->operands[0]))
+        return 0;
+
+    insn->operands[0] = *target;
+    return 1;
+}
+
+/*
+ * JMPxx L
+ * L: RET           <- RETxx
+ */
+static int jump_return(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+
+    if(insn->kind != INSN_OP || !(opcode_table[insn->opcode].flags & OPF_JUMP))
+        return 0;
+
+    size_t code = label_code(peep, label_index(peep, &insn->operands[0]));
+
+    if(code >= peep->list->count || !is_op(INSN(peep, code), OP_RET))
+        return 0;
+
+    rewrite_insn(peep, index, cond_opcode(OP_RET, opcode_table[insn->opcode].cond), NULL);
+    return 1;
+}
+
+/*
+ * JMPcc L1
+ * JMP L2
+ * L1:              <- JMP(not cc) L2 if the flags are not used
+ */
+static int branch_invert(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+
+    if(insn->kind != INSN_OP || opcode_table[insn->opcode].base != OP_JMP)
+        return 0;
+
+    int cond = invert_cond(opcode_table[insn->opcode].cond);
+    size_t next = next_op(peep, index);
+
+    if(cond == 0 || next >= peep->list->count || !is_op(INSN(peep, next), OP_JMP))
+        return 0;
+
+    size_t label = label_index(peep, &insn->operands[0]);
+
+    if(label >= peep->list->count || !falls_to(peep, next, label) || !flags_dead(peep, next))
+        return 0;
+
+    rewrite_insn(peep, index, cond_opcode(OP_JMP, cond), INSN(peep, next)->operands);
+    delete_insn(peep, next);
+    return 1;
+}
+
+/*
+ * Nothing can reach the code after an instruction that does not fall
+ * through until there is a label.
+ */
+static int dead_code(peep_t* peep, size_t index)
+{
+    insn_t* insn = INSN(peep, index);
+
+    if(insn->kind != INSN_OP || !(opcode_table[insn->opcode].flags & OPF_STOP))
+        return 0;
+
+    size_t next = next_op(peep, index);
+
+    if(next >= peep->list->count)
+        return 0;
+
+    delete_insn(peep, next);
+    return 1;
+}
+
+static peep_rule_t rules[] = {
+    {"store-load", store_load, 0},
+    {"load-store", load_store, 0},
+    {"push-pop", push_pop, 0},
+    {"inc-dec", inc_dec, 0},
+    {"self-load", self_load, 0},
+    {"jump-next", jump_next, 0},
+    {"jump-thread", jump_thread, 0},
+    {"jump-return", jump_return, 0},
+    {"branch-invert", branch_invert, 0},
+    {"dead-code", dead_code, 0},
+};
+
+#define NUM_RULES (sizeof(rules) / sizeof(rules[0]))
+
+void peephole_optimize(insn_list_t* list)
+{
+    peep_t peep;
+    int changed = 1;
+
+    if(optimize_level == 0)
+        return;
+
+    size_t size = list_size(list);
+
+    peep.list = list;
+    label_tab_init(&peep.labels);
+
+    for(size_t i = 0; i < list->count; i++)
+    {
+        if(list->insns[i].kind == INSN_LABEL)
+            label_tab_insert(&peep.labels, list->insns[i].label, i);
+    }
+
+    for(int pass = 0; changed && pass < MAX_PASSES; pass++)
+    {
+        changed = 0;
+        for(size_t i = 0; i < list->count; i++)
+        {
+            for(size_t r = 0; r < NUM_RULES && list->insns[i].kind == INSN_OP; r++)
+            {
+                if(rules[r].apply(&peep, i))
+                {
+                    __atomic_fetch_add(&rules[r].hits, 1, __ATOMIC_RELAXED);
+                    changed++;
+                }
+            }
+        }
+    }
+
+    label_tab_destroy(&peep.labels);
+    insn_compact(list);
+    __atomic_fetch_add(&bytes_saved, size - list_size(list), __ATOMIC_RELAXED);
+}
+
+void peephole_report(FILE* fp)
+{
+    if(optimize_level == 0)
+        return;
+
+    fprintf(fp, "\npeephole rule       hits\n");
+    for(size_t r = 0; r < NUM_RULES; r++)
+        fprintf(fp, "%-16s %7lu\n", rules[r].name, rules[r].hits);
+    fprintf(fp, "bytes saved      %7lu\n", bytes_saved);
+}
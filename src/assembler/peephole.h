@@ -0,0 +1,13 @@
+#ifndef __PEEPHOLE_H__
+#  define __PEEPHOLE_H__
+
+#  include <stdio.h>
+
+#  include "instructions.h"
+
+void set_optimize(int level);
+int get_optimize(void);
+void peephole_optimize(insn_list_t* list);
+void peephole_report(FILE* fp);
+
+#endif
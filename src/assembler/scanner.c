@@ -8,6 +8,7 @@
 #include <string.h>
 #include <errno.h>
 
+#include "assembler.h"
 #include "scanner.h"
 #include "scanner_symbol.h"
 #include "scanner_comment.h"
@@ -24,9 +25,12 @@ typedef struct file_stack_t
     struct file_stack_t* next;
 } _file_stack_t;
 
-static _file_stack_t* file_stack;
+// Each thread scans its own file, so the file stack is per-thread. The
+// character table is only written by scanner_init().
+static __thread _file_stack_t* file_stack;
 static char char_type_table[256];
-static token_t unget_token = -1;
+static __thread int unget_token = -1;
+static __thread char unget_str[MAX_SYMBOL];
 
 void add_char(int ch, char* str, size_t size)
 {
@@ -51,7 +55,8 @@ int get_char(void)
 
     if(file_stack != NULL)
     {
-        ch = fgetc(file_stack->fp);
+        // only this thread reads the file, so the stream lock is not needed
+        ch = getc_unlocked(file_stack->fp);
         if(ch == '\n')
         {
             file_stack->line_no++;
@@ -61,10 +66,10 @@ int get_char(void)
         {
             _file_stack_t* fs = file_stack;
 
+            // the file stack entry is kept in the arena, where the name
+            // is still needed by anything that recorded it.
             file_stack = fs->next;
             fclose(fs->fp);
-            free((void *)fs->name);
-            free(fs);
 
             // return the next char from the previous file in the stack or
             // end of input if the file stack os NULL.
@@ -82,10 +87,11 @@ void unget_char(int ch)
     ungetc(ch, file_stack->fp);
 }
 
-// this is quick and dirty. May need to add the buffer at some point, but as it stands, I only need
-// to unget single character syntax.
-void scanner_unget_token(token_t tok) {
+// Only one token can be pushed back. Its text is kept so that a number or a
+// name can be pushed back as well as single character syntax.
+void scanner_unget_token(token_t tok, const char* str) {
     unget_token = tok;
+    strncpy(unget_str, str, sizeof(unget_str) - 1);
 }
 
 /****************
@@ -101,6 +107,7 @@ token_t scanner_get_token(char* str, size_t size)
     if(unget_token > 0) {
         token = unget_token;
         unget_token = -1;
+        strncpy(str, unget_str, size - 1);
         return token;
     }
 
@@ -159,7 +166,7 @@ void scanner_init(void)
     for(int i = 0; i < 256; i++)
         char_type_table[i] = INVALID_CHAR;
 
-    for(int i = '0'; i < '9'; i++)
+    for(int i = '0'; i <= '9'; i++)
         char_type_table[i] = NUMBERIC_CHAR;
 
     for(int i = 'a'; i <= 'z'; i++)
@@ -192,25 +199,16 @@ int scanner_open_infile(char* fname)
 {
     _file_stack_t* file;
 
-    if(NULL == (file = calloc(1, sizeof(_file_stack_t))))
-    {
-        fprintf(stderr, "FATAL: cannot allocate memory for file stack\n");
-        exit(1);
-    }
+    arena_mark_t mark = arena_mark(assembler_arena());
 
-    if(NULL == (file->name = strdup(fname)))
-    {
-        fprintf(stderr, "FATAL: cannot allocate memory for file name\n");
-        free(file);
-        exit(1);
-    }
+    file = arena_calloc(assembler_arena(), 1, sizeof(_file_stack_t));
+    file->name = arena_strdup(assembler_arena(), fname);
 
     file->fp = fopen(fname, "r");
     if(file->fp == NULL)
     {
         fprintf(stderr, "ERROR: cannot open input file: \"%s\": %s\n", fname, strerror(errno));
-        free((void *)file->name);
-        free(file);
+        arena_release(assembler_arena(), mark);
         return 1;
     }
 
@@ -31,6 +31,6 @@ int get_char_type(int ch);
 int get_char(void);
 void unget_char(int ch);
 const char* scanner_tok_str(int tok);
-void scanner_unget_token(token_t tok);
+void scanner_unget_token(token_t tok, const char* str);
 
 #endif
@@ -496,6 +496,10 @@ const char* scanner_tok_str(int tok)
             return "the END_SEC keyword";
         case TOK_INCLUDE:
             return "the INCLUDE keyword";
+        case TOK_FILL:
+            return "the FILL keyword";
+        case TOK_PTRS:
+            return "the PTRS keyword";
         case TOK_INT8:
             return "the INT8 data type";
         case TOK_INT16:
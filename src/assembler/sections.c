@@ -1,20 +1,20 @@
 /*
  * As the assembler churns through the source, it creates these data structures to hold the results.
  *
- * When symbols are encountered, they are stored in a separate hash table with the index into the section
+ * When symbols are encountered, they are stored in a separate hash table with the offset into the section
  * that they are a part of. The section data is stored as a simple byte stream, including the larger sized
- * data objects. They are stored in such a way as to be able to cast the data given the index. The data in
- * the section data structure is kept in a dynamic array that grows as data is added to it. When data is
- * defined with an initializer, that is stored in the section as well. If the data is given as
- * uninitialized, the zeros are stored.
+ * data objects. They are stored in such a way as to be able to cast the data given the index. The stream
+ * is built by emitter.c in chunks that are linked together as it grows. When data is defined with an
+ * initializer, that is stored in the section as well. If the data is given as uninitialized, the zeros
+ * are stored.
  *
- * When the program is serialized, the sections are concatenated and the indexes are fixed up to point to
- * the correct location. The names of objects are saved to a debug section, which will be implemented in
- * the future. Otherwise, they are discarded.
+ * When the program is serialized, the sections are concatenated and the relocations are fixed up to point
+ * to the correct location. The names of objects are saved to the debug section.
  *
  * There are two main types of sections, data and code. All data is read/write and the code is read-only
  * from the point of view of the VM. A third section, the debug section, is used to store the symbols that
- * were used in the program, along with the section offsets.
+ * were used in the program, along with the section offsets. The pointer maps of the code sections, which
+ * tell the garbage collector in the VM where the pointers are, follow it in a section of their own.
  *
  * A section must have a name. References to a section are defined using simple "dot" notation. For example,
  * a symbol named "foo" which was defined in a section named "bar" is referenced as "bar.foo". In the global
@@ -22,56 +22,465 @@
  * about the type of the name is stored in the symbol table.
  */
 
+#include <errno.h>
+
 #include "common.h"
+#include "image.h"
 
+#include "assembler.h"
 #include "scanner.h"
 #include "errors.h"
 #include "sections.h"
-//#include "dynamic_array.h"
-
+#include "symbols.h"
+#include "fragment.h"
+#include "objcache.h"
+#include "instructions.h"
 
 typedef struct
 {
-    const char* name;        // simple name connected to the data object.
+    const char* name;        // dotted name of the object, shared with its symbol.
     int type;                // type of each element in the buffer.
-    size_t size;             // this is the number of bytes given by the buffer.
-    size_t capacity;         // how much data this buffer will hold
-    uint8_t* data;           // This is a buffer of the type given.
+    size_t offset;           // where the object starts in the section.
 } _section_entry_t;
 
 typedef struct sec_t
 {
     const char* name;        // simple name connected to the data object.
     int type;                // type of each element in the buffer.
-    array_t table;           // section data.
+    size_t base;             // offset of the section in its segment, set by the layout.
+    size_t nentries;         // number of entries in the section
+    size_t capacity;         // capacity of the entry list
+    _section_entry_t* entries;   // named objects, in the order they were defined.
+    emit_stream_t stream;    // section data.
+    image_ptrmap_t* ptrmaps; // pointer maps of a code section, by offset
+    size_t nptrmaps;
+    size_t ptrmap_capacity;
+    size_t relax_first;      // first operand of the section in the relaxation list
+    size_t relax_count;      // number of operands that can be relaxed
 } _section_t;
 
-static array_t section_table;
+// When the files have been assembled, the sections of the whole program are
+// linked into this list in the order they were defined, which is the order
+// that they are serialized in. The hash table is an index into the list.
+static _section_t** section_list;
+static size_t num_sections;
+static size_t section_capacity;
+static sec_tab_t section_index;
+
+/*
+ * Make sure that there is room for one more item in a list. The item size is
+ * given so this works for both the section list and the entry lists.
+ */
+static void* grow_list(void* list, size_t nitems, size_t* capacity, size_t item_size)
+{
+    if(nitems + 1 > *capacity)
+    {
+        size_t new_cap = (*capacity == 0)? 8: *capacity << 1;
+
+        list = arena_realloc(assembler_arena(), list, *capacity * item_size, new_cap * item_size);
+        *capacity = new_cap;
+    }
+
+    return list;
+}
+
+static void append_entry(_section_t* sec, const char* name, int type, size_t offset)
+{
+    sec->entries = grow_list(sec->entries, sec->nentries, &sec->capacity, sizeof(_section_entry_t));
+
+    _section_entry_t* entry = &sec->entries[sec->nentries];
 
-// TODO: Fix strdup()'s
+    entry->name = name;
+    entry->type = type;
+    entry->offset = offset;
+
+    sec->nentries++;
+}
+
+static void make_entry_symbol(symbol_t* sym, _section_t* sec, int type, size_t offset)
+{
+    sym->sec_type = sec->type;
+    sym->type = type;
+    sym->section = (section_t)sec;
+    sym->offset = offset;
+    sym->has_value = 0;
+}
 
-static void grow_array(_section_entry_t * entry, size_t size)
+static int define_entry(_section_t* sec, const char* name, int type, size_t offset, const expr_value_t* value)
 {
+    symbol_t sym;
 
-    size_t new_cap = entry->capacity;
+    make_entry_symbol(&sym, sec, type, offset);
+    sym.has_value = (value != NULL);
+    if(value != NULL)
+        sym.value = *value;
+
+    symbol_t* stored = add_symbol(sec->name, name, &sym);
+
+    if(stored == NULL)
+        return 1;
+
+    append_entry(sec, stored->name, type, offset);
+    return 0;
+}
+
+/*
+ * Add the sections of a file and the files that it includes to the program,
+ * depth first, in source order.
+ */
+static void link_fragment(fragment_t* frag)
+{
+    for(size_t i = 0; i < frag->nitems; i++)
+    {
+        frag_item_t* item = &frag->items[i];
+
+        if(item->kind == FRAG_INCLUDE)
+        {
+            link_fragment(item->child);
+            continue;
+        }
+
+        _section_t* sec = (_section_t*)item->section;
+
+        if(sec_tab_find(&section_index, sec->name) != NULL)
+        {
+            fprintf(stderr, "Error: %s: section \"%s\" is already defined\n", frag->file_name, sec->name);
+            inc_error_count();
+            continue;
+        }
+
+        if(num_sections + 1 > section_capacity)
+        {
+            section_capacity = (section_capacity == 0)? 16: section_capacity << 1;
+            section_list = realloc(section_list, section_capacity * sizeof(_section_t*));
+            if(section_list == NULL)
+                fatal_error("cannot allocate %lu bytes for section list", section_capacity * sizeof(_section_t*));
+        }
+
+        section_list[num_sections++] = sec;
+        sec_tab_insert(&section_index, sec->name, (section_t)sec);
+        link_symbols(sec->name, &frag->symbols);
+    }
+}
+
+/*
+ * Give every section its offset in its segment. Sections of each type are
+ * concatenated in the order they were defined. Returns the size of the
+ * segment.
+ */
+static size_t layout_segment(int type)
+{
+    size_t base = 0;
+
+    for(size_t i = 0; i < num_sections; i++)
+    {
+        _section_t* sec = section_list[i];
+
+        if(sec->type == type)
+        {
+            sec->base = base;
+            base += sec->stream.size;
+        }
+    }
+
+    return base;
+}
+
+/*
+ * Relaxation.
+ *
+ * When a code section is encoded, the address of a symbol is not known, so
+ * every operand that refers to one is given 4 bytes. Once all of the files
+ * are linked, the sizes are picked again. Every such operand starts out at
+ * 1 byte and the code is laid out. Any operand whose value does not fit is
+ * made bigger and the code is laid out again, until nothing changes. Sizes
+ * only ever grow, so this always ends, and it usually takes two or three
+ * rounds. Then the code is rewritten with the new sizes and the labels,
+ * pointer maps and relocations are moved to match.
+ *
+ * Data addresses do not depend on the code, so they are laid out once.
+ */
+typedef struct
+{
+    reloc_t* rel;            // the relocation of the operand
+    symbol_t* sym;           // what it refers to, or NULL if it is not defined
+    size_t offset;           // where the value was before relaxation
+    int size;                // bytes that the value needs
+    size_t shrink;           // bytes saved up to and including this operand
+} relax_item_t;
+
+static relax_item_t* relax_items;
+static size_t relax_count;
+static size_t relax_capacity;
+
+/*
+ * Is the relocation the value of an immediate operand that can be made
+ * smaller? The spec byte is right before it.
+ */
+static int relaxable(const uint8_t* code, const reloc_t* rel)
+{
+    if(rel->width != 4 || rel->offset == 0)
+        return 0;
+
+    uint8_t spec = code[rel->offset - 1];
+    int kind = OPND_KIND(spec);
+
+    return (kind == OPND_IMM || kind == OPND_IMM_PTR) && OPND_REG_NUM(spec) == size_code(4);
+}
+
+static void add_relax_items(_section_t* sec, const uint8_t* code)
+{
+    sec->relax_first = relax_count;
+    sec->relax_count = 0;
+
+    for(size_t i = 0; i < sec->stream.nrelocs; i++)
+    {
+        reloc_t* rel = &sec->stream.relocs[i];
+
+        if(!relaxable(code, rel))
+            continue;
+
+        // this is done after the files are assembled, so there is no arena
+        if(relax_count + 1 > relax_capacity)
+        {
+            relax_capacity = (relax_capacity == 0)? 256: relax_capacity << 1;
+            relax_items = realloc(relax_items, relax_capacity * sizeof(relax_item_t));
+            if(relax_items == NULL)
+                fatal_error("cannot allocate %lu bytes for relaxation", relax_capacity * sizeof(relax_item_t));
+        }
+
+        relax_item_t* item = &relax_items[relax_count++];
+
+        item->rel = rel;
+        item->sym = find_linked_symbol(rel->symbol);
+        item->offset = rel->offset;
+        item->size = (item->sym == NULL)? 4: 1;  // an error is reported later
+        sec->relax_count++;
+    }
+}
+
+/*
+ * Where something that was at offset in a code section is now. The
+ * operands of a section are in the order of their offsets.
+ */
+static size_t relaxed_offset(_section_t* sec, size_t offset)
+{
+    relax_item_t* items = &relax_items[sec->relax_first];
+    size_t low = 0;
+    size_t high = sec->relax_count;
+
+    // find the number of operands before the offset
+    while(low < high)
+    {
+        size_t mid = (low + high) / 2;
+
+        if(items[mid].offset < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return (low == 0)? offset: offset - items[low - 1].shrink;
+}
+
+/*
+ * Lay out the code with the sizes as they are now.
+ */
+static void relax_layout(void)
+{
+    size_t base = 0;
+
+    for(size_t i = 0; i < num_sections; i++)
+    {
+        _section_t* sec = section_list[i];
+        size_t shrink = 0;
+
+        if(sec->type != SEC_TYPE_CODE)
+            continue;
+
+        for(size_t j = 0; j < sec->relax_count; j++)
+        {
+            relax_item_t* item = &relax_items[sec->relax_first + j];
+
+            shrink += item->rel->width - item->size;
+            item->shrink = shrink;
+        }
+
+        sec->base = base;
+        base += sec->stream.size - shrink;
+    }
+}
+
+static int64_t relax_value(relax_item_t* item)
+{
+    _section_t* target = (_section_t*)item->sym->section;
+    size_t offset = item->sym->offset;
+
+    if(target->type == SEC_TYPE_CODE)
+        offset = relaxed_offset(target, offset);
+
+    return (int64_t)(target->base + offset + item->rel->addend);
+}
+
+/*
+ * Write a code section again with the new operand sizes, and move its
+ * labels, pointer maps and relocations.
+ */
+static void relax_section(_section_t* sec, const uint8_t* code, uint8_t* buffer)
+{
+    for(size_t i = 0; i < sec->nentries; i++)
+    {
+        _section_entry_t* entry = &sec->entries[i];
+
+        entry->offset = relaxed_offset(sec, entry->offset);
+
+        symbol_t* sym = find_linked_symbol(entry->name);
+
+        if(sym != NULL)
+            sym->offset = entry->offset;
+    }
+
+    for(size_t i = 0; i < sec->nptrmaps; i++)
+        sec->ptrmaps[i].offset = (uint32_t)relaxed_offset(sec, sec->ptrmaps[i].offset);
+
+    // anything that was not relaxed still has to move
+    for(size_t i = 0; i < sec->stream.nrelocs; i++)
+    {
+        reloc_t* rel = &sec->stream.relocs[i];
+
+        if(!relaxable(code, rel))
+            rel->offset = relaxed_offset(sec, rel->offset);
+    }
+
+    size_t in = 0;
+    size_t out = 0;
+
+    for(size_t i = 0; i < sec->relax_count; i++)
+    {
+        relax_item_t* item = &relax_items[sec->relax_first + i];
+        size_t len = item->offset - in;
+
+        memcpy(&buffer[out], &code[in], len);
+        out += len;
+        buffer[out - 1] = OPND_SPEC(OPND_KIND(buffer[out - 1]), size_code(item->size));
+
+        item->rel->offset = out;
+        item->rel->width = item->size;
+        memset(&buffer[out], 0, item->size);
+        out += item->size;
+        in = item->offset + 4;
+    }
+
+    memcpy(&buffer[out], &code[in], sec->stream.size - in);
+    out += sec->stream.size - in;
+
+    emit_replace(&sec->stream, buffer, out);
+}
+
+static void write_value(uint8_t* ptr, uint64_t value, int width)
+{
+    // the image is little endian
+    for(int i = 0; i < width; i++)
+        ptr[i] = (uint8_t)(value >> (i * 8));
+}
+
+/*
+ * Fill in the relocations of a section that has been copied to dest.
+ */
+static void resolve_relocations(_section_t* sec, uint8_t* dest)
+{
+    for(size_t i = 0; i < sec->stream.nrelocs; i++)
+    {
+        reloc_t* rel = &sec->stream.relocs[i];
+        symbol_t* sym = find_linked_symbol(rel->symbol);
+
+        if(sym == NULL)
+        {
+            fprintf(stderr, "Error: undefined symbol \"%s\" referenced in section \"%s\"\n",
+                    rel->symbol, sec->name);
+            inc_error_count();
+            continue;
+        }
+
+        uint64_t value = ((_section_t*)sym->section)->base + sym->offset + rel->addend;
+        // the VM sign extends values in instructions
+        int bits = (sec->type == SEC_TYPE_CODE)? rel->width * 8 - 1: rel->width * 8;
+
+        if(rel->width < 8 && (value >> bits) != 0)
+        {
+            fprintf(stderr, "Error: value of \"%s\" does not fit in %d bytes\n", rel->symbol, rel->width);
+            inc_error_count();
+        }
+
+        write_value(&dest[rel->offset], value, rel->width);
+    }
+}
+
+static size_t debug_section_size(size_t* num_symbols)
+{
+    size_t size = 0;
 
-    do
+    *num_symbols = 0;
+    for(size_t i = 0; i < num_sections; i++)
     {
-        new_cap = new_cap << 1; // grow by powers of 2
-    } while(new_cap < (entry->size + size + 1));
+        _section_t* sec = section_list[i];
 
-    entry->capacity = new_cap;
-    entry->data = realloc(entry->data, new_cap);
+        for(size_t j = 0; j < sec->nentries; j++)
+            size += sizeof(image_symbol_t) + strlen(sec->entries[j].name);
+        *num_symbols += sec->nentries;
+    }
+
+    return size;
 }
 
-static int compare_entry_func(const void* p1, const void* p2)
+static void write_debug_section(uint8_t* dest)
 {
-    return strcmp(((_section_entry_t *) (p1))->name, ((_section_entry_t *) (p2))->name);
+    for(size_t i = 0; i < num_sections; i++)
+    {
+        _section_t* sec = section_list[i];
+
+        for(size_t j = 0; j < sec->nentries; j++)
+        {
+            _section_entry_t* entry = &sec->entries[j];
+            image_symbol_t rec;
+
+            rec.segment = (sec->type == SEC_TYPE_CODE)? IMAGE_SEG_CODE: IMAGE_SEG_DATA;
+            rec.type = (uint8_t)entry->type;
+            rec.name_len = (uint16_t)strlen(entry->name);
+            rec.offset = sec->base + entry->offset;
+
+            memcpy(dest, &rec, sizeof(rec));
+            dest += sizeof(rec);
+            memcpy(dest, entry->name, rec.name_len);
+            dest += rec.name_len;
+        }
+    }
 }
 
-static int compare_func(const void* p1, const void* p2)
+/*
+ * The pointer maps of the sections are in the order of their offsets, and
+ * so are the code sections, so they are written as they are.
+ */
+static size_t write_ptrmap_section(uint8_t* dest)
 {
-    return strcmp(((_section_t *) (p1))->name, ((_section_t *) (p2))->name);
+    size_t count = 0;
+
+    for(size_t i = 0; i < num_sections; i++)
+    {
+        _section_t* sec = section_list[i];
+
+        for(size_t j = 0; j < sec->nptrmaps; j++)
+        {
+            image_ptrmap_t map = sec->ptrmaps[j];
+
+            map.offset += (uint32_t)sec->base;
+            if(dest != NULL)
+                memcpy(&dest[count * sizeof(map)], &map, sizeof(map));
+            count++;
+        }
+    }
+
+    return count * sizeof(image_ptrmap_t);
 }
 
 /************************
@@ -79,76 +488,399 @@ static int compare_func(const void* p1, const void* p2)
  */
 void init_sections(void)
 {
-    section_table = array_init(compare_func);
+    section_list = NULL;
+    num_sections = 0;
+    section_capacity = 0;
+    sec_tab_init(&section_index);
 }
 
-// section_t
-void add_section(const char* name, int type)
+/*
+ * Add a section to the file that is being assembled.
+ */
+section_t add_section(const char* name, int type)
 {
-    _section_t sec;
+    fragment_t* frag = current_fragment();
+    _section_t* sec;
+
+    if(sec_tab_find(&frag->sections, name) != NULL)
+    {
+        syntax("section \"%s\" is already defined", name);
+        return NULL;
+    }
+
+    sec = arena_alloc(assembler_arena(), sizeof(_section_t));
 
-    sec.name = strdup(name);
-    sec.type = type;
-    sec.table = array_init(compare_entry_func);
-    array_add_entry(section_table, (void *)&sec, sizeof(_section_t));
-    // return (section_t) sec;
+    sec->name = arena_strdup(assembler_arena(), name);
+    sec->type = type;
+    sec->base = 0;
+    sec->nentries = 0;
+    sec->capacity = 0;
+    sec->entries = NULL;
+    sec->ptrmaps = NULL;
+    sec->nptrmaps = 0;
+    sec->ptrmap_capacity = 0;
+    emit_init(&sec->stream);
+
+    sec_tab_insert(&frag->sections, sec->name, (section_t)sec);
+    add_fragment_section((section_t)sec);
+
+    return (section_t)sec;
 }
 
-void destroy_all_sections(void)
+/*
+ * Find a section in the file that is being assembled.
+ */
+section_t find_section(const char* name)
 {
-    _section_t sec;
+    section_t* sec = sec_tab_find(&current_fragment()->sections, name);
 
-    for(int i = 0; i < array_get_num_items(section_table); i++)
+    return (sec != NULL)? *sec: NULL;
+}
+
+/*
+ * Put the sections and symbols of all of the files together. This has to be
+ * done before the image is written.
+ */
+void link_sections(fragment_t* root)
+{
+    link_fragment(root);
+}
+
+/*
+ * Pick the smallest size for every operand in the code that refers to a
+ * symbol. This is done after the sections are linked and before the image
+ * is written. Returns the number of bytes that were saved.
+ */
+size_t relax_code(void)
+{
+    size_t before = 0;
+    size_t after = 0;
+    int changed = 1;
+
+    layout_segment(SEC_TYPE_DATA);
+
+    uint8_t** code = calloc(num_sections, sizeof(uint8_t*));
+
+    if(code == NULL)
+        fatal_error("cannot allocate %lu bytes for relaxation", num_sections * sizeof(uint8_t*));
+
+    for(size_t i = 0; i < num_sections; i++)
+    {
+        _section_t* sec = section_list[i];
+
+        if(sec->type != SEC_TYPE_CODE)
+            continue;
+
+        code[i] = malloc(sec->stream.size + 1);
+        if(code[i] == NULL)
+            fatal_error("cannot allocate %lu bytes for relaxation", sec->stream.size);
+
+        emit_copy_out(&sec->stream, code[i]);
+        add_relax_items(sec, code[i]);
+        before += sec->stream.size;
+    }
+
+    while(changed)
+    {
+        changed = 0;
+        relax_layout();
+
+        for(size_t i = 0; i < relax_count; i++)
+        {
+            relax_item_t* item = &relax_items[i];
+
+            if(item->sym == NULL)
+                continue;
+
+            int size = immediate_size(relax_value(item));
+
+            if(size > item->size)
+            {
+                item->size = size;
+                changed++;
+            }
+        }
+    }
+
+    for(size_t i = 0; i < num_sections; i++)
     {
-        array_get_by_index(section_table, i, (void *)&sec, sizeof(_section_t));
-        for(int j = 0; j < array_get_num_items(sec.table); j++)
+        _section_t* sec = section_list[i];
+
+        if(code[i] == NULL)
+            continue;
+
+        if(sec->relax_count > 0)
         {
-            _section_entry_t entry;
+            uint8_t* buffer = malloc(sec->stream.size + 1);
 
-            array_get_by_index(sec.table, j, (void *)&entry, sizeof(_section_entry_t));
-            if(entry.name != NULL)
-                free((void *)entry.name);
-            if(entry.data != NULL)
-                free(entry.data);
+            if(buffer == NULL)
+                fatal_error("cannot allocate %lu bytes for relaxation", sec->stream.size);
+
+            relax_section(sec, code[i], buffer);
+            free(buffer);
         }
-        array_uninit(sec.table);
-        if(sec.name != NULL)
-            free((void *)sec.name);
+
+        after += sec->stream.size;
+        free(code[i]);
     }
-    array_uninit(section_table);
+
+    free(code);
+    free(relax_items);
+    relax_items = NULL;
+    relax_count = 0;
+    relax_capacity = 0;
+
+    return before - after;
 }
 
-void add_section_entry(const char* sec_name, const char* name)
+/*
+ * All of the section data lives in the arenas of the fragments, so there is
+ * nothing to free here except the program tables.
+ */
+void destroy_all_sections(void)
 {
-    _section_entry_t entry;
+    if(section_list != NULL)
+        free(section_list);
+    sec_tab_destroy(&section_index);
+    destroy_symbols();
+    init_sections();
+}
 
-    entry.capacity = 1;
-    entry.size = 0;
-    entry.name = strdup(name);
-    entry.data = NULL;
+/*
+ * Define a named object that starts at the current end of the section. If
+ * the object has a constant value, it is given so that later expressions can
+ * use it, otherwise value is NULL. Returns non-zero if the name is already in
+ * use.
+ */
+int add_section_entry(section_t section, const char* name, int type, const expr_value_t* value)
+{
+    _section_t* sec = (_section_t*)section;
 
-    _section_t sec;
+    if(define_entry(sec, name, type, sec->stream.size, value))
+    {
+        syntax("symbol \"%s\" is already defined in section \"%s\"", name, sec->name);
+        return 1;
+    }
 
-    sec.name = sec_name;
-    array_get_by_key(section_table, (void *)&sec, (void *)&sec, sizeof(_section_t));
-    array_add_entry(sec.table, (void *)&entry, sizeof(_section_entry_t));
+    return 0;
 }
 
-void add_entry_bytes(const char* sec_name, const char* ent_name, void* bytes, size_t size)
+/*
+ * Give the instruction that starts at the current end of a code section a
+ * pointer map.
+ */
+void add_section_ptrmap(section_t section, uint32_t regs, uint32_t depth, uint64_t slots)
 {
-    _section_t sec;
-    _section_entry_t entry;
+    _section_t* sec = (_section_t*)section;
+
+    sec->ptrmaps = grow_list(sec->ptrmaps, sec->nptrmaps, &sec->ptrmap_capacity, sizeof(image_ptrmap_t));
 
-    sec.name = sec_name;
-    array_get_by_key(section_table, (void *)&sec, (void *)&sec, sizeof(_section_t));
-    entry.name = ent_name;
-    array_get_by_key(sec.table, (void *)&entry, (void *)&entry, sizeof(_section_entry_t));
+    image_ptrmap_t* map = &sec->ptrmaps[sec->nptrmaps++];
 
-    if(entry.size + size + 1 > entry.capacity)
+    map->offset = (uint32_t)sec->stream.size;
+    map->regs = regs;
+    map->depth = depth;
+    map->unused = 0;
+    map->slots = slots;
+}
+
+void section_cursor(section_t section, emit_cursor_t* cursor)
+{
+    emit_open(cursor, &((_section_t*)section)->stream);
+}
+
+const char* section_name(section_t section)
+{
+    return ((_section_t*)section)->name;
+}
+
+/*
+ * Write everything about a section to an object cache file: the names and
+ * offsets of its objects, its bytes, its relocations and its pointer maps.
+ */
+void save_section(section_t section, FILE* fp)
+{
+    _section_t* sec = (_section_t*)section;
+
+    cache_write_str(fp, sec->name);
+    cache_write_u64(fp, sec->type);
+
+    cache_write_u64(fp, sec->nentries);
+    for(size_t i = 0; i < sec->nentries; i++)
+    {
+        cache_write_str(fp, sec->entries[i].name);
+        cache_write_u64(fp, sec->entries[i].type);
+        cache_write_u64(fp, sec->entries[i].offset);
+    }
+
+    cache_write_u64(fp, sec->stream.size);
+    for(emit_chunk_t* chunk = sec->stream.head; chunk != NULL; chunk = chunk->next)
+        cache_write_bytes(fp, chunk->data, chunk->used);
+
+    cache_write_u64(fp, sec->stream.nrelocs);
+    for(size_t i = 0; i < sec->stream.nrelocs; i++)
+    {
+        reloc_t* rel = &sec->stream.relocs[i];
+
+        cache_write_u64(fp, rel->offset);
+        cache_write_u64(fp, rel->width);
+        cache_write_u64(fp, (uint64_t)rel->addend);
+        cache_write_str(fp, rel->symbol);
+    }
+
+    cache_write_u64(fp, sec->nptrmaps);
+    for(size_t i = 0; i < sec->nptrmaps; i++)
+    {
+        image_ptrmap_t* map = &sec->ptrmaps[i];
+
+        cache_write_u64(fp, map->offset);
+        cache_write_u64(fp, map->regs);
+        cache_write_u64(fp, map->depth);
+        cache_write_u64(fp, map->slots);
+    }
+}
+
+/*
+ * Rebuild a section in the current file from an object cache file. The
+ * names are used where they are in the cache data, which has to live as
+ * long as the file. Returns NULL if the data is not valid.
+ */
+section_t load_section(cache_reader_t* rd)
+{
+    const char* name = cache_read_str(rd);
+    int type = (int)cache_read_u64(rd);
+
+    if(rd->error)
+        return NULL;
+
+    _section_t* sec = (_section_t*)add_section(name, type);
+    size_t nentries = cache_read_u64(rd);
+    size_t nlen = strlen(name);
+
+    for(size_t i = 0; i < nentries && sec != NULL && !rd->error; i++)
+    {
+        symbol_t sym;
+
+        sym.name = cache_read_str(rd);
+
+        int etype = (int)cache_read_u64(rd);
+        size_t offset = cache_read_u64(rd);
+
+        make_entry_symbol(&sym, sec, etype, offset);
+        if(rd->error || strncmp(sym.name, name, nlen) != 0 || sym.name[nlen] != '.')
+        {
+            rd->error = 1;
+            break;
+        }
+
+        restore_symbol(&sym);
+        append_entry(sec, sym.name, sym.type, sym.offset);
+    }
+
+    size_t size = cache_read_u64(rd);
+    const uint8_t* bytes = cache_read_bytes(rd, size);
+    size_t nrelocs = cache_read_u64(rd);
+
+    if(sec == NULL || rd->error)
+        return NULL;
+
+    emit_cursor_t cursor;
+
+    emit_open(&cursor, &sec->stream);
+    emit_bytes(&cursor, bytes, size);
+
+    for(size_t i = 0; i < nrelocs && !rd->error; i++)
+    {
+        size_t offset = cache_read_u64(rd);
+        int width = (int)cache_read_u64(rd);
+        int64_t addend = (int64_t)cache_read_u64(rd);
+        const char* symbol = cache_read_str(rd);
+
+        if(!rd->error)
+            emit_add_reloc(&sec->stream, offset, width, symbol, addend);
+    }
+
+    size_t nptrmaps = cache_read_u64(rd);
+
+    for(size_t i = 0; i < nptrmaps && !rd->error; i++)
+    {
+        size_t offset = cache_read_u64(rd);
+        uint32_t regs = (uint32_t)cache_read_u64(rd);
+        uint32_t depth = (uint32_t)cache_read_u64(rd);
+        uint64_t slots = cache_read_u64(rd);
+
+        if(!rd->error)
+        {
+            // the maps are added at the end of the section
+            add_section_ptrmap((section_t)sec, regs, depth, slots);
+            sec->ptrmaps[sec->nptrmaps - 1].offset = (uint32_t)offset;
+        }
+    }
+
+    return rd->error? NULL: (section_t)sec;
+}
+
+/*
+ * Lay out the sections, build the whole image in memory and write it to the
+ * file. Each section is copied exactly once, straight into its place in the
+ * image, and its relocations are resolved there. Returns non-zero on error.
+ */
+int write_image(const char* fname)
+{
+    image_header_t header;
+    size_t num_symbols;
+
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.flags = 0;
+    header.code_size = layout_segment(SEC_TYPE_CODE);
+    header.data_size = layout_segment(SEC_TYPE_DATA);
+    header.debug_size = debug_section_size(&num_symbols);
+    header.num_symbols = num_symbols;
+    header.ptrmap_size = write_ptrmap_section(NULL);
+
+    size_t total = sizeof(header) + header.code_size + header.data_size + header.debug_size + header.ptrmap_size;
+    uint8_t* image = malloc(total);
+
+    if(image == NULL)
+        fatal_error("cannot allocate %lu bytes for the program image", total);
+
+    uint8_t* code = &image[sizeof(header)];
+    uint8_t* data = &code[header.code_size];
+
+    memcpy(image, &header, sizeof(header));
+    for(size_t i = 0; i < num_sections; i++)
     {
-        grow_array(&entry, size);
+        _section_t* sec = section_list[i];
+        uint8_t* dest = &((sec->type == SEC_TYPE_CODE)? code: data)[sec->base];
+
+        emit_copy_out(&sec->stream, dest);
+        resolve_relocations(sec, dest);
     }
+    write_debug_section(&data[header.data_size]);
+    write_ptrmap_section(&data[header.data_size + header.debug_size]);
+
+    if(get_num_errors() != 0)
+    {
+        free(image);
+        return 1;
+    }
+
+    FILE* fp = fopen(fname, "wb");
+
+    if(fp == NULL)
+    {
+        fprintf(stderr, "ERROR: cannot open output file: \"%s\": %s\n", fname, strerror(errno));
+        free(image);
+        return 1;
+    }
+
+    int retv = (fwrite(image, 1, total, fp) != total);
+
+    if(retv)
+        fprintf(stderr, "ERROR: cannot write output file: \"%s\": %s\n", fname, strerror(errno));
 
-    memcpy((void *)&((uint8_t *) entry.data)[entry.size], bytes, size);
-    entry.size += size;
+    fclose(fp);
+    free(image);
+    return retv;
 }
@@ -1,6 +1,10 @@
 #ifndef __SECTIONS_H__
 #  define __SECTIONS_H__
 
+#  include "hash_table.h"
+#  include "emitter.h"
+#  include "expressions.h"
+
 enum
 {
     TYPE_INT8,
@@ -12,6 +16,7 @@ enum
     TYPE_UINT32,
     TYPE_UINT64,
     TYPE_FLOAT,
+    TYPE_LABEL,
     SEC_TYPE_DATA,
     SEC_TYPE_CODE,
 };
@@ -21,9 +26,22 @@ enum
  */
 typedef void* section_t;
 
-void add_section(const char* name, int type);
+HASH_TABLE(sec_tab, const char*, section_t, hash_string, compare_string)
+
+struct fragment_t;
+struct cache_reader_t;
+
+section_t add_section(const char* name, int type);
+section_t find_section(const char* name);
 void destroy_all_sections(void);
-void add_section_entry(const char* sec_name, const char* name);
-void add_entry_bytes(const char* sec_name, const char* ent_name, void* bytes, size_t size);
+int add_section_entry(section_t section, const char* name, int type, const expr_value_t* value);
+void add_section_ptrmap(section_t section, uint32_t regs, uint32_t depth, uint64_t slots);
+void section_cursor(section_t section, emit_cursor_t* cursor);
+const char* section_name(section_t section);
+void link_sections(struct fragment_t* root);
+size_t relax_code(void);
+void save_section(section_t section, FILE* fp);
+section_t load_section(struct cache_reader_t* rd);
+int write_image(const char* fname);
 
 #endif
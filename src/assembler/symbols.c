@@ -0,0 +1,101 @@
+/*
+ * The symbol table. Every named object that the assembler creates is saved
+ * here under its fully qualified (dotted) name, so references such as
+ * "bar.foo" can be resolved with a single lookup.
+ *
+ * Each source file has its own table while it is being assembled. When all
+ * of the files are finished, each section name is linked to the table of the
+ * file that defined it, and a reference between files is resolved by looking
+ * the section up and then the symbol in that table. Nothing is copied, so
+ * linking costs the same however many symbols there are.
+ */
+#include "common.h"
+
+#include "assembler.h"
+#include "symbols.h"
+#include "fragment.h"
+
+HASH_TABLE(file_tab, const char*, sym_tab_t*, hash_string, compare_string)
+
+// by section name, the table of the file that defined the section
+static file_tab_t linked_files;
+
+static void make_name(char* buf, size_t size, const char* sec_name, const char* name)
+{
+    if(snprintf(buf, size, "%s.%s", sec_name, name) >= (int)size)
+        fatal_error("symbol name \"%s.%s\" is too long", sec_name, name);
+}
+
+/*
+ * Add a symbol to the table of the file being assembled. If the symbol
+ * already exists, then NULL is returned and the table is not changed.
+ * Otherwise a pointer to the stored symbol is returned, which is valid until
+ * the next symbol is added.
+ */
+symbol_t* add_symbol(const char* sec_name, const char* name, symbol_t* sym)
+{
+    sym_tab_t* table = &current_fragment()->symbols;
+    char buffer[MAX_SYMBOL * 2 + 2];
+
+    make_name(buffer, sizeof(buffer), sec_name, name);
+    if(sym_tab_find(table, buffer) != NULL)
+        return NULL;
+
+    sym->name = arena_strdup(assembler_arena(), buffer);
+
+    sym_tab_insert(table, sym->name, *sym);
+    return sym_tab_find(table, sym->name);
+}
+
+/*
+ * Put a symbol back into the table of the file being assembled from the
+ * object cache. Its name is already dotted and lives as long as the file,
+ * and the file assembled without errors, so it cannot be a duplicate.
+ */
+void restore_symbol(const symbol_t* sym)
+{
+    sym_tab_insert(&current_fragment()->symbols, sym->name, *sym);
+}
+
+symbol_t* find_symbol(const char* name)
+{
+    return sym_tab_find(&current_fragment()->symbols, name);
+}
+
+symbol_t* find_section_symbol(const char* sec_name, const char* name)
+{
+    char buffer[MAX_SYMBOL * 2 + 2];
+
+    make_name(buffer, sizeof(buffer), sec_name, name);
+    return find_symbol(buffer);
+}
+
+/*
+ * Make the symbols of a section visible to the program. Section names are
+ * unique in the program, so there can be no clashes here.
+ */
+void link_symbols(const char* sec_name, sym_tab_t* table)
+{
+    file_tab_insert(&linked_files, sec_name, table);
+}
+
+symbol_t* find_linked_symbol(const char* name)
+{
+    const char* dot = strchr(name, '.');
+    char sec_name[MAX_SYMBOL + 1];
+
+    if(dot == NULL || (size_t)(dot - name) >= sizeof(sec_name))
+        return NULL;
+
+    memcpy(sec_name, name, dot - name);
+    sec_name[dot - name] = 0;
+
+    sym_tab_t** table = file_tab_find(&linked_files, sec_name);
+
+    return (table != NULL)? sym_tab_find(*table, name): NULL;
+}
+
+void destroy_symbols(void)
+{
+    file_tab_destroy(&linked_files);
+}
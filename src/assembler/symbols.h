@@ -0,0 +1,33 @@
+#ifndef __SYMBOLS_H__
+#  define __SYMBOLS_H__
+
+#  include "hash_table.h"
+#  include "sections.h"
+#  include "expressions.h"
+
+/*
+ * A symbol is stored by its dotted name, "section.name", and records where
+ * the object it names lives.
+ */
+typedef struct
+{
+    const char* name;        // dotted name; allocated from the assembler arena
+    int sec_type;            // SEC_TYPE_DATA or SEC_TYPE_CODE
+    int type;                // type of the object (TYPE_INT8, etc.)
+    section_t section;       // the section that holds the object
+    size_t offset;           // offset of the object in the section
+    int has_value;           // set if the object was given a constant value
+    expr_value_t value;      // the folded value, for use in later expressions
+} symbol_t;
+
+HASH_TABLE(sym_tab, const char*, symbol_t, hash_string, compare_string)
+
+symbol_t* add_symbol(const char* sec_name, const char* name, symbol_t* sym);
+void restore_symbol(const symbol_t* sym);
+symbol_t* find_symbol(const char* name);
+symbol_t* find_section_symbol(const char* sec_name, const char* name);
+void link_symbols(const char* sec_name, sym_tab_t* table);
+symbol_t* find_linked_symbol(const char* name);
+void destroy_symbols(void);
+
+#endif
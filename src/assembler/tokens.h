@@ -253,6 +253,8 @@ typedef enum
     TOK_DATA,
     TOK_END_SEC,
     TOK_INCLUDE,
+    TOK_FILL,
+    TOK_PTRS,
     TOK_INT8,
     TOK_INT16,
     TOK_INT32,
@@ -0,0 +1,41 @@
+# Heap churn: a ring of 1024 blocks of mixed sizes, each replaced in turn.
+CODE main
+start
+    allocate r10, 8192
+    load r5, 0
+clear
+    load r11, r5
+    shl r11, 3
+    iadd r11, r11, r10
+    load r1, 0
+    store r1, [r11]
+    inc r5
+    cmp r5, 1024
+    jmplt clear
+    load r12, 12345
+    load r20, 2000000
+    load r5, 0
+churn
+    load r11, r5
+    shl r11, 3
+    iadd r11, r11, r10
+    load r1, [r11]
+    cmp r1, 0
+    jmpeq empty
+    free r1
+empty
+    imul r12, r12, 1103515245
+    iadd r12, r12, 12345
+    load r3, r12
+    shr r3, 16
+    and r3, r3, 511
+    inc r3
+    allocate r1, r3
+    store r1, [r11]
+    inc r5
+    and r5, r5, 1023
+    dec r20
+    jmpne churn
+    load r0, 0
+    end
+END_SEC
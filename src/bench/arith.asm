@@ -0,0 +1,19 @@
+# Integer arithmetic in a tight loop.
+CODE main
+start
+    load r10, 20000000
+    load r1, 1
+    load r2, 0
+loop
+    imul r3, r1, 3
+    iadd r2, r2, r3
+    and r2, r2, 0xFFFFFF
+    shl r1, 1
+    or r1, r1, 1
+    and r1, r1, 0xFFFF
+    isub r4, r2, r1
+    dec r10
+    jmpne loop
+    load r0, 0
+    end
+END_SEC
@@ -0,0 +1,199 @@
+#!/usr/bin/env python
+'''
+This runs the benchmarks and compares the results of two runs.
+
+Every .asm file in this directory is a VM benchmark. It is assembled once,
+run once with -c to count its instructions, and then run a few times to warm
+up and a number of times to be timed. The "data" benchmark times the
+assembler on a large generated data section instead.
+
+    bench.py run --bin ../../bin [--out results.json] [--reps 10] [--warmup 2]
+    bench.py compare old.json new.json [--threshold 5]
+
+The results are written as JSON, with the median and 99th percentile times,
+instructions per second and the peak RSS of each benchmark. Compare exits
+with 1 if any benchmark got slower by more than the threshold, in percent.
+'''
+
+import sys
+import os
+import argparse
+import json
+import glob
+import shutil
+import subprocess
+import tempfile
+import time
+import platform
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# lines of data in the generated data section
+DATA_LINES = 200000
+
+
+def run_once(cmd):
+    '''
+    Run a command and return the wall time and the peak RSS in KB.
+    '''
+    start = time.perf_counter()
+    proc = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    _, status, usage = os.wait4(proc.pid, 0)
+    elapsed = time.perf_counter() - start
+    if status != 0:
+        sys.exit("%s failed with status %d" % (" ".join(cmd), status))
+    return elapsed, usage.ru_maxrss
+
+
+def percentile(values, pct):
+    '''
+    Nearest rank percentile of a sorted list.
+    '''
+    rank = max(1, int(round(pct / 100.0 * len(values) + 0.5)))
+    return values[min(rank, len(values)) - 1]
+
+
+def measure(cmd, warmup, reps):
+    for _ in range(warmup):
+        run_once(cmd)
+
+    times = []
+    peak = 0
+    for _ in range(reps):
+        elapsed, rss = run_once(cmd)
+        times.append(elapsed)
+        peak = max(peak, rss)
+
+    times.sort()
+    median = times[len(times) // 2] if len(times) % 2 else (times[len(times) // 2 - 1] + times[len(times) // 2]) / 2
+    return {
+        "runs": reps,
+        "median_ms": round(median * 1000, 3),
+        "p99_ms": round(percentile(times, 99) * 1000, 3),
+        "min_ms": round(times[0] * 1000, 3),
+        "peak_rss_kb": peak,
+    }
+
+
+def count_instructions(vm, image):
+    proc = subprocess.run([vm, "-c", image], stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, universal_newlines=True)
+    for line in proc.stderr.splitlines():
+        if line.startswith("instructions:"):
+            return int(line.split(":")[1])
+    return None
+
+
+def write_data_source(fname):
+    with open(fname, "w") as fp:
+        fp.write("DATA big\n")
+        for i in range(DATA_LINES):
+            kind = i % 4
+            if kind == 0:
+                fp.write("    int64 v%d = %d\n" % (i, i * 7))
+            elif kind == 1:
+                fp.write("    uint32 a%d[] = {%d, %d, %d, %d}\n" % (i, i, i + 1, i + 2, i + 3))
+            elif kind == 2:
+                fp.write("    uint8 s%d[] = \"string number %d\\x00\"\n" % (i, i))
+            else:
+                fp.write("    float f%d = %d.5\n" % (i, i))
+        fp.write("END_SEC\n")
+
+
+def cmd_run(args):
+    assembler = os.path.join(args.bin, "assembler")
+    vm = os.path.join(args.bin, "virtual-machine")
+    work = tempfile.mkdtemp(prefix="vm-bench-")
+    results = {}
+
+    try:
+        for source in sorted(glob.glob(os.path.join(BENCH_DIR, "*.asm"))):
+            name = os.path.splitext(os.path.basename(source))[0]
+            if args.filter and args.filter not in name:
+                continue
+
+            image = os.path.join(work, name + ".img")
+            subprocess.run([assembler, "-o", image, source], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL, check=True)
+
+            result = measure([vm, image], args.warmup, args.reps)
+            result["instructions"] = count_instructions(vm, image)
+            if result["instructions"] is not None and result["median_ms"] > 0:
+                result["insns_per_sec"] = int(result["instructions"] / (result["median_ms"] / 1000.0))
+            results[name] = result
+            print("%-10s median %9.3f ms  p99 %9.3f ms  %6d KB" % (name, result["median_ms"], result["p99_ms"], result["peak_rss_kb"]))
+
+        if not args.filter or args.filter in "data":
+            source = os.path.join(work, "data.asm")
+            write_data_source(source)
+            result = measure([assembler, "-o", os.path.join(work, "data.img"), source], args.warmup, args.reps)
+            result["lines"] = DATA_LINES
+            result["lines_per_sec"] = int(DATA_LINES / (result["median_ms"] / 1000.0))
+            results["data"] = result
+            print("%-10s median %9.3f ms  p99 %9.3f ms  %6d KB" % ("data", result["median_ms"], result["p99_ms"], result["peak_rss_kb"]))
+    finally:
+        shutil.rmtree(work)
+
+    out = {
+        "host": platform.node(),
+        "machine": platform.machine(),
+        "time": time.strftime("%Y-%m-%dT%H:%M:%S"),
+        "warmup": args.warmup,
+        "benchmarks": results,
+    }
+
+    if args.out:
+        with open(args.out, "w") as fp:
+            json.dump(out, fp, indent=2, sort_keys=True)
+            fp.write("\n")
+    return 0
+
+
+def cmd_compare(args):
+    with open(args.old) as fp:
+        old = json.load(fp)["benchmarks"]
+    with open(args.new) as fp:
+        new = json.load(fp)["benchmarks"]
+
+    regressed = 0
+    print("%-10s %11s %11s %8s" % ("benchmark", "old ms", "new ms", "change"))
+    for name in sorted(set(old) | set(new)):
+        if name not in old or name not in new:
+            print("%-10s only in %s" % (name, "old" if name in old else "new"))
+            continue
+
+        before = old[name]["median_ms"]
+        after = new[name]["median_ms"]
+        change = (after - before) * 100.0 / before if before else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressed += 1
+        elif change < -args.threshold:
+            flag = "  faster"
+        print("%-10s %11.3f %11.3f %+7.1f%%%s" % (name, before, after, change, flag))
+
+    return 1 if regressed else 0
+
+
+parser = argparse.ArgumentParser(description="Run and compare the benchmarks")
+sub = parser.add_subparsers(dest="command")
+
+run = sub.add_parser("run", help="run the benchmarks")
+run.add_argument('--bin', dest='bin', type=str, help="directory with the assembler and the VM", required=True)
+run.add_argument('--out', dest='out', type=str, help="write the results to this JSON file")
+run.add_argument('--reps', dest='reps', type=int, default=10, help="timed runs of each benchmark")
+run.add_argument('--warmup', dest='warmup', type=int, default=2, help="untimed runs first")
+run.add_argument('--filter', dest='filter', type=str, help="only run benchmarks with this in their name")
+
+compare = sub.add_parser("compare", help="compare two results files")
+compare.add_argument('old', type=str)
+compare.add_argument('new', type=str)
+compare.add_argument('--threshold', dest='threshold', type=float, default=5.0, help="percent slower that is a regression")
+
+args = parser.parse_args()
+if args.command == "run":
+    sys.exit(cmd_run(args))
+elif args.command == "compare":
+    sys.exit(cmd_compare(args))
+else:
+    parser.print_help()
+    sys.exit(1)
@@ -0,0 +1,22 @@
+# Calls nested 1000 deep, over and over, for CALL and RET.
+CODE main
+start
+    load r10, 20000
+    load r2, 0
+again
+    load r1, 1000
+    call down
+    dec r10
+    jmpne again
+    load r0, 0
+    end
+
+# r1 = how much deeper to go; counts the returns in r2
+down
+    cmp r1, 0
+    reteq
+    dec r1
+    call down
+    inc r2
+    ret
+END_SEC
@@ -0,0 +1,26 @@
+# Recursive fibonacci, for CALL and RET with the stack.
+CODE main
+start
+    load r1, 30
+    call fib
+    load r0, 0
+    end
+
+# r1 = n, returns fib(n) in r2
+fib
+    cmp r1, 2
+    jmplt small
+    push r1
+    dec r1
+    call fib
+    pop r1
+    push r2
+    isub r1, r1, 2
+    call fib
+    pop r3
+    iadd r2, r2, r3
+    ret
+small
+    load r2, r1
+    ret
+END_SEC
@@ -0,0 +1,17 @@
+# Block moves between two heap buffers with MOVB64.
+CODE main
+start
+    allocate r1, 1048576
+    allocate r2, 1048576
+    load r3, 131072
+    load r10, 3000
+loop
+    movb64 r2, r1, r3
+    movb64 r1, r2, r3
+    dec r10
+    jmpne loop
+    free r1
+    free r2
+    load r0, 0
+    end
+END_SEC
@@ -0,0 +1,49 @@
+# A switch on a pseudo random value, done as a chain of compares.
+CODE main
+start
+    load r10, 10000000
+    load r1, 12345
+    load r2, 0
+loop
+    imul r1, r1, 1103515245
+    iadd r1, r1, 12345
+    load r3, r1
+    shr r3, 16
+    and r3, r3, 7
+    cmp r3, 0
+    jmpeq case0
+    cmp r3, 1
+    jmpeq case1
+    cmp r3, 2
+    jmpeq case2
+    cmp r3, 3
+    jmpeq case3
+    cmp r3, 4
+    jmpeq case4
+    cmp r3, 5
+    jmpeq case5
+    iadd r2, r2, 7
+    jmp next
+case0
+    inc r2
+    jmp next
+case1
+    iadd r2, r2, 2
+    jmp next
+case2
+    iadd r2, r2, 3
+    jmp next
+case3
+    isub r2, r2, 1
+    jmp next
+case4
+    shl r2, 1
+    jmp next
+case5
+    shr r2, 1
+next
+    dec r10
+    jmpne loop
+    load r0, 0
+    end
+END_SEC
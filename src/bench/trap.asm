@@ -0,0 +1,16 @@
+# A trap and its return on every trip around the loop.
+CODE main
+start
+    load r10, 10000000
+    load r2, 0
+loop
+    trap handler
+    dec r10
+    jmpne loop
+    load r0, 0
+    end
+
+handler
+    inc r2
+    tret
+END_SEC
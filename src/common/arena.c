@@ -0,0 +1,273 @@
+/*
+ * Arena allocator.
+ *
+ * Memory is handed out by bumping a pointer through large chunks that are
+ * obtained from the system. Nothing is freed individually. The whole arena
+ * is freed at once, or it can be wound back to a mark that was taken
+ * earlier. This is intended for data that lives until the end of a pass,
+ * such as everything the assembler builds while it reads the source.
+ */
+#include "common.h"
+
+#ifdef __TESTING_ARENA_C__
+#  define fatal_error(...) do {fprintf(stderr, __VA_ARGS__); exit(1);}while(0)
+#endif
+
+#define ARENA_ALIGN (_Alignof(max_align_t))
+
+static size_t align_up(size_t value, size_t align)
+{
+    return (value + align - 1) & ~(align - 1);
+}
+
+/*
+ * Make a chunk that can hold at least size bytes at the given alignment and
+ * make it the head of the arena. Chunks that were given back by a release or a
+ * reset are used before asking the system for more.
+ */
+static void new_chunk(arena_t* arena, size_t size, size_t align)
+{
+    arena_chunk_t** prev = &arena->free;
+    arena_chunk_t* chunk;
+    size_t need = size + align;
+
+    for(chunk = arena->free; chunk != NULL; prev = &chunk->next, chunk = chunk->next)
+    {
+        if(chunk->size >= need)
+        {
+            *prev = chunk->next;
+            break;
+        }
+    }
+
+    if(chunk == NULL)
+    {
+        size_t csize = (need > arena->chunk_size)? need: arena->chunk_size;
+
+        chunk = malloc(sizeof(arena_chunk_t) + csize);
+        if(chunk == NULL)
+            fatal_error("cannot allocate %lu bytes for arena chunk", sizeof(arena_chunk_t) + csize);
+
+        chunk->size = csize;
+        arena->num_chunks++;
+        arena->reserved += csize;
+        if(arena->reserved > arena->peak)
+            arena->peak = arena->reserved;
+    }
+
+    chunk->used = 0;
+    chunk->next = arena->head;
+    arena->head = chunk;
+}
+
+/*
+ * Move chunks from the head of the arena to the free list until the given
+ * chunk is at the head.
+ */
+static void retire_chunks(arena_t* arena, arena_chunk_t* stop)
+{
+    while(arena->head != stop)
+    {
+        arena_chunk_t* chunk = arena->head;
+
+        arena->head = chunk->next;
+        chunk->next = arena->free;
+        arena->free = chunk;
+    }
+}
+
+static void free_chunks(arena_chunk_t* chunk)
+{
+    arena_chunk_t* next;
+
+    for(; chunk != NULL; chunk = next)
+    {
+        next = chunk->next;
+        free(chunk);
+    }
+}
+
+/************************
+ * public interface
+ */
+void arena_init(arena_t* arena, size_t chunk_size)
+{
+    memset(arena, 0, sizeof(arena_t));
+    arena->chunk_size = (chunk_size != 0)? chunk_size: ARENA_DEFAULT_CHUNK;
+}
+
+/*
+ * Give all of the memory back to the system.
+ */
+void arena_destroy(arena_t* arena)
+{
+    free_chunks(arena->head);
+    free_chunks(arena->free);
+    arena_init(arena, arena->chunk_size);
+}
+
+/*
+ * Forget everything that was allocated, but keep the chunks so that the
+ * arena can be filled again without calling malloc().
+ */
+void arena_reset(arena_t* arena)
+{
+    retire_chunks(arena, NULL);
+    arena->last = NULL;
+    arena->allocated = 0;
+}
+
+void* arena_alloc_aligned(arena_t* arena, size_t size, size_t align)
+{
+    arena_chunk_t* chunk = arena->head;
+    uintptr_t base;
+    size_t offset = 0;
+
+    if(align == 0 || (align & (align - 1)) != 0)
+        fatal_error("arena alignment %lu is not a power of 2", align);
+
+    if(chunk != NULL)
+    {
+        base = (uintptr_t)chunk->data;
+        offset = align_up(base + chunk->used, align) - base;
+    }
+
+    if(chunk == NULL || offset + size > chunk->size)
+    {
+        new_chunk(arena, size, align);
+        chunk = arena->head;
+        base = (uintptr_t)chunk->data;
+        offset = align_up(base, align) - base;
+    }
+
+    chunk->used = offset + size;
+    arena->allocated += size;
+    arena->last = &chunk->data[offset];
+
+    return arena->last;
+}
+
+void* arena_alloc(arena_t* arena, size_t size)
+{
+    return arena_alloc_aligned(arena, size, ARENA_ALIGN);
+}
+
+void* arena_calloc(arena_t* arena, size_t nitems, size_t size)
+{
+    void* ptr = arena_alloc(arena, nitems * size);
+
+    memset(ptr, 0, nitems * size);
+    return ptr;
+}
+
+/*
+ * Resize an allocation. If it was the last thing allocated and there is
+ * room in the chunk, then it grows in place. Otherwise it is copied to a new
+ * allocation and the old space is not reused until the arena is reset.
+ */
+void* arena_realloc(arena_t* arena, void* ptr, size_t old_size, size_t new_size)
+{
+    arena_chunk_t* chunk = arena->head;
+
+    if(ptr == NULL)
+        return arena_alloc(arena, new_size);
+
+    if(ptr == arena->last)
+    {
+        size_t offset = (unsigned char*)ptr - chunk->data;
+
+        if(offset + new_size <= chunk->size)
+        {
+            chunk->used = offset + new_size;
+            arena->allocated += new_size - old_size;
+            return ptr;
+        }
+    }
+
+    if(new_size <= old_size)
+        return ptr;
+
+    void* nptr = arena_alloc(arena, new_size);
+
+    memcpy(nptr, ptr, old_size);
+    return nptr;
+}
+
+char* arena_strdup(arena_t* arena, const char* str)
+{
+    size_t len = strlen(str) + 1;
+    char* ptr = arena_alloc_aligned(arena, len, 1);
+
+    memcpy(ptr, str, len);
+    return ptr;
+}
+
+arena_mark_t arena_mark(arena_t* arena)
+{
+    arena_mark_t mark;
+
+    mark.chunk = arena->head;
+    mark.used = (arena->head != NULL)? arena->head->used: 0;
+    mark.allocated = arena->allocated;
+
+    return mark;
+}
+
+/*
+ * Throw away everything that was allocated since the mark was taken.
+ */
+void arena_release(arena_t* arena, arena_mark_t mark)
+{
+    retire_chunks(arena, mark.chunk);
+    if(arena->head != NULL)
+        arena->head->used = mark.used;
+    arena->allocated = mark.allocated;
+    arena->last = NULL;
+}
+
+#ifdef __TESTING_ARENA_C__
+/*
+ * Fill an arena with strings, wind it back and fill it again.
+ */
+
+int main(void)
+{
+    char* strs[] = { "foo", "bar", "baz", "bacon", "eggs", "potatoes", "onions", NULL };
+    arena_t arena;
+    char* ptrs[8];
+
+    arena_init(&arena, 64);
+    for(int i = 0; strs[i] != NULL; i++)
+        ptrs[i] = arena_strdup(&arena, strs[i]);
+
+    for(int i = 0; strs[i] != NULL; i++)
+        printf("value: %s\n", ptrs[i]);
+
+    arena_mark_t mark = arena_mark(&arena);
+    for(int i = 0; i < 100; i++)
+    {
+        uint64_t* ptr = arena_alloc_aligned(&arena, sizeof(uint64_t), 64);
+        if(((uintptr_t)ptr & 63) != 0)
+            printf("bad alignment: %p\n", (void*)ptr);
+    }
+
+    printf("chunks: %lu\n", arena.num_chunks);
+    printf("allocated: %lu\n", arena.allocated);
+    arena_release(&arena, mark);
+    printf("after release: %lu\n", arena.allocated);
+
+    char* buf = arena_alloc(&arena, 8);
+    strcpy(buf, "1234567");
+    buf = arena_realloc(&arena, buf, 8, 32);
+    printf("grown: %s\n", buf);
+
+    arena_reset(&arena);
+    for(int i = 0; i < 100; i++)
+        arena_alloc(&arena, 16);
+    printf("chunks after reset: %lu\n", arena.num_chunks);
+
+    arena_destroy(&arena);
+    return 0;
+}
+
+#endif
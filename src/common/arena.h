@@ -0,0 +1,49 @@
+#ifndef __ARENA_H__
+#  define __ARENA_H__
+
+#  include <stddef.h>
+
+/*
+ * For arena.c
+ */
+typedef struct arena_chunk_t
+{
+    struct arena_chunk_t* next;  // next older chunk
+    size_t size;             // number of bytes in the data area
+    size_t used;             // number of bytes handed out
+    unsigned char data[];    // the allocations
+} arena_chunk_t;
+
+typedef struct
+{
+    arena_chunk_t* head;     // chunk that allocations come from
+    arena_chunk_t* free;     // chunks kept for reuse after a reset or release
+    size_t chunk_size;       // default size of a new chunk
+    void* last;              // most recent allocation, which can grow in place
+    size_t allocated;        // bytes handed out
+    size_t reserved;         // bytes obtained from the system
+    size_t peak;             // high water mark for reserved
+    size_t num_chunks;       // number of times malloc() has been called
+} arena_t;
+
+typedef struct
+{
+    arena_chunk_t* chunk;
+    size_t used;
+    size_t allocated;
+} arena_mark_t;
+
+#  define ARENA_DEFAULT_CHUNK (1024 * 64)
+
+void arena_init(arena_t* arena, size_t chunk_size);
+void arena_destroy(arena_t* arena);
+void arena_reset(arena_t* arena);
+void* arena_alloc(arena_t* arena, size_t size);
+void* arena_alloc_aligned(arena_t* arena, size_t size, size_t align);
+void* arena_calloc(arena_t* arena, size_t nitems, size_t size);
+void* arena_realloc(arena_t* arena, void* ptr, size_t old_size, size_t new_size);
+char* arena_strdup(arena_t* arena, const char* str);
+arena_mark_t arena_mark(arena_t* arena);
+void arena_release(arena_t* arena, arena_mark_t mark);
+
+#endif
@@ -13,5 +13,6 @@
 #include "errors.h"
 #include "array_manager.h"
 #include "hash_table.h"
+#include "arena.h"
 
 #endif
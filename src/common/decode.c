@@ -0,0 +1,108 @@
+/*
+ * Instruction decoder.
+ *
+ * This is the one place that turns the bytes of an instruction back into an
+ * opcode and operands. The VM loader and the disassembler both use it, and
+ * it is driven by the tables that are generated from tokens.h, the same ones
+ * that the assembler encodes with, so none of them can disagree about the
+ * instruction set.
+ *
+ * An instruction is an opcode byte, then a spec byte for each operand, each
+ * followed by the value of the operand, if it has one. The number of
+ * operands and the kinds that each one allows come from opcode_table and the
+ * number of bytes that follow a spec byte comes from operand_payload.
+ */
+#include <string.h>
+
+#include "decode.h"
+
+/*
+ * Read a little endian value of size bytes and sign extend it.
+ */
+static int64_t read_value(const uint8_t* ptr, int size)
+{
+    uint64_t value = 0;
+
+    for(int i = 0; i < size; i++)
+        value |= (uint64_t)ptr[i] << (i * 8);
+
+    if(size < 8)
+    {
+        int shift = 64 - size * 8;
+
+        return (int64_t)(value << shift) >> shift;
+    }
+
+    return (int64_t)value;
+}
+
+/*
+ * Decode the instruction at the start of code, which has avail bytes in it.
+ * Returns DECODE_OK and fills in insn, or the reason that the bytes are not
+ * an instruction.
+ */
+int decode_insn(const uint8_t* code, size_t avail, decoded_insn_t* insn)
+{
+    if(avail == 0)
+        return DECODE_TRUNCATED;
+
+    const opcode_info_t* info = &opcode_table[code[0]];
+    size_t pos = 1;
+
+    if(info->name == NULL)
+        return DECODE_BAD_OPCODE;
+
+    insn->opcode = code[0];
+    insn->noperands = info->noperands;
+
+    for(int i = 0; i < info->noperands; i++)
+    {
+        decoded_operand_t* opnd = &insn->operands[i];
+
+        if(pos >= avail)
+            return DECODE_TRUNCATED;
+
+        uint8_t spec = code[pos++];
+        int size = operand_payload[spec];
+
+        if(size < 0 || !(info->operands[i] & OPND_MASK(OPND_KIND(spec))))
+            return DECODE_BAD_OPERAND;
+
+        if(pos + size > avail)
+            return DECODE_TRUNCATED;
+
+        opnd->kind = OPND_KIND(spec);
+        opnd->reg = OPND_REG_NUM(spec);
+        opnd->size = (uint8_t)size;
+
+        if(opnd->kind == OPND_FLOAT)
+        {
+            memcpy(&opnd->fnum, &code[pos], sizeof(double));
+            opnd->value = 0;
+        }
+        else
+            opnd->value = read_value(&code[pos], size);
+
+        pos += size;
+    }
+
+    insn->length = (uint8_t)pos;
+    return DECODE_OK;
+}
+
+const char* decode_error_str(int err)
+{
+    switch (err)
+    {
+        case DECODE_OK:
+            return "no error";
+        case DECODE_BAD_OPCODE:
+            return "invalid opcode";
+        case DECODE_BAD_OPERAND:
+            return "invalid operand";
+        case DECODE_TRUNCATED:
+            return "instruction runs past the end of the code";
+        default:
+            return "unknown error";
+    }
+}
@@ -0,0 +1,43 @@
+#ifndef __DECODE_H__
+#  define __DECODE_H__
+
+#  include <stdint.h>
+#  include <stddef.h>
+
+#  include "opcodes.h"
+
+/*
+ * For decode.c
+ */
+typedef struct
+{
+    uint8_t kind;            // OPND_REG, etc.
+    uint8_t reg;             // register number, or the size code of an immediate
+    uint8_t size;            // bytes of value that followed the spec byte
+    int64_t value;           // immediate or offset, sign extended
+    double fnum;             // for OPND_FLOAT
+} decoded_operand_t;
+
+typedef struct
+{
+    uint8_t opcode;
+    uint8_t length;          // bytes in the whole instruction
+    uint8_t noperands;
+    decoded_operand_t operands[OP_MAX_OPERANDS];
+} decoded_insn_t;
+
+// longest possible instruction: an opcode and three 9 byte operands
+#  define MAX_INSN_LENGTH (1 + OP_MAX_OPERANDS * 9)
+
+enum
+{
+    DECODE_OK,
+    DECODE_BAD_OPCODE,
+    DECODE_BAD_OPERAND,
+    DECODE_TRUNCATED,
+};
+
+int decode_insn(const uint8_t* code, size_t avail, decoded_insn_t* insn);
+const char* decode_error_str(int err);
+
+#endif
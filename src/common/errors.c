@@ -5,29 +5,164 @@
  *  This contains the functions that show errors and warnings that result from
  *  parsing as well as those that result from things like memory allocation
  *  issues.
+ *
+ *  Files may be assembled on several threads at once, so the counts are
+ *  updated atomically at the call, where the caller can see them.
+ *
+ *  Messages are not formatted where they are raised. The format string and
+ *  the arguments are captured into a record, with the strings copied, and
+ *  after log_start() the record is put on a ring buffer that belongs to the
+ *  calling thread. A writer thread takes records off all of the rings and
+ *  formats and writes them, so a thread that logs a lot, such as the
+ *  assembler with TRACE on, does not wait for the output. Each ring has one
+ *  writer and one reader, so it needs no lock: the thread moves the head
+ *  when a record is complete and the writer moves the tail when it is done
+ *  with one. A thread waits only if its ring is full. Before log_start()
+ *  and after log_stop(), a record is formatted as soon as it is captured.
+ *
+ *  The trace messages (debug, MSG and MARK) can be written to a binary log
+ *  instead, which is smaller and quicker to write. Each format string, source
+ *  location and file name is written once and then referred to by number.
+ *  It is turned back into text by tools/decode_log.py.
+ *
+ *    header       "VPLG", version 2 bytes, flags 2 bytes
+ *    BLOG_STRING  id, length, bytes
+ *    BLOG_RECORD  kind byte, level byte, format id, file id, function id,
+ *                 line, scanner file name id, scanner line, scanner column,
+ *                 number of arguments, and each argument as a type byte and
+ *                 its value
+ *
+ *  Numbers are written 7 bits to a byte, low bits first, with the top bit set
+ *  on every byte but the last. String id 0 is NULL. The scanner line and
+ *  column are biased by 1, since they are -1 when no file is open. A signed
+ *  argument is zigzag coded, so small negative numbers are short, and a
+ *  string argument is its length and then its bytes. A float is an 8 byte
+ *  double.
  */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 
 #include "errors.h"
 #include "scanner.h"
 
+#define RING_SIZE       (64 * 1024)      // bytes, a power of 2
+#define MAX_RECORD      (8 * 1024)       // strings are cut to fit
+#define MAX_ARGS        32
+#define IDLE_WAIT_NS    1000000          // longest writer sleep when all rings are empty
+
+#define BLOG_MAGIC      0x474C5056       // "VPLG"
+#define BLOG_VERSION    1
+
+// level at or below which debug messages are shown; read by the macros
+int error_level;
+
 static struct errors
 {
-    int level;
     FILE* fp;
     int errors;
     int warnings;
 } errors;
 
+// errors reported by the calling thread
+static __thread int thread_errors;
+
+enum
+{
+    LOG_PAD,                 // fills the end of a ring
+    LOG_SYNTAX,
+    LOG_SCANNER,
+    LOG_WARNING,
+    LOG_DEBUG,
+    LOG_MSG,
+    LOG_MARK,
+};
+
+// the kinds that go to the binary log
+#define IS_TRACE(kind)  ((kind) >= LOG_DEBUG)
+
+enum
+{
+    ARG_INT = 1,
+    ARG_UINT,
+    ARG_DOUBLE,
+    ARG_STR,                 // copied, without the terminator
+    ARG_NULL_STR,
+    ARG_PTR,
+};
+
+enum
+{
+    BLOG_STRING = 1,
+    BLOG_RECORD,
+};
+
+/*
+ * A captured message. The scanner file name, terminated, and then the
+ * arguments follow it. Every record is a multiple of 8 bytes long.
+ */
+typedef struct
+{
+    uint32_t size;
+    uint8_t kind;
+    uint8_t level;
+    uint8_t nargs;
+    uint8_t has_name;        // scanner_get_file_name() was not NULL
+    const char* fmt;
+    const char* file;        // where MARK() was, or NULL
+    const char* func;
+    int line;
+    int scan_line;
+    int scan_col;
+} log_rec_t;
+
+typedef struct log_ring
+{
+    uint64_t head;           // written by the thread that owns the ring
+    char pad1[56];
+    uint64_t tail;           // written by the writer thread
+    char pad2[56];
+    struct log_ring* next;   // all of the rings
+    uint8_t buf[RING_SIZE];
+} log_ring_t;
+
+static struct logger
+{
+    int running;
+    int stop;
+    unsigned int gen;        // bumped by log_start(), so old rings are not used
+    pthread_t thread;
+    pthread_mutex_t lock;    // for waking the writer
+    pthread_cond_t wake;
+    int idle;                // the writer is waiting for wake
+    log_ring_t* rings;
+    FILE* binary;            // NULL to write the trace messages as text
+
+    // interned strings for the binary log
+    struct
+    {
+        const char* str;
+        int copied;          // owned by the log
+    } *strings;
+    size_t nstrings;
+    size_t string_cap;
+} logger = {.lock = PTHREAD_MUTEX_INITIALIZER, .wake = PTHREAD_COND_INITIALIZER};
+
+static __thread log_ring_t* thread_ring;
+static __thread unsigned int thread_gen;
+
 /*
  *  Initialize the errors and logging system.
  */
 void init_errors(int level, FILE * stre)
 {
 
-    errors.level = level;
+    error_level = level;
     errors.fp = stre;   // If this is NULL, then stderr will be
     // used.
     errors.errors = 0;
@@ -36,22 +171,23 @@ void init_errors(int level, FILE * stre)
 
 void inc_error_count(void)
 {
-    errors.errors++;
+    __atomic_fetch_add(&errors.errors, 1, __ATOMIC_RELAXED);
+    thread_errors++;
 }
 
 void inc_warning_count(void)
 {
-    errors.warnings++;
+    __atomic_fetch_add(&errors.warnings, 1, __ATOMIC_RELAXED);
 }
 
 void set_error_level(int lev)
 {
-    errors.level = lev;
+    error_level = lev;
 }
 
 int get_error_level(void)
 {
-    return errors.level;
+    return error_level;
 }
 
 void set_error_stream(FILE * fp)
@@ -66,32 +202,755 @@ FILE* get_error_stream(void)
 
 int get_num_errors(void)
 {
-    return errors.errors;
+    return __atomic_load_n(&errors.errors, __ATOMIC_RELAXED);
 }
 
 int get_num_warnings(void)
 {
-    return errors.warnings;
+    return __atomic_load_n(&errors.warnings, __ATOMIC_RELAXED);
 }
 
-void syntax(char* str, ...)
+/*
+ * Errors counted on the calling thread only. A worker uses this to tell
+ * whether the file that it just assembled had errors.
+ */
+int get_thread_errors(void)
 {
+    return thread_errors;
+}
 
-    va_list args;
+/************************
+ * capturing
+ */
+
+/*
+ * Step over a conversion spec, starting after the '%'. Sets the conversion
+ * character, the length modifier and the number of '*' that take an int.
+ */
+static const char* parse_spec(const char* p, char* conv, char* len, int* stars)
+{
+    *stars = 0;
+    while(*p != '\0' && strchr("-+ #0", *p) != NULL)
+        p++;
+    for(int part = 0; part < 2; part++)
+    {
+        if(part == 1)
+        {
+            if(*p != '.')
+                break;
+            p++;
+        }
+        if(*p == '*')
+        {
+            (*stars)++;
+            p++;
+        }
+        else
+            while(*p >= '0' && *p <= '9')
+                p++;
+    }
+
+    *len = 0;
+    while(*p != '\0' && strchr("hlLqjzt", *p) != NULL)
+    {
+        // only the last one matters for the size, except "ll"
+        *len = (*len == 'l' && *p == 'l')? 'q': *p;
+        p++;
+    }
+    *conv = *p;
+    return (*p != '\0')? p + 1: p;
+}
+
+typedef struct
+{
+    uint8_t* buf;
+    size_t used;
+} capture_t;
+
+static void put_bytes(capture_t* cap, const void* ptr, size_t size)
+{
+    memcpy(&cap->buf[cap->used], ptr, size);
+    cap->used += size;
+}
+
+static void put_value(capture_t* cap, uint8_t type, uint64_t value)
+{
+    put_bytes(cap, &type, 1);
+    put_bytes(cap, &value, 8);
+}
+
+static void put_string(capture_t* cap, const char* str, size_t room)
+{
+    size_t len = strlen(str);
+    uint16_t n;
+
+    // the type byte, the length, the terminator and the rest of the record
+    size_t avail = (cap->used + room + 4 < MAX_RECORD)? MAX_RECORD - cap->used - room - 4: 0;
+
+    if(len > avail)
+        len = avail;
+    n = (uint16_t)len;
+    put_bytes(cap, &(uint8_t){ARG_STR}, 1);
+    put_bytes(cap, &n, 2);
+    put_bytes(cap, str, len);
+    put_bytes(cap, "", 1);
+}
+
+/*
+ * Copy the arguments that the format string uses. The record has to keep
+ * copies of the strings, since they may be gone by the time it is written.
+ */
+static void capture_args(capture_t* cap, log_rec_t* rec, va_list* args)
+{
+    const char* p = rec->fmt;
+
+    while((p = strchr(p, '%')) != NULL)
+    {
+        char conv;
+        char len;
+        int stars;
+
+        p = parse_spec(p + 1, &conv, &len, &stars);
+        if(conv == '%' || conv == '\0')
+            continue;
+
+        // room for the arguments that are left, at most
+        size_t room = (size_t)(MAX_ARGS - rec->nargs) * 9;
+
+        for(int i = 0; i < stars && rec->nargs < MAX_ARGS; i++, rec->nargs++)
+            put_value(cap, ARG_INT, (uint64_t)(int64_t)va_arg(*args, int));
+
+        if(rec->nargs >= MAX_ARGS)
+            break;
+
+        switch (conv)
+        {
+            case 'd':
+            case 'i':
+            case 'c':
+            {
+                int64_t v;
+
+                if(len == 'q' || len == 'j')
+                    v = va_arg(*args, long long);
+                else if(len == 'l' || len == 'z' || len == 't')
+                    v = va_arg(*args, long);
+                else
+                    v = va_arg(*args, int);
+                put_value(cap, ARG_INT, (uint64_t)v);
+                break;
+            }
+            case 'u':
+            case 'x':
+            case 'X':
+            case 'o':
+            {
+                uint64_t v;
+
+                if(len == 'q' || len == 'j')
+                    v = va_arg(*args, unsigned long long);
+                else if(len == 'l' || len == 'z' || len == 't')
+                    v = va_arg(*args, unsigned long);
+                else
+                    v = va_arg(*args, unsigned int);
+                put_value(cap, ARG_UINT, v);
+                break;
+            }
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+            {
+                double v = (len == 'L')? (double)va_arg(*args, long double): va_arg(*args, double);
+                uint64_t bits;
+
+                memcpy(&bits, &v, 8);
+                put_value(cap, ARG_DOUBLE, bits);
+                break;
+            }
+            case 's':
+            {
+                const char* s = va_arg(*args, const char*);
+
+                if(s != NULL)
+                    put_string(cap, s, room);
+                else
+                    put_bytes(cap, &(uint8_t){ARG_NULL_STR}, 1);
+                break;
+            }
+            case 'p':
+                put_value(cap, ARG_PTR, (uint64_t)(uintptr_t)va_arg(*args, void*));
+                break;
+            default:
+                // %n, or something this does not know; nothing is shown for it
+                continue;
+        }
+        rec->nargs++;
+    }
+}
+
+/*
+ * Capture a message into buf, which is MAX_RECORD bytes. Returns the record.
+ * There are no arguments if fmt is NULL.
+ */
+static log_rec_t* capture(uint8_t* buf, int kind, int level, const char* fmt, va_list* args)
+{
+    log_rec_t* rec = (log_rec_t*)buf;
+    capture_t cap = {buf, sizeof(log_rec_t)};
     const char* name = scanner_get_file_name();
-    int lnum = scanner_get_line();
-    int cnum = scanner_get_column();
 
-    if(NULL != name)
-        fprintf(stderr, "Syntax: %s: %d: %d: ", name, lnum, cnum);
+    rec->kind = (uint8_t)kind;
+    rec->level = (uint8_t)level;
+    rec->nargs = 0;
+    rec->fmt = fmt;
+    rec->file = NULL;
+    rec->func = NULL;
+    rec->line = 0;
+    rec->scan_line = scanner_get_line();
+    rec->scan_col = scanner_get_column();
+    rec->has_name = (name != NULL);
+
+    // leave room for every possible argument after the name
+    if(name != NULL)
+    {
+        size_t len = strlen(name);
+
+        if(len > MAX_RECORD / 2)
+            len = MAX_RECORD / 2;
+        put_bytes(&cap, name, len);
+    }
+    put_bytes(&cap, "", 1);
+
+    if(fmt != NULL)
+        capture_args(&cap, rec, args);
+
+    rec->size = (uint32_t)((cap.used + 7) & ~7ul);
+    return rec;
+}
+
+/************************
+ * formatting
+ */
+
+static const uint8_t* get_arg(const uint8_t* p, uint8_t* type, uint64_t* value, const char** str)
+{
+    *type = *p++;
+    if(*type == ARG_STR)
+    {
+        uint16_t n;
+
+        memcpy(&n, p, 2);
+        *str = (const char*)(p + 2);
+        return p + 2 + n + 1;
+    }
+    if(*type == ARG_NULL_STR)
+    {
+        *str = NULL;
+        return p;
+    }
+    memcpy(value, p, 8);
+    return p + 8;
+}
+
+// fprintf one value, after the widths that the spec takes from the arguments
+#define PRINT_ARG(v) do { \
+        if(stars == 2) \
+            fprintf(fp, spec, star[0], star[1], v); \
+        else if(stars == 1) \
+            fprintf(fp, spec, star[0], v); \
+        else \
+            fprintf(fp, spec, v); \
+    } while(0)
+
+/*
+ * Write the message with its captured arguments. Each conversion spec is
+ * passed to fprintf on its own, with the length changed to suit the value.
+ */
+static void format_message(FILE* fp, const log_rec_t* rec, const uint8_t* args)
+{
+    const char* p = rec->fmt;
+    int left = rec->nargs;
+
+    while(*p != '\0')
+    {
+        const char* pct = strchr(p, '%');
+
+        if(pct == NULL)
+        {
+            fputs(p, fp);
+            break;
+        }
+        fwrite(p, 1, (size_t)(pct - p), fp);
+
+        char conv;
+        char len;
+        int stars;
+        const char* end = parse_spec(pct + 1, &conv, &len, &stars);
+
+        p = end;
+        if(conv == '%')
+        {
+            fputc('%', fp);
+            continue;
+        }
+        if(conv == '\0' || strchr("diouxXcsp" "eEfFgGaA", conv) == NULL || left < stars + 1)
+            continue;
+
+        // the spec without its length, with room for "ll"
+        char spec[64];
+        size_t n = 0;
+
+        for(const char* q = pct; q < end - 1 && n < sizeof(spec) - 4; q++)
+            if(strchr("hlLqjzt", *q) == NULL)
+                spec[n++] = *q;
+
+        int star[2] = {0, 0};
+        uint8_t type;
+        uint64_t value = 0;
+        const char* str = NULL;
+
+        for(int i = 0; i < stars; i++)
+        {
+            args = get_arg(args, &type, &value, &str);
+            star[i] = (int)(int64_t)value;
+        }
+        args = get_arg(args, &type, &value, &str);
+        left -= stars + 1;
+
+        if(type == ARG_INT || type == ARG_UINT)
+        {
+            if(conv != 'c')
+            {
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+            }
+        }
+        spec[n++] = conv;
+        spec[n] = '\0';
+
+        switch (type)
+        {
+            case ARG_INT:
+            case ARG_UINT:
+                if(conv == 'c')
+                    PRINT_ARG((int)value);
+                else
+                    PRINT_ARG((long long)value);
+                break;
+            case ARG_DOUBLE:
+            {
+                double d;
+
+                memcpy(&d, &value, 8);
+                PRINT_ARG(d);
+                break;
+            }
+            case ARG_STR:
+            case ARG_NULL_STR:
+                PRINT_ARG(str);
+                break;
+            case ARG_PTR:
+                PRINT_ARG((void*)(uintptr_t)value);
+                break;
+        }
+    }
+}
+
+static FILE* trace_stream(void)
+{
+    return (errors.fp != NULL)? errors.fp: stderr;
+}
+
+static void write_text(const log_rec_t* rec)
+{
+    const char* name = rec->has_name? (const char*)(rec + 1): NULL;
+    const uint8_t* args = (const uint8_t*)(rec + 1) + strlen((const char*)(rec + 1)) + 1;
+    FILE* fp = IS_TRACE(rec->kind)? trace_stream(): stderr;
+
+    flockfile(fp);
+    switch (rec->kind)
+    {
+        case LOG_SYNTAX:
+            if(NULL != name)
+                fprintf(fp, "Syntax: %s: %d: %d: ", name, rec->scan_line, rec->scan_col);
+            else
+                fprintf(fp, "error: ");
+            break;
+        case LOG_SCANNER:
+            if(NULL != name)
+                fprintf(fp, "Scanner Error: %s: %d: %d: ", name, rec->scan_line, rec->scan_col);
+            else
+                fprintf(fp, "Scanner Error: ");
+            break;
+        case LOG_WARNING:
+            if(NULL != name)
+                fprintf(fp, "Warning: %s: %d: ", name, rec->scan_line);
+            else
+                fprintf(fp, "Warning: ");
+            break;
+        case LOG_DEBUG:
+            fprintf(fp, "DBG: ");
+            break;
+        case LOG_MSG:
+            fprintf(fp, "MSG: %s: %d: %d: ", name? name: "(null)", rec->scan_line, rec->scan_col);
+            break;
+        case LOG_MARK:
+            fprintf(fp, "MARK: (%s, %d) %s: %d: %d: %s", rec->file, rec->line, name? name: "(null)",
+                    rec->scan_line, rec->scan_col, rec->func);
+            break;
+    }
+    if(rec->fmt != NULL)
+        format_message(fp, rec, args);
+    fputc('\n', fp);
+    funlockfile(fp);
+}
+
+/************************
+ * binary log
+ */
+
+static void put_varint(capture_t* out, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        out->buf[out->used++] = (uint8_t)(value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    out->buf[out->used++] = (uint8_t)value;
+}
+
+/*
+ * The number of an interned string, which is written the first time; 0 is
+ * NULL. Format strings and source locations do not move, so they are found
+ * by address. A copied string, such as a file name, is found by what it
+ * says, and is copied again to keep.
+ */
+static uint64_t string_id(FILE* fp, const char* str, int copied)
+{
+    if(str == NULL)
+        return 0;
+
+    for(size_t i = 0; i < logger.nstrings; i++)
+        if(logger.strings[i].str == str ||
+           (copied && logger.strings[i].copied && !strcmp(logger.strings[i].str, str)))
+            return i + 1;
+
+    if(logger.nstrings == logger.string_cap)
+    {
+        logger.string_cap = logger.string_cap? logger.string_cap * 2: 64;
+        logger.strings = realloc(logger.strings, logger.string_cap * sizeof(logger.strings[0]));
+        if(logger.strings == NULL)
+            fatal_error("cannot allocate memory for the log");
+    }
+    logger.strings[logger.nstrings].str = copied? strdup(str): str;
+    logger.strings[logger.nstrings].copied = copied;
+    if(logger.strings[logger.nstrings++].str == NULL)
+        fatal_error("cannot allocate memory for the log");
+
+    uint8_t buf[32];
+    capture_t out = {buf, 0};
+    size_t len = strlen(str);
+
+    out.buf[out.used++] = BLOG_STRING;
+    put_varint(&out, logger.nstrings);
+    put_varint(&out, len);
+    fwrite(buf, 1, out.used, fp);
+    fwrite(str, 1, len, fp);
+    return logger.nstrings;
+}
+
+/*
+ * The record is put together first and written in one go. It is never
+ * longer than the captured record, since the numbers only get shorter.
+ */
+static void write_binary(const log_rec_t* rec)
+{
+    FILE* fp = logger.binary;
+    const char* name = (const char*)(rec + 1);
+    const uint8_t* args = (const uint8_t*)name + strlen(name) + 1;
+    uint64_t fmt = string_id(fp, rec->fmt, 0);
+    uint64_t file = string_id(fp, rec->file, 0);
+    uint64_t func = string_id(fp, rec->func, 0);
+    uint64_t scan_name = string_id(fp, rec->has_name? name: NULL, 1);
+    uint8_t buf[MAX_RECORD + 64];
+    capture_t out = {buf, 0};
+
+    out.buf[out.used++] = BLOG_RECORD;
+    out.buf[out.used++] = rec->kind;
+    out.buf[out.used++] = rec->level;
+    put_varint(&out, fmt);
+    put_varint(&out, file);
+    put_varint(&out, func);
+    put_varint(&out, (uint64_t)rec->line);
+    put_varint(&out, scan_name);
+    put_varint(&out, (uint64_t)(rec->scan_line + 1));
+    put_varint(&out, (uint64_t)(rec->scan_col + 1));
+    put_varint(&out, rec->nargs);
+
+    for(int i = 0; i < rec->nargs; i++)
+    {
+        uint8_t type;
+        uint64_t value;
+        const char* str;
+
+        args = get_arg(args, &type, &value, &str);
+        out.buf[out.used++] = type;
+        if(type == ARG_STR)
+        {
+            size_t len = strlen(str);
+
+            put_varint(&out, len);
+            put_bytes(&out, str, len);
+        }
+        else if(type == ARG_INT)
+            put_varint(&out, (value << 1) ^ (uint64_t)((int64_t)value >> 63));
+        else if(type == ARG_DOUBLE)
+            put_bytes(&out, &value, 8);
+        else if(type != ARG_NULL_STR)
+            put_varint(&out, value);
+    }
+    fwrite(buf, 1, out.used, fp);
+}
+
+static void write_record(const log_rec_t* rec)
+{
+    if(logger.binary != NULL && IS_TRACE(rec->kind))
+        write_binary(rec);
     else
-        fprintf(stderr, "error: ");
+        write_text(rec);
+}
+
+/************************
+ * the rings and the writer thread
+ */
+
+static log_ring_t* get_ring(void)
+{
+    if(thread_ring != NULL && thread_gen == logger.gen)
+        return thread_ring;
+
+    log_ring_t* ring = calloc(1, sizeof(log_ring_t));
+
+    if(ring == NULL)
+        return NULL;
+
+    ring->next = __atomic_load_n(&logger.rings, __ATOMIC_ACQUIRE);
+    while(!__atomic_compare_exchange_n(&logger.rings, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+
+    thread_ring = ring;
+    thread_gen = logger.gen;
+    return ring;
+}
+
+static void wake_writer(void)
+{
+    if(!__atomic_load_n(&logger.idle, __ATOMIC_ACQUIRE))
+        return;
+
+    pthread_mutex_lock(&logger.lock);
+    pthread_cond_signal(&logger.wake);
+    pthread_mutex_unlock(&logger.lock);
+}
+
+static int put_record(const log_rec_t* rec)
+{
+    log_ring_t* ring = get_ring();
+
+    if(ring == NULL)
+        return -1;
+
+    uint64_t head = ring->head;
+    size_t pos = head & (RING_SIZE - 1);
+    size_t pad = (pos + rec->size > RING_SIZE)? RING_SIZE - pos: 0;
+
+    uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    while(head + pad + rec->size - tail > RING_SIZE)
+    {
+        wake_writer();
+        sched_yield();
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    }
+
+    if(pad != 0)
+    {
+        ((log_rec_t*)&ring->buf[pos])->size = (uint32_t)pad;
+        ((log_rec_t*)&ring->buf[pos])->kind = LOG_PAD;
+        pos = 0;
+    }
+    memcpy(&ring->buf[pos], rec, rec->size);
+    __atomic_store_n(&ring->head, head + pad + rec->size, __ATOMIC_RELEASE);
+
+    // do not let it fill up while the writer sleeps
+    if(head - tail < RING_SIZE / 2 && head + pad + rec->size - tail >= RING_SIZE / 2)
+        wake_writer();
+    return 0;
+}
+
+// write what is on a ring; returns how many bytes were taken off
+static size_t drain(log_ring_t* ring)
+{
+    uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint64_t tail = ring->tail;
+    size_t taken = head - tail;
+
+    while(tail != head)
+    {
+        const log_rec_t* rec = (const log_rec_t*)&ring->buf[tail & (RING_SIZE - 1)];
+
+        if(rec->kind != LOG_PAD)
+            write_record(rec);
+        tail += rec->size;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    return taken;
+}
+
+static void* writer(void* arg)
+{
+    (void)arg;
+
+    for(;;)
+    {
+        int stop = __atomic_load_n(&logger.stop, __ATOMIC_ACQUIRE);
+        size_t taken = 0;
+
+        for(log_ring_t* ring = __atomic_load_n(&logger.rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+            taken += drain(ring);
+
+        if(stop && taken == 0)
+            break;
+        if(taken == 0)
+        {
+            struct timespec ts;
+
+            fflush(trace_stream());
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += IDLE_WAIT_NS;
+            if(ts.tv_nsec >= 1000000000)
+            {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000;
+            }
+
+            pthread_mutex_lock(&logger.lock);
+            __atomic_store_n(&logger.idle, 1, __ATOMIC_RELEASE);
+            pthread_cond_timedwait(&logger.wake, &logger.lock, &ts);
+            __atomic_store_n(&logger.idle, 0, __ATOMIC_RELEASE);
+            pthread_mutex_unlock(&logger.lock);
+        }
+    }
+    return NULL;
+}
+
+static void log_message(int kind, int level, const char* fmt, va_list args)
+{
+    uint8_t buf[MAX_RECORD] __attribute__((aligned(8)));
+    va_list copy;
+
+    // a va_list parameter can not be passed on by address
+    va_copy(copy, args);
+    const log_rec_t* rec = capture(buf, kind, level, fmt, &copy);
+    va_end(copy);
+
+    if(!__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE) || put_record(rec))
+        write_record(rec);
+}
+
+/*
+ * Start the writer thread. If binary is not NULL, the trace messages are
+ * written to that file in the binary format. Returns 0, or -1 if the thread
+ * or the file can not be made, and then messages are written as they come.
+ */
+int log_start(const char* binary)
+{
+    if(logger.running)
+        return 0;
+
+    if(binary != NULL)
+    {
+        uint16_t version = BLOG_VERSION;
+        uint16_t flags = 0;
+        uint32_t magic = BLOG_MAGIC;
+
+        if((logger.binary = fopen(binary, "wb")) == NULL)
+        {
+            fprintf(stderr, "ERROR: cannot open log %s\n", binary);
+            return -1;
+        }
+        fwrite(&magic, 4, 1, logger.binary);
+        fwrite(&version, 2, 1, logger.binary);
+        fwrite(&flags, 2, 1, logger.binary);
+    }
+
+    logger.stop = 0;
+    logger.gen++;
+    if(pthread_create(&logger.thread, NULL, writer, NULL) != 0)
+    {
+        if(logger.binary != NULL)
+            fclose(logger.binary);
+        logger.binary = NULL;
+        return -1;
+    }
+
+    __atomic_store_n(&logger.running, 1, __ATOMIC_RELEASE);
+    atexit(log_stop);
+    return 0;
+}
+
+/*
+ * Write everything that is waiting and stop the writer thread. This must be
+ * called when no other thread is logging.
+ */
+void log_stop(void)
+{
+    if(!logger.running)
+        return;
+
+    __atomic_store_n(&logger.running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&logger.stop, 1, __ATOMIC_RELEASE);
+    pthread_join(logger.thread, NULL);
+
+    while(logger.rings != NULL)
+    {
+        log_ring_t* next = logger.rings->next;
+
+        drain(logger.rings);
+        free(logger.rings);
+        logger.rings = next;
+    }
+
+    if(logger.binary != NULL)
+        fclose(logger.binary);
+    logger.binary = NULL;
+    for(size_t i = 0; i < logger.nstrings; i++)
+        if(logger.strings[i].copied)
+            free((char*)logger.strings[i].str);
+    free(logger.strings);
+    logger.strings = NULL;
+    logger.nstrings = logger.string_cap = 0;
+    fflush(trace_stream());
+    fflush(stderr);
+}
+
+/************************
+ * the messages
+ */
+
+void syntax(char* str, ...)
+{
+
+    va_list args;
 
     va_start(args, str);
-    vfprintf(stderr, str, args);
+    log_message(LOG_SYNTAX, 0, str, args);
     va_end(args);
-    fprintf(stderr, "\n");
-    errors.errors++;
+    inc_error_count();
 }
 
 void expect(char* exp, int tok)
@@ -104,59 +963,34 @@ void scanner_error(char* str, ...)
 {
 
     va_list args;
-    const char* name = scanner_get_file_name();
-    int lnum = scanner_get_line();
-    int cnum = scanner_get_column();
-
-    if(NULL != name)
-        fprintf(stderr, "Scanner Error: %s: %d: %d: ", name, lnum, cnum);
-    else
-        fprintf(stderr, "Scanner Error: ");
 
     va_start(args, str);
-    vfprintf(stderr, str, args);
+    log_message(LOG_SCANNER, 0, str, args);
     va_end(args);
-    fprintf(stderr, "\n");
-    errors.errors++;
+    inc_error_count();
 }
 
 void warning(char* str, ...)
 {
 
     va_list args;
-    const char* name = scanner_get_file_name();
-    int lnum = scanner_get_line();
-
-    if(NULL != name)
-        fprintf(stderr, "Warning: %s: %d: ", name, lnum);
-    else
-        fprintf(stderr, "Warning: ");
 
     va_start(args, str);
-    vfprintf(stderr, str, args);
+    log_message(LOG_WARNING, 0, str, args);
     va_end(args);
-    fprintf(stderr, "\n");
-    errors.warnings++;
+    inc_warning_count();
 }
 
 void debug(int lev, char* str, ...)
 {
 
     va_list args;
-    FILE* ofp;
 
-    if(lev <= errors.level)
+    if(lev <= error_level)
     {
-        if(NULL != errors.fp)
-            ofp = errors.fp;
-        else
-            ofp = stderr;
-
-        fprintf(ofp, "DBG: ");
         va_start(args, str);
-        vfprintf(ofp, str, args);
+        log_message(LOG_DEBUG, lev, str, args);
         va_end(args);
-        fprintf(ofp, "\n");
     }
 }
 
@@ -164,38 +998,29 @@ void debug_msg(int lev, const char* str, ...)
 {
 
     va_list args;
-    FILE* ofp;
 
-    if(lev <= errors.level)
+    if(lev <= error_level)
     {
-        if(NULL != errors.fp)
-            ofp = errors.fp;
-        else
-            ofp = stderr;
-
-        fprintf(ofp, "MSG: %s: %d: %d: ", scanner_get_file_name(), scanner_get_line(), scanner_get_column());
         va_start(args, str);
-        vfprintf(ofp, str, args);
+        log_message(LOG_MSG, lev, str, args);
         va_end(args);
-        fprintf(ofp, "\n");
     }
 }
 
 void debug_mark(int lev, const char* file, int line, const char* func)
 {
 
-    FILE* ofp;
+    uint8_t buf[MAX_RECORD] __attribute__((aligned(8)));
+    log_rec_t* rec;
 
-    if(lev <= errors.level)
+    if(lev <= error_level)
     {
-        if(NULL != errors.fp)
-            ofp = errors.fp;
-        else
-            ofp = stderr;
-
-        fprintf(ofp, "MARK: (%s, %d) %s: %d: %d: %s\n", file, line, scanner_get_file_name(), scanner_get_line(),
-                scanner_get_column(), func);
-        // fprintf(ofp, " %s: %d\n", file, line);
+        rec = capture(buf, LOG_MARK, lev, NULL, NULL);
+        rec->file = file;
+        rec->line = line;
+        rec->func = func;
+        if(!__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE) || put_record(rec))
+            write_record(rec);
     }
 }
 
@@ -204,6 +1029,7 @@ void fatal_error(char* str, ...)
 
     va_list args;
 
+    log_stop();
     fprintf(stderr, "FATAL ERROR: ");
     va_start(args, str);
     vfprintf(stderr, str, args);
@@ -12,6 +12,7 @@ void expect(char* exp, int tok);
 void set_logging_level(int lev);
 int get_logging_level(void);
 int get_num_errors(void);
+int get_thread_errors(void);
 int get_num_warnings(void);
 void set_error_level(int lev);
 int get_error_level(void);
@@ -23,12 +24,22 @@ void inc_warning_count(void);
 void debug_mark(int, const char* , int, const char* );
 void debug_msg(int, const char* , ...);
 
+int log_start(const char* binary);
+void log_stop(void);
+
+// debug messages at or below this level are shown
+extern int error_level;
+
 /*
  * TODO: Add more macros for debugging and memory tracking.
  */
+/*
+ * The level is tested here, so a trace that is not shown costs one compare
+ * and nothing is captured.
+ */
 #  ifdef TRACE
-#    define MARK()      debug_mark(5, __FILE__, __LINE__, __func__)
-#    define MSG(...)    debug_msg(5, __VA_ARGS__)
+#    define MARK()      do { if(5 <= error_level) debug_mark(5, __FILE__, __LINE__, __func__); } while(0)
+#    define MSG(...)    do { if(5 <= error_level) debug_msg(5, __VA_ARGS__); } while(0)
 #  else
 #    define MARK()
 #    define MSG(...)
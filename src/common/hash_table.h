@@ -1,19 +1,180 @@
 #ifndef __HASH_TABLE_H__
 #define __HASH_TABLE_H__
+/*
+ * Generic open addressing hash table.
+ *
+ * The table is generated for a specific key and value type with the
+ * HASH_TABLE() macro, so values are stored inline in the slot array and there
+ * is no per-entry allocation and no void* type erasure. The only allocation
+ * is the slot array itself, which is doubled when the load factor is reached.
+ *
+ *     HASH_TABLE(sym_tab, const char*, symbol_t, hash_string, compare_string)
+ *
+ * generates the type sym_tab_t and these functions:
+ *
+ *     void sym_tab_init(sym_tab_t* tab);
+ *     void sym_tab_destroy(sym_tab_t* tab);
+ *     int sym_tab_insert(sym_tab_t* tab, const char* key, symbol_t value);
+ *     symbol_t* sym_tab_find(sym_tab_t* tab, const char* key);
+ *     size_t sym_tab_count(sym_tab_t* tab);
+ *
+ * The table does not own the keys. Whatever a key points to has to live as
+ * long as the table does. Pointers returned by find are only valid until the
+ * next insert, since an insert can move the slot array.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "errors.h"
 
 enum {
     HASH_NO_ERROR,
     HASH_REPLACE,
     HASH_NOT_FOUND,
-    HASH_NO_DATA,
-    HASH_DATA_SIZE,
 };
 
-typedef void* hash_table_t;
+#define HASH_TABLE_MAX_LOAD 0.75
+#define HASH_TABLE_MIN_CAP  (0x01 << 3)
+
+/*
+ * This is a “FNV-1a” hash function. Do not mess with the constants.
+ */
+static inline uint32_t hash_string(const char* key)
+{
+    uint32_t hash = 2166136261u;
+
+    for(; *key != 0; key++)
+    {
+        hash ^= (uint8_t)*key;
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static inline int compare_string(const char* k1, const char* k2)
+{
+    return strcmp(k1, k2);
+}
+
+/*
+ * Walk every used slot in the table. The key and value are bound to the
+ * names given for the body of the loop.
+ */
+#define HASH_TABLE_FOREACH(tab, k, v) \
+    for(size_t _i = 0; _i < (tab)->capacity; _i++) \
+        if((tab)->entries[_i].used) \
+            for(int _once = 1; _once; _once = 0) \
+                for(k = (tab)->entries[_i].key, v = &(tab)->entries[_i].value; _once; _once = 0)
 
-hash_table_t create_hash_table(void);
-void destroy_hash_table(hash_table_t table);
-int insert_hash_table(hash_table_t table, const char* key, void* data, size_t size);
-int find_hash_table(hash_table_t table, const char* key, void* data, size_t size);
+#define HASH_TABLE(name, key_t, val_t, hash_func, compare_func) \
+ \
+typedef struct { \
+    uint32_t hash; \
+    uint8_t used; \
+    key_t key; \
+    val_t value; \
+} name##_entry_t; \
+ \
+typedef struct { \
+    size_t count; \
+    size_t capacity; \
+    name##_entry_t* entries; \
+} name##_t; \
+ \
+/* \
+ * If the key is found, return its slot. If it is not found, then return the \
+ * slot where it should be placed. Check the used flag to tell the difference. \
+ */ \
+static inline name##_entry_t* name##_find_slot(name##_entry_t* ent, size_t cap, key_t key, uint32_t hash) \
+{ \
+    size_t index = hash & (cap - 1); \
+ \
+    while(1) { \
+        name##_entry_t* entry = &ent[index]; \
+ \
+        if(!entry->used || (entry->hash == hash && !compare_func(key, entry->key))) \
+            return entry; \
+ \
+        index = (index + 1) & (cap - 1); \
+    } \
+} \
+ \
+/* \
+ * Grow the table if it needs it. The stored hashes are reused, so the keys \
+ * are never hashed again. \
+ */ \
+static inline void name##_grow(name##_t* tab) \
+{ \
+    if(tab->count + 2 > tab->capacity * HASH_TABLE_MAX_LOAD) { \
+        size_t capacity = (tab->capacity == 0)? HASH_TABLE_MIN_CAP: tab->capacity << 1; \
+ \
+        name##_entry_t* entries = (name##_entry_t*)calloc(capacity, sizeof(name##_entry_t)); \
+        if(entries == NULL) \
+            fatal_error("cannot allocate %lu bytes for hash table", capacity * sizeof(name##_entry_t)); \
+ \
+        for(size_t i = 0; i < tab->capacity; i++) { \
+            if(tab->entries[i].used) { \
+                name##_entry_t* ent = name##_find_slot(entries, capacity, \
+                                        tab->entries[i].key, tab->entries[i].hash); \
+                *ent = tab->entries[i]; \
+            } \
+        } \
+ \
+        free(tab->entries); \
+        tab->entries = entries; \
+        tab->capacity = capacity; \
+    } \
+} \
+ \
+static inline void name##_init(name##_t* tab) \
+{ \
+    tab->count = 0; \
+    tab->capacity = 0; \
+    tab->entries = NULL; \
+} \
+ \
+static inline void name##_destroy(name##_t* tab) \
+{ \
+    if(tab->entries != NULL) \
+        free(tab->entries); \
+    name##_init(tab); \
+} \
+ \
+static inline int name##_insert(name##_t* tab, key_t key, val_t value) \
+{ \
+    name##_grow(tab); \
+ \
+    uint32_t hash = hash_func(key); \
+    name##_entry_t* entry = name##_find_slot(tab->entries, tab->capacity, key, hash); \
+    int retv = (entry->used)? HASH_REPLACE: HASH_NO_ERROR; \
+ \
+    if(!entry->used) \
+        tab->count++; \
+ \
+    entry->used = 1; \
+    entry->hash = hash; \
+    entry->key = key; \
+    entry->value = value; \
+ \
+    return retv; \
+} \
+ \
+static inline val_t* name##_find(name##_t* tab, key_t key) \
+{ \
+    if(tab->count == 0) \
+        return NULL; \
+ \
+    name##_entry_t* entry = name##_find_slot(tab->entries, tab->capacity, key, hash_func(key)); \
+ \
+    return (entry->used)? &entry->value: NULL; \
+} \
+ \
+static inline size_t name##_count(name##_t* tab) \
+{ \
+    return tab->count; \
+}
 
 #endif
@@ -0,0 +1,106 @@
+/*
+ * Program image files.
+ *
+ * An image is mapped read only rather than read, so a tool that only looks
+ * at part of a large image only pays for the pages that it touches. The
+ * header is checked against the size of the file before anything else is
+ * looked at. See image.h for the layout.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "image.h"
+
+/*
+ * Map an image file and check its header. Returns non-zero and prints the
+ * reason if the file cannot be used.
+ */
+int image_open(image_file_t* img, const char* fname)
+{
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+
+    memset(img, 0, sizeof(image_file_t));
+
+    if(fd < 0 || fstat(fd, &st) < 0)
+    {
+        fprintf(stderr, "ERROR: cannot open image file: \"%s\": %s\n", fname, strerror(errno));
+        if(fd >= 0)
+            close(fd);
+        return 1;
+    }
+
+    if((size_t)st.st_size < sizeof(image_header_t))
+    {
+        fprintf(stderr, "ERROR: \"%s\" is too small to be an image\n", fname);
+        close(fd);
+        return 1;
+    }
+
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+    close(fd);
+    if(map == MAP_FAILED)
+    {
+        fprintf(stderr, "ERROR: cannot map image file: \"%s\": %s\n", fname, strerror(errno));
+        return 1;
+    }
+
+    const image_header_t* hdr = (const image_header_t*)map;
+    uint64_t size = st.st_size - sizeof(image_header_t);
+
+    if(hdr->magic != IMAGE_MAGIC || hdr->version != IMAGE_VERSION ||
+            hdr->code_size > size || hdr->data_size > size - hdr->code_size ||
+            hdr->debug_size > size - hdr->code_size - hdr->data_size ||
+            hdr->ptrmap_size != size - hdr->code_size - hdr->data_size - hdr->debug_size ||
+            hdr->ptrmap_size % sizeof(image_ptrmap_t) != 0)
+    {
+        fprintf(stderr, "ERROR: \"%s\" is not a valid image\n", fname);
+        munmap(map, st.st_size);
+        return 1;
+    }
+
+    img->map = map;
+    img->map_size = st.st_size;
+    img->header = hdr;
+    img->code = (const uint8_t*)map + sizeof(image_header_t);
+    img->data = img->code + hdr->code_size;
+    img->debug = img->data + hdr->data_size;
+    img->ptrmaps = (const image_ptrmap_t*)(img->debug + hdr->debug_size);
+    img->num_ptrmaps = hdr->ptrmap_size / sizeof(image_ptrmap_t);
+    return 0;
+}
+
+void image_close(image_file_t* img)
+{
+    if(img->map != NULL)
+        munmap(img->map, img->map_size);
+    memset(img, 0, sizeof(image_file_t));
+}
+
+/*
+ * Read the debug symbol at ptr, which starts as img->debug. The name is not
+ * terminated; its length is in rec->name_len. Returns the next record, or
+ * NULL if there are no more or the record runs past the end.
+ */
+const uint8_t* image_next_symbol(const image_file_t* img, const uint8_t* ptr, image_symbol_t* rec, const char** name)
+{
+    const uint8_t* end = img->debug + img->header->debug_size;
+
+    if(ptr == NULL || ptr + sizeof(image_symbol_t) > end)
+        return NULL;
+
+    memcpy(rec, ptr, sizeof(image_symbol_t));
+    ptr += sizeof(image_symbol_t);
+
+    if(ptr + rec->name_len > end)
+        return NULL;
+
+    *name = (const char*)ptr;
+    return ptr + rec->name_len;
+}
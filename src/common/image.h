@@ -0,0 +1,86 @@
+#ifndef __IMAGE_H__
+#  define __IMAGE_H__
+
+#  include <stdint.h>
+#  include <stddef.h>
+
+/*
+ * Layout of a program image as it is written by the assembler and read by
+ * the VM, the disassembler and the debugger.
+ *
+ * The header is followed by the code segment, the data segment, the debug
+ * section and the pointer map section, in that order, with no padding
+ * between them. All multi-byte
+ * values are little endian. Every offset in the code and data segments is
+ * relative to the start of its own segment.
+ *
+ * The debug section is a list of symbol records. Each record is a
+ * image_symbol_t followed by name_len bytes of the dotted name, with no
+ * terminator.
+ *
+ * The pointer map section is a list of image_ptrmap_t, sorted by offset.
+ * Each one says which registers and which slots of the stack frame hold
+ * heap pointers when the instruction at its offset runs, for the garbage
+ * collector in the VM. The assembler writes them for PTRS.
+ */
+#  define IMAGE_MAGIC     0x4D495056   // "VPIM"
+#  define IMAGE_VERSION   2
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t code_size;      // bytes in the code segment
+    uint64_t data_size;      // bytes in the data segment
+    uint64_t debug_size;     // bytes in the debug section
+    uint64_t num_symbols;    // number of records in the debug section
+    uint64_t ptrmap_size;    // bytes in the pointer map section
+} __attribute__((packed)) image_header_t;
+
+enum
+{
+    IMAGE_SEG_CODE,
+    IMAGE_SEG_DATA,
+};
+
+typedef struct
+{
+    uint8_t segment;         // IMAGE_SEG_CODE or IMAGE_SEG_DATA
+    uint8_t type;            // data type of the object (TYPE_INT8, etc.)
+    uint16_t name_len;       // length of the name that follows
+    uint64_t offset;         // offset of the object in its segment
+} __attribute__((packed)) image_symbol_t;
+
+#  define IMAGE_FRAME_SLOTS   64
+
+typedef struct
+{
+    uint32_t offset;         // of the instruction in the code segment
+    uint32_t regs;           // bit n is set if Rn holds a pointer
+    uint32_t depth;          // entries that the function has pushed on the stack
+    uint32_t unused;
+    uint64_t slots;          // bit n is set if entry n of the frame holds a pointer
+} __attribute__((packed)) image_ptrmap_t;
+
+/*
+ * For image.c. An image file that has been mapped into memory. Nothing is
+ * read from the file until it is touched.
+ */
+typedef struct
+{
+    void* map;
+    size_t map_size;
+    const image_header_t* header;
+    const uint8_t* code;
+    const uint8_t* data;
+    const uint8_t* debug;
+    const image_ptrmap_t* ptrmaps;
+    size_t num_ptrmaps;
+} image_file_t;
+
+int image_open(image_file_t* img, const char* fname);
+void image_close(image_file_t* img);
+const uint8_t* image_next_symbol(const image_file_t* img, const uint8_t* ptr, image_symbol_t* rec, const char** name);
+
+#endif
@@ -0,0 +1,231 @@
+
+// This file is generated from tokens.h by gen_opcode_map.py.
+// DO NOT EDIT
+
+#include "opcodes.h"
+
+const opcode_info_t opcode_table[256] = {
+    [OP_NOP] = { "nop", 0, 0, 0, OP_NOP, { 0 } },
+    [OP_STZ] = { "stz", 0, 0, 0, OP_STZ, { 0 } },
+    [OP_CLZ] = { "clz", 0, 0, 0, OP_CLZ, { 0 } },
+    [OP_STC] = { "stc", 0, 0, 0, OP_STC, { 0 } },
+    [OP_CLC] = { "clc", 0, 0, 0, OP_CLC, { 0 } },
+    [OP_STN] = { "stn", 0, 0, 0, OP_STN, { 0 } },
+    [OP_CLN] = { "cln", 0, 0, 0, OP_CLN, { 0 } },
+    [OP_STV] = { "stv", 0, 0, 0, OP_STV, { 0 } },
+    [OP_CLV] = { "clv", 0, 0, 0, OP_CLV, { 0 } },
+    [OP_STT] = { "stt", 0, 0, 0, OP_STT, { 0 } },
+    [OP_CLT] = { "clt", 0, 0, 0, OP_CLT, { 0 } },
+    [OP_STE] = { "ste", 0, 0, 0, OP_STE, { 0 } },
+    [OP_CLE] = { "cle", 0, 0, 0, OP_CLE, { 0 } },
+    [OP_PAUSE] = { "pause", 0, 0, 0, OP_PAUSE, { 0 } },
+    [OP_RESUME] = { "resume", 0, 0, 0, OP_RESUME, { 0 } },
+    [OP_END] = { "end", 0, OPF_STOP, 0, OP_END, { 0 } },
+    [OP_LOAD] = { "load", 2, 0, 0, OP_LOAD, { OPC_REG, OPC_VALUE } },
+    [OP_STORE] = { "store", 2, 0, 0, OP_STORE, { OPC_REG, OPC_DEST } },
+    [OP_MOV8] = { "mov8", 2, 0, 0, OP_MOV8, { OPC_REG, OPC_REG } },
+    [OP_MOV16] = { "mov16", 2, 0, 0, OP_MOV16, { OPC_REG, OPC_REG } },
+    [OP_MOV32] = { "mov32", 2, 0, 0, OP_MOV32, { OPC_REG, OPC_REG } },
+    [OP_MOV64] = { "mov64", 2, 0, 0, OP_MOV64, { OPC_REG, OPC_REG } },
+    [OP_MOV] = { "mov", 2, 0, 0, OP_MOV, { OPC_REG, OPC_REG } },
+    [OP_MOVB8] = { "movb8", 3, 0, 0, OP_MOVB8, { OPC_REG, OPC_REG, OPC_REG } },
+    [OP_MOVB16] = { "movb16", 3, 0, 0, OP_MOVB16, { OPC_REG, OPC_REG, OPC_REG } },
+    [OP_MOVB32] = { "movb32", 3, 0, 0, OP_MOVB32, { OPC_REG, OPC_REG, OPC_REG } },
+    [OP_MOVB64] = { "movb64", 3, 0, 0, OP_MOVB64, { OPC_REG, OPC_REG, OPC_REG } },
+    [OP_MOVB] = { "movb", 3, 0, 0, OP_MOVB, { OPC_REG, OPC_REG, OPC_REG } },
+    [OP_PUSH] = { "push", 1, 0, 0, OP_PUSH, { OPC_VALUE } },
+    [OP_POP] = { "pop", 1, 0, 0, OP_POP, { OPC_REG } },
+    [OP_IADD] = { "iadd", 3, OPF_SETS_FLAGS, 0, OP_IADD, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_UADD] = { "uadd", 3, OPF_SETS_FLAGS, 0, OP_UADD, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_FADD] = { "fadd", 3, OPF_SETS_FLAGS, 0, OP_FADD, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_ISUB] = { "isub", 3, OPF_SETS_FLAGS, 0, OP_ISUB, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_USUB] = { "usub", 3, OPF_SETS_FLAGS, 0, OP_USUB, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_FSUB] = { "fsub", 3, OPF_SETS_FLAGS, 0, OP_FSUB, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_IMUL] = { "imul", 3, OPF_SETS_FLAGS, 0, OP_IMUL, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_UMUL] = { "umul", 3, OPF_SETS_FLAGS, 0, OP_UMUL, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_FMUL] = { "fmul", 3, OPF_SETS_FLAGS, 0, OP_FMUL, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_IDIV] = { "idiv", 3, OPF_SETS_FLAGS, 0, OP_IDIV, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_UDIV] = { "udiv", 3, OPF_SETS_FLAGS, 0, OP_UDIV, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_FDIV] = { "fdiv", 3, OPF_SETS_FLAGS, 0, OP_FDIV, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_IMOD] = { "imod", 3, OPF_SETS_FLAGS, 0, OP_IMOD, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_UMOD] = { "umod", 3, OPF_SETS_FLAGS, 0, OP_UMOD, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_FMOD] = { "fmod", 3, OPF_SETS_FLAGS, 0, OP_FMOD, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_INEG] = { "ineg", 1, OPF_SETS_FLAGS, 0, OP_INEG, { OPC_REG } },
+    [OP_UNEG] = { "uneg", 1, OPF_SETS_FLAGS, 0, OP_UNEG, { OPC_REG } },
+    [OP_FNEG] = { "fneg", 1, OPF_SETS_FLAGS, 0, OP_FNEG, { OPC_REG } },
+    [OP_FTU] = { "ftu", 1, 0, 0, OP_FTU, { OPC_REG } },
+    [OP_FTI] = { "fti", 1, 0, 0, OP_FTI, { OPC_REG } },
+    [OP_ITF] = { "itf", 1, 0, 0, OP_ITF, { OPC_REG } },
+    [OP_ITU] = { "itu", 1, 0, 0, OP_ITU, { OPC_REG } },
+    [OP_UTF] = { "utf", 1, 0, 0, OP_UTF, { OPC_REG } },
+    [OP_UTI] = { "uti", 1, 0, 0, OP_UTI, { OPC_REG } },
+    [OP_INC] = { "inc", 1, OPF_SETS_FLAGS, 0, OP_INC, { OPC_REG } },
+    [OP_DEC] = { "dec", 1, OPF_SETS_FLAGS, 0, OP_DEC, { OPC_REG } },
+    [OP_SHL] = { "shl", 2, OPF_SETS_FLAGS, 0, OP_SHL, { OPC_REG, OPC_VALUE } },
+    [OP_SHR] = { "shr", 2, OPF_SETS_FLAGS, 0, OP_SHR, { OPC_REG, OPC_VALUE } },
+    [OP_ROL] = { "rol", 2, OPF_SETS_FLAGS, 0, OP_ROL, { OPC_REG, OPC_VALUE } },
+    [OP_ROR] = { "ror", 2, OPF_SETS_FLAGS, 0, OP_ROR, { OPC_REG, OPC_VALUE } },
+    [OP_AND] = { "and", 3, OPF_SETS_FLAGS, 0, OP_AND, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_OR] = { "or", 3, OPF_SETS_FLAGS, 0, OP_OR, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_XOR] = { "xor", 3, OPF_SETS_FLAGS, 0, OP_XOR, { OPC_REG, OPC_VALUE, OPC_VALUE } },
+    [OP_NOT] = { "not", 1, OPF_SETS_FLAGS, 0, OP_NOT, { OPC_REG } },
+    [OP_CMP] = { "cmp", 2, OPF_SETS_FLAGS, 0, OP_CMP, { OPC_VALUE, OPC_VALUE } },
+    [OP_TST] = { "tst", 2, OPF_SETS_FLAGS, 0, OP_TST, { OPC_VALUE, OPC_VALUE } },
+    [OP_JMPEQ] = { "jmpeq", 1, OPF_READS_FLAGS | OPF_JUMP, 1, OP_JMP, { OPC_TARGET } },
+    [OP_JMPNE] = { "jmpne", 1, OPF_READS_FLAGS | OPF_JUMP, 2, OP_JMP, { OPC_TARGET } },
+    [OP_JMPCS] = { "jmpcs", 1, OPF_READS_FLAGS | OPF_JUMP, 3, OP_JMP, { OPC_TARGET } },
+    [OP_JMPCC] = { "jmpcc", 1, OPF_READS_FLAGS | OPF_JUMP, 4, OP_JMP, { OPC_TARGET } },
+    [OP_JMPMI] = { "jmpmi", 1, OPF_READS_FLAGS | OPF_JUMP, 5, OP_JMP, { OPC_TARGET } },
+    [OP_JMPPL] = { "jmppl", 1, OPF_READS_FLAGS | OPF_JUMP, 6, OP_JMP, { OPC_TARGET } },
+    [OP_JMPVS] = { "jmpvs", 1, OPF_READS_FLAGS | OPF_JUMP, 7, OP_JMP, { OPC_TARGET } },
+    [OP_JMPVC] = { "jmpvc", 1, OPF_READS_FLAGS | OPF_JUMP, 8, OP_JMP, { OPC_TARGET } },
+    [OP_JMPHI] = { "jmphi", 1, OPF_READS_FLAGS | OPF_JUMP, 9, OP_JMP, { OPC_TARGET } },
+    [OP_JMPLS] = { "jmpls", 1, OPF_READS_FLAGS | OPF_JUMP, 10, OP_JMP, { OPC_TARGET } },
+    [OP_JMPGE] = { "jmpge", 1, OPF_READS_FLAGS | OPF_JUMP, 11, OP_JMP, { OPC_TARGET } },
+    [OP_JMPLT] = { "jmplt", 1, OPF_READS_FLAGS | OPF_JUMP, 12, OP_JMP, { OPC_TARGET } },
+    [OP_JMPGT] = { "jmpgt", 1, OPF_READS_FLAGS | OPF_JUMP, 13, OP_JMP, { OPC_TARGET } },
+    [OP_JMPLE] = { "jmple", 1, OPF_READS_FLAGS | OPF_JUMP, 14, OP_JMP, { OPC_TARGET } },
+    [OP_JMPTE] = { "jmpte", 1, OPF_READS_FLAGS | OPF_JUMP, 15, OP_JMP, { OPC_TARGET } },
+    [OP_JMPEE] = { "jmpee", 1, OPF_READS_FLAGS | OPF_JUMP, 16, OP_JMP, { OPC_TARGET } },
+    [OP_JMP] = { "jmp", 1, OPF_JUMP | OPF_STOP, 0, OP_JMP, { OPC_TARGET } },
+    [OP_CALLEQ] = { "calleq", 1, OPF_READS_FLAGS | OPF_CALL, 1, OP_CALL, { OPC_TARGET } },
+    [OP_CALLNE] = { "callne", 1, OPF_READS_FLAGS | OPF_CALL, 2, OP_CALL, { OPC_TARGET } },
+    [OP_CALLCS] = { "callcs", 1, OPF_READS_FLAGS | OPF_CALL, 3, OP_CALL, { OPC_TARGET } },
+    [OP_CALLCC] = { "callcc", 1, OPF_READS_FLAGS | OPF_CALL, 4, OP_CALL, { OPC_TARGET } },
+    [OP_CALLMI] = { "callmi", 1, OPF_READS_FLAGS | OPF_CALL, 5, OP_CALL, { OPC_TARGET } },
+    [OP_CALLPL] = { "callpl", 1, OPF_READS_FLAGS | OPF_CALL, 6, OP_CALL, { OPC_TARGET } },
+    [OP_CALLVS] = { "callvs", 1, OPF_READS_FLAGS | OPF_CALL, 7, OP_CALL, { OPC_TARGET } },
+    [OP_CALLVC] = { "callvc", 1, OPF_READS_FLAGS | OPF_CALL, 8, OP_CALL, { OPC_TARGET } },
+    [OP_CALLHI] = { "callhi", 1, OPF_READS_FLAGS | OPF_CALL, 9, OP_CALL, { OPC_TARGET } },
+    [OP_CALLLS] = { "callls", 1, OPF_READS_FLAGS | OPF_CALL, 10, OP_CALL, { OPC_TARGET } },
+    [OP_CALLGE] = { "callge", 1, OPF_READS_FLAGS | OPF_CALL, 11, OP_CALL, { OPC_TARGET } },
+    [OP_CALLLT] = { "calllt", 1, OPF_READS_FLAGS | OPF_CALL, 12, OP_CALL, { OPC_TARGET } },
+    [OP_CALLGT] = { "callgt", 1, OPF_READS_FLAGS | OPF_CALL, 13, OP_CALL, { OPC_TARGET } },
+    [OP_CALLLE] = { "callle", 1, OPF_READS_FLAGS | OPF_CALL, 14, OP_CALL, { OPC_TARGET } },
+    [OP_CALLTE] = { "callte", 1, OPF_READS_FLAGS | OPF_CALL, 15, OP_CALL, { OPC_TARGET } },
+    [OP_CALLEE] = { "callee", 1, OPF_READS_FLAGS | OPF_CALL, 16, OP_CALL, { OPC_TARGET } },
+    [OP_CALL] = { "call", 1, OPF_CALL, 0, OP_CALL, { OPC_TARGET } },
+    [OP_EXCALLEQ] = { "excalleq", 1, OPF_READS_FLAGS | OPF_CALL, 1, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLNE] = { "excallne", 1, OPF_READS_FLAGS | OPF_CALL, 2, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLCS] = { "excallcs", 1, OPF_READS_FLAGS | OPF_CALL, 3, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLCC] = { "excallcc", 1, OPF_READS_FLAGS | OPF_CALL, 4, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLMI] = { "excallmi", 1, OPF_READS_FLAGS | OPF_CALL, 5, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLPL] = { "excallpl", 1, OPF_READS_FLAGS | OPF_CALL, 6, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLVS] = { "excallvs", 1, OPF_READS_FLAGS | OPF_CALL, 7, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLVC] = { "excallvc", 1, OPF_READS_FLAGS | OPF_CALL, 8, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLHI] = { "excallhi", 1, OPF_READS_FLAGS | OPF_CALL, 9, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLLS] = { "excallls", 1, OPF_READS_FLAGS | OPF_CALL, 10, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLGE] = { "excallge", 1, OPF_READS_FLAGS | OPF_CALL, 11, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLLT] = { "excalllt", 1, OPF_READS_FLAGS | OPF_CALL, 12, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLGT] = { "excallgt", 1, OPF_READS_FLAGS | OPF_CALL, 13, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLLE] = { "excallle", 1, OPF_READS_FLAGS | OPF_CALL, 14, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLTE] = { "excallte", 1, OPF_READS_FLAGS | OPF_CALL, 15, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALLEE] = { "excallee", 1, OPF_READS_FLAGS | OPF_CALL, 16, OP_EXCALL, { OPC_TARGET } },
+    [OP_EXCALL] = { "excall", 1, OPF_CALL, 0, OP_EXCALL, { OPC_TARGET } },
+    [OP_RETEQ] = { "reteq", 0, OPF_READS_FLAGS | OPF_RETURN, 1, OP_RET, { 0 } },
+    [OP_RETNE] = { "retne", 0, OPF_READS_FLAGS | OPF_RETURN, 2, OP_RET, { 0 } },
+    [OP_RETCS] = { "retcs", 0, OPF_READS_FLAGS | OPF_RETURN, 3, OP_RET, { 0 } },
+    [OP_RETCC] = { "retcc", 0, OPF_READS_FLAGS | OPF_RETURN, 4, OP_RET, { 0 } },
+    [OP_RETMI] = { "retmi", 0, OPF_READS_FLAGS | OPF_RETURN, 5, OP_RET, { 0 } },
+    [OP_RETPL] = { "retpl", 0, OPF_READS_FLAGS | OPF_RETURN, 6, OP_RET, { 0 } },
+    [OP_RETVS] = { "retvs", 0, OPF_READS_FLAGS | OPF_RETURN, 7, OP_RET, { 0 } },
+    [OP_RETVC] = { "retvc", 0, OPF_READS_FLAGS | OPF_RETURN, 8, OP_RET, { 0 } },
+    [OP_RETHI] = { "rethi", 0, OPF_READS_FLAGS | OPF_RETURN, 9, OP_RET, { 0 } },
+    [OP_RETLS] = { "retls", 0, OPF_READS_FLAGS | OPF_RETURN, 10, OP_RET, { 0 } },
+    [OP_RETGE] = { "retge", 0, OPF_READS_FLAGS | OPF_RETURN, 11, OP_RET, { 0 } },
+    [OP_RETLT] = { "retlt", 0, OPF_READS_FLAGS | OPF_RETURN, 12, OP_RET, { 0 } },
+    [OP_RETGT] = { "retgt", 0, OPF_READS_FLAGS | OPF_RETURN, 13, OP_RET, { 0 } },
+    [OP_RETLE] = { "retle", 0, OPF_READS_FLAGS | OPF_RETURN, 14, OP_RET, { 0 } },
+    [OP_RETTE] = { "rette", 0, OPF_READS_FLAGS | OPF_RETURN, 15, OP_RET, { 0 } },
+    [OP_RETEE] = { "retee", 0, OPF_READS_FLAGS | OPF_RETURN, 16, OP_RET, { 0 } },
+    [OP_RET] = { "ret", 0, OPF_RETURN | OPF_STOP, 0, OP_RET, { 0 } },
+    [OP_TRAPEQ] = { "trapeq", 1, OPF_READS_FLAGS | OPF_CALL, 1, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPNE] = { "trapne", 1, OPF_READS_FLAGS | OPF_CALL, 2, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPCS] = { "trapcs", 1, OPF_READS_FLAGS | OPF_CALL, 3, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPCC] = { "trapcc", 1, OPF_READS_FLAGS | OPF_CALL, 4, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPMI] = { "trapmi", 1, OPF_READS_FLAGS | OPF_CALL, 5, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPPL] = { "trappl", 1, OPF_READS_FLAGS | OPF_CALL, 6, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPVS] = { "trapvs", 1, OPF_READS_FLAGS | OPF_CALL, 7, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPVC] = { "trapvc", 1, OPF_READS_FLAGS | OPF_CALL, 8, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPHI] = { "traphi", 1, OPF_READS_FLAGS | OPF_CALL, 9, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPLS] = { "trapls", 1, OPF_READS_FLAGS | OPF_CALL, 10, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPGE] = { "trapge", 1, OPF_READS_FLAGS | OPF_CALL, 11, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPLT] = { "traplt", 1, OPF_READS_FLAGS | OPF_CALL, 12, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPGT] = { "trapgt", 1, OPF_READS_FLAGS | OPF_CALL, 13, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPLE] = { "traple", 1, OPF_READS_FLAGS | OPF_CALL, 14, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPTE] = { "trapte", 1, OPF_READS_FLAGS | OPF_CALL, 15, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAPEE] = { "trapee", 1, OPF_READS_FLAGS | OPF_CALL, 16, OP_TRAP, { OPC_TARGET } },
+    [OP_TRAP] = { "trap", 1, OPF_CALL, 0, OP_TRAP, { OPC_TARGET } },
+    [OP_TRETEQ] = { "treteq", 0, OPF_READS_FLAGS | OPF_RETURN, 1, OP_TRET, { 0 } },
+    [OP_TRETNE] = { "tretne", 0, OPF_READS_FLAGS | OPF_RETURN, 2, OP_TRET, { 0 } },
+    [OP_TRETCS] = { "tretcs", 0, OPF_READS_FLAGS | OPF_RETURN, 3, OP_TRET, { 0 } },
+    [OP_TRETCC] = { "tretcc", 0, OPF_READS_FLAGS | OPF_RETURN, 4, OP_TRET, { 0 } },
+    [OP_TRETMI] = { "tretmi", 0, OPF_READS_FLAGS | OPF_RETURN, 5, OP_TRET, { 0 } },
+    [OP_TRETPL] = { "tretpl", 0, OPF_READS_FLAGS | OPF_RETURN, 6, OP_TRET, { 0 } },
+    [OP_TRETVS] = { "tretvs", 0, OPF_READS_FLAGS | OPF_RETURN, 7, OP_TRET, { 0 } },
+    [OP_TRETVC] = { "tretvc", 0, OPF_READS_FLAGS | OPF_RETURN, 8, OP_TRET, { 0 } },
+    [OP_TRETHI] = { "trethi", 0, OPF_READS_FLAGS | OPF_RETURN, 9, OP_TRET, { 0 } },
+    [OP_TRETLS] = { "tretls", 0, OPF_READS_FLAGS | OPF_RETURN, 10, OP_TRET, { 0 } },
+    [OP_TRETGE] = { "tretge", 0, OPF_READS_FLAGS | OPF_RETURN, 11, OP_TRET, { 0 } },
+    [OP_TRETLT] = { "tretlt", 0, OPF_READS_FLAGS | OPF_RETURN, 12, OP_TRET, { 0 } },
+    [OP_TRETGT] = { "tretgt", 0, OPF_READS_FLAGS | OPF_RETURN, 13, OP_TRET, { 0 } },
+    [OP_TRETLE] = { "tretle", 0, OPF_READS_FLAGS | OPF_RETURN, 14, OP_TRET, { 0 } },
+    [OP_TRETTE] = { "trette", 0, OPF_READS_FLAGS | OPF_RETURN, 15, OP_TRET, { 0 } },
+    [OP_TRETEE] = { "tretee", 0, OPF_READS_FLAGS | OPF_RETURN, 16, OP_TRET, { 0 } },
+    [OP_TRET] = { "tret", 0, OPF_RETURN | OPF_STOP, 0, OP_TRET, { 0 } },
+    [OP_RAISEEQ] = { "raiseeq", 1, OPF_READS_FLAGS | OPF_CALL, 1, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISENE] = { "raisene", 1, OPF_READS_FLAGS | OPF_CALL, 2, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISECS] = { "raisecs", 1, OPF_READS_FLAGS | OPF_CALL, 3, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISECC] = { "raisecc", 1, OPF_READS_FLAGS | OPF_CALL, 4, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEMI] = { "raisemi", 1, OPF_READS_FLAGS | OPF_CALL, 5, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEPL] = { "raisepl", 1, OPF_READS_FLAGS | OPF_CALL, 6, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEVS] = { "raisevs", 1, OPF_READS_FLAGS | OPF_CALL, 7, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEVC] = { "raisevc", 1, OPF_READS_FLAGS | OPF_CALL, 8, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEHI] = { "raisehi", 1, OPF_READS_FLAGS | OPF_CALL, 9, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISELS] = { "raisels", 1, OPF_READS_FLAGS | OPF_CALL, 10, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEGE] = { "raisege", 1, OPF_READS_FLAGS | OPF_CALL, 11, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISELT] = { "raiselt", 1, OPF_READS_FLAGS | OPF_CALL, 12, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEGT] = { "raisegt", 1, OPF_READS_FLAGS | OPF_CALL, 13, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISELE] = { "raisele", 1, OPF_READS_FLAGS | OPF_CALL, 14, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISETE] = { "raisete", 1, OPF_READS_FLAGS | OPF_CALL, 15, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISEEE] = { "raiseee", 1, OPF_READS_FLAGS | OPF_CALL, 16, OP_RAISE, { OPC_TARGET } },
+    [OP_RAISE] = { "raise", 1, OPF_CALL, 0, OP_RAISE, { OPC_TARGET } },
+    [OP_ERETEQ] = { "ereteq", 0, OPF_READS_FLAGS | OPF_RETURN, 1, OP_ERET, { 0 } },
+    [OP_ERETNE] = { "eretne", 0, OPF_READS_FLAGS | OPF_RETURN, 2, OP_ERET, { 0 } },
+    [OP_ERETCS] = { "eretcs", 0, OPF_READS_FLAGS | OPF_RETURN, 3, OP_ERET, { 0 } },
+    [OP_ERETCC] = { "eretcc", 0, OPF_READS_FLAGS | OPF_RETURN, 4, OP_ERET, { 0 } },
+    [OP_ERETMI] = { "eretmi", 0, OPF_READS_FLAGS | OPF_RETURN, 5, OP_ERET, { 0 } },
+    [OP_ERETPL] = { "eretpl", 0, OPF_READS_FLAGS | OPF_RETURN, 6, OP_ERET, { 0 } },
+    [OP_ERETVS] = { "eretvs", 0, OPF_READS_FLAGS | OPF_RETURN, 7, OP_ERET, { 0 } },
+    [OP_ERETVC] = { "eretvc", 0, OPF_READS_FLAGS | OPF_RETURN, 8, OP_ERET, { 0 } },
+    [OP_ERETHI] = { "erethi", 0, OPF_READS_FLAGS | OPF_RETURN, 9, OP_ERET, { 0 } },
+    [OP_ERETLS] = { "eretls", 0, OPF_READS_FLAGS | OPF_RETURN, 10, OP_ERET, { 0 } },
+    [OP_ERETGE] = { "eretge", 0, OPF_READS_FLAGS | OPF_RETURN, 11, OP_ERET, { 0 } },
+    [OP_ERETLT] = { "eretlt", 0, OPF_READS_FLAGS | OPF_RETURN, 12, OP_ERET, { 0 } },
+    [OP_ERETGT] = { "eretgt", 0, OPF_READS_FLAGS | OPF_RETURN, 13, OP_ERET, { 0 } },
+    [OP_ERETLE] = { "eretle", 0, OPF_READS_FLAGS | OPF_RETURN, 14, OP_ERET, { 0 } },
+    [OP_ERETTE] = { "erette", 0, OPF_READS_FLAGS | OPF_RETURN, 15, OP_ERET, { 0 } },
+    [OP_ERETEE] = { "eretee", 0, OPF_READS_FLAGS | OPF_RETURN, 16, OP_ERET, { 0 } },
+    [OP_ERET] = { "eret", 0, OPF_RETURN | OPF_STOP, 0, OP_ERET, { 0 } },
+    [OP_ALLOCATE] = { "allocate", 2, 0, 0, OP_ALLOCATE, { OPC_REG, OPC_VALUE } },
+    [OP_FREE] = { "free", 1, 0, 0, OP_FREE, { OPC_REG } },
+};
+
+const int8_t operand_payload[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+    1, 2, 4, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    1, 2, 4, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
@@ -1,222 +1,277 @@
 
-// This file is generated from tokens.h.
+// This file is generated from tokens.h by gen_opcode_map.py.
 // DO NOT EDIT
-// Generated: Fri Apr 17 13:25:03 2020
 
 #ifndef __OPCODES_H__
 #define __OPCODES_H__
 
-typedef enum = {
-    OP_NOP = 0x2E,
-    OP_STZ = 0x2F,
-    OP_CLZ = 0x30,
-    OP_STC = 0x31,
-    OP_CLC = 0x32,
-    OP_STN = 0x33,
-    OP_CLN = 0x34,
-    OP_STV = 0x35,
-    OP_CLV = 0x36,
-    OP_STT = 0x37,
-    OP_CLT = 0x38,
-    OP_STE = 0x39,
-    OP_CLE = 0x3A,
-    OP_PAUSE = 0x3B,
-    OP_RESUME = 0x3C,
-    OP_END = 0x3D,
-    OP_LOAD = 0x3E,
-    OP_STORE = 0x3F,
-    OP_MOV8 = 0x40,
-    OP_MOV16 = 0x41,
-    OP_MOV32 = 0x42,
-    OP_MOV64 = 0x43,
-    OP_MOV = 0x44,
-    OP_MOVB8 = 0x45,
-    OP_MOVB16 = 0x46,
-    OP_MOVB32 = 0x47,
-    OP_MOVB64 = 0x48,
-    OP_MOVB = 0x49,
-    OP_PUSH = 0x4A,
-    OP_POP = 0x4B,
-    OP_IADD = 0x4C,
-    OP_UADD = 0x4D,
-    OP_FADD = 0x4E,
-    OP_ISUB = 0x4F,
-    OP_USUB = 0x50,
-    OP_FSUB = 0x51,
-    OP_IMUL = 0x52,
-    OP_UMUL = 0x53,
-    OP_FMUL = 0x54,
-    OP_IDIV = 0x55,
-    OP_UDIV = 0x56,
-    OP_FDIV = 0x57,
-    OP_IMOD = 0x58,
-    OP_UMOD = 0x59,
-    OP_FMOD = 0x5A,
-    OP_INEG = 0x5B,
-    OP_UNEG = 0x5C,
-    OP_FNEG = 0x5D,
-    OP_FTU = 0x5E,
-    OP_FTI = 0x5F,
-    OP_ITF = 0x60,
-    OP_ITU = 0x61,
-    OP_UTF = 0x62,
-    OP_UTI = 0x63,
-    OP_INC = 0x64,
-    OP_DEC = 0x65,
-    OP_SHL = 0x66,
-    OP_SHR = 0x67,
-    OP_ROL = 0x68,
-    OP_ROR = 0x69,
-    OP_AND = 0x6A,
-    OP_OR = 0x6B,
-    OP_NOT = 0x6C,
-    OP_CMP = 0x6D,
-    OP_TST = 0x6E,
-    OP_JMPEQ = 0x6F,
-    OP_JMPNE = 0x70,
-    OP_JMPCS = 0x71,
-    OP_JMPCC = 0x72,
-    OP_JMPMI = 0x73,
-    OP_JMPPL = 0x74,
-    OP_JMPVS = 0x75,
-    OP_JMPVC = 0x76,
-    OP_JMPHI = 0x77,
-    OP_JMPLS = 0x78,
-    OP_JMPGE = 0x79,
-    OP_JMPLT = 0x7A,
-    OP_JMPGT = 0x7B,
-    OP_JMPLE = 0x7C,
-    OP_JMPTE = 0x7D,
-    OP_JMPEE = 0x7E,
-    OP_JMP = 0x7F,
-    OP_CALLEQ = 0x80,
-    OP_CALLNE = 0x81,
-    OP_CALLCS = 0x82,
-    OP_CALLCC = 0x83,
-    OP_CALLMI = 0x84,
-    OP_CALLPL = 0x85,
-    OP_CALLVS = 0x86,
-    OP_CALLVC = 0x87,
-    OP_CALLHI = 0x88,
-    OP_CALLLS = 0x89,
-    OP_CALLGE = 0x8A,
-    OP_CALLLT = 0x8B,
-    OP_CALLGT = 0x8C,
-    OP_CALLLE = 0x8D,
-    OP_CALLTE = 0x8E,
-    OP_CALLEE = 0x8F,
-    OP_CALL = 0x90,
-    OP_EXCALLEQ = 0x91,
-    OP_EXCALLNE = 0x92,
-    OP_EXCALLCS = 0x93,
-    OP_EXCALLCC = 0x94,
-    OP_EXCALLMI = 0x95,
-    OP_EXCALLPL = 0x96,
-    OP_EXCALLVS = 0x97,
-    OP_EXCALLVC = 0x98,
-    OP_EXCALLHI = 0x99,
-    OP_EXCALLLS = 0x9A,
-    OP_EXCALLGE = 0x9B,
-    OP_EXCALLLT = 0x9C,
-    OP_EXCALLGT = 0x9D,
-    OP_EXCALLLE = 0x9E,
-    OP_EXCALLTE = 0x9F,
-    OP_EXCALLEE = 0xA0,
-    OP_EXCALL = 0xA1,
-    OP_RETEQ = 0xA2,
-    OP_RETNE = 0xA3,
-    OP_RETCS = 0xA4,
-    OP_RETCC = 0xA5,
-    OP_RETMI = 0xA6,
-    OP_RETPL = 0xA7,
-    OP_RETVS = 0xA8,
-    OP_RETVC = 0xA9,
-    OP_RETHI = 0xAA,
-    OP_RETLS = 0xAB,
-    OP_RETGE = 0xAC,
-    OP_RETLT = 0xAD,
-    OP_RETGT = 0xAE,
-    OP_RETLE = 0xAF,
-    OP_RETTE = 0xB0,
-    OP_RETEE = 0xB1,
-    OP_RET = 0xB2,
-    OP_TRAPEQ = 0xB3,
-    OP_TRAPNE = 0xB4,
-    OP_TRAPCS = 0xB5,
-    OP_TRAPCC = 0xB6,
-    OP_TRAPMI = 0xB7,
-    OP_TRAPPL = 0xB8,
-    OP_TRAPVS = 0xB9,
-    OP_TRAPVC = 0xBA,
-    OP_TRAPHI = 0xBB,
-    OP_TRAPLS = 0xBC,
-    OP_TRAPGE = 0xBD,
-    OP_TRAPLT = 0xBE,
-    OP_TRAPGT = 0xBF,
-    OP_TRAPLE = 0xC0,
-    OP_TRAPTE = 0xC1,
-    OP_TRAPEE = 0xC2,
-    OP_TRAP = 0xC3,
-    OP_TRETEQ = 0xC4,
-    OP_TRETNE = 0xC5,
-    OP_TRETCS = 0xC6,
-    OP_TRETCC = 0xC7,
-    OP_TRETMI = 0xC8,
-    OP_TRETPL = 0xC9,
-    OP_TRETVS = 0xCA,
-    OP_TRETVC = 0xCB,
-    OP_TRETHI = 0xCC,
-    OP_TRETLS = 0xCD,
-    OP_TRETGE = 0xCE,
-    OP_TRETLT = 0xCF,
-    OP_TRETGT = 0xD0,
-    OP_TRETLE = 0xD1,
-    OP_TRETTE = 0xD2,
-    OP_TRETEE = 0xD3,
-    OP_TRET = 0xD4,
-    OP_RAISEEQ = 0xD5,
-    OP_RAISENE = 0xD6,
-    OP_RAISECS = 0xD7,
-    OP_RAISECC = 0xD8,
-    OP_RAISEMI = 0xD9,
-    OP_RAISEPL = 0xDA,
-    OP_RAISEVS = 0xDB,
-    OP_RAISEVC = 0xDC,
-    OP_RAISEHI = 0xDD,
-    OP_RAISELS = 0xDE,
-    OP_RAISEGE = 0xDF,
-    OP_RAISELT = 0xE0,
-    OP_RAISEGT = 0xE1,
-    OP_RAISELE = 0xE2,
-    OP_RAISETE = 0xE3,
-    OP_RAISEEE = 0xE4,
-    OP_RAISE = 0xE5,
-    OP_ERETEQ = 0xE6,
-    OP_ERETNE = 0xE7,
-    OP_ERETCS = 0xE8,
-    OP_ERETCC = 0xE9,
-    OP_ERETMI = 0xEA,
-    OP_ERETPL = 0xEB,
-    OP_ERETVS = 0xEC,
-    OP_ERETVC = 0xED,
-    OP_ERETHI = 0xEE,
-    OP_ERETLS = 0xEF,
-    OP_ERETGE = 0xF0,
-    OP_ERETLT = 0xF1,
-    OP_ERETGT = 0xF2,
-    OP_ERETLE = 0xF3,
-    OP_ERETTE = 0xF4,
-    OP_ERETEE = 0xF5,
-    OP_ERET = 0xF6,
-    OP_ALLOCATE = 0xF7,
-    OP_FREE = 0xF8,
-    OP_CODE = 0xF9,
-    OP_DATA = 0xFA,
-    OP_END_SEC = 0xFB,
-    OP_FLOAT = 0xFC,
-    OP_BWXOR = 0xFD,
-    OP_SEMICOLON = 0xFE,
+#include <stdint.h>
+
+typedef enum {
+    OP_NOP = 0x01,
+    OP_STZ = 0x02,
+    OP_CLZ = 0x03,
+    OP_STC = 0x04,
+    OP_CLC = 0x05,
+    OP_STN = 0x06,
+    OP_CLN = 0x07,
+    OP_STV = 0x08,
+    OP_CLV = 0x09,
+    OP_STT = 0x0A,
+    OP_CLT = 0x0B,
+    OP_STE = 0x0C,
+    OP_CLE = 0x0D,
+    OP_PAUSE = 0x0E,
+    OP_RESUME = 0x0F,
+    OP_END = 0x10,
+    OP_LOAD = 0x11,
+    OP_STORE = 0x12,
+    OP_MOV8 = 0x13,
+    OP_MOV16 = 0x14,
+    OP_MOV32 = 0x15,
+    OP_MOV64 = 0x16,
+    OP_MOV = 0x17,
+    OP_MOVB8 = 0x18,
+    OP_MOVB16 = 0x19,
+    OP_MOVB32 = 0x1A,
+    OP_MOVB64 = 0x1B,
+    OP_MOVB = 0x1C,
+    OP_PUSH = 0x1D,
+    OP_POP = 0x1E,
+    OP_IADD = 0x1F,
+    OP_UADD = 0x20,
+    OP_FADD = 0x21,
+    OP_ISUB = 0x22,
+    OP_USUB = 0x23,
+    OP_FSUB = 0x24,
+    OP_IMUL = 0x25,
+    OP_UMUL = 0x26,
+    OP_FMUL = 0x27,
+    OP_IDIV = 0x28,
+    OP_UDIV = 0x29,
+    OP_FDIV = 0x2A,
+    OP_IMOD = 0x2B,
+    OP_UMOD = 0x2C,
+    OP_FMOD = 0x2D,
+    OP_INEG = 0x2E,
+    OP_UNEG = 0x2F,
+    OP_FNEG = 0x30,
+    OP_FTU = 0x31,
+    OP_FTI = 0x32,
+    OP_ITF = 0x33,
+    OP_ITU = 0x34,
+    OP_UTF = 0x35,
+    OP_UTI = 0x36,
+    OP_INC = 0x37,
+    OP_DEC = 0x38,
+    OP_SHL = 0x39,
+    OP_SHR = 0x3A,
+    OP_ROL = 0x3B,
+    OP_ROR = 0x3C,
+    OP_AND = 0x3D,
+    OP_OR = 0x3E,
+    OP_XOR = 0x3F,
+    OP_NOT = 0x40,
+    OP_CMP = 0x41,
+    OP_TST = 0x42,
+    OP_JMPEQ = 0x43,
+    OP_JMPNE = 0x44,
+    OP_JMPCS = 0x45,
+    OP_JMPCC = 0x46,
+    OP_JMPMI = 0x47,
+    OP_JMPPL = 0x48,
+    OP_JMPVS = 0x49,
+    OP_JMPVC = 0x4A,
+    OP_JMPHI = 0x4B,
+    OP_JMPLS = 0x4C,
+    OP_JMPGE = 0x4D,
+    OP_JMPLT = 0x4E,
+    OP_JMPGT = 0x4F,
+    OP_JMPLE = 0x50,
+    OP_JMPTE = 0x51,
+    OP_JMPEE = 0x52,
+    OP_JMP = 0x53,
+    OP_CALLEQ = 0x54,
+    OP_CALLNE = 0x55,
+    OP_CALLCS = 0x56,
+    OP_CALLCC = 0x57,
+    OP_CALLMI = 0x58,
+    OP_CALLPL = 0x59,
+    OP_CALLVS = 0x5A,
+    OP_CALLVC = 0x5B,
+    OP_CALLHI = 0x5C,
+    OP_CALLLS = 0x5D,
+    OP_CALLGE = 0x5E,
+    OP_CALLLT = 0x5F,
+    OP_CALLGT = 0x60,
+    OP_CALLLE = 0x61,
+    OP_CALLTE = 0x62,
+    OP_CALLEE = 0x63,
+    OP_CALL = 0x64,
+    OP_EXCALLEQ = 0x65,
+    OP_EXCALLNE = 0x66,
+    OP_EXCALLCS = 0x67,
+    OP_EXCALLCC = 0x68,
+    OP_EXCALLMI = 0x69,
+    OP_EXCALLPL = 0x6A,
+    OP_EXCALLVS = 0x6B,
+    OP_EXCALLVC = 0x6C,
+    OP_EXCALLHI = 0x6D,
+    OP_EXCALLLS = 0x6E,
+    OP_EXCALLGE = 0x6F,
+    OP_EXCALLLT = 0x70,
+    OP_EXCALLGT = 0x71,
+    OP_EXCALLLE = 0x72,
+    OP_EXCALLTE = 0x73,
+    OP_EXCALLEE = 0x74,
+    OP_EXCALL = 0x75,
+    OP_RETEQ = 0x76,
+    OP_RETNE = 0x77,
+    OP_RETCS = 0x78,
+    OP_RETCC = 0x79,
+    OP_RETMI = 0x7A,
+    OP_RETPL = 0x7B,
+    OP_RETVS = 0x7C,
+    OP_RETVC = 0x7D,
+    OP_RETHI = 0x7E,
+    OP_RETLS = 0x7F,
+    OP_RETGE = 0x80,
+    OP_RETLT = 0x81,
+    OP_RETGT = 0x82,
+    OP_RETLE = 0x83,
+    OP_RETTE = 0x84,
+    OP_RETEE = 0x85,
+    OP_RET = 0x86,
+    OP_TRAPEQ = 0x87,
+    OP_TRAPNE = 0x88,
+    OP_TRAPCS = 0x89,
+    OP_TRAPCC = 0x8A,
+    OP_TRAPMI = 0x8B,
+    OP_TRAPPL = 0x8C,
+    OP_TRAPVS = 0x8D,
+    OP_TRAPVC = 0x8E,
+    OP_TRAPHI = 0x8F,
+    OP_TRAPLS = 0x90,
+    OP_TRAPGE = 0x91,
+    OP_TRAPLT = 0x92,
+    OP_TRAPGT = 0x93,
+    OP_TRAPLE = 0x94,
+    OP_TRAPTE = 0x95,
+    OP_TRAPEE = 0x96,
+    OP_TRAP = 0x97,
+    OP_TRETEQ = 0x98,
+    OP_TRETNE = 0x99,
+    OP_TRETCS = 0x9A,
+    OP_TRETCC = 0x9B,
+    OP_TRETMI = 0x9C,
+    OP_TRETPL = 0x9D,
+    OP_TRETVS = 0x9E,
+    OP_TRETVC = 0x9F,
+    OP_TRETHI = 0xA0,
+    OP_TRETLS = 0xA1,
+    OP_TRETGE = 0xA2,
+    OP_TRETLT = 0xA3,
+    OP_TRETGT = 0xA4,
+    OP_TRETLE = 0xA5,
+    OP_TRETTE = 0xA6,
+    OP_TRETEE = 0xA7,
+    OP_TRET = 0xA8,
+    OP_RAISEEQ = 0xA9,
+    OP_RAISENE = 0xAA,
+    OP_RAISECS = 0xAB,
+    OP_RAISECC = 0xAC,
+    OP_RAISEMI = 0xAD,
+    OP_RAISEPL = 0xAE,
+    OP_RAISEVS = 0xAF,
+    OP_RAISEVC = 0xB0,
+    OP_RAISEHI = 0xB1,
+    OP_RAISELS = 0xB2,
+    OP_RAISEGE = 0xB3,
+    OP_RAISELT = 0xB4,
+    OP_RAISEGT = 0xB5,
+    OP_RAISELE = 0xB6,
+    OP_RAISETE = 0xB7,
+    OP_RAISEEE = 0xB8,
+    OP_RAISE = 0xB9,
+    OP_ERETEQ = 0xBA,
+    OP_ERETNE = 0xBB,
+    OP_ERETCS = 0xBC,
+    OP_ERETCC = 0xBD,
+    OP_ERETMI = 0xBE,
+    OP_ERETPL = 0xBF,
+    OP_ERETVS = 0xC0,
+    OP_ERETVC = 0xC1,
+    OP_ERETHI = 0xC2,
+    OP_ERETLS = 0xC3,
+    OP_ERETGE = 0xC4,
+    OP_ERETLT = 0xC5,
+    OP_ERETGT = 0xC6,
+    OP_ERETLE = 0xC7,
+    OP_ERETTE = 0xC8,
+    OP_ERETEE = 0xC9,
+    OP_ERET = 0xCA,
+    OP_ALLOCATE = 0xCB,
+    OP_FREE = 0xCC,
+    OP_LAST_OP = 0xCD,
 } opcode_t;
 
-#endif
+/*
+ * Each operand is a spec byte, which may be followed by a value. The kind is
+ * in the top 3 bits and the register number is in the bottom 5 bits. For an
+ * immediate, the bottom bits give the size of the value that follows as a
+ * power of 2, from 1 to 8 bytes. Immediates and offsets are sign extended.
+ */
+#define OPND_KIND(spec)     (((spec) >> 5) & 0x07)
+#define OPND_REG_NUM(spec)  ((spec) & 0x1F)
+#define OPND_SPEC(kind, n)  ((uint8_t)(((kind) << 5) | ((n) & 0x1F)))
+
+enum {
+    OPND_REG,           // Rn
+    OPND_REG_PTR,       // [Rn]
+    OPND_REG_OFS8,      // [Rn + ofs], 1 byte offset follows
+    OPND_REG_OFS16,     // [Rn + ofs], 2 byte offset follows
+    OPND_IMM,           // number or address, 1 to 8 bytes follow
+    OPND_IMM_PTR,       // [address], 1 to 8 bytes follow
+    OPND_FLOAT,         // 8 byte double follows
+};
+
+// operand classes, as masks of the kinds that are allowed
+#define OPND_MASK(kind) (1 << (kind))
+#define OPC_REG     (OPND_MASK(OPND_REG))
+#define OPC_PTR     (OPND_MASK(OPND_REG_PTR) | OPND_MASK(OPND_REG_OFS8) | \
+                     OPND_MASK(OPND_REG_OFS16) | OPND_MASK(OPND_IMM_PTR))
+#define OPC_DEST    (OPC_REG | OPC_PTR)
+#define OPC_VALUE   (OPC_DEST | OPND_MASK(OPND_IMM) | OPND_MASK(OPND_FLOAT))
+#define OPC_TARGET  (OPC_REG | OPND_MASK(OPND_IMM))
+
+// opcode flags
+#define OPF_READS_FLAGS 0x01    // conditional; tests the flags
+#define OPF_SETS_FLAGS  0x02    // sets the condition flags from the result
+#define OPF_JUMP        0x04    // transfers control to the operand
+#define OPF_CALL        0x08    // transfers control and returns
+#define OPF_RETURN      0x10    // returns to the caller
+#define OPF_STOP        0x20    // never falls through to the next instruction
+
+#define OP_MAX_OPERANDS 3
 
+typedef struct {
+    const char* name;
+    uint8_t noperands;
+    uint8_t flags;
+    uint8_t cond;               // 0 for always, else 1 to 16 for EQ to EE
+    uint8_t base;               // opcode of the unconditional form
+    uint8_t operands[OP_MAX_OPERANDS];  // class of each operand
+} opcode_info_t;
+
+extern const opcode_info_t opcode_table[256];
+
+/*
+ * Bytes of value that follow each spec byte, or -1 if the spec byte is not
+ * valid. This is the decode table for the assembler, the VM loader and the
+ * disassembler.
+ */
+extern const int8_t operand_payload[256];
+
+#define NUM_CONDITIONS 16
+
+#endif
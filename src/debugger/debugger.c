@@ -0,0 +1,759 @@
+/*
+ * Assembly level debugger for the VM.
+ *
+ * The debugger links the same VM as the virtual-machine program, and the VM
+ * has no hooks for it in its dispatch loop. Instead:
+ *
+ * A breakpoint replaces the handler slot of the decoded instruction with
+ * VM_OP_BREAK, whose handler stops the VM. The instruction is run from its
+ * real opcode when the VM is resumed from it.
+ *
+ * A watchpoint write protects the page of VM memory that holds the watched
+ * word. A write to that page faults, and the signal handler unprotects the
+ * page and points vm->dispatch at a table where every slot checks the word
+ * before the next instruction runs. If the word changed, the VM stops there.
+ * If it did not, the page is protected again and the dispatch table is put
+ * back.
+ *
+ * Ctrl-C points vm->dispatch at vm_stop_handlers, so the VM stops before the
+ * next instruction.
+ *
+ * The run is always recorded, or replayed from a log, with snapshots kept in
+ * memory (see record.c). Going back an instruction restores the last
+ * snapshot before it and steps forward to it, with output turned off.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "debugger.h"
+
+// the debugger that the signal handlers act on
+static debugger_t* volatile attached;
+static vm_handler_t watch_handlers[VM_HANDLERS];
+
+static void* alloc_or_die(size_t size)
+{
+    void* ptr = malloc(size);
+
+    if(ptr == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", size);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+/************************
+ * labels
+ */
+static int compare_labels(const void* a, const void* b)
+{
+    const dbg_label_t* la = a;
+    const dbg_label_t* lb = b;
+
+    return (la->offset > lb->offset) - (la->offset < lb->offset);
+}
+
+static void load_labels(debugger_t* dbg)
+{
+    const image_file_t* img = &dbg->vm.image;
+    const uint8_t* ptr = img->debug;
+    image_symbol_t rec;
+    const char* name;
+    size_t count = 0;
+
+    dbg->labels = alloc_or_die((img->header->num_symbols + 1) * sizeof(dbg_label_t));
+    while((ptr = image_next_symbol(img, ptr, &rec, &name)) != NULL)
+    {
+        if(rec.segment != IMAGE_SEG_CODE)
+            continue;
+
+        dbg->labels[count].offset = rec.offset;
+        dbg->labels[count].name = name;
+        dbg->labels[count].len = rec.name_len;
+        count++;
+    }
+
+    qsort(dbg->labels, count, sizeof(dbg_label_t), compare_labels);
+    dbg->nlabels = count;
+}
+
+/*
+ * Show a code offset as the last label at or before it, and the distance
+ * from there.
+ */
+static void print_code_address(debugger_t* dbg, uint64_t offset)
+{
+    size_t lo = 0;
+    size_t hi = dbg->nlabels;
+
+    while(lo < hi)
+    {
+        size_t mid = (lo + hi) / 2;
+
+        if(dbg->labels[mid].offset <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if(lo == 0)
+    {
+        printf("0x%08lx", offset);
+        return;
+    }
+
+    const dbg_label_t* label = &dbg->labels[lo - 1];
+
+    printf("%.*s", label->len, label->name);
+    if(offset != label->offset)
+        printf("+%lu", offset - label->offset);
+}
+
+static void print_insn(debugger_t* dbg, const vm_insn_t* insn)
+{
+    if(insn->op == VM_OP_FELL_OFF)
+    {
+        printf("%08x  (end of code)\n", insn->offset);
+        return;
+    }
+
+    const decoded_insn_t* dec = &insn->insn;
+    const opcode_info_t* info = &opcode_table[dec->opcode];
+
+    printf("%08x %c %s", vm_source_offset(&dbg->vm, insn), (insn->op == VM_OP_BREAK)? '*': ' ', info->name);
+    for(int i = 0; i < dec->noperands; i++)
+    {
+        const decoded_operand_t* opnd = &dec->operands[i];
+
+        printf((i == 0)? " ": ", ");
+        switch (opnd->kind)
+        {
+            case OPND_REG:
+                printf("r%d", opnd->reg);
+                break;
+            case OPND_REG_PTR:
+                printf("[r%d]", opnd->reg);
+                break;
+            case OPND_REG_OFS8:
+            case OPND_REG_OFS16:
+                printf("[r%d%+ld]", opnd->reg, opnd->value);
+                break;
+            case OPND_IMM:
+                if(insn->target != NULL)
+                    print_code_address(dbg, vm_source_offset(&dbg->vm, insn->target));
+                else
+                    printf("%ld", opnd->value);
+                break;
+            case OPND_IMM_PTR:
+                printf("[0x%lx]", opnd->value);
+                break;
+            case OPND_FLOAT:
+                printf("%g", opnd->fnum);
+                break;
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * A location is a number, or a symbol in the given segment with an optional
+ * "+n". Returns non-zero if it is not one.
+ */
+static int parse_location(debugger_t* dbg, const char* str, int segment, uint64_t* offset)
+{
+    char* end;
+
+    if(str == NULL)
+        return 1;
+
+    if(isdigit((unsigned char)*str))
+    {
+        *offset = strtoull(str, &end, 0);
+        return *end != 0;
+    }
+
+    char name[256];
+    const char* plus = strchr(str, '+');
+    size_t len = plus? (size_t)(plus - str): strlen(str);
+    uint64_t add = 0;
+    image_symbol_t rec;
+
+    if(len >= sizeof(name))
+        return 1;
+    memcpy(name, str, len);
+    name[len] = 0;
+
+    if(plus != NULL)
+    {
+        add = strtoull(plus + 1, &end, 0);
+        if(end == plus + 1 || *end != 0)
+            return 1;
+    }
+
+    if(vm_find_symbol(&dbg->vm, name, &rec) || rec.segment != segment)
+        return 1;
+
+    *offset = rec.offset + add;
+    return 0;
+}
+
+/************************
+ * watchpoints
+ */
+static uint64_t watch_value(debugger_t* dbg)
+{
+    uint64_t value;
+
+    memcpy(&value, &dbg->vm.mem[dbg->watch_addr], sizeof(value));
+    return value;
+}
+
+static void protect_watch(debugger_t* dbg, int on)
+{
+    // a word can cross into the next page
+    size_t len = (&dbg->vm.mem[dbg->watch_addr + 8] > dbg->watch_page + dbg->page_size)? 2 * dbg->page_size: dbg->page_size;
+
+    mprotect(dbg->watch_page, len, on? PROT_READ: PROT_READ | PROT_WRITE);
+}
+
+/*
+ * Every slot of watch_handlers. The VM has written to the watched page, so
+ * look at the word before the next instruction runs.
+ */
+static const vm_insn_t* watch_check(vm_t* vm, const vm_insn_t* insn)
+{
+    debugger_t* dbg = attached;
+
+    if(watch_value(dbg) != dbg->watch_old)
+    {
+        dbg->watch_hit = 1;
+        vm->status = VM_STOPPED;
+        vm->stop_insn = insn;
+        return NULL;
+    }
+
+    protect_watch(dbg, 1);
+    vm->dispatch = vm_handlers;
+    return vm_handlers[insn->op](vm, insn);
+}
+
+static void segv_handler(int sig, siginfo_t* info, void* context)
+{
+    debugger_t* dbg = attached;
+    uint8_t* addr = info->si_addr;
+
+    (void)context;
+    if(dbg == NULL || !dbg->watching || addr < dbg->watch_page || addr >= dbg->watch_page + 2 * dbg->page_size)
+    {
+        // not ours, so let it crash
+        signal(sig, SIG_DFL);
+        return;
+    }
+
+    protect_watch(dbg, 0);
+    dbg->vm.dispatch = watch_handlers;
+}
+
+static void interrupt_handler(int sig)
+{
+    (void)sig;
+    if(attached != NULL)
+        attached->vm.dispatch = vm_stop_handlers;
+}
+
+static void install_handlers(void)
+{
+    struct sigaction sa;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = segv_handler;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = interrupt_handler;
+    sigaction(SIGINT, &sa, NULL);
+
+    for(int i = 0; i < VM_HANDLERS; i++)
+        watch_handlers[i] = watch_check;
+}
+
+/************************
+ * running
+ */
+static void report_stop(debugger_t* dbg, const vm_insn_t* insn)
+{
+    vm_t* vm = &dbg->vm;
+
+    vm->dispatch = vm_handlers;
+    switch (vm->status)
+    {
+        case VM_ENDED:
+            fflush(stdout);
+            printf("program ended, r0 = %ld\n", (int64_t)vm->regs[0]);
+            dbg->pc = NULL;
+            return;
+
+        case VM_ERROR:
+            fflush(stdout);
+            printf("error at ");
+            print_code_address(dbg, vm_source_offset(vm, vm->stop_insn));
+            printf(": %s\n", vm->error);
+            dbg->pc = NULL;
+            return;
+
+        case VM_BREAK:
+            printf("breakpoint at ");
+            break;
+
+        case VM_STOPPED:
+            if(dbg->watch_hit)
+            {
+                uint64_t value = watch_value(dbg);
+
+                printf("watch 0x%lx: %ld -> %ld, at ", dbg->watch_addr, (int64_t)dbg->watch_old, (int64_t)value);
+                dbg->watch_old = value;
+                dbg->watch_hit = 0;
+                protect_watch(dbg, 1);
+            }
+            else
+                printf("stopped at ");
+            break;
+    }
+
+    dbg->pc = insn;
+    print_code_address(dbg, vm_source_offset(vm, insn));
+    printf("\n");
+    print_insn(dbg, insn);
+}
+
+/*
+ * Run one instruction and say so if that stopped the VM. Returns non-zero
+ * if it stopped.
+ */
+static int step_one(debugger_t* dbg)
+{
+    vm_t* vm = &dbg->vm;
+    const vm_insn_t* next = vm_step(vm, dbg->pc);
+
+    if(next == NULL)
+    {
+        report_stop(dbg, vm->stop_insn);
+        return 1;
+    }
+
+    // a write to the watched page sends the VM to watch_check
+    if(vm->dispatch == watch_handlers)
+    {
+        vm->dispatch = vm_handlers;
+        if(watch_value(dbg) != dbg->watch_old)
+        {
+            dbg->watch_hit = 1;
+            vm->status = VM_STOPPED;
+            report_stop(dbg, next);
+            return 1;
+        }
+        protect_watch(dbg, 1);
+    }
+
+    dbg->pc = next;
+    return 0;
+}
+
+static void resume(debugger_t* dbg)
+{
+    // the instruction at a breakpoint has to be run past it
+    if(dbg->pc->op == VM_OP_BREAK && step_one(dbg))
+        return;
+
+    report_stop(dbg, vm_run(&dbg->vm, dbg->pc));
+}
+
+static void restart(debugger_t* dbg)
+{
+    if(dbg->watching)
+        protect_watch(dbg, 0);
+    dbg->pc = record_restart(&dbg->vm);
+    if(dbg->watching)
+    {
+        dbg->watch_old = watch_value(dbg);
+        protect_watch(dbg, 1);
+    }
+}
+
+/*
+ * Go back to the instruction that ran before the one at dbg->pc. Returns
+ * non-zero if it cannot.
+ */
+static int step_back(debugger_t* dbg)
+{
+    vm_t* vm = &dbg->vm;
+    uint64_t branches = vm->branches;
+    uint32_t offset = dbg->pc->offset;
+    const vm_insn_t* insn = record_rewind(vm, branches, offset);
+    size_t steps = 0;
+
+    if(insn == NULL)
+    {
+        printf("at the start of the run\n");
+        return 1;
+    }
+
+    // count the instructions from the snapshot, then do one less
+    while(insn != NULL && !(vm->branches == branches && insn->offset == offset))
+    {
+        insn = vm_step(vm, insn);
+        steps++;
+    }
+
+    if(insn == NULL)
+    {
+        printf("the run did not go the same way again\n");
+        dbg->pc = NULL;
+        return 1;
+    }
+
+    insn = record_rewind(vm, branches, offset);
+    for(size_t i = 1; i < steps; i++)
+        insn = vm_step(vm, insn);
+
+    dbg->pc = insn;
+    return 0;
+}
+
+/************************
+ * commands
+ */
+/*
+ * Patch the handler slot of an instruction and of the copies of it that
+ * the loader inlined, so that a breakpoint stops in all of them.
+ */
+static void patch_copies(debugger_t* dbg, vm_insn_t* insn, uint8_t op)
+{
+    vm_t* vm = &dbg->vm;
+
+    insn->op = op;
+    for(size_t k = 0; k < vm->ninsns; k++)
+        if(vm->insns[k].offset > vm->image.header->code_size && vm_source_offset(vm, &vm->insns[k]) == insn->offset)
+            vm->insns[k].op = op;
+}
+
+static void cmd_break(debugger_t* dbg, const char* arg)
+{
+    uint64_t offset;
+    vm_insn_t* insn;
+
+    if(parse_location(dbg, arg, IMAGE_SEG_CODE, &offset) || (insn = (vm_insn_t*)vm_find_insn(&dbg->vm, offset)) == NULL ||
+       insn->op == VM_OP_FELL_OFF)
+    {
+        printf("not an instruction: %s\n", arg? arg: "");
+        return;
+    }
+
+    for(int i = 0; i < MAX_BREAKPOINTS; i++)
+    {
+        if(dbg->breaks[i] == NULL)
+        {
+            dbg->breaks[i] = insn;
+            patch_copies(dbg, insn, VM_OP_BREAK);
+            printf("breakpoint %d at ", i);
+            print_code_address(dbg, offset);
+            printf("\n");
+            return;
+        }
+    }
+
+    printf("too many breakpoints\n");
+}
+
+static void cmd_delete(debugger_t* dbg, const char* arg)
+{
+    int n = arg? atoi(arg): -1;
+
+    if(n < 0 || n >= MAX_BREAKPOINTS || dbg->breaks[n] == NULL)
+    {
+        printf("no breakpoint %s\n", arg? arg: "");
+        return;
+    }
+
+    patch_copies(dbg, dbg->breaks[n], dbg->breaks[n]->plain);
+    dbg->breaks[n] = NULL;
+}
+
+static void cmd_info(debugger_t* dbg)
+{
+    for(int i = 0; i < MAX_BREAKPOINTS; i++)
+    {
+        if(dbg->breaks[i] != NULL)
+        {
+            printf("breakpoint %d at ", i);
+            print_code_address(dbg, dbg->breaks[i]->offset);
+            printf("\n");
+        }
+    }
+
+    if(dbg->watching)
+        printf("watch 0x%lx = %ld\n", dbg->watch_addr, (int64_t)watch_value(dbg));
+}
+
+static void cmd_watch(debugger_t* dbg, const char* arg)
+{
+    uint64_t addr;
+
+    if(parse_location(dbg, arg, IMAGE_SEG_DATA, &addr) || addr > dbg->vm.mem_size - 8)
+    {
+        printf("not a data address: %s\n", arg? arg: "");
+        return;
+    }
+
+    if(dbg->watching)
+        protect_watch(dbg, 0);
+
+    dbg->watching = 1;
+    dbg->watch_addr = addr;
+    dbg->watch_page = (uint8_t*)((uintptr_t)&dbg->vm.mem[addr] & ~(uintptr_t)(dbg->page_size - 1));
+    dbg->watch_old = watch_value(dbg);
+    protect_watch(dbg, 1);
+    printf("watch 0x%lx = %ld\n", addr, (int64_t)dbg->watch_old);
+}
+
+static void cmd_unwatch(debugger_t* dbg)
+{
+    if(dbg->watching)
+        protect_watch(dbg, 0);
+    dbg->watching = 0;
+}
+
+static void cmd_regs(debugger_t* dbg)
+{
+    vm_t* vm = &dbg->vm;
+
+    for(int i = 0; i < VM_NUM_REGS; i++)
+        printf("r%-2d %016lx%s", i, vm->regs[i], (i % 4 == 3)? "\n": "  ");
+    printf("flags %c%c%c%c%c%c%c%c  sp %lu\n",
+           (vm->flags & VM_FLAG_Z)? 'Z': '-', (vm->flags & VM_FLAG_N)? 'N': '-',
+           (vm->flags & VM_FLAG_C)? 'C': '-', (vm->flags & VM_FLAG_V)? 'V': '-',
+           (vm->flags & VM_FLAG_T)? 'T': '-', (vm->flags & VM_FLAG_E)? 'E': '-',
+           (vm->flags & VM_FLAG_TM)? 't': '-', (vm->flags & VM_FLAG_EM)? 'e': '-', vm->sp);
+}
+
+static void cmd_examine(debugger_t* dbg, const char* arg, const char* count_arg)
+{
+    uint64_t addr;
+    long count = count_arg? atol(count_arg): 1;
+
+    if(parse_location(dbg, arg, IMAGE_SEG_DATA, &addr))
+    {
+        printf("not a data address: %s\n", arg? arg: "");
+        return;
+    }
+
+    for(long i = 0; i < count && addr <= dbg->vm.mem_size - 8; i++, addr += 8)
+    {
+        uint64_t value;
+
+        memcpy(&value, &dbg->vm.mem[addr], sizeof(value));
+        printf("0x%08lx  %016lx  %ld\n", addr, value, (int64_t)value);
+    }
+}
+
+static void cmd_list(debugger_t* dbg, const char* count_arg)
+{
+    const vm_insn_t* insn = dbg->pc? dbg->pc: dbg->entry;
+    long count = count_arg? atol(count_arg): 10;
+
+    for(long i = 0; i < count; i++, insn++)
+    {
+        print_insn(dbg, insn);
+        if(insn->op == VM_OP_FELL_OFF)
+            break;
+    }
+}
+
+static void cmd_reverse(debugger_t* dbg, const char* count_arg)
+{
+    long count = count_arg? atol(count_arg): 1;
+
+    if(dbg->pc == NULL)
+    {
+        printf("the program is not running\n");
+        return;
+    }
+
+    if(dbg->watching)
+        protect_watch(dbg, 0);
+    record_set_quiet(&dbg->vm, 1);
+
+    for(long i = 0; i < count; i++)
+        if(step_back(dbg))
+            break;
+
+    record_set_quiet(&dbg->vm, 0);
+    if(dbg->watching)
+    {
+        dbg->watch_old = watch_value(dbg);
+        protect_watch(dbg, 1);
+    }
+
+    if(dbg->pc != NULL)
+        print_insn(dbg, dbg->pc);
+}
+
+static void help(void)
+{
+    printf("break <label|offset>   set a breakpoint\n"
+           "delete <n>             remove breakpoint n\n"
+           "watch <data|address>   stop when the 64 bit word there changes\n"
+           "unwatch                remove the watch\n"
+           "info                   show breakpoints and the watch\n"
+           "run                    start the program from the beginning\n"
+           "continue               run until something stops it\n"
+           "step [n]               run n instructions\n"
+           "reverse [n]            go back n instructions\n"
+           "regs                   show the registers\n"
+           "x <data|address> [n]   show n 64 bit words of memory\n"
+           "list [n]               show the next n instructions\n"
+           "quit\n");
+}
+
+/*
+ * Returns non-zero to quit.
+ */
+static int command(debugger_t* dbg, char* line)
+{
+    const char* cmd = strtok(line, " \t\n");
+    const char* arg = strtok(NULL, " \t\n");
+    const char* arg2 = strtok(NULL, " \t\n");
+
+    if(cmd == NULL)
+        return 0;
+
+    if(!strcmp(cmd, "quit") || !strcmp(cmd, "q"))
+        return 1;
+    else if(!strcmp(cmd, "break") || !strcmp(cmd, "b"))
+        cmd_break(dbg, arg);
+    else if(!strcmp(cmd, "delete") || !strcmp(cmd, "d"))
+        cmd_delete(dbg, arg);
+    else if(!strcmp(cmd, "watch") || !strcmp(cmd, "w"))
+        cmd_watch(dbg, arg);
+    else if(!strcmp(cmd, "unwatch"))
+        cmd_unwatch(dbg);
+    else if(!strcmp(cmd, "reverse") || !strcmp(cmd, "rs"))
+        cmd_reverse(dbg, arg);
+    else if(!strcmp(cmd, "info") || !strcmp(cmd, "i"))
+        cmd_info(dbg);
+    else if(!strcmp(cmd, "regs") || !strcmp(cmd, "r"))
+        cmd_regs(dbg);
+    else if(!strcmp(cmd, "x"))
+        cmd_examine(dbg, arg, arg2);
+    else if(!strcmp(cmd, "list") || !strcmp(cmd, "l"))
+        cmd_list(dbg, arg);
+    else if(!strcmp(cmd, "run"))
+    {
+        restart(dbg);
+        resume(dbg);
+    }
+    else if(!strcmp(cmd, "continue") || !strcmp(cmd, "c") || !strcmp(cmd, "step") || !strcmp(cmd, "s"))
+    {
+        if(dbg->pc == NULL)
+            restart(dbg);
+
+        if(cmd[0] == 'c')
+            resume(dbg);
+        else
+        {
+            long count = arg? atol(arg): 1;
+
+            for(long i = 0; i < count; i++)
+                if(step_one(dbg))
+                    return 0;
+            print_insn(dbg, dbg->pc);
+        }
+    }
+    else
+        help();
+
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-e label | -p log] image\n", name);
+}
+
+int main(int argc, char** argv)
+{
+    static debugger_t dbg;
+    const char* entry = NULL;
+    const char* replay = NULL;
+    char line[512];
+    int opt;
+
+    while((opt = getopt(argc, argv, "e:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e':
+                entry = optarg;
+                break;
+            case 'p':
+                replay = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind != argc - 1 || (entry != NULL && replay != NULL))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    vm_init_dispatch();
+    if(vm_load(&dbg.vm, argv[optind]))
+        return 1;
+
+    load_labels(&dbg);
+    dbg.page_size = (size_t)sysconf(_SC_PAGESIZE);
+    dbg.entry = dbg.vm.insns;
+    if(entry != NULL)
+    {
+        uint64_t offset;
+
+        if(parse_location(&dbg, entry, IMAGE_SEG_CODE, &offset) || (dbg.entry = vm_find_insn(&dbg.vm, offset)) == NULL)
+        {
+            fprintf(stderr, "ERROR: \"%s\" is not a label in the code\n", entry);
+            return 1;
+        }
+    }
+
+    if(replay != NULL? replay_start(&dbg.vm, replay, &dbg.entry, 1): record_start(&dbg.vm, NULL, dbg.entry, 1))
+        return 1;
+
+    attached = &dbg;
+    install_handlers();
+
+    for(;;)
+    {
+        printf("(vdb) ");
+        fflush(stdout);
+        if(fgets(line, sizeof(line), stdin) == NULL || command(&dbg, line))
+            break;
+    }
+
+    cmd_unwatch(&dbg);
+    attached = NULL;
+    record_finish(&dbg.vm);
+    free(dbg.labels);
+    vm_unload(&dbg.vm);
+    return 0;
+}
@@ -0,0 +1,42 @@
+#ifndef __DEBUGGER_H__
+#  define __DEBUGGER_H__
+
+#  include <stdint.h>
+#  include <stddef.h>
+
+#  include "virtual_machine.h"
+
+#  define MAX_BREAKPOINTS 64
+
+/*
+ * A label in the code, for showing where the VM is. The name points into
+ * the mapped image and is not terminated.
+ */
+typedef struct
+{
+    uint64_t offset;
+    const char* name;
+    uint16_t len;
+} dbg_label_t;
+
+typedef struct
+{
+    vm_t vm;
+    const vm_insn_t* entry;  // where "run" starts
+    const vm_insn_t* pc;     // next instruction to run, or NULL if not running
+
+    dbg_label_t* labels;     // sorted by offset
+    size_t nlabels;
+
+    vm_insn_t* breaks[MAX_BREAKPOINTS];  // NULL if the slot is free
+
+    // one watched 64 bit word in VM memory
+    int watching;
+    uint64_t watch_addr;
+    uint64_t watch_old;
+    uint8_t* watch_page;
+    size_t page_size;
+    int watch_hit;
+} debugger_t;
+
+#endif
@@ -0,0 +1,481 @@
+/*
+ * Disassembler.
+ *
+ * This reads a program image and writes the code segment back out as
+ * assembly, one instruction per line with its offset and bytes. It is meant
+ * for looking at very large images, so the image is mapped rather than read,
+ * the output is built in a large buffer instead of going through stdio, and
+ * --range decodes a window of the code without reading the rest of it.
+ *
+ * Instructions are decoded by decode_insn(), which is shared with the VM
+ * loader and driven by the tables generated from tokens.h, so the
+ * disassembler shows exactly what the VM will run.
+ *
+ * Labels and the names of data objects come from the debug section, if the
+ * image has one. The names point into the mapped file, so nothing is copied.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "decode.h"
+#include "dissasembler.h"
+
+// instruction bytes shown on a line before they are cut off
+#define MAX_SHOWN_BYTES 10
+
+static void add_symbol(dis_symtab_t* tab, uint64_t offset, const char* name, uint16_t len)
+{
+    if(tab->count + 1 > tab->capacity)
+    {
+        tab->capacity = (tab->capacity == 0)? 256: tab->capacity << 1;
+        tab->list = realloc(tab->list, tab->capacity * sizeof(dis_symbol_t));
+        if(tab->list == NULL)
+        {
+            fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes for symbols\n",
+                    tab->capacity * sizeof(dis_symbol_t));
+            exit(1);
+        }
+    }
+
+    dis_symbol_t* sym = &tab->list[tab->count++];
+
+    sym->offset = offset;
+    sym->name = name;
+    sym->len = len;
+}
+
+static int compare_symbols(const void* a, const void* b)
+{
+    uint64_t oa = ((const dis_symbol_t*)a)->offset;
+    uint64_t ob = ((const dis_symbol_t*)b)->offset;
+
+    return (oa > ob) - (oa < ob);
+}
+
+/*
+ * The assembler writes the symbols in order, so sorting is almost never
+ * needed.
+ */
+static void sort_symbols(dis_symtab_t* tab)
+{
+    for(size_t i = 1; i < tab->count; i++)
+    {
+        if(tab->list[i].offset < tab->list[i - 1].offset)
+        {
+            qsort(tab->list, tab->count, sizeof(dis_symbol_t), compare_symbols);
+            return;
+        }
+    }
+}
+
+/*
+ * Index of the first symbol at or after offset.
+ */
+static size_t lower_bound(const dis_symtab_t* tab, uint64_t offset)
+{
+    size_t low = 0;
+    size_t high = tab->count;
+
+    while(low < high)
+    {
+        size_t mid = (low + high) / 2;
+
+        if(tab->list[mid].offset < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low;
+}
+
+static void put_symbol(writer_t* wr, const dis_symbol_t* sym)
+{
+    put_mem(wr, sym->name, sym->len);
+}
+
+/*
+ * A code address is only shown as a name if it is exactly a label. A data
+ * address is shown as the object that it is in, plus the offset.
+ */
+static void put_address(disassembler_t* dis, uint64_t value, int is_code)
+{
+    const dis_symtab_t* tab = is_code? &dis->code_syms: &dis->data_syms;
+    size_t index = lower_bound(tab, value);
+
+    if(index < tab->count && tab->list[index].offset == value)
+    {
+        put_symbol(&dis->out, &tab->list[index]);
+        return;
+    }
+
+    if(!is_code && index > 0 && value < dis->image->header->data_size)
+    {
+        put_symbol(&dis->out, &tab->list[index - 1]);
+        put_char(&dis->out, '+');
+        put_dec(&dis->out, value - tab->list[index - 1].offset);
+        return;
+    }
+
+    put_str(&dis->out, "0x");
+    put_hex(&dis->out, value, (value >> 32)? 16: 8);
+}
+
+static void put_operand(disassembler_t* dis, const decoded_operand_t* opnd, int flags)
+{
+    writer_t* wr = &dis->out;
+    char buffer[32];
+
+    switch (opnd->kind)
+    {
+        case OPND_REG:
+            put_char(wr, 'r');
+            put_dec(wr, opnd->reg);
+            break;
+
+        case OPND_REG_PTR:
+            put_str(wr, "[r");
+            put_dec(wr, opnd->reg);
+            put_char(wr, ']');
+            break;
+
+        case OPND_REG_OFS8:
+        case OPND_REG_OFS16:
+            put_str(wr, "[r");
+            put_dec(wr, opnd->reg);
+            if(opnd->value >= 0)
+                put_char(wr, '+');
+            put_dec(wr, opnd->value);
+            put_char(wr, ']');
+            break;
+
+        case OPND_IMM:
+            // a small number is more likely to be a number than an address
+            if(flags & (OPF_JUMP | OPF_CALL))
+                put_address(dis, opnd->value, 1);
+            else
+                put_dec(wr, opnd->value);
+            break;
+
+        case OPND_IMM_PTR:
+            put_char(wr, '[');
+            put_address(dis, opnd->value, 0);
+            put_char(wr, ']');
+            break;
+
+        case OPND_FLOAT:
+            snprintf(buffer, sizeof(buffer), "%.17g", opnd->fnum);
+            put_str(wr, buffer);
+            // make sure that it reads back as a float
+            if(strpbrk(buffer, ".eEn") == NULL)
+                put_str(wr, ".0");
+            break;
+    }
+}
+
+static void put_line_start(writer_t* wr, uint64_t pc, const uint8_t* bytes, size_t len)
+{
+    put_hex(wr, pc, 8);
+    put_str(wr, "  ");
+
+    for(size_t i = 0; i < MAX_SHOWN_BYTES; i++)
+    {
+        if(i < len && (i < MAX_SHOWN_BYTES - 1 || len == MAX_SHOWN_BYTES))
+        {
+            put_hex(wr, bytes[i], 2);
+            put_char(wr, ' ');
+        }
+        else if(i < len)
+            put_str(wr, ".. ");
+        else
+            put_str(wr, "   ");
+    }
+
+    put_char(wr, ' ');
+}
+
+/*
+ * A pointer map is shown the way it was written, on a line of its own
+ * before its instruction.
+ */
+static void put_ptrmap(writer_t* wr, uint64_t pc, const image_ptrmap_t* map)
+{
+    const char* sep = " ";
+
+    put_line_start(wr, pc, NULL, 0);
+    put_str(wr, "ptrs ");
+    put_dec(wr, map->depth);
+    put_str(wr, " {");
+    for(int r = 0; r < 32; r++)
+    {
+        if(map->regs & (1u << r))
+        {
+            put_str(wr, sep);
+            put_char(wr, 'r');
+            put_dec(wr, r);
+            sep = ", ";
+        }
+    }
+    for(int n = 0; n < IMAGE_FRAME_SLOTS; n++)
+    {
+        if(map->slots & (1ull << n))
+        {
+            put_str(wr, sep);
+            put_char(wr, '[');
+            put_dec(wr, n);
+            put_char(wr, ']');
+            sep = ", ";
+        }
+    }
+    put_str(wr, " }\n");
+}
+
+/*
+ * Load the debug symbols. Symbols are kept by segment, sorted by offset.
+ */
+void load_symbols(disassembler_t* dis)
+{
+    const image_file_t* img = dis->image;
+    const uint8_t* ptr = img->debug;
+    image_symbol_t rec;
+    const char* name;
+
+    memset(&dis->code_syms, 0, sizeof(dis_symtab_t));
+    memset(&dis->data_syms, 0, sizeof(dis_symtab_t));
+
+    while((ptr = image_next_symbol(img, ptr, &rec, &name)) != NULL)
+    {
+        if(rec.segment == IMAGE_SEG_CODE)
+            add_symbol(&dis->code_syms, rec.offset, name, rec.name_len);
+        else
+            add_symbol(&dis->data_syms, rec.offset, name, rec.name_len);
+    }
+
+    sort_symbols(&dis->code_syms);
+    sort_symbols(&dis->data_syms);
+}
+
+void free_symbols(disassembler_t* dis)
+{
+    free(dis->code_syms.list);
+    free(dis->data_syms.list);
+    memset(&dis->code_syms, 0, sizeof(dis_symtab_t));
+    memset(&dis->data_syms, 0, sizeof(dis_symtab_t));
+}
+
+/*
+ * Write the instructions that start from start up to end. Instructions are
+ * different lengths, so decoding can only start where an instruction starts.
+ * It starts at the last label at or before start, or at the beginning of
+ * the code if there is none, and nothing is written until start is reached.
+ */
+void disassemble(disassembler_t* dis, uint64_t start, uint64_t end)
+{
+    const uint8_t* code = dis->image->code;
+    uint64_t size = dis->image->header->code_size;
+    writer_t* wr = &dis->out;
+    size_t sym = lower_bound(&dis->code_syms, start);
+    size_t map = 0;
+    uint64_t pc = 0;
+    decoded_insn_t insn;
+
+    if(end > size)
+        end = size;
+
+    if(sym < dis->code_syms.count && dis->code_syms.list[sym].offset == start)
+        pc = start;
+    else if(sym > 0)
+        pc = dis->code_syms.list[--sym].offset;
+
+    while(pc < end)
+    {
+        int show = (pc >= start);
+
+        while(sym < dis->code_syms.count && dis->code_syms.list[sym].offset <= pc)
+        {
+            if(show && dis->code_syms.list[sym].offset == pc)
+            {
+                put_char(wr, '\n');
+                put_symbol(wr, &dis->code_syms.list[sym]);
+                put_str(wr, ":\n");
+            }
+            sym++;
+        }
+
+        while(map < dis->image->num_ptrmaps && dis->image->ptrmaps[map].offset <= pc)
+        {
+            if(show && dis->image->ptrmaps[map].offset == pc)
+                put_ptrmap(wr, pc, &dis->image->ptrmaps[map]);
+            map++;
+        }
+
+        int err = decode_insn(&code[pc], size - pc, &insn);
+
+        if(err != DECODE_OK)
+        {
+            // show the byte and try again at the next one
+            if(show)
+            {
+                put_line_start(wr, pc, &code[pc], 1);
+                put_str(wr, ".byte 0x");
+                put_hex(wr, code[pc], 2);
+                put_str(wr, "    ; ");
+                put_str(wr, decode_error_str(err));
+                put_char(wr, '\n');
+            }
+            pc++;
+            continue;
+        }
+
+        if(show)
+        {
+            const opcode_info_t* info = &opcode_table[insn.opcode];
+            // the operand of EXCALL is a routine number, not an address
+            int flags = (info->base == OP_EXCALL)? 0: info->flags;
+
+            put_line_start(wr, pc, &code[pc], insn.length);
+            put_str(wr, info->name);
+            for(int i = 0; i < insn.noperands; i++)
+            {
+                put_str(wr, (i == 0)? " ": ", ");
+                put_operand(dis, &insn.operands[i], flags);
+            }
+            put_char(wr, '\n');
+        }
+
+        pc += insn.length;
+    }
+}
+
+/*
+ * The range is "start:end" or "start:+length". Either end can be left off.
+ * Numbers can be given in hex with 0x.
+ */
+static int parse_range(const char* str, uint64_t* start, uint64_t* end)
+{
+    char* ptr;
+
+    *start = 0;
+    *end = UINT64_MAX;
+
+    if(*str != ':')
+    {
+        *start = strtoull(str, &ptr, 0);
+        if(ptr == str)
+            return 1;
+        str = ptr;
+    }
+
+    if(*str == 0)
+        return 0;
+    if(*str++ != ':')
+        return 1;
+    if(*str == 0)
+        return 0;
+
+    int relative = (*str == '+');
+
+    if(relative)
+        str++;
+
+    uint64_t value = strtoull(str, &ptr, 0);
+
+    if(ptr == str || *ptr != 0)
+        return 1;
+
+    *end = relative? *start + value: value;
+    return 0;
+}
+
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-o outfile] [-r|--range start:end] image\n", name);
+    exit(1);
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option options[] = {
+        {"output", required_argument, NULL, 'o'},
+        {"range", required_argument, NULL, 'r'},
+        {NULL, 0, NULL, 0},
+    };
+    const char* outfile = NULL;
+    uint64_t start = 0;
+    uint64_t end = UINT64_MAX;
+    image_file_t image;
+    disassembler_t dis;
+    int opt;
+
+    while((opt = getopt_long(argc, argv, "o:r:", options, NULL)) != -1)
+    {
+        switch (opt)
+        {
+            case 'o':
+                outfile = optarg;
+                break;
+            case 'r':
+                if(parse_range(optarg, &start, &end))
+                {
+                    fprintf(stderr, "ERROR: bad range: \"%s\"\n", optarg);
+                    usage(argv[0]);
+                }
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+
+    if(optind != argc - 1)
+        usage(argv[0]);
+
+    if(image_open(&image, argv[optind]))
+        return 1;
+
+    int fd = STDOUT_FILENO;
+
+    if(outfile != NULL)
+    {
+        fd = open(outfile, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if(fd < 0)
+        {
+            fprintf(stderr, "ERROR: cannot open output file: \"%s\": %s\n", outfile, strerror(errno));
+            image_close(&image);
+            return 1;
+        }
+    }
+
+    // a whole image is read front to back
+    if(start == 0 && end >= image.header->code_size)
+        madvise(image.map, image.map_size, MADV_SEQUENTIAL);
+
+    dis.image = &image;
+    writer_open(&dis.out, fd, WRITER_SIZE);
+    load_symbols(&dis);
+
+    put_str(&dis.out, "; code ");
+    put_dec(&dis.out, image.header->code_size);
+    put_str(&dis.out, " bytes, data ");
+    put_dec(&dis.out, image.header->data_size);
+    put_str(&dis.out, " bytes, ");
+    put_dec(&dis.out, image.header->num_symbols);
+    put_str(&dis.out, " symbols, ");
+    put_dec(&dis.out, image.num_ptrmaps);
+    put_str(&dis.out, " pointer maps\n");
+
+    disassemble(&dis, start, end);
+
+    int errors = writer_close(&dis.out);
+
+    if(outfile != NULL)
+        close(fd);
+    free_symbols(&dis);
+    image_close(&image);
+    return errors;
+}
@@ -0,0 +1,40 @@
+#ifndef __DISASSEMBLER_H__
+#  define __DISASSEMBLER_H__
+
+#  include <stdint.h>
+#  include <stddef.h>
+
+#  include "image.h"
+#  include "writer.h"
+
+/*
+ * A symbol from the debug section. The name points into the mapped image
+ * and is not terminated.
+ */
+typedef struct
+{
+    uint64_t offset;
+    const char* name;
+    uint16_t len;
+} dis_symbol_t;
+
+typedef struct
+{
+    dis_symbol_t* list;
+    size_t count;
+    size_t capacity;
+} dis_symtab_t;
+
+typedef struct
+{
+    const image_file_t* image;
+    dis_symtab_t code_syms;
+    dis_symtab_t data_syms;
+    writer_t out;
+} disassembler_t;
+
+void load_symbols(disassembler_t* dis);
+void disassemble(disassembler_t* dis, uint64_t start, uint64_t end);
+void free_symbols(disassembler_t* dis);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+ * Buffered output for the disassembler.
+ *
+ * A large image makes millions of lines of output. Going through stdio costs
+ * a lock and a format parse for every call, so the lines are built directly
+ * in one big buffer that is handed to write(2) when it is full.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+void writer_open(writer_t* wr, int fd, size_t size)
+{
+    wr->fd = fd;
+    wr->error = 0;
+    wr->size = size;
+    wr->used = 0;
+    wr->buf = malloc(size);
+    if(wr->buf == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes for output\n", size);
+        exit(1);
+    }
+}
+
+void writer_flush(writer_t* wr)
+{
+    size_t done = 0;
+
+    while(done < wr->used && !wr->error)
+    {
+        ssize_t n = write(wr->fd, &wr->buf[done], wr->used - done);
+
+        if(n < 0 && errno == EINTR)
+            continue;
+        if(n <= 0)
+        {
+            fprintf(stderr, "ERROR: cannot write output: %s\n", strerror(errno));
+            wr->error = 1;
+            break;
+        }
+        done += n;
+    }
+
+    wr->used = 0;
+}
+
+/*
+ * Write what is left and free the buffer. Returns non-zero if anything could
+ * not be written.
+ */
+int writer_close(writer_t* wr)
+{
+    writer_flush(wr);
+    free(wr->buf);
+    wr->buf = NULL;
+    return wr->error;
+}
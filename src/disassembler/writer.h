@@ -0,0 +1,87 @@
+#ifndef __WRITER_H__
+#  define __WRITER_H__
+
+#  include <stdint.h>
+#  include <stddef.h>
+
+/*
+ * For writer.c. Output is collected in a large buffer and written to the
+ * file descriptor with write(2) when it fills up. The put functions are
+ * inline because they are called several times for every instruction.
+ */
+typedef struct
+{
+    int fd;
+    int error;               // set if a write failed
+    size_t size;
+    size_t used;
+    char* buf;
+} writer_t;
+
+#  define WRITER_SIZE (1024 * 1024)
+
+void writer_open(writer_t* wr, int fd, size_t size);
+void writer_flush(writer_t* wr);
+int writer_close(writer_t* wr);
+
+static inline void put_char(writer_t* wr, char ch)
+{
+    if(wr->used == wr->size)
+        writer_flush(wr);
+    wr->buf[wr->used++] = ch;
+}
+
+static inline void put_mem(writer_t* wr, const char* str, size_t len)
+{
+    while(len > 0)
+    {
+        if(wr->used == wr->size)
+            writer_flush(wr);
+
+        size_t room = wr->size - wr->used;
+        size_t n = (len < room)? len: room;
+
+        for(size_t i = 0; i < n; i++)
+            wr->buf[wr->used + i] = str[i];
+        wr->used += n;
+        str += n;
+        len -= n;
+    }
+}
+
+static inline void put_str(writer_t* wr, const char* str)
+{
+    while(*str != 0)
+        put_char(wr, *str++);
+}
+
+/*
+ * Exactly digits hex digits, with leading zeros.
+ */
+static inline void put_hex(writer_t* wr, uint64_t value, int digits)
+{
+    static const char hex[] = "0123456789abcdef";
+
+    for(int i = digits - 1; i >= 0; i--)
+        put_char(wr, hex[(value >> (i * 4)) & 0x0F]);
+}
+
+static inline void put_dec(writer_t* wr, int64_t value)
+{
+    char tmp[24];
+    int len = 0;
+    uint64_t mag = (value < 0)? -(uint64_t)value: (uint64_t)value;
+
+    do
+    {
+        tmp[len++] = (char)('0' + mag % 10);
+        mag /= 10;
+    } while(mag != 0);
+
+    if(value < 0)
+        put_char(wr, '-');
+    while(len > 0)
+        put_char(wr, tmp[--len]);
+}
+
+#endif
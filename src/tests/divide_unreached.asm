@@ -0,0 +1,7 @@
+# A divide by 0 after END can never run, so the program loads. Exits with 3.
+CODE main
+start
+    load r0, 3
+    end
+    idiv r1, r1, 0
+END_SEC
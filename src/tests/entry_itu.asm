@@ -0,0 +1,14 @@
+# The type pass never sees main.other, which makes r1 negative before the
+# ITU, so with -e main.other the ITU has to run. Exits with 9 either way.
+CODE main
+start
+    load r1, 9
+conv
+    itu r1
+    load r0, r1
+    end
+other
+    load r1, 0
+    isub r1, r1, 9
+    jmp conv
+END_SEC
@@ -0,0 +1,14 @@
+# Assemble PROGRAM into IMAGE, run it with the VM and OPTIONS, and check that
+# it exits with STATUS.
+execute_process(COMMAND ${ASSEMBLER} -o ${IMAGE} ${PROGRAM}
+    RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${PROGRAM} does not assemble")
+endif()
+
+separate_arguments(options UNIX_COMMAND "${OPTIONS}")
+execute_process(COMMAND ${VM} ${options} ${IMAGE}
+    RESULT_VARIABLE result OUTPUT_QUIET ERROR_QUIET)
+if(NOT result EQUAL ${STATUS})
+    message(FATAL_ERROR "${PROGRAM} ${OPTIONS}: exit status ${result}, expected ${STATUS}")
+endif()
@@ -0,0 +1,12 @@
+# STORE writes the register in its second operand, so r2 holds -7 when ITU
+# runs and the conversion cannot be dropped. Exits with 7.
+CODE main
+start
+    load r2, 5
+    load r1, 0
+    isub r1, r1, 7
+    store r1, r2
+    itu r2
+    load r0, r2
+    end
+END_SEC
@@ -0,0 +1,176 @@
+#!/usr/bin/env python
+'''
+This turns a binary trace log, written by the assembler with -L, back into
+the text that it would have written without it. The format is described at
+the top of common/errors.c.
+
+    decode_log.py [-o outfile] tracelog
+'''
+
+import sys
+import re
+import struct
+import argparse
+
+MAGIC = 0x474C5056
+VERSION = 1
+
+BLOG_STRING = 1
+BLOG_RECORD = 2
+
+LOG_DEBUG = 4
+LOG_MSG = 5
+LOG_MARK = 6
+
+ARG_INT = 1
+ARG_UINT = 2
+ARG_DOUBLE = 3
+ARG_STR = 4
+ARG_NULL_STR = 5
+ARG_PTR = 6
+
+# a printf conversion spec, split into the part python knows and the length
+SPEC = re.compile(r'%([-+ #0]*)(\*|[0-9]*)(?:\.(\*|[0-9]*))?([hlLqjzt]*)([a-zA-Z%])')
+
+
+class Reader:
+    def __init__(self, data):
+        self.data = data
+        self.pos = 0
+
+    def done(self):
+        return self.pos >= len(self.data)
+
+    def byte(self):
+        value = self.data[self.pos]
+        self.pos += 1
+        return value
+
+    def bytes(self, n):
+        value = self.data[self.pos:self.pos + n]
+        self.pos += n
+        return value
+
+    def varint(self):
+        value = 0
+        shift = 0
+        while True:
+            b = self.byte()
+            value |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return value
+
+    def text(self, n):
+        return self.bytes(n).decode("utf-8", "replace")
+
+
+def format_message(fmt, args):
+    '''
+    Format the way printf would, one spec at a time.
+    '''
+    out = []
+    pos = 0
+    args = list(args)
+
+    for m in SPEC.finditer(fmt):
+        out.append(fmt[pos:m.start()])
+        pos = m.end()
+        flags, width, prec, _, conv = m.groups()
+        if conv == '%':
+            out.append('%')
+            continue
+        if conv == 'n' or not args:
+            continue
+
+        if width == '*':
+            width = str(args.pop(0))
+        if prec == '*':
+            prec = str(args.pop(0))
+        if not args:
+            continue
+        value = args.pop(0)
+
+        spec = '%' + flags + (width or '') + ('.' + prec if prec is not None else '')
+        if conv == 'p':
+            out.append((spec + 's') % ("(nil)" if value == 0 else "0x%x" % value))
+        elif conv in "di":
+            out.append((spec + 'd') % value)
+        elif conv == 'u':
+            out.append((spec + 'd') % value)
+        elif conv == 'c':
+            out.append((spec + 'c') % chr(value & 0xFF))
+        elif conv == 's':
+            out.append((spec + 's') % ("(null)" if value is None else value))
+        else:
+            out.append((spec + conv) % value)
+
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def decode(data, fp):
+    rd = Reader(data)
+    magic, version, _ = struct.unpack("<IHH", rd.bytes(8))
+    if magic != MAGIC or version != VERSION:
+        sys.exit("not a trace log")
+
+    strings = {0: None}
+    while not rd.done():
+        kind = rd.byte()
+        if kind == BLOG_STRING:
+            sid = rd.varint()
+            strings[sid] = rd.text(rd.varint())
+            continue
+        if kind != BLOG_RECORD:
+            sys.exit("bad record at %d" % (rd.pos - 1))
+
+        kind = rd.byte()
+        rd.byte()       # level
+        fmt = strings[rd.varint()]
+        file = strings[rd.varint()]
+        func = strings[rd.varint()]
+        line = rd.varint()
+        name = strings[rd.varint()]
+        scan_line = rd.varint() - 1
+        scan_col = rd.varint() - 1
+
+        args = []
+        for _ in range(rd.varint()):
+            atype = rd.byte()
+            if atype == ARG_STR:
+                args.append(rd.text(rd.varint()))
+            elif atype == ARG_NULL_STR:
+                args.append(None)
+            elif atype == ARG_DOUBLE:
+                args.append(struct.unpack("<d", rd.bytes(8))[0])
+            elif atype == ARG_INT:
+                zigzag = rd.varint()
+                args.append((zigzag >> 1) ^ -(zigzag & 1))
+            else:
+                args.append(rd.varint())
+
+        shown = name if name is not None else "(null)"
+        if kind == LOG_DEBUG:
+            prefix = "DBG: "
+        elif kind == LOG_MSG:
+            prefix = "MSG: %s: %d: %d: " % (shown, scan_line, scan_col)
+        else:
+            prefix = "MARK: (%s, %d) %s: %d: %d: %s" % (file, line, shown, scan_line, scan_col, func)
+
+        fp.write(prefix + (format_message(fmt, args) if fmt is not None else "") + "\n")
+
+
+parser = argparse.ArgumentParser(description="Decode a binary trace log")
+parser.add_argument('-o', dest='outfile', type=str, help="write the text here instead of to stdout")
+parser.add_argument('logfile', type=str)
+args = parser.parse_args()
+
+with open(args.logfile, "rb") as fp:
+    data = fp.read()
+
+if args.outfile:
+    with open(args.outfile, "w") as out:
+        decode(data, out)
+else:
+    decode(data, sys.stdout)
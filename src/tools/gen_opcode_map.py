@@ -1,118 +1,220 @@
 #!/usr/bin/env python
 '''
-This stand-alone program generates the keyword_map data structure
-from the tokens.h file.
+This stand-alone program generates the opcode definitions and the opcode
+table from the tokens.h file.
+
+Every token from TOK_NOP to TOK_FREE is an instruction. The opcodes are
+numbered in the order that the tokens are defined, starting at 1, so that a
+zero byte is never a valid instruction. The table gives the name, the number
+and kind of the operands and how the instruction uses the flags. It is used
+by the assembler, the VM loader and the disassembler, so they can not
+disagree about the instruction set.
 '''
 
 import sys
 import argparse
-import time
 
 parser = argparse.ArgumentParser(description="Process the tokens file")
 parser.add_argument('-i', dest='infile', type=str, help="specify the full name of the input file", required=True)
-parser.add_argument('-o', dest='outfile', type=str, help="specify the full name of the output file", required=True)
+parser.add_argument('-o', dest='outfile', type=str, help="specify the full name of the output header", required=True)
+parser.add_argument('-t', dest='tabfile', type=str, help="specify the full name of the output table", required=True)
 args = parser.parse_args()
 
-# these are tokens that do not map to an opcode
-exclude_list = [
-    "TOK_ERROR",
-    "TOK_END_INPUT",
-    "TOK_STRING_LITERAL",
-    "TOK_IDENTIFIER",
-    "TOK_UNUM_LITERAL",
-    "TOK_INUM_LITERAL",
-    "TOK_FNUM_LITERAL",
-    "TOK_R0",
-    "TOK_R1",
-    "TOK_R2",
-    "TOK_R3",
-    "TOK_R4",
-    "TOK_R5",
-    "TOK_R6",
-    "TOK_R7",
-    "TOK_R8",
-    "TOK_R9",
-    "TOK_R10",
-    "TOK_R11",
-    "TOK_R12",
-    "TOK_R13",
-    "TOK_R14",
-    "TOK_R15",
-    "TOK_R16",
-    "TOK_R17",
-    "TOK_R18",
-    "TOK_R19",
-    "TOK_R20",
-    "TOK_R21",
-    "TOK_R22",
-    "TOK_R23",
-    "TOK_R24",
-    "TOK_R25",
-    "TOK_R26",
-    "TOK_R27",
-    "TOK_R28",
-    "TOK_R29",
-    "TOK_R30",
-    "TOK_R31",
-    "TOK_SECTION",
-    "TOK_INCLUDE",
-    "TOK_INT8",
-    "TOK_INT16",
-    "TOK_INT32",
-    "TOK_INT64",
-    "TOK_UINT8",
-    "TOK_UINT16",
-    "TOK_UINT32",
-    "TOK_UINT64",
-    "TOK_GLOBAL",
-    "TOK_CONST",
-    "TOK_PLUS",
-    "TOK_MINUS",
-    "TOK_STAR",
-    "TOK_SLASH",
-    "TOK_BWSHL",
-    "TOK_BWSHR",
-    "TOK_BWAND",
-    "TOK_BWOR",
-    "TOK_XOR",
-    "TOK_BWNOT",
-    "TOK_OCURLY",
-    "TOK_CCURLY",
-    "TOK_OPAREN",
-    "TOK_CPAREN",
-    "TOK_OSQUARE",
-    "TOK_CSQUARE",
-    "TOK_EQUAL",
-    "TOK_PERIOD",
-    "TOK_COMMA",
-]
-tok_list = []
+FIRST_OP = "TOK_NOP"
+LAST_OP = "TOK_FREE"
 
-with open(args.infile, 'r') as infp:
+# condition codes in the order that the conditional forms are defined
+conditions = ["EQ", "NE", "CS", "CC", "MI", "PL", "VS", "VC",
+              "HI", "LS", "GE", "LT", "GT", "LE", "TE", "EE"]
+
+# groups of instructions that have a conditional form for every condition
+cond_groups = ["JMP", "CALL", "EXCALL", "RET", "TRAP", "TRET", "RAISE", "ERET"]
+
+# operand classes
+#   R - a register
+#   V - a value: a register, a pointer, an immediate or a float
+#   D - a destination: a register or a pointer
+#   T - a branch target: a register or an immediate
+operands = {
+    "LOAD": "RV", "STORE": "RD",
+    "MOV8": "RR", "MOV16": "RR", "MOV32": "RR", "MOV64": "RR", "MOV": "RR",
+    "MOVB8": "RRR", "MOVB16": "RRR", "MOVB32": "RRR", "MOVB64": "RRR", "MOVB": "RRR",
+    "PUSH": "V", "POP": "R",
+    "IADD": "RVV", "UADD": "RVV", "FADD": "RVV",
+    "ISUB": "RVV", "USUB": "RVV", "FSUB": "RVV",
+    "IMUL": "RVV", "UMUL": "RVV", "FMUL": "RVV",
+    "IDIV": "RVV", "UDIV": "RVV", "FDIV": "RVV",
+    "IMOD": "RVV", "UMOD": "RVV", "FMOD": "RVV",
+    "INEG": "R", "UNEG": "R", "FNEG": "R",
+    "FTU": "R", "FTI": "R", "ITF": "R", "ITU": "R", "UTF": "R", "UTI": "R",
+    "INC": "R", "DEC": "R",
+    "SHL": "RV", "SHR": "RV", "ROL": "RV", "ROR": "RV",
+    "AND": "RVV", "OR": "RVV", "XOR": "RVV", "NOT": "R",
+    "CMP": "VV", "TST": "VV",
+    "JMP": "T", "CALL": "T", "EXCALL": "T", "TRAP": "T", "RAISE": "T",
+    "ALLOCATE": "RV", "FREE": "R",
+}
+
+# instructions that set the condition flags from their result
+sets_flags = ["IADD", "UADD", "FADD", "ISUB", "USUB", "FSUB", "IMUL", "UMUL", "FMUL",
+              "IDIV", "UDIV", "FDIV", "IMOD", "UMOD", "FMOD", "INEG", "UNEG", "FNEG",
+              "INC", "DEC", "SHL", "SHR", "ROL", "ROR", "AND", "OR", "XOR", "NOT",
+              "CMP", "TST"]
 
+# what kind of transfer of control each group does
+transfer = {
+    "JMP": "OPF_JUMP", "CALL": "OPF_CALL", "EXCALL": "OPF_CALL", "TRAP": "OPF_CALL",
+    "RAISE": "OPF_CALL", "RET": "OPF_RETURN", "TRET": "OPF_RETURN", "ERET": "OPF_RETURN",
+}
+
+tok_list = []
+with open(args.infile, 'r') as infp:
+    active = False
     for line in infp:
-        line = line.strip()
-        if(line[:4] == 'TOK_'):
-            line = line.replace(',', '')
-            if not line in exclude_list:
-                tok_list.append(line)
-
-count = 0
-value = 255 - len(tok_list)
+        line = line.strip().replace(',', '')
+        if line == FIRST_OP:
+            active = True
+        if active and line[:4] == 'TOK_':
+            tok_list.append(line[4:])
+        if line == LAST_OP:
+            break
+
+
+def split_cond(name):
+    '''Return the group and condition index of a conditional instruction.'''
+    for group in cond_groups:
+        if name == group:
+            return (group, 0)
+        if name[:len(group)] == group and name[len(group):] in conditions:
+            return (group, conditions.index(name[len(group):]) + 1)
+    return (name, 0)
+
+
+entries = []
+for num, name in enumerate(tok_list, 1):
+    group, cond = split_cond(name)
+    flags = []
+    if cond != 0:
+        flags.append("OPF_READS_FLAGS")
+    if name in sets_flags:
+        flags.append("OPF_SETS_FLAGS")
+    if group in transfer:
+        flags.append(transfer[group])
+    if name == "END":
+        flags.append("OPF_STOP")
+    if cond == 0 and transfer.get(group) in ("OPF_JUMP", "OPF_RETURN"):
+        flags.append("OPF_STOP")
+    if group in cond_groups:
+        base = "OP_" + group
+    else:
+        base = "OP_" + name
+    entries.append((name, num, group, cond, base, operands.get(group, ""), flags))
+
 with open(args.outfile, 'w') as outfp:
-    outfp.write("\n// This file is generated from tokens.h.\n// DO NOT EDIT\n")
-    outfp.write("// Generated: %s\n"%(time.ctime()))
+    outfp.write("\n// This file is generated from tokens.h by gen_opcode_map.py.\n// DO NOT EDIT\n")
     outfp.write("\n#ifndef __OPCODES_H__\n#define __OPCODES_H__\n\n")
-    #outfp.write("\n#include tokens.h\n\n");
-    outfp.write("typedef enum = {\n")
+    outfp.write("#include <stdint.h>\n\n")
+    outfp.write("typedef enum {\n")
+    for name, num, group, cond, base, opnds, flags in entries:
+        outfp.write("    OP_%s = 0x%02X,\n" % (name, num))
+    outfp.write("    OP_LAST_OP = 0x%02X,\n" % (len(entries) + 1))
+    outfp.write("} opcode_t;\n\n")
+
+    outfp.write('''/*
+ * Each operand is a spec byte, which may be followed by a value. The kind is
+ * in the top 3 bits and the register number is in the bottom 5 bits. For an
+ * immediate, the bottom bits give the size of the value that follows as a
+ * power of 2, from 1 to 8 bytes. Immediates and offsets are sign extended.
+ */
+#define OPND_KIND(spec)     (((spec) >> 5) & 0x07)
+#define OPND_REG_NUM(spec)  ((spec) & 0x1F)
+#define OPND_SPEC(kind, n)  ((uint8_t)(((kind) << 5) | ((n) & 0x1F)))
+
+enum {
+    OPND_REG,           // Rn
+    OPND_REG_PTR,       // [Rn]
+    OPND_REG_OFS8,      // [Rn + ofs], 1 byte offset follows
+    OPND_REG_OFS16,     // [Rn + ofs], 2 byte offset follows
+    OPND_IMM,           // number or address, 1 to 8 bytes follow
+    OPND_IMM_PTR,       // [address], 1 to 8 bytes follow
+    OPND_FLOAT,         // 8 byte double follows
+};
+
+// operand classes, as masks of the kinds that are allowed
+#define OPND_MASK(kind) (1 << (kind))
+#define OPC_REG     (OPND_MASK(OPND_REG))
+#define OPC_PTR     (OPND_MASK(OPND_REG_PTR) | OPND_MASK(OPND_REG_OFS8) | \\
+                     OPND_MASK(OPND_REG_OFS16) | OPND_MASK(OPND_IMM_PTR))
+#define OPC_DEST    (OPC_REG | OPC_PTR)
+#define OPC_VALUE   (OPC_DEST | OPND_MASK(OPND_IMM) | OPND_MASK(OPND_FLOAT))
+#define OPC_TARGET  (OPC_REG | OPND_MASK(OPND_IMM))
+
+// opcode flags
+#define OPF_READS_FLAGS 0x01    // conditional; tests the flags
+#define OPF_SETS_FLAGS  0x02    // sets the condition flags from the result
+#define OPF_JUMP        0x04    // transfers control to the operand
+#define OPF_CALL        0x08    // transfers control and returns
+#define OPF_RETURN      0x10    // returns to the caller
+#define OPF_STOP        0x20    // never falls through to the next instruction
+
+#define OP_MAX_OPERANDS 3
+
+typedef struct {
+    const char* name;
+    uint8_t noperands;
+    uint8_t flags;
+    uint8_t cond;               // 0 for always, else 1 to 16 for EQ to EE
+    uint8_t base;               // opcode of the unconditional form
+    uint8_t operands[OP_MAX_OPERANDS];  // class of each operand
+} opcode_info_t;
+
+extern const opcode_info_t opcode_table[256];
+
+/*
+ * Bytes of value that follow each spec byte, or -1 if the spec byte is not
+ * valid. This is the decode table for the assembler, the VM loader and the
+ * disassembler.
+ */
+extern const int8_t operand_payload[256];
+
+''')
+    outfp.write("#define NUM_CONDITIONS %d\n\n" % len(conditions))
+    outfp.write("#endif\n")
+
+classes = {"R": "OPC_REG", "V": "OPC_VALUE", "D": "OPC_DEST", "T": "OPC_TARGET"}
 
-    #tok_list.sort()
-    for line in tok_list:
-        outfp.write("    %s = 0x%02X,\n"%(line.replace("TOK_", "OP_"), value))
-        count += 1
-        value += 1
+with open(args.tabfile, 'w') as outfp:
+    outfp.write("\n// This file is generated from tokens.h by gen_opcode_map.py.\n// DO NOT EDIT\n")
+    outfp.write('\n#include "opcodes.h"\n\n')
+    outfp.write("const opcode_info_t opcode_table[256] = {\n")
+    for name, num, group, cond, base, opnds, flags in entries:
+        opnd_str = ", ".join([classes[c] for c in opnds]) if opnds else "0"
+        flag_str = " | ".join(flags) if flags else "0"
+        outfp.write('    [OP_%s] = { "%s", %d, %s, %d, %s, { %s } },\n'
+                    % (name, name.lower(), len(opnds), flag_str, cond, base, opnd_str))
+    outfp.write("};\n\n")
 
-    outfp.write("} opcode_t;\n\n#endif\n\n")
+    # kinds in the order of the enum in opcodes.h
+    def payload(spec):
+        kind = spec >> 5
+        low = spec & 0x1F
+        if kind in (0, 1):
+            return 0
+        if kind == 2:
+            return 1
+        if kind == 3:
+            return 2
+        if kind in (4, 5):
+            return (1 << low) if low <= 3 else -1
+        if kind == 6:
+            return 8
+        return -1
 
+    outfp.write("const int8_t operand_payload[256] = {")
+    for spec in range(256):
+        if spec % 16 == 0:
+            outfp.write("\n   ")
+        outfp.write(" %d," % payload(spec))
+    outfp.write("\n};\n")
 
-print("Finished: Processed %d tokens"%(count))
+print("Finished: Processed %d tokens" % (len(entries)))
@@ -0,0 +1,126 @@
+/*
+ * Running a program that was compiled ahead of time.
+ *
+ * The aot tool turns the code of an image into C, and the C compiler turns
+ * that into a shared library, which is loaded here with -a. The handler
+ * slot of each instruction where compiled code can be entered is patched
+ * to VM_OP_AOT, so the interpreter goes into the compiled code the next
+ * time it gets there, and the compiled code hands back to the interpreter
+ * for whatever it does not do itself, such as TRAP, exceptions and jumps
+ * through a register. The library is checked against the code of the image
+ * it is loaded with, since the compiled code only knows the code by its
+ * instruction numbers.
+ *
+ * The compiled code does not count branches, so it cannot be used with
+ * record and replay, and it has no write barrier for the collector.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "aot.h"
+
+struct vm_aot_t
+{
+    void* lib;
+    vm_handler_t* funcs;     // by instruction index, NULL if not an entry
+};
+
+/*
+ * The handler for VM_OP_AOT. If the compiled code gives the instruction
+ * straight back, it is one that the compiled code leaves to the
+ * interpreter, so it is run here.
+ */
+const vm_insn_t* aot_enter(vm_t* vm, const vm_insn_t* insn)
+{
+    const vm_insn_t* next = vm->aot->funcs[insn - vm->insns](vm, insn);
+
+    if(next == insn)
+        return vm_handlers[insn->insn.opcode](vm, insn);
+    return next;
+}
+
+/*
+ * FNV-1a, to tell whether a library was compiled from this code.
+ */
+uint64_t aot_code_hash(const uint8_t* code, size_t size)
+{
+    uint64_t hash = 0xcbf29ce484222325ull;
+
+    for(size_t i = 0; i < size; i++)
+        hash = (hash ^ code[i]) * 0x100000001b3ull;
+    return hash;
+}
+
+/*
+ * Load a compiled program for the loaded image. Returns non-zero and prints
+ * the reason if it cannot be used.
+ */
+int aot_load(vm_t* vm, const char* fname)
+{
+    char path[4096];
+
+    // dlopen() only looks in the current directory if it is asked to
+    snprintf(path, sizeof(path), "%s%s", (strchr(fname, '/') == NULL)? "./": "", fname);
+
+    void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+
+    if(lib == NULL)
+    {
+        fprintf(stderr, "ERROR: cannot load \"%s\": %s\n", fname, dlerror());
+        return 1;
+    }
+
+    const aot_program_t* prog = dlsym(lib, AOT_PROGRAM);
+
+    if(prog == NULL || prog->abi != AOT_ABI || prog->vm_size != sizeof(vm_t))
+    {
+        fprintf(stderr, "ERROR: \"%s\" was not compiled by this version of aot\n", fname);
+        dlclose(lib);
+        return 1;
+    }
+    if(prog->code_size != vm->image.header->code_size ||
+       prog->code_hash != aot_code_hash(vm->image.code, vm->image.header->code_size))
+    {
+        fprintf(stderr, "ERROR: \"%s\" was compiled from a different program\n", fname);
+        dlclose(lib);
+        return 1;
+    }
+
+    vm->aot = calloc(1, sizeof(struct vm_aot_t));
+    vm->aot->funcs = calloc(vm->ninsns + 1, sizeof(vm_handler_t));
+    if(vm->aot->funcs == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", (vm->ninsns + 1) * sizeof(vm_handler_t));
+        exit(1);
+    }
+    vm->aot->lib = lib;
+
+    for(uint32_t i = 0; i < prog->nentries; i++)
+    {
+        const aot_entry_t* entry = &prog->entries[i];
+
+        if(entry->index >= vm->ninsns)
+            continue;
+        vm->aot->funcs[entry->index] = entry->func;
+        vm->insns[entry->index].op = VM_OP_AOT;
+    }
+
+    return 0;
+}
+
+void aot_unload(vm_t* vm)
+{
+    if(vm->aot == NULL)
+        return;
+
+    for(size_t i = 0; i < vm->ninsns; i++)
+        if(vm->aot->funcs[i] != NULL)
+            vm->insns[i].op = vm->insns[i].plain;
+
+    dlclose(vm->aot->lib);
+    free(vm->aot->funcs);
+    free(vm->aot);
+    vm->aot = NULL;
+}
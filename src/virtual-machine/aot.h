@@ -0,0 +1,405 @@
+#ifndef _AOT_H_
+#define _AOT_H_
+
+/*
+ * The interface between the VM and a program that was compiled ahead of
+ * time by the aot tool, and the helpers that the generated C is written
+ * with.
+ *
+ * The library exports one aot_program_t, named by AOT_PROGRAM. Each entry
+ * is an instruction, by its index in vm->insns, where the interpreter can
+ * go into compiled code, and the function that runs from there. A function
+ * has the same type as a handler: it returns the next instruction for the
+ * interpreter to run, or NULL if the VM stopped.
+ *
+ * The helpers do exactly what the handlers in execute.c do, and must be
+ * kept the same as them. They take the flags as a pointer, so that the
+ * compiler can keep them in a local and drop the ones that are never used.
+ */
+#include <string.h>
+#include <math.h>
+
+#include "virtual_machine.h"
+
+// changes when vm_t or the way the generated code uses it changes
+#define AOT_ABI         6
+
+#define AOT_PROGRAM     "aot_program"
+
+// compiled calls nest on the C stack up to this deep
+#define AOT_MAX_DEPTH   4096
+
+typedef struct
+{
+    uint32_t index;          // of the instruction in vm->insns
+    vm_handler_t func;
+} aot_entry_t;
+
+typedef struct
+{
+    uint32_t abi;
+    uint32_t vm_size;        // sizeof(vm_t)
+    uint64_t code_size;
+    uint64_t code_hash;      // aot_code_hash() of the code segment
+    uint32_t nentries;
+    const aot_entry_t* entries;
+} aot_program_t;
+
+/*
+ * A trace tree compiled by the JIT exports its function as "trace" and one
+ * jit_tree_t, named by JIT_TREE, that has what is needed to load it again
+ * from the code cache. The steps of all of the traces are one after
+ * another, three words each: the instruction, the instruction after it in
+ * the trace, and whether a conditional instruction was met.
+ */
+#define JIT_TREE        "jit_tree"
+#define JIT_CLOSES      0x80000000u     // in nsteps: the trace goes back to the start
+
+typedef struct
+{
+    uint32_t abi;
+    uint32_t vm_size;        // sizeof(vm_t)
+    uint64_t code_size;
+    uint64_t code_hash;      // aot_code_hash() of the code segment
+    uint32_t anchor;         // instruction where the tree starts
+    uint32_t ntraces;
+    const uint32_t* nsteps;  // by trace
+    const uint32_t* steps;
+    uint32_t nexits;
+    const int8_t* branches;  // by exit: the trace it goes to, or -1
+} jit_tree_t;
+
+static inline uint8_t* aot_mem(vm_t* vm, const vm_insn_t* insn, uint64_t addr, uint64_t size)
+{
+    if(addr > vm->mem_size || size > vm->mem_size - addr)
+        vm_fault(vm, insn, "memory reference out of range");
+
+    return &vm->mem[addr];
+}
+
+static inline uint64_t aot_read(vm_t* vm, const vm_insn_t* insn, uint64_t addr)
+{
+    uint64_t value;
+
+    memcpy(&value, aot_mem(vm, insn, addr, 8), 8);
+    return value;
+}
+
+static inline void aot_write(vm_t* vm, const vm_insn_t* insn, uint64_t addr, uint64_t value)
+{
+    memcpy(aot_mem(vm, insn, addr, 8), &value, 8);
+}
+
+static inline double aot_float(uint64_t bits)
+{
+    double d;
+
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static inline uint64_t aot_bits(double d)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &d, sizeof(d));
+    return bits;
+}
+
+static inline void aot_set_flags(uint32_t* f, uint64_t result, uint32_t flags)
+{
+    flags |= (result == 0)? VM_FLAG_Z: 0;
+    flags |= ((int64_t)result < 0)? VM_FLAG_N: 0;
+    *f = (*f & ~VM_FLAG_NZCV) | flags;
+}
+
+static inline void aot_set_float_flags(uint32_t* f, double a, double b, double result)
+{
+    uint32_t flags = (result < 0)? VM_FLAG_N: 0;
+
+    if(isinf(result) && !isinf(a) && !isinf(b))
+        flags |= VM_FLAG_V;
+    *f = (*f & ~VM_FLAG_NZCV) | flags;
+}
+
+/*
+ * The condition is a constant in the generated code, so this folds away.
+ */
+static inline int aot_cond(int cond, uint32_t flags)
+{
+    int z = (flags & VM_FLAG_Z) != 0;
+    int n = (flags & VM_FLAG_N) != 0;
+    int c = (flags & VM_FLAG_C) != 0;
+    int v = (flags & VM_FLAG_V) != 0;
+
+    switch (cond)
+    {
+        case 0: return 1;
+        case 1: return z;
+        case 2: return !z;
+        case 3: return c;
+        case 4: return !c;
+        case 5: return n;
+        case 6: return !n;
+        case 7: return v;
+        case 8: return !v;
+        case 9: return c && !z;
+        case 10: return !c || z;
+        case 11: return n == v;
+        case 12: return n != v;
+        case 13: return !z && n == v;
+        case 14: return z || n != v;
+        case 15: return (flags & VM_FLAG_T) != 0;
+        case 16: return (flags & VM_FLAG_E) != 0;
+        default: return 0;
+    }
+}
+
+/************************
+ * arithmetic
+ */
+#define AOT_INT_OP(name, builtin) \
+static inline uint64_t name(uint32_t* f, uint64_t a, uint64_t b) \
+{ \
+    int64_t r; \
+    int over = builtin((int64_t)a, (int64_t)b, &r); \
+    aot_set_flags(f, (uint64_t)r, over? VM_FLAG_V: 0); \
+    return (uint64_t)r; \
+}
+
+#define AOT_UINT_OP(name, builtin) \
+static inline uint64_t name(uint32_t* f, uint64_t a, uint64_t b) \
+{ \
+    uint64_t r; \
+    int over = builtin(a, b, &r); \
+    *f = (*f & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0) | (over? VM_FLAG_C: 0); \
+    return r; \
+}
+
+#define AOT_FLOAT_OP(name, expr) \
+static inline uint64_t name(uint32_t* f, uint64_t x, uint64_t y) \
+{ \
+    double a = aot_float(x); \
+    double b = aot_float(y); \
+    double r = (expr); \
+    aot_set_float_flags(f, a, b, r); \
+    return aot_bits(r); \
+}
+
+AOT_INT_OP(aot_iadd, __builtin_add_overflow)
+AOT_INT_OP(aot_isub, __builtin_sub_overflow)
+AOT_INT_OP(aot_imul, __builtin_mul_overflow)
+AOT_UINT_OP(aot_uadd, __builtin_add_overflow)
+AOT_UINT_OP(aot_usub, __builtin_sub_overflow)
+AOT_UINT_OP(aot_umul, __builtin_mul_overflow)
+AOT_FLOAT_OP(aot_fadd, a + b)
+AOT_FLOAT_OP(aot_fsub, a - b)
+AOT_FLOAT_OP(aot_fmul, a * b)
+AOT_FLOAT_OP(aot_fdiv, a / b)
+AOT_FLOAT_OP(aot_fmod, fmod(a, b))
+
+static inline uint64_t aot_int_divide(vm_t* vm, const vm_insn_t* insn, uint32_t* f, uint64_t x, uint64_t y, int modulo)
+{
+    int64_t a = (int64_t)x;
+    int64_t b = (int64_t)y;
+    int64_t r;
+    uint32_t flags = 0;
+
+    if(b == 0)
+        vm_fault(vm, insn, "divide by zero");
+
+    if(a == INT64_MIN && b == -1)
+    {
+        r = modulo? 0: INT64_MIN;
+        flags = VM_FLAG_V;
+    }
+    else
+        r = modulo? a % b: a / b;
+
+    aot_set_flags(f, (uint64_t)r, flags);
+    return (uint64_t)r;
+}
+
+static inline uint64_t aot_uint_divide(vm_t* vm, const vm_insn_t* insn, uint32_t* f, uint64_t a, uint64_t b, int modulo)
+{
+    if(b == 0)
+        vm_fault(vm, insn, "divide by zero");
+
+    uint64_t r = modulo? a % b: a / b;
+
+    *f = (*f & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0);
+    return r;
+}
+
+static inline uint64_t aot_ineg(uint32_t* f, uint64_t a)
+{
+    int64_t r;
+    int over = __builtin_sub_overflow((int64_t)0, (int64_t)a, &r);
+
+    aot_set_flags(f, (uint64_t)r, over? VM_FLAG_V: 0);
+    return (uint64_t)r;
+}
+
+static inline uint64_t aot_uneg(uint32_t* f, uint64_t a)
+{
+    uint64_t r = -a;
+
+    *f = (*f & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0);
+    return r;
+}
+
+static inline uint64_t aot_fneg(uint32_t* f, uint64_t a)
+{
+    double r = -aot_float(a);
+
+    *f = (*f & ~VM_FLAG_NZCV) | ((r < 0)? VM_FLAG_N: 0);
+    return aot_bits(r);
+}
+
+static inline uint64_t aot_itu(uint64_t x)
+{
+    int64_t a = (int64_t)x;
+
+    return (a < 0)? -(uint64_t)a: (uint64_t)a;
+}
+
+static inline uint64_t aot_inc(uint32_t* f, uint64_t a)
+{
+    int64_t r;
+    int over = __builtin_add_overflow((int64_t)a, (int64_t)1, &r);
+
+    aot_set_flags(f, (uint64_t)r, over? VM_FLAG_V: 0);
+    return (uint64_t)r;
+}
+
+static inline uint64_t aot_dec(uint32_t* f, uint64_t a)
+{
+    int64_t r;
+    int over = __builtin_sub_overflow((int64_t)a, (int64_t)1, &r);
+
+    aot_set_flags(f, (uint64_t)r, over? VM_FLAG_V: 0);
+    return (uint64_t)r;
+}
+
+/************************
+ * bits
+ */
+static inline void aot_set_shift_flags(uint32_t* f, uint64_t r, int carry)
+{
+    uint32_t flags = (r == 0)? VM_FLAG_Z: 0;
+
+    flags |= carry? VM_FLAG_C: 0;
+    flags |= (r >> 63)? VM_FLAG_V: 0;
+    *f = (*f & ~VM_FLAG_NZCV) | flags;
+}
+
+static inline uint64_t aot_shl(uint32_t* f, uint64_t a, uint64_t n)
+{
+    uint64_t r = (n >= 64)? 0: a << n;
+    int carry = (n >= 64)? (a != 0): (n > 0 && (a >> (64 - n)) != 0);
+
+    aot_set_shift_flags(f, r, carry);
+    return r;
+}
+
+static inline uint64_t aot_shr(uint32_t* f, uint64_t a, uint64_t n)
+{
+    uint64_t r = (n >= 64)? 0: a >> n;
+    int carry = (n >= 64)? (a != 0): (n > 0 && (a & ((1ull << n) - 1)) != 0);
+
+    aot_set_shift_flags(f, r, carry);
+    return r;
+}
+
+static inline uint64_t aot_rol(uint32_t* f, uint64_t a, uint64_t count)
+{
+    unsigned n = count & 63;
+    uint64_t r = (n == 0)? a: (a << n) | (a >> (64 - n));
+
+    aot_set_shift_flags(f, r, 0);
+    return r;
+}
+
+static inline uint64_t aot_ror(uint32_t* f, uint64_t a, uint64_t count)
+{
+    unsigned n = count & 63;
+    uint64_t r = (n == 0)? a: (a >> n) | (a << (64 - n));
+
+    aot_set_shift_flags(f, r, 0);
+    return r;
+}
+
+static inline uint64_t aot_logic(uint32_t* f, uint64_t r)
+{
+    *f = (*f & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0);
+    return r;
+}
+
+static inline void aot_cmp(uint32_t* f, uint64_t a, uint64_t b)
+{
+    int64_t r;
+    uint32_t flags = (a >= b)? VM_FLAG_C: 0;
+
+    if(__builtin_sub_overflow((int64_t)a, (int64_t)b, &r))
+        flags |= VM_FLAG_V;
+    aot_set_flags(f, (uint64_t)r, flags);
+}
+
+/************************
+ * moving data
+ */
+static inline void aot_move(vm_t* vm, const vm_insn_t* insn, uint64_t dest, uint64_t src, uint64_t size)
+{
+    uint8_t* from = aot_mem(vm, insn, src, size);
+    uint8_t* to = aot_mem(vm, insn, dest, size);
+
+    memcpy(to, from, size);
+}
+
+static inline void aot_move_block(vm_t* vm, const vm_insn_t* insn, uint64_t dest, uint64_t src, uint64_t count, uint64_t size)
+{
+    if(count > vm->mem_size / size)
+        vm_fault(vm, insn, "memory reference out of range");
+
+    uint8_t* from = aot_mem(vm, insn, src, count * size);
+    uint8_t* to = aot_mem(vm, insn, dest, count * size);
+
+    memmove(to, from, count * size);
+}
+
+static inline void aot_push(vm_t* vm, const vm_insn_t* insn, uint64_t value)
+{
+    if(vm->sp >= vm->stack_size)
+        vm_fault(vm, insn, "stack overflow");
+    vm->stack[vm->sp++] = value;
+}
+
+static inline uint64_t aot_pop(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->sp == 0)
+        vm_fault(vm, insn, "stack underflow");
+    return vm->stack[--vm->sp];
+}
+
+/*
+ * RET, once the registers and flags are back in vm. Returning with nothing
+ * on the stack ends the program.
+ */
+static inline const vm_insn_t* aot_return(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->sp == 0)
+    {
+        vm->status = VM_ENDED;
+        vm->stop_insn = insn;
+        return NULL;
+    }
+
+    const vm_insn_t* target = vm_find_insn(vm, aot_pop(vm, insn));
+
+    if(target == NULL)
+        vm_fault(vm, insn, "return to an address that is not an instruction");
+    vm->flags &= ~VM_FLAG_NZCV;
+    return target;
+}
+
+#endif /* _AOT_H_ */
@@ -0,0 +1,437 @@
+/*
+ * Writing decoded instructions as C, for the aot tool and the JIT.
+ *
+ * The C is written with the helpers in aot.h, which do what the handlers
+ * do. The registers are locals named r0 to r31, the flags are in a local
+ * that the caller names, I is vm->insns and vm is the vm_t. Only the
+ * instructions that do not change where the program goes are written
+ * here, since the aot tool and the JIT do that differently.
+ *
+ * The JIT knows the values of some registers. Those are written as
+ * constants where the instruction reads them, and the C compiler folds
+ * them in.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "virtual_machine.h"
+
+// aot.h and the headers it needs, put together by cgen_header.cmake
+extern const char cgen_header[];
+
+static const vm_insn_t* cur_insns;
+static size_t cur_k;
+static const cgen_consts_t* cur_consts;
+
+/*
+ * An operand as a C expression. The results are good until the fourth call.
+ */
+static const char* value(int n)
+{
+    static char bufs[4][96];
+    static int next;
+    const decoded_operand_t* opnd = &cur_insns[cur_k].insn.operands[n];
+    char* buf = bufs[next++ & 3];
+
+    switch (opnd->kind)
+    {
+        case OPND_REG:
+            if(cur_consts != NULL && (cur_consts->known & (1u << opnd->reg)))
+                snprintf(buf, sizeof(bufs[0]), "0x%lxull", cur_consts->values[opnd->reg]);
+            else
+                snprintf(buf, sizeof(bufs[0]), "r%d", opnd->reg);
+            break;
+        case OPND_IMM:
+        case OPND_FLOAT:
+            snprintf(buf, sizeof(bufs[0]), "0x%lxull", (uint64_t)opnd->value);
+            break;
+        case OPND_REG_PTR:
+            snprintf(buf, sizeof(bufs[0]), "aot_read(vm, &I[%lu], r%d)", cur_k, opnd->reg);
+            break;
+        case OPND_REG_OFS8:
+        case OPND_REG_OFS16:
+            snprintf(buf, sizeof(bufs[0]), "aot_read(vm, &I[%lu], r%d + 0x%lxull)", cur_k, opnd->reg, (uint64_t)opnd->value);
+            break;
+        default:
+            snprintf(buf, sizeof(bufs[0]), "aot_read(vm, &I[%lu], 0x%lxull)", cur_k, (uint64_t)opnd->value);
+            break;
+    }
+
+    return buf;
+}
+
+// the register an operand names, which is what REG() is in execute.c
+static int reg(int n)
+{
+    return cur_insns[cur_k].insn.operands[n].reg;
+}
+
+// the same, where the instruction only reads it
+static const char* src(int n)
+{
+    static char bufs[3][32];
+    static int next;
+    char* buf = bufs[next++ % 3];
+    int r = reg(n);
+
+    if(cur_consts != NULL && (cur_consts->known & (1u << r)))
+        snprintf(buf, sizeof(bufs[0]), "0x%lxull", cur_consts->values[r]);
+    else
+        snprintf(buf, sizeof(bufs[0]), "r%d", r);
+    return buf;
+}
+
+static void store_value(FILE* out, int n, const char* expr)
+{
+    const decoded_operand_t* opnd = &cur_insns[cur_k].insn.operands[n];
+
+    switch (opnd->kind)
+    {
+        case OPND_REG:
+            fprintf(out, "r%d = %s;\n", opnd->reg, expr);
+            break;
+        case OPND_REG_PTR:
+            fprintf(out, "aot_write(vm, &I[%lu], r%d, %s);\n", cur_k, opnd->reg, expr);
+            break;
+        case OPND_REG_OFS8:
+        case OPND_REG_OFS16:
+            fprintf(out, "aot_write(vm, &I[%lu], r%d + 0x%lxull, %s);\n", cur_k, opnd->reg, (uint64_t)opnd->value, expr);
+            break;
+        default:
+            fprintf(out, "aot_write(vm, &I[%lu], 0x%lxull, %s);\n", cur_k, (uint64_t)opnd->value, expr);
+            break;
+    }
+}
+
+static const char* flag_name(int base)
+{
+    switch (base)
+    {
+        case OP_STZ: case OP_CLZ: return "VM_FLAG_Z";
+        case OP_STC: case OP_CLC: return "VM_FLAG_C";
+        case OP_STN: case OP_CLN: return "VM_FLAG_N";
+        case OP_STV: case OP_CLV: return "VM_FLAG_V";
+        case OP_STT: case OP_CLT: return "VM_FLAG_T";
+        default: return "VM_FLAG_E";
+    }
+}
+
+static const char* arith_helper(int base)
+{
+    switch (base)
+    {
+        case OP_IADD: return "aot_iadd";
+        case OP_UADD: return "aot_uadd";
+        case OP_FADD: return "aot_fadd";
+        case OP_ISUB: return "aot_isub";
+        case OP_USUB: return "aot_usub";
+        case OP_FSUB: return "aot_fsub";
+        case OP_IMUL: return "aot_imul";
+        case OP_UMUL: return "aot_umul";
+        case OP_FMUL: return "aot_fmul";
+        case OP_FDIV: return "aot_fdiv";
+        default: return "aot_fmod";
+    }
+}
+
+static int move_size(int base)
+{
+    switch (base)
+    {
+        case OP_MOV8: case OP_MOVB8: return 1;
+        case OP_MOV16: case OP_MOVB16: return 2;
+        case OP_MOV32: case OP_MOVB32: return 4;
+        default: return 8;
+    }
+}
+
+/*
+ * Write instruction k, unless it is one that can change where the program
+ * goes, in which case return non-zero. flags names the local that gets
+ * the N, Z, C and V flags it sets, and consts, if it is not NULL, has the
+ * registers with known values.
+ */
+int cgen_data_op(FILE* out, const char* in, vm_t* vm, size_t k, const char* flags, const cgen_consts_t* consts)
+{
+    // a conversion that vm_infer_types() dropped is written as a UTI
+    const opcode_info_t* info = &opcode_table[vm->insns[k].plain];
+    int a = vm->insns[k].insn.operands[0].reg;
+
+    cur_insns = vm->insns;
+    cur_k = k;
+    cur_consts = consts;
+
+    switch (info->base)
+    {
+        case OP_NOP:
+        case OP_RESUME:
+        case OP_UTI:
+            fprintf(out, "%s;\n", in);
+            break;
+        case OP_STZ: case OP_STC: case OP_STN: case OP_STV: case OP_STT: case OP_STE:
+            fprintf(out, "%s%s |= %s;\n", in, flags, flag_name(info->base));
+            break;
+        case OP_CLZ: case OP_CLC: case OP_CLN: case OP_CLV: case OP_CLT: case OP_CLE:
+            fprintf(out, "%s%s &= ~%s;\n", in, flags, flag_name(info->base));
+            break;
+        case OP_LOAD:
+            fprintf(out, "%sr%d = %s;\n", in, a, value(1));
+            break;
+        case OP_STORE:
+            fputs(in, out);
+            store_value(out, 1, src(0));
+            break;
+        case OP_MOV8: case OP_MOV16: case OP_MOV32: case OP_MOV64: case OP_MOV:
+            fprintf(out, "%saot_move(vm, &I[%lu], %s, %s, %d);\n", in, k, src(0), src(1), move_size(info->base));
+            break;
+        case OP_MOVB8: case OP_MOVB16: case OP_MOVB32: case OP_MOVB64: case OP_MOVB:
+            fprintf(out, "%saot_move_block(vm, &I[%lu], %s, %s, %s, %d);\n",
+                    in, k, src(0), src(1), src(2), move_size(info->base));
+            break;
+        case OP_PUSH:
+            fprintf(out, "%saot_push(vm, &I[%lu], %s);\n", in, k, value(0));
+            break;
+        case OP_POP:
+            fprintf(out, "%sr%d = aot_pop(vm, &I[%lu]);\n", in, a, k);
+            break;
+        case OP_IADD: case OP_UADD: case OP_FADD:
+        case OP_ISUB: case OP_USUB: case OP_FSUB:
+        case OP_IMUL: case OP_UMUL: case OP_FMUL:
+        case OP_FDIV: case OP_FMOD:
+            fprintf(out, "%sr%d = %s(&%s, %s, %s);\n", in, a, arith_helper(info->base), flags, value(1), value(2));
+            break;
+        case OP_IDIV: case OP_IMOD:
+            fprintf(out, "%sr%d = aot_int_divide(vm, &I[%lu], &%s, %s, %s, %d);\n",
+                    in, a, k, flags, value(1), value(2), info->base == OP_IMOD);
+            break;
+        case OP_UDIV: case OP_UMOD:
+            fprintf(out, "%sr%d = aot_uint_divide(vm, &I[%lu], &%s, %s, %s, %d);\n",
+                    in, a, k, flags, value(1), value(2), info->base == OP_UMOD);
+            break;
+        case OP_INEG:
+            fprintf(out, "%sr%d = aot_ineg(&%s, %s);\n", in, a, flags, src(0));
+            break;
+        case OP_UNEG:
+            fprintf(out, "%sr%d = aot_uneg(&%s, %s);\n", in, a, flags, src(0));
+            break;
+        case OP_FNEG:
+            fprintf(out, "%sr%d = aot_fneg(&%s, %s);\n", in, a, flags, src(0));
+            break;
+        case OP_FTU:
+            fprintf(out, "%sr%d = (uint64_t)fabs(aot_float(%s));\n", in, a, src(0));
+            break;
+        case OP_FTI:
+            fprintf(out, "%sr%d = (uint64_t)(int64_t)aot_float(%s);\n", in, a, src(0));
+            break;
+        case OP_ITF:
+            fprintf(out, "%sr%d = aot_bits((double)(int64_t)%s);\n", in, a, src(0));
+            break;
+        case OP_UTF:
+            fprintf(out, "%sr%d = aot_bits((double)%s);\n", in, a, src(0));
+            break;
+        case OP_ITU:
+            fprintf(out, "%sr%d = aot_itu(%s);\n", in, a, src(0));
+            break;
+        case OP_INC:
+            fprintf(out, "%sr%d = aot_inc(&%s, %s);\n", in, a, flags, src(0));
+            break;
+        case OP_DEC:
+            fprintf(out, "%sr%d = aot_dec(&%s, %s);\n", in, a, flags, src(0));
+            break;
+        case OP_SHL: case OP_SHR: case OP_ROL: case OP_ROR:
+            fprintf(out, "%sr%d = aot_%s(&%s, %s, %s);\n", in, a, info->name, flags, src(0), value(1));
+            break;
+        case OP_AND:
+            fprintf(out, "%sr%d = aot_logic(&%s, %s & %s);\n", in, a, flags, value(1), value(2));
+            break;
+        case OP_OR:
+            fprintf(out, "%sr%d = aot_logic(&%s, %s | %s);\n", in, a, flags, value(1), value(2));
+            break;
+        case OP_XOR:
+            fprintf(out, "%sr%d = aot_logic(&%s, %s ^ %s);\n", in, a, flags, value(1), value(2));
+            break;
+        case OP_NOT:
+            fprintf(out, "%sr%d = aot_logic(&%s, ~%s);\n", in, a, flags, src(0));
+            break;
+        case OP_CMP:
+            fprintf(out, "%saot_cmp(&%s, %s, %s);\n", in, flags, value(0), value(1));
+            break;
+        case OP_TST:
+            fprintf(out, "%saot_set_flags(&%s, %s & %s, 0);\n", in, flags, value(0), value(1));
+            break;
+        case OP_ALLOCATE:
+            fprintf(out, "%sr%d = heap_allocate(vm, %s);\n", in, a, value(1));
+            break;
+        case OP_FREE:
+            fprintf(out, "%sif(heap_free(vm, %s))\n%s    vm_fault(vm, &I[%lu], \"free of memory that was not allocated\");\n",
+                    in, src(0), in, k);
+            break;
+        default:
+            return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * An operand as a C expression, for the instructions that cgen_data_op()
+ * does not write.
+ */
+const char* cgen_value(vm_t* vm, size_t k, int n, const cgen_consts_t* consts)
+{
+    cur_insns = vm->insns;
+    cur_k = k;
+    cur_consts = consts;
+    return value(n);
+}
+
+/*
+ * Whether an instruction that cgen_data_op() writes sets the register in
+ * its first operand.
+ */
+int cgen_sets_reg(int base)
+{
+    switch (base)
+    {
+        case OP_LOAD: case OP_POP: case OP_ALLOCATE:
+        case OP_IADD: case OP_UADD: case OP_FADD:
+        case OP_ISUB: case OP_USUB: case OP_FSUB:
+        case OP_IMUL: case OP_UMUL: case OP_FMUL:
+        case OP_IDIV: case OP_UDIV: case OP_FDIV:
+        case OP_IMOD: case OP_UMOD: case OP_FMOD:
+        case OP_INEG: case OP_UNEG: case OP_FNEG:
+        case OP_FTU: case OP_FTI: case OP_ITF: case OP_ITU: case OP_UTF: case OP_UTI:
+        case OP_INC: case OP_DEC:
+        case OP_SHL: case OP_SHR: case OP_ROL: case OP_ROR:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_NOT:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * The register that an instruction which cgen_data_op() writes sets, or -1
+ * if it sets none. STORE sets its second operand when that is a register.
+ */
+int cgen_dest_reg(const vm_insn_t* insn)
+{
+    const decoded_operand_t* opnds = insn->insn.operands;
+    int base = opcode_table[insn->insn.opcode].base;
+
+    if(base == OP_STORE)
+        return (opnds[1].kind == OPND_REG)? opnds[1].reg: -1;
+    if(cgen_sets_reg(base) && opnds[0].kind == OPND_REG)
+        return opnds[0].reg;
+    return -1;
+}
+
+/*
+ * The registers that an instruction names.
+ */
+uint32_t cgen_regs(const vm_insn_t* insn)
+{
+    uint32_t regs = 0;
+
+    for(int n = 0; n < insn->insn.noperands; n++)
+        if(insn->insn.operands[n].kind <= OPND_REG_OFS16)
+            regs |= 1u << insn->insn.operands[n].reg;
+    return regs;
+}
+
+/*
+ * Put the locals back in the vm_t, or take them out again.
+ */
+void cgen_spill(FILE* out, const char* in, uint32_t regs)
+{
+    fprintf(out, "%svm->flags = f;\n", in);
+    for(int r = 0; r < VM_NUM_REGS; r++)
+        if(regs & (1u << r))
+            fprintf(out, "%svm->regs[%d] = r%d;\n", in, r, r);
+}
+
+void cgen_reload(FILE* out, const char* in, uint32_t regs)
+{
+    fprintf(out, "%sf = vm->flags;\n", in);
+    for(int r = 0; r < VM_NUM_REGS; r++)
+        if(regs & (1u << r))
+            fprintf(out, "%sr%d = vm->regs[%d];\n", in, r, r);
+}
+
+/*
+ * Run the compiler and wait for it. Returns non-zero if it failed.
+ */
+static int run(char** argv)
+{
+    int status;
+    pid_t pid = fork();
+
+    if(pid == 0)
+    {
+        execvp(argv[0], argv);
+        fprintf(stderr, "ERROR: cannot run \"%s\": %s\n", argv[0], strerror(errno));
+        _exit(127);
+    }
+    if(pid < 0 || waitpid(pid, &status, 0) < 0)
+    {
+        fprintf(stderr, "ERROR: cannot run \"%s\": %s\n", argv[0], strerror(errno));
+        return 1;
+    }
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        fprintf(stderr, "ERROR: \"%s\" failed\n", argv[0]);
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Build a shared library from the C with the system C compiler, which is
+ * $CC if it is set. Returns non-zero if it failed; the compiler says why.
+ *
+ * The C includes aot.h. The one built into the library is written to a
+ * directory of its own for each compile, so the source tree is not needed.
+ */
+int cgen_compile(const char* cfile, const char* outfile)
+{
+    const char* cc = getenv("CC");
+    char dir[] = "/tmp/cgenXXXXXX";
+    char header[sizeof(dir) + 8];
+    char include[sizeof(dir) + 2];
+    char* argv[] = {
+        (char*)((cc != NULL && *cc != '\0')? cc: "cc"),
+        "-O2", "-fPIC", "-shared", include,
+        "-o", (char*)outfile, (char*)cfile, "-lm",
+        NULL
+    };
+
+    if(mkdtemp(dir) == NULL)
+    {
+        fprintf(stderr, "ERROR: cannot make a directory for aot.h: %s\n", strerror(errno));
+        return 1;
+    }
+    snprintf(header, sizeof(header), "%s/aot.h", dir);
+    snprintf(include, sizeof(include), "-I%s", dir);
+
+    FILE* fp = fopen(header, "w");
+    int ret = (fp == NULL);
+
+    if(fp != NULL)
+    {
+        ret = (fputs(cgen_header, fp) == EOF);
+        ret |= (fclose(fp) != 0);
+    }
+    if(ret)
+        fprintf(stderr, "ERROR: cannot write \"%s\": %s\n", header, strerror(errno));
+    else
+        ret = run(argv);
+
+    unlink(header);
+    rmdir(dir);
+    return ret;
+}
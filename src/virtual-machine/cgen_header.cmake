@@ -0,0 +1,20 @@
+# Writes OUTPUT, a C file that defines cgen_header, the text of HEADERS put
+# together in the order given. The headers include each other with quotes, so
+# those lines are left out; each one is already in the text above it. The C
+# that the aot tool and the JIT write includes this as aot.h, so it can be
+# compiled without the source tree.
+
+set(text "")
+foreach(header ${HEADERS})
+    file(READ "${header}" body)
+    string(REGEX REPLACE "#[ \t]*include[ \t]*\"[^\"]*\"[^\n]*" "" body "${body}")
+    string(APPEND text "${body}\n")
+endforeach()
+
+string(REPLACE "\\" "\\\\" text "${text}")
+string(REPLACE "\"" "\\\"" text "${text}")
+string(REPLACE "\n" "\\n\"\n    \"" text "${text}")
+
+file(WRITE "${OUTPUT}"
+    "// generated from the headers that aot.h needs; do not edit\n\n"
+    "const char cgen_header[] =\n    \"${text}\";\n")
@@ -0,0 +1,1020 @@
+/*
+ * The instruction handlers and the dispatch loop.
+ *
+ * Each decoded instruction has a handler slot, which is its opcode unless a
+ * breakpoint has been patched in, and the VM runs the handler in that slot
+ * of the table that vm->dispatch points to. Normally that is vm_handlers.
+ * The debugger stops the VM by pointing vm->dispatch at vm_stop_handlers,
+ * where every slot stops before the instruction is run, and sets a
+ * breakpoint by patching the slot of an instruction to VM_OP_BREAK. The
+ * loop itself never checks for anything, so a VM that is not being debugged
+ * pays nothing for it.
+ *
+ * Runtime errors, such as a bad memory reference or a divide by zero, call
+ * vm_fault(), which jumps straight back out of the loop, so the handlers do
+ * not have to pass errors back.
+ *
+ * All of the conditional forms of an instruction share one handler, which
+ * tests the condition first. A branch that is taken clears the N, Z, C and
+ * V flags, and is counted for record and replay.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "virtual_machine.h"
+
+vm_handler_t vm_handlers[VM_HANDLERS];
+vm_handler_t vm_stop_handlers[VM_HANDLERS];
+vm_handler_t vm_count_handlers[VM_HANDLERS];
+
+// cond_table[cond][flags] is set if the condition is met
+static uint8_t cond_table[NUM_CONDITIONS + 1][256];
+
+#define HANDLER(name) static const vm_insn_t* name(vm_t* vm, const vm_insn_t* insn)
+#define OPND(n)     (&insn->insn.operands[n])
+#define REG(n)      (vm->regs[insn->insn.operands[n].reg])
+#define NEXT        (insn + 1)
+#define COND_MET    (cond_table[insn->cond][vm->flags & 0xFF])
+
+void vm_fault(vm_t* vm, const vm_insn_t* insn, const char* msg)
+{
+    vm->status = VM_ERROR;
+    vm->error = msg;
+    vm->stop_insn = insn;
+    longjmp(vm->fault_jmp, 1);
+}
+
+/************************
+ * memory and operands
+ */
+static inline uint8_t* mem_ptr(vm_t* vm, const vm_insn_t* insn, uint64_t addr, uint64_t size)
+{
+    if(addr > vm->mem_size || size > vm->mem_size - addr)
+        vm_fault(vm, insn, "memory reference out of range");
+
+    return &vm->mem[addr];
+}
+
+static inline uint64_t operand_addr(vm_t* vm, const decoded_operand_t* opnd)
+{
+    switch (opnd->kind)
+    {
+        case OPND_REG_PTR:
+            return vm->regs[opnd->reg];
+        case OPND_REG_OFS8:
+        case OPND_REG_OFS16:
+            return vm->regs[opnd->reg] + opnd->value;
+        default:
+            return opnd->value;
+    }
+}
+
+static inline uint64_t get_value(vm_t* vm, const vm_insn_t* insn, const decoded_operand_t* opnd)
+{
+    uint64_t value;
+
+    switch (opnd->kind)
+    {
+        case OPND_REG:
+            return vm->regs[opnd->reg];
+        case OPND_IMM:
+        case OPND_FLOAT:     // the loader put the bits in value
+            return opnd->value;
+        default:
+            memcpy(&value, mem_ptr(vm, insn, operand_addr(vm, opnd), 8), 8);
+            return value;
+    }
+}
+
+static inline void set_value(vm_t* vm, const vm_insn_t* insn, const decoded_operand_t* opnd, uint64_t value)
+{
+    if(opnd->kind == OPND_REG)
+        vm->regs[opnd->reg] = value;
+    else
+        memcpy(mem_ptr(vm, insn, operand_addr(vm, opnd), 8), &value, 8);
+}
+
+static inline double as_float(uint64_t bits)
+{
+    double d;
+
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static inline uint64_t from_float(double d)
+{
+    uint64_t bits;
+
+    memcpy(&bits, &d, sizeof(d));
+    return bits;
+}
+
+static inline void push(vm_t* vm, const vm_insn_t* insn, uint64_t value)
+{
+    if(vm->sp >= vm->stack_size)
+        vm_fault(vm, insn, "stack overflow");
+    vm->stack[vm->sp++] = value;
+}
+
+static inline uint64_t pop(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->sp == 0)
+        vm_fault(vm, insn, "stack underflow");
+    return vm->stack[--vm->sp];
+}
+
+/*
+ * Set N and Z from the result, and the other flags as given.
+ */
+static inline void set_flags(vm_t* vm, uint64_t result, uint32_t flags)
+{
+    flags |= (result == 0)? VM_FLAG_Z: 0;
+    flags |= ((int64_t)result < 0)? VM_FLAG_N: 0;
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | flags;
+}
+
+/*
+ * Floats never set Z. V is set when a finite calculation overflows.
+ */
+static inline void set_float_flags(vm_t* vm, double a, double b, double result)
+{
+    uint32_t flags = (result < 0)? VM_FLAG_N: 0;
+
+    if(isinf(result) && !isinf(a) && !isinf(b))
+        flags |= VM_FLAG_V;
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | flags;
+}
+
+/************************
+ * branching
+ */
+/*
+ * Kept out of line so that a branch to a fixed address needs no stack frame.
+ */
+static __attribute__((noinline)) const vm_insn_t* indirect_target(vm_t* vm, const vm_insn_t* insn)
+{
+    const vm_insn_t* target = vm_find_insn(vm, get_value(vm, insn, OPND(0)));
+
+    if(target == NULL)
+        vm_fault(vm, insn, "branch to an address that is not an instruction");
+    return target;
+}
+
+static inline const vm_insn_t* branch_target(vm_t* vm, const vm_insn_t* insn)
+{
+    if(insn->target != NULL)
+        return insn->target;
+
+    return indirect_target(vm, insn);
+}
+
+/*
+ * Returning with nothing on the stack ends the program, the same as END.
+ */
+static inline const vm_insn_t* do_return(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->sp == 0)
+    {
+        vm->status = VM_ENDED;
+        vm->stop_insn = insn;
+        return NULL;
+    }
+
+    const vm_insn_t* target = vm_find_insn(vm, pop(vm, insn));
+
+    if(target == NULL)
+        vm_fault(vm, insn, "return to an address that is not an instruction");
+    vm->flags &= ~VM_FLAG_NZCV;
+    return vm_branch_taken(vm, target);
+}
+
+HANDLER(op_jmp)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    vm->flags &= ~VM_FLAG_NZCV;
+    return vm_branch_taken(vm, branch_target(vm, insn));
+}
+
+HANDLER(op_call)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    const vm_insn_t* target = branch_target(vm, insn);
+
+    push(vm, insn, NEXT->offset);
+    vm->flags &= ~VM_FLAG_NZCV;
+    return vm_branch_taken(vm, target);
+}
+
+HANDLER(op_excall)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    const vm_native_info_t* native = vm_find_native(get_value(vm, insn, OPND(0)));
+
+    if(native == NULL)
+        vm_fault(vm, insn, "call to an external routine that does not exist");
+
+    vm->flags &= ~VM_FLAG_NZCV;
+    if(vm->record != NULL && native->flags != 0)
+        record_native(vm, insn, get_value(vm, insn, OPND(0)), native);
+    else
+        native->func(vm, insn);
+    return NEXT;
+}
+
+HANDLER(op_ret)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    return do_return(vm, insn);
+}
+
+HANDLER(op_trap)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    if(vm->flags & VM_FLAG_T)
+    {
+        vm->flags |= VM_FLAG_TM;
+        return NEXT;
+    }
+
+    const vm_insn_t* target = branch_target(vm, insn);
+
+    push(vm, insn, NEXT->offset);
+    vm->flags = (vm->flags & ~(VM_FLAG_NZCV | VM_FLAG_TM)) | VM_FLAG_T;
+    return vm_branch_taken(vm, target);
+}
+
+HANDLER(op_tret)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    vm->flags &= ~VM_FLAG_T;
+    return do_return(vm, insn);
+}
+
+HANDLER(op_raise)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    if(vm->flags & VM_FLAG_E)
+    {
+        vm->flags |= VM_FLAG_EM;
+        return NEXT;
+    }
+
+    const vm_insn_t* target = branch_target(vm, insn);
+
+    push(vm, insn, NEXT->offset);
+    vm->flags = (vm->flags & ~(VM_FLAG_NZCV | VM_FLAG_EM)) | VM_FLAG_E;
+    return vm_branch_taken(vm, target);
+}
+
+HANDLER(op_eret)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    vm->flags &= ~VM_FLAG_E;
+    return do_return(vm, insn);
+}
+
+/************************
+ * arithmetic
+ */
+#define INT_OP(name, builtin) \
+HANDLER(name) \
+{ \
+    int64_t a = (int64_t)get_value(vm, insn, OPND(1)); \
+    int64_t b = (int64_t)get_value(vm, insn, OPND(2)); \
+    int64_t r; \
+    int over = builtin(a, b, &r); \
+    set_flags(vm, (uint64_t)r, over? VM_FLAG_V: 0); \
+    REG(0) = (uint64_t)r; \
+    return NEXT; \
+}
+
+#define UINT_OP(name, builtin) \
+HANDLER(name) \
+{ \
+    uint64_t a = get_value(vm, insn, OPND(1)); \
+    uint64_t b = get_value(vm, insn, OPND(2)); \
+    uint64_t r; \
+    int over = builtin(a, b, &r); \
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0) | (over? VM_FLAG_C: 0); \
+    REG(0) = r; \
+    return NEXT; \
+}
+
+#define FLOAT_OP(name, expr) \
+HANDLER(name) \
+{ \
+    double a = as_float(get_value(vm, insn, OPND(1))); \
+    double b = as_float(get_value(vm, insn, OPND(2))); \
+    double r = (expr); \
+    set_float_flags(vm, a, b, r); \
+    REG(0) = from_float(r); \
+    return NEXT; \
+}
+
+INT_OP(op_iadd, __builtin_add_overflow)
+INT_OP(op_isub, __builtin_sub_overflow)
+INT_OP(op_imul, __builtin_mul_overflow)
+UINT_OP(op_uadd, __builtin_add_overflow)
+UINT_OP(op_usub, __builtin_sub_overflow)
+UINT_OP(op_umul, __builtin_mul_overflow)
+FLOAT_OP(op_fadd, a + b)
+FLOAT_OP(op_fsub, a - b)
+FLOAT_OP(op_fmul, a * b)
+FLOAT_OP(op_fdiv, a / b)
+FLOAT_OP(op_fmod, fmod(a, b))
+
+static const vm_insn_t* int_divide(vm_t* vm, const vm_insn_t* insn, int modulo)
+{
+    int64_t a = (int64_t)get_value(vm, insn, OPND(1));
+    int64_t b = (int64_t)get_value(vm, insn, OPND(2));
+    int64_t r;
+    uint32_t flags = 0;
+
+    if(b == 0)
+        vm_fault(vm, insn, "divide by zero");
+
+    if(a == INT64_MIN && b == -1)
+    {
+        r = modulo? 0: INT64_MIN;
+        flags = VM_FLAG_V;
+    }
+    else
+        r = modulo? a % b: a / b;
+
+    set_flags(vm, (uint64_t)r, flags);
+    REG(0) = (uint64_t)r;
+    return NEXT;
+}
+
+static const vm_insn_t* uint_divide(vm_t* vm, const vm_insn_t* insn, int modulo)
+{
+    uint64_t a = get_value(vm, insn, OPND(1));
+    uint64_t b = get_value(vm, insn, OPND(2));
+
+    if(b == 0)
+        vm_fault(vm, insn, "divide by zero");
+
+    uint64_t r = modulo? a % b: a / b;
+
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0);
+    REG(0) = r;
+    return NEXT;
+}
+
+HANDLER(op_idiv) { return int_divide(vm, insn, 0); }
+HANDLER(op_imod) { return int_divide(vm, insn, 1); }
+HANDLER(op_udiv) { return uint_divide(vm, insn, 0); }
+HANDLER(op_umod) { return uint_divide(vm, insn, 1); }
+
+HANDLER(op_ineg)
+{
+    int64_t a = (int64_t)REG(0);
+    int64_t r;
+    int over = __builtin_sub_overflow((int64_t)0, a, &r);
+
+    set_flags(vm, (uint64_t)r, over? VM_FLAG_V: 0);
+    REG(0) = (uint64_t)r;
+    return NEXT;
+}
+
+HANDLER(op_uneg)
+{
+    uint64_t r = -REG(0);
+
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0);
+    REG(0) = r;
+    return NEXT;
+}
+
+HANDLER(op_fneg)
+{
+    double r = -as_float(REG(0));
+
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | ((r < 0)? VM_FLAG_N: 0);
+    REG(0) = from_float(r);
+    return NEXT;
+}
+
+// conversions leave the flags alone
+HANDLER(op_ftu) { REG(0) = (uint64_t)fabs(as_float(REG(0))); return NEXT; }
+HANDLER(op_fti) { REG(0) = (uint64_t)(int64_t)as_float(REG(0)); return NEXT; }
+HANDLER(op_itf) { REG(0) = from_float((double)(int64_t)REG(0)); return NEXT; }
+HANDLER(op_utf) { REG(0) = from_float((double)REG(0)); return NEXT; }
+HANDLER(op_uti) { (void)vm; return NEXT; }   // the bits do not change
+
+HANDLER(op_itu)
+{
+    int64_t a = (int64_t)REG(0);
+
+    REG(0) = (a < 0)? -(uint64_t)a: (uint64_t)a;
+    return NEXT;
+}
+
+HANDLER(op_inc)
+{
+    int64_t r;
+    int over = __builtin_add_overflow((int64_t)REG(0), (int64_t)1, &r);
+
+    set_flags(vm, (uint64_t)r, over? VM_FLAG_V: 0);
+    REG(0) = (uint64_t)r;
+    return NEXT;
+}
+
+HANDLER(op_dec)
+{
+    int64_t r;
+    int over = __builtin_sub_overflow((int64_t)REG(0), (int64_t)1, &r);
+
+    set_flags(vm, (uint64_t)r, over? VM_FLAG_V: 0);
+    REG(0) = (uint64_t)r;
+    return NEXT;
+}
+
+/************************
+ * bits
+ */
+static inline void set_shift_flags(vm_t* vm, uint64_t r, int carry)
+{
+    uint32_t flags = (r == 0)? VM_FLAG_Z: 0;
+
+    flags |= carry? VM_FLAG_C: 0;
+    flags |= (r >> 63)? VM_FLAG_V: 0;
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | flags;
+}
+
+HANDLER(op_shl)
+{
+    uint64_t a = REG(0);
+    uint64_t n = get_value(vm, insn, OPND(1));
+    uint64_t r = (n >= 64)? 0: a << n;
+    int carry = (n >= 64)? (a != 0): (n > 0 && (a >> (64 - n)) != 0);
+
+    set_shift_flags(vm, r, carry);
+    REG(0) = r;
+    return NEXT;
+}
+
+HANDLER(op_shr)
+{
+    uint64_t a = REG(0);
+    uint64_t n = get_value(vm, insn, OPND(1));
+    uint64_t r = (n >= 64)? 0: a >> n;
+    int carry = (n >= 64)? (a != 0): (n > 0 && (a & ((1ull << n) - 1)) != 0);
+
+    set_shift_flags(vm, r, carry);
+    REG(0) = r;
+    return NEXT;
+}
+
+HANDLER(op_rol)
+{
+    uint64_t a = REG(0);
+    unsigned n = get_value(vm, insn, OPND(1)) & 63;
+    uint64_t r = (n == 0)? a: (a << n) | (a >> (64 - n));
+
+    set_shift_flags(vm, r, 0);
+    REG(0) = r;
+    return NEXT;
+}
+
+HANDLER(op_ror)
+{
+    uint64_t a = REG(0);
+    unsigned n = get_value(vm, insn, OPND(1)) & 63;
+    uint64_t r = (n == 0)? a: (a >> n) | (a << (64 - n));
+
+    set_shift_flags(vm, r, 0);
+    REG(0) = r;
+    return NEXT;
+}
+
+#define LOGIC_OP(name, op) \
+HANDLER(name) \
+{ \
+    uint64_t r = get_value(vm, insn, OPND(1)) op get_value(vm, insn, OPND(2)); \
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0); \
+    REG(0) = r; \
+    return NEXT; \
+}
+
+LOGIC_OP(op_and, &)
+LOGIC_OP(op_or, |)
+LOGIC_OP(op_xor, ^)
+
+HANDLER(op_not)
+{
+    uint64_t r = ~REG(0);
+
+    vm->flags = (vm->flags & ~VM_FLAG_NZCV) | ((r == 0)? VM_FLAG_Z: 0);
+    REG(0) = r;
+    return NEXT;
+}
+
+/*
+ * The flags are set from left - right. C is set if left is the same or
+ * higher as unsigned, so that CS and CC work as unsigned compares.
+ */
+HANDLER(op_cmp)
+{
+    uint64_t a = get_value(vm, insn, OPND(0));
+    uint64_t b = get_value(vm, insn, OPND(1));
+    int64_t r;
+    uint32_t flags = (a >= b)? VM_FLAG_C: 0;
+
+    if(__builtin_sub_overflow((int64_t)a, (int64_t)b, &r))
+        flags |= VM_FLAG_V;
+    set_flags(vm, (uint64_t)r, flags);
+    return NEXT;
+}
+
+HANDLER(op_tst)
+{
+    set_flags(vm, get_value(vm, insn, OPND(0)) & get_value(vm, insn, OPND(1)), 0);
+    return NEXT;
+}
+
+/************************
+ * moving data
+ */
+HANDLER(op_load)
+{
+    REG(0) = get_value(vm, insn, OPND(1));
+    return NEXT;
+}
+
+HANDLER(op_store)
+{
+    set_value(vm, insn, OPND(1), REG(0));
+    return NEXT;
+}
+
+static const vm_insn_t* move(vm_t* vm, const vm_insn_t* insn, uint64_t size)
+{
+    uint8_t* src = mem_ptr(vm, insn, REG(1), size);
+    uint8_t* dest = mem_ptr(vm, insn, REG(0), size);
+
+    memcpy(dest, src, size);
+    return NEXT;
+}
+
+static const vm_insn_t* move_block(vm_t* vm, const vm_insn_t* insn, uint64_t size)
+{
+    uint64_t count = REG(2);
+
+    if(count > vm->mem_size / size)
+        vm_fault(vm, insn, "memory reference out of range");
+
+    uint8_t* src = mem_ptr(vm, insn, REG(1), count * size);
+    uint8_t* dest = mem_ptr(vm, insn, REG(0), count * size);
+
+    memmove(dest, src, count * size);
+    return NEXT;
+}
+
+HANDLER(op_mov8) { return move(vm, insn, 1); }
+HANDLER(op_mov16) { return move(vm, insn, 2); }
+HANDLER(op_mov32) { return move(vm, insn, 4); }
+HANDLER(op_mov64) { return move(vm, insn, 8); }
+HANDLER(op_movb8) { return move_block(vm, insn, 1); }
+HANDLER(op_movb16) { return move_block(vm, insn, 2); }
+HANDLER(op_movb32) { return move_block(vm, insn, 4); }
+HANDLER(op_movb64) { return move_block(vm, insn, 8); }
+
+HANDLER(op_push)
+{
+    push(vm, insn, get_value(vm, insn, OPND(0)));
+    return NEXT;
+}
+
+HANDLER(op_pop)
+{
+    REG(0) = pop(vm, insn);
+    return NEXT;
+}
+
+HANDLER(op_allocate)
+{
+    REG(0) = heap_allocate(vm, get_value(vm, insn, OPND(1)));
+    return NEXT;
+}
+
+HANDLER(op_free)
+{
+    if(heap_free(vm, REG(0)))
+        vm_fault(vm, insn, "free of memory that was not allocated");
+    return NEXT;
+}
+
+/************************
+ * administrative
+ */
+#define FLAG_OP(name, expr) HANDLER(name) { vm->flags expr; return NEXT; }
+
+FLAG_OP(op_stz, |= VM_FLAG_Z)
+FLAG_OP(op_clz, &= ~VM_FLAG_Z)
+FLAG_OP(op_stc, |= VM_FLAG_C)
+FLAG_OP(op_clc, &= ~VM_FLAG_C)
+FLAG_OP(op_stn, |= VM_FLAG_N)
+FLAG_OP(op_cln, &= ~VM_FLAG_N)
+FLAG_OP(op_stv, |= VM_FLAG_V)
+FLAG_OP(op_clv, &= ~VM_FLAG_V)
+FLAG_OP(op_stt, |= VM_FLAG_T)
+FLAG_OP(op_clt, &= ~VM_FLAG_T)
+FLAG_OP(op_ste, |= VM_FLAG_E)
+FLAG_OP(op_cle, &= ~VM_FLAG_E)
+
+HANDLER(op_nop)
+{
+    (void)vm;
+    return NEXT;
+}
+
+HANDLER(op_pause)
+{
+    (void)vm;
+    pause();
+    return NEXT;
+}
+
+HANDLER(op_end)
+{
+    vm->status = VM_ENDED;
+    vm->stop_insn = insn;
+    return NULL;
+}
+
+HANDLER(op_fell_off)
+{
+    vm->status = VM_ENDED;
+    vm->stop_insn = insn;
+    return NULL;
+}
+
+HANDLER(op_invalid)
+{
+    vm_fault(vm, insn, "invalid instruction");
+}
+
+HANDLER(op_break)
+{
+    vm->status = VM_BREAK;
+    vm->stop_insn = insn;
+    return NULL;
+}
+
+HANDLER(op_stop)
+{
+    vm->status = VM_STOPPED;
+    vm->stop_insn = insn;
+    return NULL;
+}
+
+// every slot of vm_count_handlers
+HANDLER(op_count)
+{
+    vm->insns_run++;
+    return vm_handlers[insn->op](vm, insn);
+}
+
+/************************
+ * trusted handlers
+ */
+/*
+ * For code that vm_verify() has shown to keep the stack balanced, a POP
+ * always has something to pop, and a return pops an address that a call or
+ * a signal pushed, which is always an instruction.
+ */
+static inline const vm_insn_t* trusted_return(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->sp == 0)
+    {
+        vm->status = VM_ENDED;
+        vm->stop_insn = insn;
+        return NULL;
+    }
+
+    vm->flags &= ~VM_FLAG_NZCV;
+    return vm_branch_taken(vm, &vm->insns[vm->insn_index[vm->stack[--vm->sp]]]);
+}
+
+HANDLER(op_trusted_pop)
+{
+    REG(0) = vm->stack[--vm->sp];
+    return NEXT;
+}
+
+HANDLER(op_trusted_ret)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    return trusted_return(vm, insn);
+}
+
+HANDLER(op_trusted_tret)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    vm->flags &= ~VM_FLAG_T;
+    return trusted_return(vm, insn);
+}
+
+HANDLER(op_trusted_eret)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    vm->flags &= ~VM_FLAG_E;
+    return trusted_return(vm, insn);
+}
+
+/*
+ * Every EXCALL has an immediate number, which the verifier has looked up.
+ */
+HANDLER(op_trusted_excall)
+{
+    if(!COND_MET)
+        return NEXT;
+
+    uint64_t number = (uint64_t)OPND(0)->value;
+    const vm_native_info_t* native = vm_find_native(number);
+
+    vm->flags &= ~VM_FLAG_NZCV;
+    if(vm->record != NULL && native->flags != 0)
+        record_native(vm, insn, number, native);
+    else
+        native->func(vm, insn);
+    return NEXT;
+}
+
+/************************
+ * public interface
+ */
+static vm_handler_t base_handler(int base)
+{
+    switch (base)
+    {
+        case OP_NOP: return op_nop;
+        case OP_STZ: return op_stz;
+        case OP_CLZ: return op_clz;
+        case OP_STC: return op_stc;
+        case OP_CLC: return op_clc;
+        case OP_STN: return op_stn;
+        case OP_CLN: return op_cln;
+        case OP_STV: return op_stv;
+        case OP_CLV: return op_clv;
+        case OP_STT: return op_stt;
+        case OP_CLT: return op_clt;
+        case OP_STE: return op_ste;
+        case OP_CLE: return op_cle;
+        case OP_PAUSE: return op_pause;
+        case OP_RESUME: return op_nop;
+        case OP_END: return op_end;
+        case OP_LOAD: return op_load;
+        case OP_STORE: return op_store;
+        case OP_MOV8: return op_mov8;
+        case OP_MOV16: return op_mov16;
+        case OP_MOV32: return op_mov32;
+        case OP_MOV64: return op_mov64;
+        case OP_MOV: return op_mov64;
+        case OP_MOVB8: return op_movb8;
+        case OP_MOVB16: return op_movb16;
+        case OP_MOVB32: return op_movb32;
+        case OP_MOVB64: return op_movb64;
+        case OP_MOVB: return op_movb64;
+        case OP_PUSH: return op_push;
+        case OP_POP: return op_pop;
+        case OP_IADD: return op_iadd;
+        case OP_UADD: return op_uadd;
+        case OP_FADD: return op_fadd;
+        case OP_ISUB: return op_isub;
+        case OP_USUB: return op_usub;
+        case OP_FSUB: return op_fsub;
+        case OP_IMUL: return op_imul;
+        case OP_UMUL: return op_umul;
+        case OP_FMUL: return op_fmul;
+        case OP_IDIV: return op_idiv;
+        case OP_UDIV: return op_udiv;
+        case OP_FDIV: return op_fdiv;
+        case OP_IMOD: return op_imod;
+        case OP_UMOD: return op_umod;
+        case OP_FMOD: return op_fmod;
+        case OP_INEG: return op_ineg;
+        case OP_UNEG: return op_uneg;
+        case OP_FNEG: return op_fneg;
+        case OP_FTU: return op_ftu;
+        case OP_FTI: return op_fti;
+        case OP_ITF: return op_itf;
+        case OP_ITU: return op_itu;
+        case OP_UTF: return op_utf;
+        case OP_UTI: return op_uti;
+        case OP_INC: return op_inc;
+        case OP_DEC: return op_dec;
+        case OP_SHL: return op_shl;
+        case OP_SHR: return op_shr;
+        case OP_ROL: return op_rol;
+        case OP_ROR: return op_ror;
+        case OP_AND: return op_and;
+        case OP_OR: return op_or;
+        case OP_XOR: return op_xor;
+        case OP_NOT: return op_not;
+        case OP_CMP: return op_cmp;
+        case OP_TST: return op_tst;
+        case OP_JMP: return op_jmp;
+        case OP_CALL: return op_call;
+        case OP_EXCALL: return op_excall;
+        case OP_RET: return op_ret;
+        case OP_TRAP: return op_trap;
+        case OP_TRET: return op_tret;
+        case OP_RAISE: return op_raise;
+        case OP_ERET: return op_eret;
+        case OP_ALLOCATE: return op_allocate;
+        case OP_FREE: return op_free;
+        default: return op_invalid;
+    }
+}
+
+static int cond_met(int cond, uint32_t flags)
+{
+    int z = (flags & VM_FLAG_Z) != 0;
+    int n = (flags & VM_FLAG_N) != 0;
+    int c = (flags & VM_FLAG_C) != 0;
+    int v = (flags & VM_FLAG_V) != 0;
+
+    // in the order of the conditions in gen_opcode_map.py
+    switch (cond)
+    {
+        case 0: return 1;
+        case 1: return z;                   // EQ
+        case 2: return !z;                  // NE
+        case 3: return c;                   // CS
+        case 4: return !c;                  // CC
+        case 5: return n;                   // MI
+        case 6: return !n;                  // PL
+        case 7: return v;                   // VS
+        case 8: return !v;                  // VC
+        case 9: return c && !z;             // HI
+        case 10: return !c || z;            // LS
+        case 11: return n == v;             // GE
+        case 12: return n != v;             // LT
+        case 13: return !z && n == v;       // GT
+        case 14: return z || n != v;        // LE
+        case 15: return (flags & VM_FLAG_T) != 0;   // TE
+        case 16: return (flags & VM_FLAG_E) != 0;   // EE
+        default: return 0;
+    }
+}
+
+/*
+ * Build the handler tables and the condition table. This is called once
+ * before any VM is run.
+ */
+void vm_init_dispatch(void)
+{
+    for(int op = 0; op < VM_HANDLERS; op++)
+    {
+        const opcode_info_t* info = &opcode_table[op];
+
+        vm_handlers[op] = (info->name != NULL)? base_handler(info->base): op_invalid;
+        vm_stop_handlers[op] = op_stop;
+        vm_count_handlers[op] = op_count;
+    }
+
+    vm_handlers[VM_OP_BREAK] = op_break;
+    vm_handlers[VM_OP_TRACE] = jit_enter;
+    vm_handlers[VM_OP_AOT] = aot_enter;
+    vm_handlers[VM_OP_EVENT] = record_event;
+    vm_handlers[VM_OP_FELL_OFF] = op_fell_off;
+
+    for(int cond = 0; cond <= NUM_CONDITIONS; cond++)
+        for(int flags = 0; flags < 256; flags++)
+            cond_table[cond][flags] = (uint8_t)cond_met(cond, flags);
+}
+
+/*
+ * Run the program on the trusted handlers for what the verifier could show
+ * about it. This patches vm_handlers, so it must be done before anything
+ * else takes a copy of them, and only when the program starts where the
+ * verifier started: at the start of the code.
+ */
+void vm_trust(vm_t* vm)
+{
+    for(int op = 0; op < VM_HANDLERS; op++)
+    {
+        const opcode_info_t* info = &opcode_table[op];
+
+        if(info->name == NULL)
+            continue;
+
+        if(vm->verified & VM_VERIFIED_STACK)
+        {
+            switch (info->base)
+            {
+                case OP_POP: vm_handlers[op] = op_trusted_pop; break;
+                case OP_RET: vm_handlers[op] = op_trusted_ret; break;
+                case OP_TRET: vm_handlers[op] = op_trusted_tret; break;
+                case OP_ERET: vm_handlers[op] = op_trusted_eret; break;
+            }
+        }
+        if((vm->verified & VM_VERIFIED_NATIVES) && info->base == OP_EXCALL)
+            vm_handlers[op] = op_trusted_excall;
+    }
+
+    vm->trusted = 1;
+}
+
+void vm_untrust(vm_t* vm)
+{
+    for(int op = 0; op < VM_HANDLERS; op++)
+        if(opcode_table[op].name != NULL)
+            vm_handlers[op] = base_handler(opcode_table[op].base);
+
+    vm->trusted = 0;
+}
+
+/*
+ * Put the VM back the way it was when the program was loaded.
+ */
+void vm_reset(vm_t* vm)
+{
+    memset(vm->regs, 0, sizeof(vm->regs));
+    vm->flags = 0;
+    vm->sp = 0;
+    vm->branches = 0;
+    vm->branch_limit = UINT64_MAX;
+    vm->insns_run = 0;
+    vm->pending_signals = 0;
+    vm->status = VM_RUNNING;
+    vm->error = NULL;
+    vm->stop_insn = NULL;
+    vm->dispatch = vm->handlers;
+
+    memcpy(vm->mem, vm->image.data, vm->image.header->data_size);
+    memset(&vm->mem[vm->image.header->data_size], 0, vm->heap_top - vm->image.header->data_size);
+    if(vm->gc != NULL)
+        gc_reset(vm);
+    else
+        heap_init(vm);
+}
+
+static const vm_insn_t* dispatch_loop(vm_t* vm, const vm_insn_t* insn)
+{
+    while(insn != NULL)
+        insn = vm->dispatch[insn->op](vm, insn);
+
+    return vm->stop_insn;
+}
+
+/*
+ * Run from insn until something stops the VM. Returns the instruction that
+ * it stopped at, which has not been run, and the reason is in vm->status.
+ */
+const vm_insn_t* vm_run(vm_t* vm, const vm_insn_t* insn)
+{
+    vm->status = VM_RUNNING;
+
+    if(setjmp(vm->fault_jmp))
+        return vm->stop_insn;
+
+    return dispatch_loop(vm, insn);
+}
+
+/*
+ * Run one instruction, even if a breakpoint has been patched over it.
+ * Returns the next instruction, or NULL if the VM stopped.
+ */
+const vm_insn_t* vm_step(vm_t* vm, const vm_insn_t* insn)
+{
+    vm->status = VM_RUNNING;
+
+    if(setjmp(vm->fault_jmp))
+        return NULL;
+
+    int op = (insn->op == VM_OP_BREAK)? insn->plain: insn->op;
+    const vm_insn_t* next = vm_handlers[op](vm, insn);
+
+    if(next != NULL)
+        vm->stop_insn = next;
+    return next;
+}
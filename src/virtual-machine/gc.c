@@ -0,0 +1,942 @@
+/*
+ * The garbage collector, for a program that is run with -g.
+ *
+ * The collector is precise. Every object has a gc_header_t in front of it
+ * with its size and a mask of the words in it that hold pointers, and the
+ * pointer maps that the assembler writes for PTRS say which registers and
+ * stack entries hold pointers at an instruction. A pointer is 0, an address
+ * outside of the collected heap, or the address of the start of an object.
+ * The data segment is not scanned, so it must not hold the only pointer to
+ * an object.
+ *
+ * A collection can only happen at ALLOCATE or at a native that allocates,
+ * so those need maps, and so does every call that is on the stack when one
+ * happens. The map of a call gives the frame of its caller. The frames are
+ * found by walking down the stack from the map of the instruction that
+ * started the collection, through the return addresses.
+ *
+ * New objects are bump allocated in the nursery. When it is full, a minor
+ * collection copies everything in it that can be reached to the end of the
+ * old generation and scans the copies, Cheney style, so the nursery is
+ * always empty afterwards. The roots of a minor collection are the maps and
+ * the old objects that have been written since the last one. STORE of a
+ * nursery pointer, and any MOV, into the old generation marks the card that
+ * it writes to. The card table has a byte for every CARD_SIZE bytes of the
+ * old generation, and the cards that are marked are also put on a list, so
+ * a collection only looks at those. Each card also has how far back the
+ * object that covers its first byte starts, so it can be scanned without
+ * walking the generation from the start.
+ *
+ * When the old generation has grown past twice what was left after the
+ * last major collection, or there is not room in it for a full nursery, a
+ * major collection marks everything that can be reached and slides it down
+ * to the start of the generation, in the three passes of the Lisp 2
+ * compactor. Objects too big for the nursery go straight to the old
+ * generation.
+ *
+ * Like the heap, everything the collector keeps about the objects is in the
+ * VM memory, after the data, so a snapshot of the memory up to heap_top is
+ * a snapshot of the collector too. Only the pause times and scratch lists
+ * are kept outside.
+ *
+ * ALLOCATE makes an object that has no pointers in it, and FREE does
+ * nothing. The gc_alloc native makes an object with pointers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "virtual_machine.h"
+
+#define GC_NURSERY_SIZE     (1ul << 20)
+#define CARD_SHIFT          9
+#define CARD_SIZE           (1ul << CARD_SHIFT)
+#define LARGE_OBJECT        (64ul * 1024)    // bigger objects go straight to the old generation
+#define MIN_MAJOR           (32ul << 20)     // old generation size before the first major collection
+#define HEADER_SIZE         16
+#define GC_PAGE             4096
+#define PREFAULT_SIZE       (64ul * 1024)   // of the old generation at a time
+
+#define GC_MARKED           0x80000000u
+#define GC_FORWARDED        0x40000000u
+#define GC_WORDS            0x3FFFFFFFu
+
+typedef struct
+{
+    uint32_t words;          // in the object, with the flags in the top bits
+    uint32_t forward;        // where it moves to, in words from old_base
+    uint64_t mask;           // bit n is set if word n holds a pointer; bit 63 is for the rest too
+} gc_header_t;
+
+// at heap_base; all of the addresses are VM addresses
+typedef struct
+{
+    uint64_t nursery;
+    uint64_t nursery_top;    // next free byte
+    uint64_t nursery_end;
+    uint64_t old_base;       // the old generation runs from here to heap_top
+    uint64_t old_end;
+    uint64_t cards;          // a byte for each card of the old generation
+    uint64_t cover;          // uint32_t for each card: words back to the object that covers it
+    uint64_t dirty;          // uint32_t for each card that is marked
+    uint64_t ndirty;
+    uint64_t major_limit;    // old generation size that starts a major collection
+    uint64_t faulted;        // the old generation has been touched up to here
+} gc_ctl_t;
+
+typedef struct
+{
+    uint64_t* ns;
+    size_t count;
+    size_t capacity;
+} pause_list_t;
+
+typedef struct vm_gc_t
+{
+    image_ptrmap_t* maps;    // sorted by offset
+    size_t nmaps;
+    const vm_insn_t* insn;   // that started the collection
+
+    uint64_t** roots;
+    size_t nroots;
+    size_t roots_capacity;
+
+    uint64_t* marks;         // objects that are marked and not yet scanned
+    size_t nmarks;
+    size_t marks_capacity;
+
+    pause_list_t minor;
+    pause_list_t major;
+    uint64_t promoted;       // bytes copied out of the nursery
+} vm_gc_t;
+
+// what the barriers call to do the work
+static vm_handler_t plain_handlers[VM_HANDLERS];
+static uint8_t move_width[VM_HANDLERS];
+static int installed;
+
+static void* grow_or_die(void* list, size_t* capacity, size_t item_size)
+{
+    *capacity = (*capacity == 0)? 1024: *capacity << 1;
+    list = realloc(list, *capacity * item_size);
+    if(list == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", *capacity * item_size);
+        exit(1);
+    }
+
+    return list;
+}
+
+static inline gc_ctl_t* ctl_of(vm_t* vm)
+{
+    return (gc_ctl_t*)&vm->mem[vm->heap_base];
+}
+
+// addr is the address of the object, after its header
+static inline gc_header_t* header_of(vm_t* vm, uint64_t addr)
+{
+    return (gc_header_t*)&vm->mem[addr - HEADER_SIZE];
+}
+
+static inline uint64_t object_bytes(const gc_header_t* hdr)
+{
+    return HEADER_SIZE + (uint64_t)(hdr->words & GC_WORDS) * 8;
+}
+
+static inline int holds_pointer(const gc_header_t* hdr, uint64_t word)
+{
+    return (hdr->mask >> ((word < 63)? word: 63)) & 1;
+}
+
+static inline uint8_t* card_table(vm_t* vm, gc_ctl_t* ctl)
+{
+    return &vm->mem[ctl->cards];
+}
+
+static inline uint32_t* cover_table(vm_t* vm, gc_ctl_t* ctl)
+{
+    return (uint32_t*)&vm->mem[ctl->cover];
+}
+
+static inline uint32_t* dirty_list(vm_t* vm, gc_ctl_t* ctl)
+{
+    return (uint32_t*)&vm->mem[ctl->dirty];
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void add_pause(pause_list_t* list, uint64_t ns)
+{
+    if(list->count == list->capacity)
+        list->ns = grow_or_die(list->ns, &list->capacity, sizeof(uint64_t));
+    list->ns[list->count++] = ns;
+}
+
+/*
+ * Memory past heap_top is always zero. Big pieces are given back to the
+ * system instead of being cleared.
+ */
+static void clear_memory(vm_t* vm, uint64_t start, uint64_t end)
+{
+    uint64_t first = (start + GC_PAGE - 1) & ~(uint64_t)(GC_PAGE - 1);
+    uint64_t last = end & ~(uint64_t)(GC_PAGE - 1);
+
+    if(last > first + 16 * GC_PAGE && madvise(&vm->mem[first], last - first, MADV_DONTNEED) == 0)
+    {
+        memset(&vm->mem[start], 0, first - start);
+        memset(&vm->mem[last], 0, end - last);
+    }
+    else
+        memset(&vm->mem[start], 0, end - start);
+}
+
+/************************
+ * the old generation
+ */
+/*
+ * A minor collection copies at most what is in the nursery to heap_top, so
+ * as the nursery fills, as much of the old generation past heap_top is
+ * touched, to take the page faults while the program runs instead of in the
+ * pause. The memory is zero, so writing zero to it changes nothing.
+ */
+static void prefault(vm_t* vm, gc_ctl_t* ctl)
+{
+    uint64_t want = vm->heap_top + (ctl->nursery_top - ctl->nursery) + PREFAULT_SIZE;
+
+    if(want > ctl->old_end)
+        want = ctl->old_end;
+    if(ctl->faulted < vm->heap_top)
+        ctl->faulted = vm->heap_top;
+    if(want <= ctl->faulted)
+        return;
+
+#ifdef MADV_POPULATE_WRITE
+    uint64_t first = ctl->faulted & ~(uint64_t)(GC_PAGE - 1);
+
+    if(madvise(&vm->mem[first], want - first, MADV_POPULATE_WRITE) == 0)
+    {
+        ctl->faulted = want;
+        return;
+    }
+#endif
+    for(uint64_t addr = ctl->faulted; addr < want; addr += GC_PAGE)
+        vm->mem[addr] = 0;
+    ctl->faulted = want;
+}
+
+/*
+ * An object has been put in the old generation at start, which is where its
+ * header is. Every card that starts inside of it is covered by it.
+ */
+static void note_object(vm_t* vm, gc_ctl_t* ctl, uint64_t start, uint64_t bytes)
+{
+    uint32_t* cover = cover_table(vm, ctl);
+    uint64_t first = (start - ctl->old_base + CARD_SIZE - 1) >> CARD_SHIFT;
+    uint64_t end = (start + bytes - ctl->old_base + CARD_SIZE - 1) >> CARD_SHIFT;
+
+    for(uint64_t c = first; c < end; c++)
+        cover[c] = (uint32_t)((ctl->old_base + (c << CARD_SHIFT) - start) / 8);
+}
+
+static void mark_cards(vm_t* vm, gc_ctl_t* ctl, uint64_t addr, uint64_t size)
+{
+    uint64_t end = addr + size;
+
+    if(end > vm->heap_top)
+        end = vm->heap_top;
+    if(addr < ctl->old_base || addr >= end)
+        return;
+
+    uint8_t* cards = card_table(vm, ctl);
+    uint32_t* dirty = dirty_list(vm, ctl);
+
+    for(uint64_t c = (addr - ctl->old_base) >> CARD_SHIFT; c <= (end - 1 - ctl->old_base) >> CARD_SHIFT; c++)
+    {
+        if(!cards[c])
+        {
+            cards[c] = 1;
+            dirty[ctl->ndirty++] = (uint32_t)c;
+        }
+    }
+}
+
+/************************
+ * roots
+ */
+static const image_ptrmap_t* find_map(vm_gc_t* gc, uint32_t offset)
+{
+    size_t low = 0;
+    size_t high = gc->nmaps;
+
+    while(low < high)
+    {
+        size_t mid = (low + high) / 2;
+
+        if(gc->maps[mid].offset < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return (low < gc->nmaps && gc->maps[low].offset == offset)? &gc->maps[low]: NULL;
+}
+
+static void add_root(vm_gc_t* gc, uint64_t* slot)
+{
+    if(gc->nroots == gc->roots_capacity)
+        gc->roots = grow_or_die(gc->roots, &gc->roots_capacity, sizeof(uint64_t*));
+    gc->roots[gc->nroots++] = slot;
+}
+
+/*
+ * Find every register and stack entry that holds a pointer. This is done
+ * before anything moves, so that a map that is missing or wrong stops the
+ * VM with the heap as it was.
+ */
+static void find_roots(vm_t* vm, vm_gc_t* gc, const vm_insn_t* insn)
+{
+    const image_ptrmap_t* map = find_map(gc, insn->offset);
+    size_t sp = vm->sp;
+
+    gc->nroots = 0;
+    if(map == NULL)
+        vm_fault(vm, insn, "collection at an instruction that has no pointer map");
+
+    for(int r = 0; r < VM_NUM_REGS; r++)
+    {
+        if(map->regs & (1u << r))
+            add_root(gc, &vm->regs[r]);
+    }
+
+    for(;;)
+    {
+        if(map->depth > sp)
+            vm_fault(vm, insn, "a pointer map has a frame deeper than the stack");
+
+        size_t base = sp - map->depth;
+
+        for(uint32_t n = 0; n < IMAGE_FRAME_SLOTS && n < map->depth; n++)
+        {
+            if(map->slots & (1ull << n))
+                add_root(gc, &vm->stack[base + n]);
+        }
+
+        if(base == 0)
+            break;
+
+        // the entry under a frame is the return address of the call that made it
+        const vm_insn_t* ret = vm_find_insn(vm, vm->stack[base - 1]);
+
+        if(ret == NULL || ret == vm->insns || !(opcode_table[ret[-1].insn.opcode].flags & OPF_CALL))
+            vm_fault(vm, insn, "the stack does not match the pointer maps");
+
+        map = find_map(gc, ret[-1].offset);
+        if(map == NULL)
+            vm_fault(vm, insn, "a call on the stack has no pointer map");
+        sp = base - 1;
+    }
+}
+
+/************************
+ * minor collections
+ */
+static uint64_t promote(vm_t* vm, vm_gc_t* gc, gc_ctl_t* ctl, uint64_t addr)
+{
+    if(addr < ctl->nursery + HEADER_SIZE || addr >= ctl->nursery_top)
+        return addr;
+
+    gc_header_t* hdr = header_of(vm, addr);
+
+    if(hdr->words & GC_FORWARDED)
+        return ctl->old_base + (uint64_t)hdr->forward * 8 + HEADER_SIZE;
+
+    uint64_t bytes = object_bytes(hdr);
+    uint64_t dest = vm->heap_top;
+
+    if(bytes > ctl->old_end - dest)
+        vm_fault(vm, gc->insn, "out of memory for collected objects");
+
+    memcpy(&vm->mem[dest], hdr, bytes);
+    note_object(vm, ctl, dest, bytes);
+    vm->heap_top += bytes;
+    gc->promoted += bytes;
+
+    hdr->forward = (uint32_t)((dest - ctl->old_base) / 8);
+    hdr->words |= GC_FORWARDED;
+    return dest + HEADER_SIZE;
+}
+
+/*
+ * Promote what the pointers in words [first, end) of the object with its
+ * header at start point to.
+ */
+static void promote_fields(vm_t* vm, vm_gc_t* gc, gc_ctl_t* ctl, uint64_t start, uint64_t first, uint64_t end)
+{
+    gc_header_t* hdr = (gc_header_t*)&vm->mem[start];
+    uint64_t* words = (uint64_t*)&vm->mem[start + HEADER_SIZE];
+
+    if(hdr->mask == 0)
+        return;
+
+    for(uint64_t n = first; n < end; n++)
+    {
+        if(holds_pointer(hdr, n))
+            words[n] = promote(vm, gc, ctl, words[n]);
+    }
+}
+
+/*
+ * Promote what the pointers in a card point to. The objects that the card
+ * has part of are found from the object that covers its first byte.
+ */
+static void scan_card(vm_t* vm, vm_gc_t* gc, gc_ctl_t* ctl, uint64_t c, uint64_t limit)
+{
+    uint64_t card = ctl->old_base + (c << CARD_SHIFT);
+    uint64_t card_end = card + CARD_SIZE;
+
+    if(card >= limit)
+        return;
+    if(card_end > limit)
+        card_end = limit;
+
+    for(uint64_t obj = card - (uint64_t)cover_table(vm, ctl)[c] * 8; obj < card_end;)
+    {
+        gc_header_t* hdr = (gc_header_t*)&vm->mem[obj];
+        uint64_t words = hdr->words & GC_WORDS;
+        uint64_t data = obj + HEADER_SIZE;
+        uint64_t first = (card > data)? (card - data) / 8: 0;
+        uint64_t end = (card_end - data + 7) / 8;
+
+        promote_fields(vm, gc, ctl, obj, first, (end < words)? end: words);
+        obj = data + words * 8;
+    }
+}
+
+static void minor_collection(vm_t* vm, vm_gc_t* gc, gc_ctl_t* ctl)
+{
+    uint64_t limit = vm->heap_top;
+    uint64_t scan = vm->heap_top;
+
+    for(size_t i = 0; i < gc->nroots; i++)
+        *gc->roots[i] = promote(vm, gc, ctl, *gc->roots[i]);
+
+    uint8_t* cards = card_table(vm, ctl);
+    uint32_t* dirty = dirty_list(vm, ctl);
+
+    for(uint64_t i = 0; i < ctl->ndirty; i++)
+    {
+        cards[dirty[i]] = 0;
+        scan_card(vm, gc, ctl, dirty[i], limit);
+    }
+    ctl->ndirty = 0;
+
+    // the copies are scanned in the order they were made
+    while(scan < vm->heap_top)
+    {
+        gc_header_t* hdr = (gc_header_t*)&vm->mem[scan];
+
+        promote_fields(vm, gc, ctl, scan, 0, hdr->words & GC_WORDS);
+        scan += object_bytes(hdr);
+    }
+
+    ctl->nursery_top = ctl->nursery;
+}
+
+/************************
+ * major collections
+ */
+static void mark_object(vm_t* vm, vm_gc_t* gc, gc_ctl_t* ctl, uint64_t addr)
+{
+    if(addr < ctl->old_base + HEADER_SIZE || addr >= vm->heap_top)
+        return;
+
+    gc_header_t* hdr = header_of(vm, addr);
+
+    if(hdr->words & GC_MARKED)
+        return;
+
+    hdr->words |= GC_MARKED;
+    if(hdr->mask == 0)
+        return;
+
+    if(gc->nmarks == gc->marks_capacity)
+        gc->marks = grow_or_die(gc->marks, &gc->marks_capacity, sizeof(uint64_t));
+    gc->marks[gc->nmarks++] = addr;
+}
+
+static inline uint64_t new_address(vm_t* vm, gc_ctl_t* ctl, uint64_t addr)
+{
+    if(addr < ctl->old_base + HEADER_SIZE || addr >= vm->heap_top)
+        return addr;
+
+    return ctl->old_base + (uint64_t)header_of(vm, addr)->forward * 8 + HEADER_SIZE;
+}
+
+/*
+ * The nursery is empty when this is called, so everything is in the old
+ * generation.
+ */
+static void major_collection(vm_t* vm, vm_gc_t* gc, gc_ctl_t* ctl)
+{
+    uint64_t top = vm->heap_top;
+    uint64_t next = ctl->old_base;
+    uint64_t bytes;
+
+    for(size_t i = 0; i < gc->nroots; i++)
+        mark_object(vm, gc, ctl, *gc->roots[i]);
+
+    while(gc->nmarks > 0)
+    {
+        uint64_t addr = gc->marks[--gc->nmarks];
+        gc_header_t* hdr = header_of(vm, addr);
+        uint64_t* words = (uint64_t*)&vm->mem[addr];
+        uint64_t n = hdr->words & GC_WORDS;
+
+        for(uint64_t i = 0; i < n; i++)
+        {
+            if(holds_pointer(hdr, i))
+                mark_object(vm, gc, ctl, words[i]);
+        }
+    }
+
+    // where everything that is marked will go
+    for(uint64_t obj = ctl->old_base; obj < top; obj += bytes)
+    {
+        gc_header_t* hdr = (gc_header_t*)&vm->mem[obj];
+
+        bytes = object_bytes(hdr);
+        if(hdr->words & GC_MARKED)
+        {
+            hdr->forward = (uint32_t)((next - ctl->old_base) / 8);
+            next += bytes;
+        }
+    }
+
+    for(size_t i = 0; i < gc->nroots; i++)
+        *gc->roots[i] = new_address(vm, ctl, *gc->roots[i]);
+
+    for(uint64_t obj = ctl->old_base; obj < top; obj += bytes)
+    {
+        gc_header_t* hdr = (gc_header_t*)&vm->mem[obj];
+        uint64_t* words = (uint64_t*)&vm->mem[obj + HEADER_SIZE];
+        uint64_t n = hdr->words & GC_WORDS;
+
+        bytes = object_bytes(hdr);
+        if(!(hdr->words & GC_MARKED) || hdr->mask == 0)
+            continue;
+
+        for(uint64_t i = 0; i < n; i++)
+        {
+            if(holds_pointer(hdr, i))
+                words[i] = new_address(vm, ctl, words[i]);
+        }
+    }
+
+    for(uint64_t obj = ctl->old_base; obj < top; obj += bytes)
+    {
+        gc_header_t* hdr = (gc_header_t*)&vm->mem[obj];
+
+        bytes = object_bytes(hdr);
+        if(hdr->words & GC_MARKED)
+        {
+            uint64_t dest = ctl->old_base + (uint64_t)hdr->forward * 8;
+
+            hdr->words &= ~GC_MARKED;
+            memmove(&vm->mem[dest], hdr, bytes);
+            note_object(vm, ctl, dest, bytes);
+        }
+    }
+
+    clear_memory(vm, next, top);
+    vm->heap_top = next;
+    ctl->faulted = next;
+
+    uint64_t live = next - ctl->old_base;
+
+    ctl->major_limit = (2 * live > MIN_MAJOR)? 2 * live: MIN_MAJOR;
+}
+
+static void collect(vm_t* vm, const vm_insn_t* insn, int major)
+{
+    vm_gc_t* gc = vm->gc;
+    gc_ctl_t* ctl = ctl_of(vm);
+
+    find_roots(vm, gc, insn);
+    gc->insn = insn;
+
+    uint64_t start = now_ns();
+
+    minor_collection(vm, gc, ctl);
+
+    if(major || vm->heap_top - ctl->old_base > ctl->major_limit || ctl->old_end - vm->heap_top < GC_NURSERY_SIZE)
+    {
+        major_collection(vm, gc, ctl);
+        add_pause(&gc->major, now_ns() - start);
+    }
+    else
+        add_pause(&gc->minor, now_ns() - start);
+}
+
+/************************
+ * handlers
+ */
+#define HANDLER(name) static const vm_insn_t* name(vm_t* vm, const vm_insn_t* insn)
+#define REG(n)      (vm->regs[insn->insn.operands[n].reg])
+
+static uint64_t operand_value(vm_t* vm, const vm_insn_t* insn, const decoded_operand_t* opnd)
+{
+    uint64_t addr;
+    uint64_t value;
+
+    switch (opnd->kind)
+    {
+        case OPND_REG:
+            return vm->regs[opnd->reg];
+        case OPND_IMM:
+        case OPND_FLOAT:
+            return opnd->value;
+        case OPND_REG_PTR:
+            addr = vm->regs[opnd->reg];
+            break;
+        case OPND_REG_OFS8:
+        case OPND_REG_OFS16:
+            addr = vm->regs[opnd->reg] + opnd->value;
+            break;
+        default:
+            addr = opnd->value;
+            break;
+    }
+
+    if(addr > vm->mem_size || 8 > vm->mem_size - addr)
+        vm_fault(vm, insn, "memory reference out of range");
+    memcpy(&value, &vm->mem[addr], 8);
+    return value;
+}
+
+HANDLER(op_gc_store)
+{
+    const decoded_operand_t* opnd = &insn->insn.operands[1];
+    const vm_insn_t* next = plain_handlers[insn->op](vm, insn);
+    gc_ctl_t* ctl = ctl_of(vm);
+    uint64_t value = REG(0);
+
+    // only a pointer to the nursery has to be remembered
+    if(opnd->kind == OPND_REG || value < ctl->nursery || value >= ctl->nursery_end)
+        return next;
+
+    uint64_t addr = (opnd->kind == OPND_REG_PTR)? vm->regs[opnd->reg]:
+                    (opnd->kind == OPND_IMM_PTR)? (uint64_t)opnd->value:
+                    vm->regs[opnd->reg] + opnd->value;
+
+    mark_cards(vm, ctl, addr, 8);
+    return next;
+}
+
+HANDLER(op_gc_move)
+{
+    const vm_insn_t* next = plain_handlers[insn->op](vm, insn);
+    uint64_t size = move_width[insn->op];
+
+    if(opcode_table[insn->op].noperands == 3)
+        size *= REG(2);
+    if(size > 0)
+        mark_cards(vm, ctl_of(vm), REG(0), size);
+    return next;
+}
+
+HANDLER(op_gc_allocate)
+{
+    REG(0) = gc_allocate(vm, insn, operand_value(vm, insn, &insn->insn.operands[1]), 0);
+    return insn + 1;
+}
+
+HANDLER(op_gc_free)
+{
+    (void)vm;
+    return insn + 1;
+}
+
+static void install_handlers(void)
+{
+    if(installed)
+        return;
+
+    memcpy(plain_handlers, vm_handlers, sizeof(plain_handlers));
+    for(int op = 0; op < VM_HANDLERS; op++)
+    {
+        if(opcode_table[op].name == NULL)
+            continue;
+
+        switch (opcode_table[op].base)
+        {
+            case OP_STORE:
+                vm_handlers[op] = op_gc_store;
+                break;
+            case OP_MOV8:
+            case OP_MOVB8:
+                move_width[op] = 1;
+                vm_handlers[op] = op_gc_move;
+                break;
+            case OP_MOV16:
+            case OP_MOVB16:
+                move_width[op] = 2;
+                vm_handlers[op] = op_gc_move;
+                break;
+            case OP_MOV32:
+            case OP_MOVB32:
+                move_width[op] = 4;
+                vm_handlers[op] = op_gc_move;
+                break;
+            case OP_MOV64:
+            case OP_MOV:
+            case OP_MOVB64:
+            case OP_MOVB:
+                move_width[op] = 8;
+                vm_handlers[op] = op_gc_move;
+                break;
+            case OP_ALLOCATE:
+                vm_handlers[op] = op_gc_allocate;
+                break;
+            case OP_FREE:
+                vm_handlers[op] = op_gc_free;
+                break;
+        }
+    }
+    installed = 1;
+}
+
+static int compare_maps(const void* a, const void* b)
+{
+    uint32_t oa = ((const image_ptrmap_t*)a)->offset;
+    uint32_t ob = ((const image_ptrmap_t*)b)->offset;
+
+    return (oa > ob) - (oa < ob);
+}
+
+/*
+ * Every ALLOCATE, and every call of a native that allocates by number, has
+ * to have a map. Anything else is found out when it is collected at.
+ */
+static int check_maps(vm_t* vm)
+{
+    int errors = 0;
+
+    for(size_t i = 0; i < vm->ninsns; i++)
+    {
+        const vm_insn_t* insn = &vm->insns[i];
+        const decoded_operand_t* opnd = &insn->insn.operands[0];
+        int base = opcode_table[insn->insn.opcode].base;
+
+        if(base != OP_ALLOCATE && (base != OP_EXCALL || opnd->kind != OPND_IMM ||
+                                   (opnd->value != VM_NATIVE_GC_ALLOC && opnd->value != VM_NATIVE_GC_COLLECT)))
+            continue;
+
+        if(find_map(vm->gc, insn->offset) == NULL)
+        {
+            fprintf(stderr, "ERROR: code offset 0x%08x: %s has no pointer map\n",
+                    insn->offset, opcode_table[insn->insn.opcode].name);
+            errors++;
+        }
+    }
+
+    return errors;
+}
+
+/************************
+ * public interface
+ */
+/*
+ * Turn the collector on, before the program is run. The memory is mapped
+ * again with room for a bigger heap. Returns non-zero and prints the reason
+ * if the program cannot be collected.
+ */
+int gc_start(vm_t* vm)
+{
+    vm_gc_t* gc = calloc(1, sizeof(vm_gc_t));
+
+    if(gc == NULL || vm_remap(vm, VM_GC_HEAP_SIZE))
+    {
+        free(gc);
+        return 1;
+    }
+
+    vm->gc = gc;
+    gc->nmaps = vm->image.num_ptrmaps;
+    gc->maps = malloc(gc->nmaps * sizeof(image_ptrmap_t) + 1);
+    if(gc->maps == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", gc->nmaps * sizeof(image_ptrmap_t));
+        exit(1);
+    }
+    memcpy(gc->maps, vm->image.ptrmaps, gc->nmaps * sizeof(image_ptrmap_t));
+    qsort(gc->maps, gc->nmaps, sizeof(image_ptrmap_t), compare_maps);
+
+    if(check_maps(vm))
+        return 1;
+
+    install_handlers();
+    gc_reset(vm);
+    return 0;
+}
+
+/*
+ * Lay out the collected heap. The memory after the data is all zero.
+ */
+void gc_reset(vm_t* vm)
+{
+    gc_ctl_t* ctl = ctl_of(vm);
+    uint64_t ncards = (vm->mem_size - vm->heap_base) >> CARD_SHIFT;
+
+    memset(ctl, 0, sizeof(gc_ctl_t));
+    ctl->cards = vm->heap_base + sizeof(gc_ctl_t);
+    ctl->cover = (ctl->cards + ncards + 7) & ~7ul;
+    ctl->dirty = ctl->cover + ncards * sizeof(uint32_t);
+    ctl->nursery = (ctl->dirty + ncards * sizeof(uint32_t) + GC_PAGE - 1) & ~(uint64_t)(GC_PAGE - 1);
+    ctl->nursery_top = ctl->nursery;
+    ctl->nursery_end = ctl->nursery + GC_NURSERY_SIZE;
+    ctl->old_base = ctl->nursery_end;
+    ctl->old_end = vm->mem_size;
+    ctl->major_limit = MIN_MAJOR;
+    vm->heap_top = ctl->old_base;
+}
+
+/*
+ * Returns the VM address of a new object of size bytes, all zero, or 0 if
+ * there is no room. Bit n of mask is set if word n of the object holds a
+ * pointer, and bit 63 is for every word from 63 on. This is where
+ * collections happen, so insn must have a pointer map.
+ */
+uint64_t gc_allocate(vm_t* vm, const vm_insn_t* insn, uint64_t size, uint64_t mask)
+{
+    gc_ctl_t* ctl = ctl_of(vm);
+
+    if(size == 0 || size > (uint64_t)GC_WORDS * 8)
+        return 0;
+
+    uint64_t bytes = HEADER_SIZE + ((size + 7) & ~7ul);
+    uint64_t addr;
+
+    if(bytes > LARGE_OBJECT)
+    {
+        // leave room to empty the nursery into
+        if(bytes + GC_NURSERY_SIZE > ctl->old_end - vm->heap_top)
+        {
+            collect(vm, insn, 1);
+            if(bytes + GC_NURSERY_SIZE > ctl->old_end - vm->heap_top)
+                return 0;
+        }
+
+        // memory past heap_top is already zero
+        addr = vm->heap_top;
+        vm->heap_top += bytes;
+        note_object(vm, ctl, addr, bytes);
+    }
+    else
+    {
+        if(bytes > ctl->nursery_end - ctl->nursery_top)
+            collect(vm, insn, 0);
+
+        addr = ctl->nursery_top;
+        ctl->nursery_top += bytes;
+        memset(&vm->mem[addr], 0, bytes);
+        if((addr ^ ctl->nursery_top) >= PREFAULT_SIZE)
+            prefault(vm, ctl);
+    }
+
+    gc_header_t* hdr = (gc_header_t*)&vm->mem[addr];
+
+    hdr->words = (uint32_t)((bytes - HEADER_SIZE) / 8);
+    hdr->mask = mask;
+    return addr + HEADER_SIZE;
+}
+
+/*
+ * A major collection, when the program asks for one.
+ */
+void gc_collect(vm_t* vm, const vm_insn_t* insn)
+{
+    collect(vm, insn, 1);
+}
+
+// in the nursery and the old generation
+uint64_t gc_heap_bytes(vm_t* vm)
+{
+    gc_ctl_t* ctl = ctl_of(vm);
+
+    return (ctl->nursery_top - ctl->nursery) + (vm->heap_top - ctl->old_base);
+}
+
+static int compare_ns(const void* a, const void* b)
+{
+    uint64_t na = *(const uint64_t*)a;
+    uint64_t nb = *(const uint64_t*)b;
+
+    return (na > nb) - (na < nb);
+}
+
+static void report_pauses(FILE* fp, const char* kind, pause_list_t* list)
+{
+    uint64_t total = 0;
+
+    if(list->count == 0)
+    {
+        fprintf(fp, "gc: no %s collections\n", kind);
+        return;
+    }
+
+    qsort(list->ns, list->count, sizeof(uint64_t), compare_ns);
+    for(size_t i = 0; i < list->count; i++)
+        total += list->ns[i];
+
+    // nearest rank
+    size_t p99 = (list->count * 99 + 99) / 100;
+
+    fprintf(fp, "gc: %lu %s collections, pause p50 %.1f us, p99 %.1f us, max %.1f us, total %.3f ms\n",
+            list->count, kind, list->ns[(list->count - 1) / 2] / 1000.0, list->ns[p99 - 1] / 1000.0,
+            list->ns[list->count - 1] / 1000.0, total / 1000000.0);
+}
+
+/*
+ * Print the pause times of the collections.
+ */
+void gc_finish(vm_t* vm, FILE* fp)
+{
+    if(vm->gc == NULL)
+        return;
+
+    report_pauses(fp, "minor", &vm->gc->minor);
+    report_pauses(fp, "major", &vm->gc->major);
+    fprintf(fp, "gc: %lu bytes promoted, %lu bytes in the old generation\n",
+            vm->gc->promoted, vm->heap_top - ctl_of(vm)->old_base);
+}
+
+void gc_destroy(vm_t* vm)
+{
+    vm_gc_t* gc = vm->gc;
+
+    if(gc == NULL)
+        return;
+
+    if(installed)
+    {
+        memcpy(vm_handlers, plain_handlers, sizeof(plain_handlers));
+        installed = 0;
+    }
+
+    free(gc->maps);
+    free(gc->roots);
+    free(gc->marks);
+    free(gc->minor.ns);
+    free(gc->major.ns);
+    free(gc);
+    vm->gc = NULL;
+}
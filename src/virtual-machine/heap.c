@@ -0,0 +1,460 @@
+/*
+ * The VM heap, for ALLOCATE and FREE.
+ *
+ * The heap is the part of the VM memory after the data segment, and all of
+ * its bookkeeping is kept there too, so an address is always an offset into
+ * the VM memory and a snapshot of the memory up to heap_top is a snapshot
+ * of the heap.
+ *
+ * The heap starts with a heap_ctl_t, which has a page_map_t for every page
+ * of the heap after it. The pages are handed out in spans of whole pages,
+ * from a list of free spans or from heap_top. A freed span is merged with
+ * the spans on either side of it if they are free, and if it ends at
+ * heap_top, heap_top moves back instead. Large freed spans, and any at the
+ * top, are given back to the system with madvise(), although their
+ * addresses stay reserved. Memory past heap_top is always zero.
+ *
+ * A small block is taken from a slab, a span of SLAB_PAGES that holds blocks
+ * of one size class, and has no header of its own. The slab_header_t at the
+ * start of a slab has the list of its free blocks, and each class has a list
+ * of the slabs that have room. The blocks of a new slab are handed out in
+ * order before any free list is used, so a slab is not touched until it is
+ * used. A slab whose blocks are all free is given back, unless it is the
+ * only one of its class that has room.
+ *
+ * A block bigger than the largest class is a span of its own, and starts at
+ * the start of the span.
+ *
+ * The VM runs one thread, so nothing here is locked.
+ */
+#include <string.h>
+#include <sys/mman.h>
+
+#include "virtual_machine.h"
+
+#define HEAP_PAGE           4096
+#define SLAB_PAGES          16
+#define SLAB_SIZE           (SLAB_PAGES * HEAP_PAGE)
+#define RELEASE_PAGES       16       // free spans this big are given back
+#define ALIGNMENT           16
+#define NONE                0        // end of a list of pages, which are numbered from 1
+
+// sizes of the classes, which are never more than 25% bigger than the request
+static const uint32_t class_size[HEAP_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128,
+    160, 192, 224, 256, 320, 384, 448, 512,
+    640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+};
+
+#define MAX_SMALL           2048
+
+// size class for each multiple of ALIGNMENT up to MAX_SMALL
+static uint8_t class_table[MAX_SMALL / ALIGNMENT + 1];
+
+enum
+{
+    SPAN_NONE,               // past heap_top
+    SPAN_FREE,
+    SPAN_SLAB,
+    SPAN_LARGE,
+    SPAN_INSIDE,             // not the first page of a span
+};
+
+/*
+ * The first page of a span has its kind and length. The last page of every
+ * span, and every page of a slab, has how far back the first page is.
+ */
+typedef struct
+{
+    uint32_t pages;
+    uint8_t kind;
+    uint8_t size_class;      // of a slab
+    uint16_t unused;
+} page_map_t;
+
+typedef struct
+{
+    uint32_t free_spans;     // first free span
+    uint32_t npages;         // pages the heap has room for
+    uint64_t pages_base;     // VM address of page 1
+    uint32_t partial[HEAP_CLASSES];      // first slab of each class with room
+    heap_stats_t stats;
+    page_map_t map[];        // by page, from 1
+} heap_ctl_t;
+
+// at the start of a free span
+typedef struct
+{
+    uint32_t next;
+    uint32_t prev;
+} span_links_t;
+
+// at the start of a slab
+typedef struct
+{
+    uint32_t next;           // in the list of slabs with room
+    uint32_t prev;
+    uint32_t free;           // first free block, as a block number plus 1
+    uint16_t carved;         // blocks handed out at least once
+    uint16_t live;           // blocks in use
+} slab_header_t;
+
+#define SLAB_HEADER_SIZE    ((sizeof(slab_header_t) + ALIGNMENT - 1) & ~(size_t)(ALIGNMENT - 1))
+#define SLAB_BLOCKS(c)      ((SLAB_SIZE - SLAB_HEADER_SIZE) / class_size[c])
+
+static inline heap_ctl_t* ctl_of(vm_t* vm)
+{
+    return (heap_ctl_t*)&vm->mem[vm->heap_base];
+}
+
+static inline uint64_t page_addr(heap_ctl_t* ctl, uint32_t page)
+{
+    return ctl->pages_base + (uint64_t)(page - 1) * HEAP_PAGE;
+}
+
+static inline void* page_ptr(vm_t* vm, heap_ctl_t* ctl, uint32_t page)
+{
+    return &vm->mem[page_addr(ctl, page)];
+}
+
+static inline uint32_t top_page(vm_t* vm, heap_ctl_t* ctl)
+{
+    return (uint32_t)((vm->heap_top - ctl->pages_base) / HEAP_PAGE) + 1;
+}
+
+/************************
+ * spans
+ */
+
+static void set_span(heap_ctl_t* ctl, uint32_t page, uint32_t pages, int kind)
+{
+    ctl->map[page].pages = pages;
+    ctl->map[page].kind = (uint8_t)kind;
+    if(pages > 1)
+    {
+        ctl->map[page + pages - 1].pages = pages - 1;
+        ctl->map[page + pages - 1].kind = SPAN_INSIDE;
+    }
+}
+
+static void unlink_free(vm_t* vm, heap_ctl_t* ctl, uint32_t page)
+{
+    span_links_t* links = page_ptr(vm, ctl, page);
+
+    if(links->prev != NONE)
+        ((span_links_t*)page_ptr(vm, ctl, links->prev))->next = links->next;
+    else
+        ctl->free_spans = links->next;
+    if(links->next != NONE)
+        ((span_links_t*)page_ptr(vm, ctl, links->next))->prev = links->prev;
+}
+
+static void push_free(vm_t* vm, heap_ctl_t* ctl, uint32_t page, uint32_t pages)
+{
+    span_links_t* links = page_ptr(vm, ctl, page);
+
+    set_span(ctl, page, pages, SPAN_FREE);
+    links->prev = NONE;
+    links->next = ctl->free_spans;
+    if(links->next != NONE)
+        ((span_links_t*)page_ptr(vm, ctl, links->next))->prev = page;
+    ctl->free_spans = page;
+}
+
+/*
+ * Returns the first page of a new span, or NONE if there is no room. The
+ * free spans are searched first fit, and the rest of the one that is used
+ * stays free.
+ */
+static uint32_t alloc_span(vm_t* vm, heap_ctl_t* ctl, uint32_t pages, int kind)
+{
+    for(uint32_t page = ctl->free_spans; page != NONE; page = ((span_links_t*)page_ptr(vm, ctl, page))->next)
+    {
+        uint32_t have = ctl->map[page].pages;
+
+        if(have < pages)
+            continue;
+
+        unlink_free(vm, ctl, page);
+        if(have > pages)
+            push_free(vm, ctl, page + pages, have - pages);
+        set_span(ctl, page, pages, kind);
+        return page;
+    }
+
+    uint32_t page = top_page(vm, ctl);
+
+    if(page - 1 + (uint64_t)pages > ctl->npages)
+        return NONE;
+
+    vm->heap_top += (size_t)pages * HEAP_PAGE;
+    set_span(ctl, page, pages, kind);
+    return page;
+}
+
+static void free_span(vm_t* vm, heap_ctl_t* ctl, uint32_t page)
+{
+    uint32_t pages = ctl->map[page].pages;
+    uint32_t top = top_page(vm, ctl);
+
+    // merge with the span after it
+    if(page + pages < top && ctl->map[page + pages].kind == SPAN_FREE)
+    {
+        unlink_free(vm, ctl, page + pages);
+        pages += ctl->map[page + pages].pages;
+    }
+
+    // and the span before it
+    if(page > 1)
+    {
+        uint32_t first = page - 1;
+
+        if(ctl->map[first].kind == SPAN_INSIDE)
+            first -= ctl->map[first].pages;
+        if(ctl->map[first].kind == SPAN_FREE)
+        {
+            unlink_free(vm, ctl, first);
+            pages += page - first;
+            page = first;
+        }
+    }
+
+    void* ptr = page_ptr(vm, ctl, page);
+    size_t bytes = (size_t)pages * HEAP_PAGE;
+
+    if(page + pages == top)
+    {
+        // memory past heap_top is always zero, so that a replay sees the same
+        if(madvise(ptr, bytes, MADV_DONTNEED))
+            memset(ptr, 0, bytes);
+        memset(&ctl->map[page], 0, sizeof(page_map_t));
+        memset(&ctl->map[page + pages - 1], 0, sizeof(page_map_t));
+        vm->heap_top = page_addr(ctl, page);
+        return;
+    }
+    if(pages >= RELEASE_PAGES)
+        madvise(ptr, bytes, MADV_DONTNEED);
+    push_free(vm, ctl, page, pages);
+}
+
+/************************
+ * slabs
+ */
+
+static void push_partial(vm_t* vm, heap_ctl_t* ctl, int c, uint32_t page)
+{
+    slab_header_t* slab = page_ptr(vm, ctl, page);
+
+    slab->prev = NONE;
+    slab->next = ctl->partial[c];
+    if(slab->next != NONE)
+        ((slab_header_t*)page_ptr(vm, ctl, slab->next))->prev = page;
+    ctl->partial[c] = page;
+}
+
+static void unlink_partial(vm_t* vm, heap_ctl_t* ctl, int c, uint32_t page)
+{
+    slab_header_t* slab = page_ptr(vm, ctl, page);
+
+    if(slab->prev != NONE)
+        ((slab_header_t*)page_ptr(vm, ctl, slab->prev))->next = slab->next;
+    else
+        ctl->partial[c] = slab->next;
+    if(slab->next != NONE)
+        ((slab_header_t*)page_ptr(vm, ctl, slab->next))->prev = slab->prev;
+}
+
+static uint32_t new_slab(vm_t* vm, heap_ctl_t* ctl, int c)
+{
+    uint32_t page = alloc_span(vm, ctl, SLAB_PAGES, SPAN_SLAB);
+
+    if(page == NONE)
+        return NONE;
+
+    for(uint32_t i = 1; i < SLAB_PAGES; i++)
+    {
+        ctl->map[page + i].pages = i;
+        ctl->map[page + i].kind = SPAN_INSIDE;
+    }
+    ctl->map[page].size_class = (uint8_t)c;
+
+    slab_header_t* slab = page_ptr(vm, ctl, page);
+
+    memset(slab, 0, sizeof(slab_header_t));
+    push_partial(vm, ctl, c, page);
+    ctl->stats.class_slabs[c]++;
+    return page;
+}
+
+static uint64_t alloc_small(vm_t* vm, heap_ctl_t* ctl, int c)
+{
+    uint32_t page = ctl->partial[c];
+
+    if(page == NONE && (page = new_slab(vm, ctl, c)) == NONE)
+        return 0;
+
+    slab_header_t* slab = page_ptr(vm, ctl, page);
+    uint64_t base = page_addr(ctl, page) + SLAB_HEADER_SIZE;
+    uint32_t block;
+
+    if(slab->free != NONE)
+    {
+        block = slab->free - 1;
+        memcpy(&slab->free, &vm->mem[base + (uint64_t)block * class_size[c]], sizeof(uint32_t));
+    }
+    else
+        block = slab->carved++;
+
+    slab->live++;
+    if(slab->free == NONE && slab->carved == SLAB_BLOCKS(c))
+        unlink_partial(vm, ctl, c, page);
+
+    ctl->stats.class_live[c]++;
+    ctl->stats.live_bytes += class_size[c];
+    return base + (uint64_t)block * class_size[c];
+}
+
+static int free_small(vm_t* vm, heap_ctl_t* ctl, uint32_t page, uint64_t addr)
+{
+    int c = ctl->map[page].size_class;
+    slab_header_t* slab = page_ptr(vm, ctl, page);
+    uint64_t base = page_addr(ctl, page) + SLAB_HEADER_SIZE;
+
+    if(addr < base || (addr - base) % class_size[c] != 0)
+        return 1;
+
+    uint32_t block = (uint32_t)((addr - base) / class_size[c]);
+
+    if(block >= slab->carved || slab->live == 0)
+        return 1;
+
+    int was_full = (slab->free == NONE && slab->carved == SLAB_BLOCKS(c));
+
+    memcpy(&vm->mem[addr], &slab->free, sizeof(uint32_t));
+    slab->free = block + 1;
+    slab->live--;
+    ctl->stats.class_live[c]--;
+    ctl->stats.live_bytes -= class_size[c];
+
+    if(was_full)
+        push_partial(vm, ctl, c, page);
+    else if(slab->live == 0 && (slab->prev != NONE || slab->next != NONE))
+    {
+        unlink_partial(vm, ctl, c, page);
+        ctl->stats.class_slabs[c]--;
+        free_span(vm, ctl, page);
+    }
+    return 0;
+}
+
+/************************
+ * public interface
+ */
+
+void heap_init(vm_t* vm)
+{
+    if(class_table[1] == 0)
+    {
+        int c = 0;
+
+        for(int i = 1; i <= MAX_SMALL / ALIGNMENT; i++)
+        {
+            while(class_size[c] < (uint32_t)i * ALIGNMENT)
+                c++;
+            class_table[i] = (uint8_t)c;
+        }
+    }
+
+    heap_ctl_t* ctl = ctl_of(vm);
+    size_t room = (vm->mem_size - vm->heap_base) / HEAP_PAGE;
+    size_t ctl_size = (sizeof(heap_ctl_t) + (room + 1) * sizeof(page_map_t) + HEAP_PAGE - 1) & ~(size_t)(HEAP_PAGE - 1);
+
+    memset(ctl, 0, sizeof(heap_ctl_t));
+    ctl->npages = (uint32_t)(room - ctl_size / HEAP_PAGE);
+    ctl->pages_base = vm->heap_base + ctl_size;
+    vm->heap_top = ctl->pages_base;
+}
+
+void heap_destroy(vm_t* vm)
+{
+    (void)vm;
+}
+
+/*
+ * Returns the VM address of the new block, or 0 if there is no room. 0 is
+ * never a heap address, because the heap starts after the data.
+ */
+uint64_t heap_allocate(vm_t* vm, uint64_t size)
+{
+    heap_ctl_t* ctl = ctl_of(vm);
+
+    if(size == 0 || size > vm->mem_size)
+        return 0;
+
+    if(size <= MAX_SMALL)
+        return alloc_small(vm, ctl, class_table[(size + ALIGNMENT - 1) / ALIGNMENT]);
+
+    uint32_t pages = (uint32_t)((size + HEAP_PAGE - 1) / HEAP_PAGE);
+    uint32_t page = alloc_span(vm, ctl, pages, SPAN_LARGE);
+
+    if(page == NONE)
+        return 0;
+
+    ctl->stats.large_objects++;
+    ctl->stats.large_bytes += (uint64_t)pages * HEAP_PAGE;
+    ctl->stats.live_bytes += (uint64_t)pages * HEAP_PAGE;
+    return page_addr(ctl, page);
+}
+
+/*
+ * Returns non-zero if addr is not a block that is in use. A small block
+ * that is freed twice is not caught.
+ */
+int heap_free(vm_t* vm, uint64_t addr)
+{
+    heap_ctl_t* ctl = ctl_of(vm);
+
+    if(addr < ctl->pages_base || addr >= vm->heap_top)
+        return 1;
+
+    uint32_t page = (uint32_t)((addr - ctl->pages_base) / HEAP_PAGE) + 1;
+
+    if(ctl->map[page].kind == SPAN_INSIDE)
+        page -= ctl->map[page].pages;
+
+    switch (ctl->map[page].kind)
+    {
+        case SPAN_SLAB:
+            return free_small(vm, ctl, page, addr);
+        case SPAN_LARGE:
+        {
+            if(addr != page_addr(ctl, page))
+                return 1;
+
+            uint64_t bytes = (uint64_t)ctl->map[page].pages * HEAP_PAGE;
+
+            ctl->stats.large_objects--;
+            ctl->stats.large_bytes -= bytes;
+            ctl->stats.live_bytes -= bytes;
+            free_span(vm, ctl, page);
+            return 0;
+        }
+        default:
+            return 1;
+    }
+}
+
+const heap_stats_t* heap_stats(vm_t* vm)
+{
+    return &ctl_of(vm)->stats;
+}
+
+uint32_t heap_class_size(int c)
+{
+    return class_size[c];
+}
+
+uint32_t heap_class_blocks(int c)
+{
+    return (uint32_t)SLAB_BLOCKS(c);
+}
@@ -0,0 +1,264 @@
+/*
+ * Inlining of small leaf routines.
+ *
+ * A CALL to a fixed address pushes the address of the next instruction and
+ * dispatches to the routine, and the RET at the end of it pops the address,
+ * looks it up and dispatches again. For a routine of a few instructions
+ * that is most of what it costs, so the loader puts a copy of the routine
+ * in place of the CALL, when nothing that the program does can tell.
+ *
+ * The routine has to end at an unconditional RET within INLINE_MAX_INSNS
+ * instructions. Everything before that has to be a data instruction, or a
+ * jump to a fixed address inside the routine, which goes to the same place
+ * in the copy; a jump to the RET goes to the instruction after the copy.
+ * Nothing in it may use the stack, since the return address is not on it,
+ * or call, trap, stop or allocate, since natives and the collector look up
+ * the instruction that called them.
+ *
+ * CALL and RET both clear N, Z, C and V, and the copy does not. So the
+ * routine has to set all four before it tests a flag or jumps, and the
+ * code after the CALL has to set all four before it tests a flag or goes
+ * anywhere else. The taken branches that the CALL and RET counted are not
+ * counted either, which record and replay do not mind, since they load the
+ * code the same way.
+ *
+ * The copies go in vm->insns in place of the CALL, and each one gets an
+ * offset of its own past the end of the code, so that a return address, a
+ * signal or a snapshot that is in one can find it again. vm->sources gives
+ * the offset of the instruction in the code that each one is a copy of,
+ * for the debugger. The offset of the CALL goes to the first instruction
+ * of its copy.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "virtual_machine.h"
+
+#define INLINE_MAX_INSNS    8
+
+static void* alloc_or_die(size_t size)
+{
+    void* ptr = malloc(size);
+
+    if(ptr == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", size);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+/*
+ * The instructions that can be copied as they are, apart from jumps.
+ */
+static int copyable(const vm_insn_t* insn)
+{
+    switch (opcode_table[insn->insn.opcode].base)
+    {
+        case OP_PUSH:
+        case OP_POP:
+        case OP_ALLOCATE:
+            return 0;
+        case OP_NOP:
+        case OP_RESUME:
+        case OP_STZ: case OP_CLZ: case OP_STC: case OP_CLC: case OP_STN: case OP_CLN:
+        case OP_STV: case OP_CLV: case OP_STT: case OP_CLT: case OP_STE: case OP_CLE:
+        case OP_STORE:
+        case OP_MOV8: case OP_MOV16: case OP_MOV32: case OP_MOV64: case OP_MOV:
+        case OP_MOVB8: case OP_MOVB16: case OP_MOVB32: case OP_MOVB64: case OP_MOVB:
+        case OP_CMP:
+        case OP_TST:
+        case OP_FREE:
+            return 1;
+        default:
+            return cgen_dest_reg(insn) >= 0;
+    }
+}
+
+/*
+ * The instructions that set all of N, Z, C and V.
+ */
+static int sets_nzcv(int base)
+{
+    switch (base)
+    {
+        case OP_IADD: case OP_UADD: case OP_FADD:
+        case OP_ISUB: case OP_USUB: case OP_FSUB:
+        case OP_IMUL: case OP_UMUL: case OP_FMUL:
+        case OP_IDIV: case OP_UDIV: case OP_FDIV:
+        case OP_IMOD: case OP_UMOD: case OP_FMOD:
+        case OP_INEG: case OP_UNEG: case OP_FNEG:
+        case OP_INC: case OP_DEC:
+        case OP_SHL: case OP_SHR: case OP_ROL: case OP_ROR:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_NOT:
+        case OP_CMP: case OP_TST:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * The number of instructions to copy for a call to instruction t, or 0 if
+ * it cannot be inlined.
+ */
+static size_t body_length(vm_t* vm, size_t t)
+{
+    int flags_set = 0;
+
+    for(size_t k = t; k < vm->ninsns && k - t <= INLINE_MAX_INSNS; k++)
+    {
+        const vm_insn_t* insn = &vm->insns[k];
+        const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+
+        if(info->base == OP_RET && info->cond == 0)
+            return k - t;
+
+        if(info->base == OP_JMP)
+        {
+            if(!flags_set || insn->target == NULL)
+                return 0;
+        }
+        else if(!copyable(insn))
+            return 0;
+
+        flags_set |= sets_nzcv(info->base);
+    }
+
+    return 0;
+}
+
+/*
+ * Whether the code after a call sets N, Z, C and V before anything could
+ * see that the call did not clear them.
+ */
+static int flags_dead_after(vm_t* vm, size_t k)
+{
+    for(; k < vm->ninsns; k++)
+    {
+        int base = opcode_table[vm->insns[k].insn.opcode].base;
+
+        if(sets_nzcv(base))
+            return 1;
+        if(base == OP_JMP || !copyable(&vm->insns[k]))
+            return 0;
+    }
+
+    return 0;
+}
+
+/*
+ * The jumps in a body have to land inside it, on an instruction that is
+ * copied or on the RET.
+ */
+static int jumps_inside(vm_t* vm, size_t t, size_t len)
+{
+    for(size_t k = t; k < t + len; k++)
+    {
+        const vm_insn_t* target = vm->insns[k].target;
+
+        if(target != NULL && ((size_t)(target - vm->insns) < t || (size_t)(target - vm->insns) > t + len))
+            return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Put copies of the small leaf routines in place of the calls to them.
+ * Runs after vm_verify(), on the code as it was decoded.
+ */
+void vm_inline(vm_t* vm)
+{
+    size_t* lens = calloc(vm->ninsns + 1, sizeof(size_t));   // by call, the body length
+    size_t ncopies = 0;
+
+    if(lens == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", (vm->ninsns + 1) * sizeof(size_t));
+        exit(1);
+    }
+
+    for(size_t k = 0; k < vm->ninsns; k++)
+    {
+        const vm_insn_t* insn = &vm->insns[k];
+        const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+
+        if(info->base != OP_CALL || info->cond != 0 || insn->target == NULL)
+            continue;
+
+        size_t t = (size_t)(insn->target - vm->insns);
+        size_t len = body_length(vm, t);
+
+        if(len > 0 && jumps_inside(vm, t, len) && flags_dead_after(vm, k + 1))
+        {
+            lens[k] = len;
+            ncopies += len;
+        }
+    }
+
+    if(ncopies == 0)
+    {
+        free(lens);
+        return;
+    }
+
+    // new index of each old instruction; a call goes to the start of its copy
+    uint32_t* moved = alloc_or_die((vm->ninsns + 1) * sizeof(uint32_t));
+    size_t ninsns = 0;
+
+    for(size_t k = 0; k <= vm->ninsns; k++)
+    {
+        moved[k] = (uint32_t)ninsns;
+        ninsns += (lens[k] > 0)? lens[k]: 1;
+    }
+
+    uint64_t size = vm->image.header->code_size;
+    vm_insn_t* insns = alloc_or_die(ninsns * sizeof(vm_insn_t));
+    uint32_t* index = alloc_or_die((size + 1 + ncopies) * sizeof(uint32_t));
+    uint32_t* sources = alloc_or_die(ncopies * sizeof(uint32_t));
+    size_t n = 0;
+
+    memset(index, 0xFF, (size + 1) * sizeof(uint32_t));
+    for(size_t k = 0; k <= vm->ninsns; k++)
+    {
+        const vm_insn_t* old = &vm->insns[k];
+        vm_insn_t* insn = &insns[moved[k]];
+
+        index[old->offset] = moved[k];
+        if(lens[k] == 0)
+        {
+            *insn = *old;
+            if(old->target != NULL)
+                insn->target = &insns[moved[old->target - vm->insns]];
+            continue;
+        }
+
+        size_t t = (size_t)(old->target - vm->insns);
+
+        for(size_t i = 0; i < lens[k]; i++, insn++, n++)
+        {
+            const vm_insn_t* src = &vm->insns[t + i];
+
+            *insn = *src;
+            insn->offset = (uint32_t)(size + 1 + n);
+            if(src->target != NULL)
+                insn->target = &insns[moved[k] + (src->target - &vm->insns[t])];
+            index[insn->offset] = (uint32_t)(insn - insns);
+            sources[n] = src->offset;
+        }
+    }
+
+    free(vm->insns);
+    free(vm->insn_index);
+    free(lens);
+    free(moved);
+    vm->insns = insns;
+    vm->ninsns = ninsns - 1;
+    vm->insn_index = index;
+    vm->noffsets = size + 1 + ncopies;
+    vm->sources = sources;
+    vm_find_vectors(vm);
+}
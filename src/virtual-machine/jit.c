@@ -0,0 +1,1230 @@
+/*
+ * Tracing JIT, for a program that is run with -j.
+ *
+ * Every taken backward jump counts against its target. When a target has
+ * been jumped back to JIT_HOT_LOOP times, the VM records a trace from it:
+ * vm->dispatch is pointed at a table where every slot writes down the
+ * instruction and which way it went, and then runs it. The trace follows
+ * CALL and RET, so a loop that calls small functions is one trace. It ends
+ * when it gets back to where it started, or at the start of another trace,
+ * and is given up if it gets too long or reaches something that cannot be
+ * in a trace, such as TRAP or a jump through a register.
+ *
+ * A trace is straight line code. Each conditional instruction becomes a
+ * guard that leaves the trace if it would go the other way, and each RET a
+ * guard that the return address is the one that was recorded. Leaving
+ * puts the registers back and hands the guard instruction to the
+ * interpreter, which runs it again. When one exit has been taken
+ * JIT_HOT_EXIT times, a branch trace is recorded from there, and the start
+ * trace and its branches are compiled together as a tree, where the guard
+ * goes straight to the branch.
+ *
+ * Before it is written, each trace is worked through in order with the
+ * registers whose values are known, from LOAD of a constant and from
+ * instructions whose inputs are all known, which are done now and not
+ * when it runs. Guards on flags that are known go away. The flags that are
+ * set and never looked at before they are set again are written to a
+ * local that is thrown away. The tree is written as one C function with
+ * the VM registers in locals, and the C compiler puts those in machine
+ * registers and does the rest.
+ *
+ * The C is compiled by the system C compiler on a thread of its own, so
+ * the program goes on in the interpreter while it is compiled, and the
+ * library is loaded and the start of the tree is patched to VM_OP_TRACE
+ * the next time the VM comes past. If a compile fails, for example because
+ * there is no C compiler, the VM says so once and records no more traces.
+ * Compiled traces do not count branches, so -j cannot be used with record
+ * and replay.
+ *
+ * With -J the libraries are kept in a code cache directory, in a directory
+ * of their own for each program, named from the hash of its code, the
+ * version of the code the JIT writes, the size of vm_t and a hash of the
+ * CPU's features, so that a library is never used with anything but what
+ * it was compiled for. Each library has the traces it was compiled from in
+ * it, and they are all loaded when the VM starts, so the program does not
+ * have to warm up again. dlopen() maps them, so processes that run the
+ * same program share the pages. A library is compiled under a temporary
+ * name and renamed into place, so another process never sees half of it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+
+#include "aot.h"
+
+#define JIT_HOT_LOOP    1000    // backward jumps to a target before it is traced
+#define JIT_HOT_EXIT    200     // times out of an exit before a branch is traced
+#define JIT_MAX_STEPS   512     // longest trace
+#define JIT_MAX_TRACES  16      // in a tree, with its start trace
+#define JIT_MAX_TRIES   3       // recordings given up before a place is left alone
+#define JIT_NEVER       UINT16_MAX
+#define JIT_NO_EXIT     UINT32_MAX
+
+typedef const vm_insn_t* (*jit_func_t)(vm_t* vm, const vm_insn_t* insn, uint32_t* exit);
+
+typedef struct
+{
+    uint32_t k;              // instruction
+    uint32_t next;           // the instruction after it in the trace
+    uint8_t taken;           // a conditional instruction went the way it goes when met
+    uint32_t exit;           // for its condition, or JIT_NO_EXIT
+    uint32_t ret_exit;       // for the return address of a RET
+} step_t;
+
+typedef struct
+{
+    step_t* steps;
+    uint32_t nsteps;
+    int closes;              // goes back to the start of the tree at the end
+} trace_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint8_t tries;
+    int8_t branch;           // trace that it goes to, or -1
+} exit_t;
+
+typedef struct tree_t
+{
+    uint32_t anchor;
+    trace_t traces[JIT_MAX_TRACES];
+    int ntraces;
+    exit_t* exits;
+    uint32_t nexits;
+    jit_func_t func;
+    void* lib;
+    int compiling;
+    int changed;             // traces were added while it was compiled
+} tree_t;
+
+typedef struct job_t
+{
+    tree_t* tree;
+    uint32_t anchor;
+    char* source;
+    size_t size;
+    void* lib;               // set by the compile thread
+    jit_func_t func;
+    struct job_t* next;
+} job_t;
+
+struct vm_jit_t
+{
+    uint16_t* counts;        // by instruction: backward jumps to it
+    uint8_t* tries;
+    tree_t** trees;          // by instruction: the tree that starts there
+    uint64_t code_hash;
+    char* cache;             // directory for this program, or NULL
+
+    // the trace being recorded
+    int recording;
+    tree_t* rec_tree;        // NULL for a start trace
+    uint32_t rec_exit;
+    uint32_t rec_start;
+    step_t* rec_steps;
+    uint32_t rec_n;
+    int off;                 // a compile failed; nothing more is recorded
+
+    // shared with the compile thread
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    job_t* queue;
+    job_t* done;
+    volatile int ready;
+    int stop;
+    int failed;              // a compile failed, so no more are tried
+
+    uint64_t ntraces;
+    uint64_t ntrees;
+    uint64_t ncompiled;
+    uint64_t ncached;
+    uint64_t naborted;
+};
+
+static vm_handler_t plain_handlers[VM_HANDLERS];
+static vm_handler_t record_handlers[VM_HANDLERS];
+
+static void* alloc_or_die(size_t size)
+{
+    void* ptr = calloc(1, size);
+
+    if(ptr == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", size);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+static int base_of(vm_t* vm, uint32_t k)
+{
+    return opcode_table[vm->insns[k].insn.opcode].base;
+}
+
+/************************
+ * compiling
+ */
+/*
+ * Compile the C of a job and load it. job->func is left NULL if that fails.
+ */
+static void compile_job(struct vm_jit_t* jit, job_t* job)
+{
+    char cfile[] = "/tmp/vmjitXXXXXX.c";
+    char sofile[4096];
+    char cached[4096];
+
+    snprintf(sofile, sizeof(sofile), "%s/.jitXXXXXX.so", (jit->cache != NULL)? jit->cache: "/tmp");
+
+    int cfd = mkstemps(cfile, 2);
+    int sofd = mkstemps(sofile, 3);
+
+    if(cfd >= 0 && sofd >= 0 && write(cfd, job->source, job->size) == (ssize_t)job->size &&
+       !cgen_compile(cfile, sofile))
+    {
+        job->lib = dlopen(sofile, RTLD_NOW | RTLD_LOCAL);
+        if(job->lib != NULL)
+            job->func = (jit_func_t)dlsym(job->lib, "trace");
+    }
+    if(cfd >= 0)
+    {
+        close(cfd);
+        unlink(cfile);
+    }
+    if(sofd >= 0)
+    {
+        close(sofd);
+        snprintf(cached, sizeof(cached), "%s/t%u.so", jit->cache, job->anchor);
+        if(jit->cache == NULL || job->func == NULL || rename(sofile, cached))
+            unlink(sofile);
+    }
+}
+
+static void* compile_thread(void* arg)
+{
+    struct vm_jit_t* jit = arg;
+
+    pthread_mutex_lock(&jit->lock);
+    for(;;)
+    {
+        while(!jit->stop && jit->queue == NULL)
+            pthread_cond_wait(&jit->wake, &jit->lock);
+        if(jit->stop)
+            break;
+
+        job_t* job = jit->queue;
+        int failed = jit->failed;
+
+        jit->queue = job->next;
+        pthread_mutex_unlock(&jit->lock);
+
+        // after one has failed, the rest would fail the same way
+        if(!failed)
+            compile_job(jit, job);
+
+        pthread_mutex_lock(&jit->lock);
+        if(job->func == NULL)
+            jit->failed = 1;
+        job->next = jit->done;
+        jit->done = job;
+        __atomic_store_n(&jit->ready, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&jit->lock);
+    return NULL;
+}
+
+static void queue_compile(vm_t* vm, tree_t* tree);
+
+/*
+ * Put the trees that have been compiled in place. This is only called
+ * from the handlers, never from compiled code, so an old library can go.
+ * If a compile failed, the program goes on in the interpreter and no more
+ * traces are recorded.
+ */
+static void install(vm_t* vm)
+{
+    struct vm_jit_t* jit = vm->jit;
+
+    pthread_mutex_lock(&jit->lock);
+
+    job_t* job = jit->done;
+    int failed = jit->failed;
+
+    jit->done = NULL;
+    jit->ready = 0;
+    pthread_mutex_unlock(&jit->lock);
+
+    if(failed && !jit->off)
+    {
+        fprintf(stderr, "Warning: the JIT cannot compile traces; the program runs in the interpreter\n");
+        jit->off = 1;
+    }
+
+    while(job != NULL)
+    {
+        job_t* next = job->next;
+        tree_t* tree = job->tree;
+
+        tree->compiling = 0;
+        if(job->func != NULL)
+        {
+            if(tree->lib != NULL)
+                dlclose(tree->lib);
+            tree->lib = job->lib;
+            tree->func = job->func;
+            vm->insns[tree->anchor].op = VM_OP_TRACE;
+            jit->ncompiled++;
+        }
+        else if(job->lib != NULL)
+            dlclose(job->lib);
+        if(tree->changed && !jit->stop && !jit->off)
+        {
+            tree->changed = 0;
+            queue_compile(vm, tree);
+        }
+
+        free(job->source);
+        free(job);
+        job = next;
+    }
+}
+
+/************************
+ * writing the C
+ */
+typedef struct
+{
+    FILE* out;
+    vm_t* vm;
+    tree_t* tree;
+    cgen_consts_t consts;
+    int flags_known;
+    uint32_t flags;          // N, Z, C and V, if they are known
+    uint32_t regs;           // used anywhere in the tree
+} writer_t;
+
+/*
+ * The value of an operand, if it is known now.
+ */
+static int known(writer_t* wr, uint32_t k, int n, uint64_t* value)
+{
+    const decoded_operand_t* opnd = &wr->vm->insns[k].insn.operands[n];
+
+    if(opnd->kind == OPND_IMM || opnd->kind == OPND_FLOAT)
+        *value = (uint64_t)opnd->value;
+    else if(opnd->kind == OPND_REG && (wr->consts.known & (1u << opnd->reg)))
+        *value = wr->consts.values[opnd->reg];
+    else
+        return 0;
+    return 1;
+}
+
+/*
+ * Work out an instruction now, if all of its inputs are known. The
+ * helpers are the ones the compiled code uses, so they give the same
+ * answer.
+ */
+static int fold(writer_t* wr, uint32_t k, uint64_t* result, uint32_t* flags)
+{
+    vm_t* vm = wr->vm;
+    const vm_insn_t* insn = &vm->insns[k];
+    int base = opcode_table[insn->insn.opcode].base;
+    uint64_t a, b;
+    uint32_t f = 0;
+
+    switch (base)
+    {
+        case OP_LOAD:
+            if(!known(wr, k, 1, &a))
+                return 0;
+            *result = a;
+            return 1;
+        case OP_IADD: case OP_UADD: case OP_FADD:
+        case OP_ISUB: case OP_USUB: case OP_FSUB:
+        case OP_IMUL: case OP_UMUL: case OP_FMUL:
+        case OP_IDIV: case OP_UDIV: case OP_FDIV:
+        case OP_IMOD: case OP_UMOD: case OP_FMOD:
+        case OP_AND: case OP_OR: case OP_XOR:
+            if(!known(wr, k, 1, &a) || !known(wr, k, 2, &b))
+                return 0;
+            break;
+        case OP_SHL: case OP_SHR: case OP_ROL: case OP_ROR:
+            if(!known(wr, k, 0, &a) || !known(wr, k, 1, &b))
+                return 0;
+            break;
+        case OP_CMP: case OP_TST:
+            if(!known(wr, k, 0, &a) || !known(wr, k, 1, &b))
+                return 0;
+            break;
+        case OP_INEG: case OP_UNEG: case OP_FNEG: case OP_INC: case OP_DEC: case OP_NOT:
+        case OP_FTU: case OP_FTI: case OP_ITF: case OP_ITU: case OP_UTF: case OP_UTI:
+            if(!known(wr, k, 0, &a))
+                return 0;
+            break;
+        default:
+            return 0;
+    }
+
+    switch (base)
+    {
+        case OP_IADD: *result = aot_iadd(&f, a, b); break;
+        case OP_UADD: *result = aot_uadd(&f, a, b); break;
+        case OP_FADD: *result = aot_fadd(&f, a, b); break;
+        case OP_ISUB: *result = aot_isub(&f, a, b); break;
+        case OP_USUB: *result = aot_usub(&f, a, b); break;
+        case OP_FSUB: *result = aot_fsub(&f, a, b); break;
+        case OP_IMUL: *result = aot_imul(&f, a, b); break;
+        case OP_UMUL: *result = aot_umul(&f, a, b); break;
+        case OP_FMUL: *result = aot_fmul(&f, a, b); break;
+        case OP_FDIV: *result = aot_fdiv(&f, a, b); break;
+        case OP_FMOD: *result = aot_fmod(&f, a, b); break;
+        case OP_IDIV: case OP_IMOD:
+            if(b == 0)
+                return 0;
+            *result = aot_int_divide(vm, insn, &f, a, b, base == OP_IMOD);
+            break;
+        case OP_UDIV: case OP_UMOD:
+            if(b == 0)
+                return 0;
+            *result = aot_uint_divide(vm, insn, &f, a, b, base == OP_UMOD);
+            break;
+        case OP_AND: *result = aot_logic(&f, a & b); break;
+        case OP_OR: *result = aot_logic(&f, a | b); break;
+        case OP_XOR: *result = aot_logic(&f, a ^ b); break;
+        case OP_SHL: *result = aot_shl(&f, a, b); break;
+        case OP_SHR: *result = aot_shr(&f, a, b); break;
+        case OP_ROL: *result = aot_rol(&f, a, b); break;
+        case OP_ROR: *result = aot_ror(&f, a, b); break;
+        case OP_CMP: aot_cmp(&f, a, b); break;
+        case OP_TST: aot_set_flags(&f, a & b, 0); break;
+        case OP_INEG: *result = aot_ineg(&f, a); break;
+        case OP_UNEG: *result = aot_uneg(&f, a); break;
+        case OP_FNEG: *result = aot_fneg(&f, a); break;
+        case OP_INC: *result = aot_inc(&f, a); break;
+        case OP_DEC: *result = aot_dec(&f, a); break;
+        case OP_NOT: *result = aot_logic(&f, ~a); break;
+        case OP_FTU: *result = (uint64_t)fabs(aot_float(a)); break;
+        case OP_FTI: *result = (uint64_t)(int64_t)aot_float(a); break;
+        case OP_ITF: *result = aot_bits((double)(int64_t)a); break;
+        case OP_UTF: *result = aot_bits((double)a); break;
+        case OP_ITU: *result = aot_itu(a); break;
+        case OP_UTI: *result = a; break;
+    }
+
+    *flags = f & VM_FLAG_NZCV;
+    return 1;
+}
+
+static void forget(writer_t* wr)
+{
+    wr->consts.known = 0;
+    wr->flags_known = 0;
+}
+
+/*
+ * Leave the trace at guard k, or go to the branch that carries on from it.
+ */
+static void write_exit(writer_t* wr, uint32_t k, uint32_t exit)
+{
+    const exit_t* e = (exit == JIT_NO_EXIT)? NULL: &wr->tree->exits[exit];
+
+    if(e != NULL && e->branch >= 0)
+        fprintf(wr->out, "    {\n        goto b%d;\n    }\n", e->branch);
+    else
+        fprintf(wr->out, "    {\n        next = &I[%u];\n        *exit = 0x%xu;\n        goto out;\n    }\n", k, exit);
+}
+
+static void clear_flags(writer_t* wr, int live)
+{
+    if(live)
+        fprintf(wr->out, "    f &= ~VM_FLAG_NZCV;\n");
+    wr->flags_known = 1;
+    wr->flags = 0;
+}
+
+/*
+ * Which steps set flags that are looked at before they are set again. A
+ * guard looks at them, and so does every way out of the trace, since they
+ * go back in the vm_t.
+ */
+static void find_live_flags(vm_t* vm, const trace_t* trace, uint8_t* live)
+{
+    int now = 1;
+
+    for(uint32_t i = trace->nsteps; i-- > 0;)
+    {
+        const step_t* step = &trace->steps[i];
+        const opcode_info_t* info = &opcode_table[vm->insns[step->k].insn.opcode];
+
+        live[i] = (uint8_t)now;
+        if(info->cond != 0 || info->base == OP_RET)
+            now = 1;
+        else if(info->flags & OPF_SETS_FLAGS)
+            now = 0;
+        else if(info->base == OP_JMP || info->base == OP_CALL || info->base == OP_EXCALL)
+            now = 0;
+        else if(info->base >= OP_STZ && info->base <= OP_CLE)
+            now = 1;
+    }
+}
+
+static void write_step(writer_t* wr, const step_t* step, int live)
+{
+    FILE* out = wr->out;
+    vm_t* vm = wr->vm;
+    uint32_t k = step->k;
+    const vm_insn_t* insn = &vm->insns[k];
+    const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+    uint64_t result;
+    uint32_t flags;
+
+    fprintf(out, "    // %08x %s\n", insn->offset, info->name);
+
+    if(info->cond != 0)
+    {
+        if(wr->flags_known && info->cond <= 14)
+        {
+            if(aot_cond(info->cond, wr->flags) != step->taken)
+                write_exit(wr, k, step->exit);
+        }
+        else
+        {
+            fprintf(out, "    if(%saot_cond(%d, f))\n", step->taken? "!": "", info->cond);
+            write_exit(wr, k, step->exit);
+        }
+        if(!step->taken)
+            return;
+    }
+
+    if(fold(wr, k, &result, &flags))
+    {
+        int r = cgen_dest_reg(insn);
+
+        if(r >= 0)
+        {
+            fprintf(out, "    r%d = 0x%lxull;\n", r, result);
+            wr->consts.known |= 1u << r;
+            wr->consts.values[r] = result;
+        }
+        if(info->flags & OPF_SETS_FLAGS)
+        {
+            if(live)
+                fprintf(out, "    f = (f & ~VM_FLAG_NZCV) | 0x%xu;\n", flags);
+            wr->flags_known = 1;
+            wr->flags = flags;
+        }
+        return;
+    }
+
+    if(!cgen_data_op(out, "    ", vm, k, live? "f": "dead", &wr->consts))
+    {
+        int r = cgen_dest_reg(insn);
+
+        if(r >= 0)
+            wr->consts.known &= ~(1u << r);
+        if((info->flags & OPF_SETS_FLAGS) || (info->base >= OP_STZ && info->base <= OP_CLE))
+            wr->flags_known = 0;
+        return;
+    }
+
+    switch (info->base)
+    {
+        case OP_JMP:
+            clear_flags(wr, live);
+            break;
+        case OP_CALL:
+            fprintf(out, "    aot_push(vm, &I[%u], 0x%x);\n", k, insn[1].offset);
+            clear_flags(wr, live);
+            break;
+        case OP_EXCALL:
+        {
+            uint64_t number;
+
+            if(known(wr, k, 0, &number))
+            {
+                const vm_native_info_t* native = vm_find_native(number);
+
+                if(native == NULL)
+                {
+                    fprintf(out, "    vm_fault(vm, &I[%u], \"call to an external routine that does not exist\");\n", k);
+                    break;
+                }
+                fprintf(out, "    f &= ~VM_FLAG_NZCV;\n");
+                cgen_spill(out, "    ", wr->regs);
+                fprintf(out, "    vm_find_native(%lu)->func(vm, &I[%u]);     // %s\n", number, k, native->name);
+            }
+            else
+            {
+                fprintf(out, "    native = vm_find_native(%s);\n", cgen_value(vm, k, 0, &wr->consts));
+                fprintf(out, "    if(native == NULL)\n        vm_fault(vm, &I[%u], \"call to an external routine that does not exist\");\n", k);
+                fprintf(out, "    f &= ~VM_FLAG_NZCV;\n");
+                cgen_spill(out, "    ", wr->regs);
+                fprintf(out, "    native->func(vm, &I[%u]);\n", k);
+            }
+            cgen_reload(out, "    ", wr->regs);
+            forget(wr);
+            wr->flags_known = 1;
+            wr->flags = 0;
+            break;
+        }
+        case OP_RET:
+            fprintf(out, "    if(vm->sp == 0 || vm->stack[vm->sp - 1] != 0x%x)\n", vm->insns[step->next].offset);
+            write_exit(wr, k, step->ret_exit);
+            fprintf(out, "    vm->sp--;\n");
+            clear_flags(wr, live);
+            break;
+    }
+}
+
+static void write_trace(writer_t* wr, int t)
+{
+    const trace_t* trace = &wr->tree->traces[t];
+    uint8_t* live = alloc_or_die(trace->nsteps);
+
+    find_live_flags(wr->vm, trace, live);
+    forget(wr);
+    fprintf(wr->out, "%s%d:\n", (t == 0)? "loop": "b", t);
+    if(t == 0)
+        fprintf(wr->out, "    ;\n");
+
+    for(uint32_t i = 0; i < trace->nsteps; i++)
+        write_step(wr, &trace->steps[i], live[i]);
+
+    if(trace->closes)
+    {
+        fprintf(wr->out, "    if(vm->dispatch != vm->handlers)\n    {\n        next = &I[%u];\n        goto out;\n    }\n",
+                wr->tree->anchor);
+        fprintf(wr->out, "    goto loop0;\n\n");
+    }
+    else
+        fprintf(wr->out, "    next = &I[%u];\n    goto out;\n\n", trace->steps[trace->nsteps - 1].next);
+
+    free(live);
+}
+
+/*
+ * The traces, so the tree can be loaded from the code cache.
+ */
+static void write_steps(FILE* out, vm_t* vm, tree_t* tree)
+{
+    fprintf(out, "static const uint32_t nsteps[] = {");
+    for(int t = 0; t < tree->ntraces; t++)
+        fprintf(out, " 0x%xu,", tree->traces[t].nsteps | (tree->traces[t].closes? JIT_CLOSES: 0));
+    fprintf(out, " };\n\n");
+
+    fprintf(out, "static const uint32_t steps[] = {\n");
+    for(int t = 0; t < tree->ntraces; t++)
+        for(uint32_t i = 0; i < tree->traces[t].nsteps; i++)
+        {
+            const step_t* step = &tree->traces[t].steps[i];
+
+            fprintf(out, "    %u, %u, %u,\n", step->k, step->next, step->taken);
+        }
+    fprintf(out, "};\n\n");
+
+    fprintf(out, "static const int8_t branches[] = {");
+    for(uint32_t e = 0; e < tree->nexits; e++)
+        fprintf(out, " %d,", tree->exits[e].branch);
+    fprintf(out, " 0 };\n\n");
+
+    fprintf(out, "const jit_tree_t jit_tree = {\n");
+    fprintf(out, "    AOT_ABI, sizeof(vm_t), %lu, 0x%lxull, %u, %d, nsteps, steps, %u, branches\n};\n",
+            vm->image.header->code_size, vm->jit->code_hash, tree->anchor, tree->ntraces, tree->nexits);
+}
+
+static char* write_tree(vm_t* vm, tree_t* tree, size_t* size)
+{
+    char* source = NULL;
+    FILE* out = open_memstream(&source, size);
+    writer_t wr;
+
+    if(out == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate memory for a trace\n");
+        exit(1);
+    }
+
+    memset(&wr, 0, sizeof(wr));
+    wr.out = out;
+    wr.vm = vm;
+    wr.tree = tree;
+    for(int t = 0; t < tree->ntraces; t++)
+        for(uint32_t i = 0; i < tree->traces[t].nsteps; i++)
+            wr.regs |= cgen_regs(&vm->insns[tree->traces[t].steps[i].k]);
+
+    fprintf(out, "// trace tree at code offset 0x%08x\n", vm->insns[tree->anchor].offset);
+    fprintf(out, "#include \"aot.h\"\n\n");
+    fprintf(out, "const vm_insn_t* trace(vm_t* vm, const vm_insn_t* insn, uint32_t* exit)\n{\n");
+    fprintf(out, "    const vm_insn_t* I = vm->insns;\n");
+    fprintf(out, "    const vm_insn_t* next;\n");
+    fprintf(out, "    const vm_native_info_t* native;\n");
+    fprintf(out, "    uint32_t f = vm->flags;\n");
+    fprintf(out, "    uint32_t dead = 0;\n");
+    for(int r = 0; r < VM_NUM_REGS; r++)
+        if(wr.regs & (1u << r))
+            fprintf(out, "    uint64_t r%d = vm->regs[%d];\n", r, r);
+    fprintf(out, "\n    (void)insn;\n    (void)native;\n    (void)dead;\n");
+    fprintf(out, "    *exit = 0x%xu;\n", JIT_NO_EXIT);
+
+    for(int t = 0; t < tree->ntraces; t++)
+        write_trace(&wr, t);
+
+    fprintf(out, "out:\n");
+    cgen_spill(out, "    ", wr.regs);
+    fprintf(out, "    return next;\n}\n\n");
+
+    write_steps(out, vm, tree);
+    fclose(out);
+    return source;
+}
+
+static void queue_compile(vm_t* vm, tree_t* tree)
+{
+    struct vm_jit_t* jit = vm->jit;
+    job_t* job = alloc_or_die(sizeof(job_t));
+
+    job->tree = tree;
+    job->anchor = tree->anchor;
+    job->source = write_tree(vm, tree, &job->size);
+    tree->compiling = 1;
+
+    pthread_mutex_lock(&jit->lock);
+    job->next = jit->queue;
+    jit->queue = job;
+    pthread_cond_signal(&jit->wake);
+    pthread_mutex_unlock(&jit->lock);
+}
+
+/************************
+ * recording
+ */
+static int can_trace(vm_t* vm, uint32_t k)
+{
+    const vm_insn_t* insn = &vm->insns[k];
+
+    if(opcode_table[insn->insn.opcode].name == NULL)
+        return 0;
+
+    switch (base_of(vm, k))
+    {
+        case OP_TRAP:
+        case OP_TRET:
+        case OP_RAISE:
+        case OP_ERET:
+        case OP_PAUSE:
+        case OP_END:
+            return 0;
+        case OP_JMP:
+        case OP_CALL:
+            return insn->target != NULL;
+        default:
+            return 1;
+    }
+}
+
+static void start_recording(vm_t* vm, tree_t* tree, uint32_t exit, uint32_t start)
+{
+    struct vm_jit_t* jit = vm->jit;
+
+    jit->recording = 1;
+    jit->rec_tree = tree;
+    jit->rec_exit = exit;
+    jit->rec_start = start;
+    jit->rec_n = 0;
+    vm->dispatch = record_handlers;
+}
+
+static void stop_recording(vm_t* vm)
+{
+    vm->jit->recording = 0;
+    if(vm->dispatch == record_handlers)
+        vm->dispatch = vm->handlers;
+}
+
+static void give_up(vm_t* vm)
+{
+    struct vm_jit_t* jit = vm->jit;
+
+    jit->naborted++;
+    if(jit->rec_tree == NULL)
+    {
+        if(++jit->tries[jit->rec_start] >= JIT_MAX_TRIES)
+            jit->counts[jit->rec_start] = JIT_NEVER;
+    }
+    else
+        jit->rec_tree->exits[jit->rec_exit].tries++;
+    stop_recording(vm);
+}
+
+static void add_exits(tree_t* tree, trace_t* trace, vm_t* vm)
+{
+    uint32_t n = 0;
+
+    for(uint32_t i = 0; i < trace->nsteps; i++)
+    {
+        const opcode_info_t* info = &opcode_table[vm->insns[trace->steps[i].k].insn.opcode];
+
+        n += (info->cond != 0) + (info->base == OP_RET);
+    }
+
+    tree->exits = realloc(tree->exits, (tree->nexits + n) * sizeof(exit_t));
+    if(tree->exits == NULL && tree->nexits + n > 0)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate memory for a trace\n");
+        exit(1);
+    }
+
+    for(uint32_t i = 0; i < trace->nsteps; i++)
+    {
+        step_t* step = &trace->steps[i];
+        const opcode_info_t* info = &opcode_table[vm->insns[step->k].insn.opcode];
+
+        step->exit = step->ret_exit = JIT_NO_EXIT;
+        if(info->cond != 0)
+            step->exit = tree->nexits++;
+        if(info->base == OP_RET)
+            step->ret_exit = tree->nexits++;
+    }
+    for(uint32_t e = tree->nexits - n; e < tree->nexits; e++)
+    {
+        tree->exits[e].count = 0;
+        tree->exits[e].tries = 0;
+        tree->exits[e].branch = -1;
+    }
+}
+
+static void finish_recording(vm_t* vm, int closes)
+{
+    struct vm_jit_t* jit = vm->jit;
+    tree_t* tree = jit->rec_tree;
+
+    stop_recording(vm);
+    if(jit->rec_n == 0)
+        return;
+
+    if(tree == NULL)
+    {
+        tree = alloc_or_die(sizeof(tree_t));
+        tree->anchor = jit->rec_start;
+        jit->trees[tree->anchor] = tree;
+        jit->counts[tree->anchor] = JIT_NEVER;
+        jit->ntrees++;
+    }
+    else
+        tree->exits[jit->rec_exit].branch = (int8_t)tree->ntraces;
+
+    trace_t* trace = &tree->traces[tree->ntraces++];
+
+    trace->steps = jit->rec_steps;
+    trace->nsteps = jit->rec_n;
+    trace->closes = closes;
+    jit->rec_steps = alloc_or_die(JIT_MAX_STEPS * sizeof(step_t));
+    jit->ntraces++;
+
+    add_exits(tree, trace, vm);
+    if(tree->compiling)
+        tree->changed = 1;
+    else
+        queue_compile(vm, tree);
+}
+
+/*
+ * Every slot of record_handlers. Write the instruction down and run it.
+ */
+static const vm_insn_t* record_insn(vm_t* vm, const vm_insn_t* insn)
+{
+    struct vm_jit_t* jit = vm->jit;
+    uint32_t k = (uint32_t)(insn - vm->insns);
+    uint32_t anchor = (jit->rec_tree != NULL)? jit->rec_tree->anchor: jit->rec_start;
+
+    if(jit->rec_n > 0 && k == anchor)
+    {
+        finish_recording(vm, 1);
+        return insn;
+    }
+    if(jit->rec_n > 0 && jit->trees[k] != NULL)
+    {
+        finish_recording(vm, 0);
+        return insn;
+    }
+    if(!can_trace(vm, k) || jit->rec_n == JIT_MAX_STEPS)
+    {
+        give_up(vm);
+        return insn;
+    }
+
+    step_t* step = &jit->rec_steps[jit->rec_n];
+    const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+
+    step->k = k;
+    step->taken = (uint8_t)aot_cond(info->cond, vm->flags);
+
+    const vm_insn_t* next = vm_handlers[insn->insn.opcode](vm, insn);
+
+    if(next == NULL)
+    {
+        give_up(vm);
+        return NULL;
+    }
+
+    step->next = (uint32_t)(next - vm->insns);
+    jit->rec_n++;
+    return next;
+}
+
+/************************
+ * running
+ */
+static __attribute__((noinline)) const vm_insn_t* loop_taken(vm_t* vm, const vm_insn_t* target)
+{
+    struct vm_jit_t* jit = vm->jit;
+    uint32_t k = (uint32_t)(target - vm->insns);
+
+    if(jit->ready)
+        install(vm);
+    if(jit->recording)
+    {
+        // a signal took the VM away from the recording
+        if(vm->dispatch != record_handlers)
+            give_up(vm);
+        return target;
+    }
+
+    if(!jit->off && jit->counts[k] != JIT_NEVER && ++jit->counts[k] >= JIT_HOT_LOOP)
+    {
+        jit->counts[k] = 0;
+        start_recording(vm, NULL, JIT_NO_EXIT, k);
+    }
+    return target;
+}
+
+/*
+ * The JMP slots of vm_handlers, while the JIT is on.
+ */
+static const vm_insn_t* jit_jump(vm_t* vm, const vm_insn_t* insn)
+{
+    const vm_insn_t* next = plain_handlers[insn->op](vm, insn);
+
+    if(next != NULL && next <= insn)
+        return loop_taken(vm, next);
+    return next;
+}
+
+static void side_exit(vm_t* vm, tree_t* tree, uint32_t exit, const vm_insn_t* next)
+{
+    struct vm_jit_t* jit = vm->jit;
+    exit_t* e = &tree->exits[exit];
+
+    if(jit->recording || jit->off || e->branch >= 0 || e->tries >= JIT_MAX_TRIES ||
+       tree->ntraces == JIT_MAX_TRACES || next == NULL || next == &vm->insns[tree->anchor])
+        return;
+
+    if(++e->count >= JIT_HOT_EXIT)
+    {
+        e->count = 0;
+        start_recording(vm, tree, exit, (uint32_t)(next - vm->insns));
+    }
+}
+
+/*
+ * The handler for VM_OP_TRACE. If the trace gives the instruction straight
+ * back, it is run here, the same as for compiled code from aot.
+ */
+const vm_insn_t* jit_enter(vm_t* vm, const vm_insn_t* insn)
+{
+    struct vm_jit_t* jit = vm->jit;
+    tree_t* tree = jit->trees[insn - vm->insns];
+    uint32_t exit;
+    const vm_insn_t* next = tree->func(vm, insn, &exit);
+
+    if(jit->ready)
+        install(vm);
+    if(exit != JIT_NO_EXIT)
+        side_exit(vm, tree, exit, next);
+    if(next == insn)
+        return vm_handlers[insn->insn.opcode](vm, insn);
+    return next;
+}
+
+/************************
+ * the code cache
+ */
+
+/*
+ * A hash of the machine and the features of its CPU, from /proc/cpuinfo
+ * where there is one.
+ */
+static uint32_t cpu_hash(void)
+{
+    struct utsname name;
+    char line[4096];
+    uint64_t hash = 0;
+    FILE* fp;
+
+    if(uname(&name) == 0)
+        hash = aot_code_hash((const uint8_t*)name.machine, strlen(name.machine));
+    if((fp = fopen("/proc/cpuinfo", "r")) != NULL)
+    {
+        while(fgets(line, sizeof(line), fp) != NULL)
+            if(strncmp(line, "flags", 5) == 0 || strncmp(line, "Features", 8) == 0)
+            {
+                hash ^= aot_code_hash((const uint8_t*)line, strlen(line));
+                break;
+            }
+        fclose(fp);
+    }
+
+    return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static int make_dir(const char* path)
+{
+    if(mkdir(path, 0777) && errno != EEXIST)
+    {
+        fprintf(stderr, "ERROR: cannot make the code cache directory \"%s\": %s\n", path, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
+
+static int open_cache(vm_t* vm, const char* dir)
+{
+    struct vm_jit_t* jit = vm->jit;
+    char path[4096];
+
+    snprintf(path, sizeof(path), "%s/%016lx-%lx-%u-%u-%08x", dir, jit->code_hash,
+             vm->image.header->code_size, AOT_ABI, (unsigned)sizeof(vm_t), cpu_hash());
+    if(make_dir(dir) || make_dir(path))
+        return 1;
+
+    jit->cache = strdup(path);
+    return jit->cache == NULL;
+}
+
+static void free_tree(tree_t* tree)
+{
+    if(tree->lib != NULL)
+        dlclose(tree->lib);
+    for(int t = 0; t < tree->ntraces; t++)
+        free(tree->traces[t].steps);
+    free(tree->exits);
+    free(tree);
+}
+
+/*
+ * Rebuild a tree from the traces in a library in the cache. A library that
+ * does not fit the program is left alone.
+ */
+static tree_t* load_tree(vm_t* vm, void* lib)
+{
+    struct vm_jit_t* jit = vm->jit;
+    const jit_tree_t* saved = dlsym(lib, JIT_TREE);
+    jit_func_t func = (jit_func_t)dlsym(lib, "trace");
+
+    if(saved == NULL || func == NULL || saved->abi != AOT_ABI || saved->vm_size != sizeof(vm_t) ||
+       saved->code_size != vm->image.header->code_size || saved->code_hash != jit->code_hash ||
+       saved->anchor >= vm->ninsns || jit->trees[saved->anchor] != NULL ||
+       saved->ntraces == 0 || saved->ntraces > JIT_MAX_TRACES)
+        return NULL;
+
+    tree_t* tree = alloc_or_die(sizeof(tree_t));
+    const uint32_t* words = saved->steps;
+
+    tree->anchor = saved->anchor;
+    for(uint32_t t = 0; t < saved->ntraces; t++)
+    {
+        trace_t* trace = &tree->traces[tree->ntraces++];
+        uint32_t n = saved->nsteps[t] & ~JIT_CLOSES;
+
+        if(n == 0 || n > JIT_MAX_STEPS)
+            goto bad;
+        trace->steps = alloc_or_die(n * sizeof(step_t));
+        trace->nsteps = n;
+        trace->closes = (saved->nsteps[t] & JIT_CLOSES) != 0;
+        for(uint32_t i = 0; i < n; i++, words += 3)
+        {
+            if(words[0] >= vm->ninsns || words[1] > vm->ninsns)
+                goto bad;
+            trace->steps[i].k = words[0];
+            trace->steps[i].next = words[1];
+            trace->steps[i].taken = (uint8_t)words[2];
+        }
+        add_exits(tree, trace, vm);
+    }
+
+    if(tree->nexits != saved->nexits)
+        goto bad;
+    for(uint32_t e = 0; e < tree->nexits; e++)
+    {
+        if(saved->branches[e] < -1 || saved->branches[e] >= tree->ntraces)
+            goto bad;
+        tree->exits[e].branch = saved->branches[e];
+    }
+
+    tree->func = func;
+    tree->lib = lib;
+    return tree;
+
+bad:
+    free_tree(tree);
+    return NULL;
+}
+
+static void load_cache(vm_t* vm)
+{
+    struct vm_jit_t* jit = vm->jit;
+    DIR* dir = opendir(jit->cache);
+    struct dirent* ent;
+    char path[4096];
+    unsigned anchor;
+
+    if(dir == NULL)
+        return;
+
+    while((ent = readdir(dir)) != NULL)
+    {
+        if(sscanf(ent->d_name, "t%u.so", &anchor) != 1)
+            continue;
+
+        snprintf(path, sizeof(path), "%s/%s", jit->cache, ent->d_name);
+
+        void* lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        tree_t* tree;
+
+        if(lib == NULL)
+            continue;
+        if((tree = load_tree(vm, lib)) == NULL)
+        {
+            dlclose(lib);
+            continue;
+        }
+
+        jit->trees[tree->anchor] = tree;
+        jit->counts[tree->anchor] = JIT_NEVER;
+        vm->insns[tree->anchor].op = VM_OP_TRACE;
+        jit->ntrees++;
+        jit->ntraces += tree->ntraces;
+        jit->ncached++;
+    }
+    closedir(dir);
+}
+
+/************************
+ * public interface
+ */
+static void free_jit(struct vm_jit_t* jit)
+{
+    free(jit->counts);
+    free(jit->tries);
+    free(jit->trees);
+    free(jit->rec_steps);
+    free(jit->cache);
+    free(jit);
+}
+
+/*
+ * Start compiling traces, with the code cache in cache_dir if it is not
+ * NULL.
+ */
+int jit_start(vm_t* vm, const char* cache_dir)
+{
+    struct vm_jit_t* jit = alloc_or_die(sizeof(struct vm_jit_t));
+
+    jit->counts = alloc_or_die((vm->ninsns + 1) * sizeof(uint16_t));
+    jit->tries = alloc_or_die(vm->ninsns + 1);
+    jit->trees = alloc_or_die((vm->ninsns + 1) * sizeof(tree_t*));
+    jit->rec_steps = alloc_or_die(JIT_MAX_STEPS * sizeof(step_t));
+    jit->code_hash = aot_code_hash(vm->image.code, vm->image.header->code_size);
+    vm->jit = jit;
+
+    if(cache_dir != NULL && open_cache(vm, cache_dir))
+    {
+        free_jit(jit);
+        vm->jit = NULL;
+        return 1;
+    }
+
+    pthread_mutex_init(&jit->lock, NULL);
+    pthread_cond_init(&jit->wake, NULL);
+    if(pthread_create(&jit->thread, NULL, compile_thread, jit))
+    {
+        fprintf(stderr, "ERROR: cannot start the thread that compiles traces\n");
+        free_jit(jit);
+        vm->jit = NULL;
+        return 1;
+    }
+
+    memcpy(plain_handlers, vm_handlers, sizeof(plain_handlers));
+    for(int op = 0; op < VM_HANDLERS; op++)
+    {
+        record_handlers[op] = record_insn;
+        if(opcode_table[op].name != NULL && opcode_table[op].base == OP_JMP)
+            vm_handlers[op] = jit_jump;
+    }
+
+    if(jit->cache != NULL)
+        load_cache(vm);
+    return 0;
+}
+
+void jit_finish(vm_t* vm, FILE* fp)
+{
+    struct vm_jit_t* jit = vm->jit;
+
+    if(jit == NULL)
+        return;
+
+    fprintf(fp, "jit: %lu traces in %lu trees, %lu compiles, %lu from the cache, %lu recordings given up\n",
+            jit->ntraces, jit->ntrees, jit->ncompiled, jit->ncached, jit->naborted);
+}
+
+void jit_destroy(vm_t* vm)
+{
+    struct vm_jit_t* jit = vm->jit;
+
+    if(jit == NULL)
+        return;
+
+    pthread_mutex_lock(&jit->lock);
+    jit->stop = 1;
+    pthread_cond_signal(&jit->wake);
+    pthread_mutex_unlock(&jit->lock);
+    pthread_join(jit->thread, NULL);
+
+    // anything compiled but not put in place
+    while(jit->queue != NULL)
+    {
+        job_t* job = jit->queue;
+
+        jit->queue = job->next;
+        job->next = jit->done;
+        jit->done = job;
+    }
+    install(vm);
+
+    for(size_t k = 0; k < vm->ninsns; k++)
+    {
+        if(jit->trees[k] == NULL)
+            continue;
+        vm->insns[k].op = vm->insns[k].plain;
+        free_tree(jit->trees[k]);
+    }
+
+    memcpy(vm_handlers, plain_handlers, sizeof(plain_handlers));
+    if(vm->dispatch == record_handlers)
+        vm->dispatch = vm->handlers;
+    pthread_mutex_destroy(&jit->lock);
+    pthread_cond_destroy(&jit->wake);
+    free_jit(jit);
+    vm->jit = NULL;
+}
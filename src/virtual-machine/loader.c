@@ -0,0 +1,261 @@
+/*
+ * Program loader.
+ *
+ * The image is mapped and the whole code segment is decoded up front with
+ * decode_insn(), the same decoder that the disassembler uses. A jump can only
+ * go to the start of an instruction, so the loader also builds a table from
+ * code offsets to decoded instructions. Code that does not decode is an
+ * error when the program is loaded, not when it runs. Branches to an
+ * immediate address are resolved to the instruction they go to here as well,
+ * and then the code is checked by the verifier; see verify.c. After that,
+ * calls to small leaf routines are replaced with copies of them; see
+ * inline.c.
+ *
+ * The data segment is copied to the start of the VM memory and the heap
+ * follows it, in one mapping, so that a VM address is an offset into it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "virtual_machine.h"
+
+static void* alloc_or_die(size_t size)
+{
+    void* ptr = malloc(size);
+
+    if(ptr == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", size);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+static void grow_insns(vm_t* vm, size_t* capacity)
+{
+    *capacity <<= 1;
+    vm->insns = realloc(vm->insns, *capacity * sizeof(vm_insn_t));
+    if(vm->insns == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", *capacity * sizeof(vm_insn_t));
+        exit(1);
+    }
+}
+
+/*
+ * The bits of a float operand go in its value, so that the VM can read
+ * every immediate the same way.
+ */
+static void prepare_insn(vm_insn_t* insn)
+{
+    insn->op = insn->plain = insn->insn.opcode;
+    insn->cond = opcode_table[insn->op].cond;
+    insn->target = NULL;
+
+    for(int i = 0; i < insn->insn.noperands; i++)
+    {
+        decoded_operand_t* opnd = &insn->insn.operands[i];
+
+        if(opnd->kind == OPND_FLOAT)
+            memcpy(&opnd->value, &opnd->fnum, sizeof(opnd->value));
+    }
+}
+
+static int resolve_targets(vm_t* vm, const char* fname)
+{
+    for(size_t i = 0; i < vm->ninsns; i++)
+    {
+        vm_insn_t* insn = &vm->insns[i];
+        const opcode_info_t* info = &opcode_table[insn->op];
+
+        if(!(info->flags & (OPF_JUMP | OPF_CALL)) || info->base == OP_EXCALL)
+            continue;
+        if(insn->insn.operands[0].kind != OPND_IMM)
+            continue;
+
+        insn->target = vm_find_insn(vm, (uint64_t)insn->insn.operands[0].value);
+        if(insn->target == NULL)
+        {
+            fprintf(stderr, "ERROR: \"%s\": code offset 0x%08x: branch to 0x%08lx is not an instruction\n",
+                    fname, insn->offset, insn->insn.operands[0].value);
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int map_memory(vm_t* vm, size_t heap_size)
+{
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t data_size = vm->image.header->data_size;
+
+    vm->heap_base = (data_size + page - 1) & ~(page - 1);
+    vm->mem_size = vm->heap_base + heap_size;
+    vm->mem = mmap(NULL, vm->mem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(vm->mem == MAP_FAILED)
+    {
+        vm->mem = NULL;
+        fprintf(stderr, "ERROR: cannot map %lu bytes of memory for the VM\n", vm->mem_size);
+        return 1;
+    }
+
+    memcpy(vm->mem, vm->image.data, data_size);
+    return 0;
+}
+
+/*
+ * Load an image. Returns non-zero and prints the reason if it cannot be
+ * run.
+ */
+int vm_load(vm_t* vm, const char* fname)
+{
+    memset(vm, 0, sizeof(vm_t));
+
+    if(image_open(&vm->image, fname))
+        return 1;
+
+    const uint8_t* code = vm->image.code;
+    uint64_t size = vm->image.header->code_size;
+
+    if(size >= VM_NO_INSN)
+    {
+        fprintf(stderr, "ERROR: \"%s\": code segment is too large\n", fname);
+        vm_unload(vm);
+        return 1;
+    }
+
+    size_t capacity = size / 4 + 16;
+
+    vm->insns = alloc_or_die(capacity * sizeof(vm_insn_t));
+    vm->insn_index = alloc_or_die((size + 1) * sizeof(uint32_t));
+    memset(vm->insn_index, 0xFF, (size + 1) * sizeof(uint32_t));
+    vm->noffsets = size + 1;
+
+    for(uint64_t pc = 0; pc < size;)
+    {
+        if(vm->ninsns == capacity)
+            grow_insns(vm, &capacity);
+
+        vm_insn_t* insn = &vm->insns[vm->ninsns];
+        int err = decode_insn(&code[pc], size - pc, &insn->insn);
+
+        if(err != DECODE_OK)
+        {
+            fprintf(stderr, "ERROR: \"%s\": code offset 0x%08lx: %s\n", fname, pc, decode_error_str(err));
+            vm_unload(vm);
+            return 1;
+        }
+
+        prepare_insn(insn);
+        insn->offset = (uint32_t)pc;
+        vm->insn_index[pc] = (uint32_t)vm->ninsns++;
+        pc += insn->insn.length;
+    }
+
+    // running off the end of the code lands here
+    if(vm->ninsns == capacity)
+        grow_insns(vm, &capacity);
+
+    vm_insn_t* end = &vm->insns[vm->ninsns];
+
+    memset(end, 0, sizeof(vm_insn_t));
+    end->op = VM_OP_FELL_OFF;
+    end->offset = (uint32_t)size;
+    vm->insn_index[size] = (uint32_t)vm->ninsns;
+
+    if(resolve_targets(vm, fname) || map_memory(vm, VM_HEAP_SIZE))
+    {
+        vm_unload(vm);
+        return 1;
+    }
+
+    vm->stack_size = VM_STACK_SIZE;
+    vm->stack = alloc_or_die(vm->stack_size * sizeof(uint64_t));
+    heap_init(vm);
+
+    vm->dispatch = vm->handlers = vm_handlers;
+    vm->profile = NULL;
+    vm->branch_limit = UINT64_MAX;
+    vm_find_vectors(vm);
+    if(vm_verify(vm, fname))
+    {
+        vm_unload(vm);
+        return 1;
+    }
+    vm_inline(vm);
+    return 0;
+}
+
+/*
+ * Map the memory again with room for a heap of a different size, before
+ * the program is run. Whatever was on the heap is lost. Returns non-zero
+ * and prints the reason if it cannot be mapped.
+ */
+int vm_remap(vm_t* vm, size_t heap_size)
+{
+    munmap(vm->mem, vm->mem_size);
+    return map_memory(vm, heap_size);
+}
+
+/*
+ * The decoded instruction that starts at a code offset, or NULL if no
+ * instruction starts there. The end of the code counts as an instruction.
+ */
+const vm_insn_t* vm_find_insn(vm_t* vm, uint64_t offset)
+{
+    if(offset >= vm->noffsets || vm->insn_index[offset] == VM_NO_INSN)
+        return NULL;
+
+    return &vm->insns[vm->insn_index[offset]];
+}
+
+/*
+ * Where an instruction is in the code, or, for a copy that vm_inline() put
+ * in, where the instruction that it is a copy of is.
+ */
+uint32_t vm_source_offset(vm_t* vm, const vm_insn_t* insn)
+{
+    uint64_t size = vm->image.header->code_size;
+
+    return (insn->offset <= size)? insn->offset: vm->sources[insn->offset - size - 1];
+}
+
+/*
+ * Look a symbol up by its dotted name in the debug section. Returns non-zero
+ * if there is no such symbol.
+ */
+int vm_find_symbol(vm_t* vm, const char* name, image_symbol_t* rec)
+{
+    const uint8_t* ptr = vm->image.debug;
+    const char* sym;
+    size_t len = strlen(name);
+
+    while((ptr = image_next_symbol(&vm->image, ptr, rec, &sym)) != NULL)
+        if(rec->name_len == len && memcmp(sym, name, len) == 0)
+            return 0;
+
+    return 1;
+}
+
+void vm_unload(vm_t* vm)
+{
+    jit_destroy(vm);
+    aot_unload(vm);
+    gc_destroy(vm);
+    if(vm->trusted)
+        vm_untrust(vm);
+    if(vm->mem != NULL)
+        munmap(vm->mem, vm->mem_size);
+    heap_destroy(vm);
+    free(vm->stack);
+    free(vm->insns);
+    free(vm->insn_index);
+    free(vm->sources);
+    image_close(&vm->image);
+    memset(vm, 0, sizeof(vm_t));
+}
@@ -0,0 +1,165 @@
+/*
+ * Routines outside of the VM that a program calls with EXCALL. The operand
+ * of EXCALL is the number of the routine in this table. Arguments are in R1
+ * and up, and the result, if there is one, is returned in R0.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "virtual_machine.h"
+
+static void print_int(vm_t* vm, const vm_insn_t* insn)
+{
+    (void)insn;
+    printf("%ld", (int64_t)vm->regs[1]);
+}
+
+static void print_uint(vm_t* vm, const vm_insn_t* insn)
+{
+    (void)insn;
+    printf("%lu", vm->regs[1]);
+}
+
+static void print_float(vm_t* vm, const vm_insn_t* insn)
+{
+    double d;
+
+    (void)insn;
+    memcpy(&d, &vm->regs[1], sizeof(d));
+    printf("%g", d);
+}
+
+static void print_char(vm_t* vm, const vm_insn_t* insn)
+{
+    (void)insn;
+    putchar((int)(vm->regs[1] & 0xFF));
+}
+
+/*
+ * R1 is the address of a string that ends with a zero byte.
+ */
+static void print_str(vm_t* vm, const vm_insn_t* insn)
+{
+    uint64_t addr = vm->regs[1];
+
+    if(addr >= vm->mem_size)
+        vm_fault(vm, insn, "string address out of range");
+
+    const uint8_t* str = &vm->mem[addr];
+    const uint8_t* end = memchr(str, 0, vm->mem_size - addr);
+
+    if(end == NULL)
+        vm_fault(vm, insn, "string is not terminated");
+    fwrite(str, 1, end - str, stdout);
+}
+
+static void read_int(vm_t* vm, const vm_insn_t* insn)
+{
+    long value;
+
+    (void)insn;
+    fflush(stdout);
+    vm->regs[0] = (scanf("%ld", &value) == 1)? (uint64_t)value: 0;
+}
+
+/*
+ * Nanoseconds from a monotonic clock.
+ */
+static void clock_ns(vm_t* vm, const vm_insn_t* insn)
+{
+    struct timespec ts;
+
+    (void)insn;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    vm->regs[0] = (uint64_t)ts.tv_sec * 1000000000ul + (uint64_t)ts.tv_nsec;
+}
+
+static void random_int(vm_t* vm, const vm_insn_t* insn)
+{
+    (void)insn;
+    vm->regs[0] = ((uint64_t)random() << 32) ^ (uint64_t)random();
+}
+
+/*
+ * R0 is the number of bytes in use on the heap. If R1 is not 0, it is the
+ * address of R2 64 bit words, which are filled with as much as fits of: the
+ * bytes in use, the number of large blocks and their bytes, and then for
+ * each size class its size, the blocks in use and the blocks there is room
+ * for in its slabs. With the collector, only R0 is set, to the bytes that
+ * the collected objects take up.
+ */
+static void heap_info(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->gc != NULL)
+    {
+        vm->regs[0] = gc_heap_bytes(vm);
+        return;
+    }
+
+    const heap_stats_t* stats = heap_stats(vm);
+    uint64_t addr = vm->regs[1];
+    uint64_t n = vm->regs[2];
+
+    vm->regs[0] = stats->live_bytes;
+    if(addr == 0)
+        return;
+
+    if(addr >= vm->mem_size || n > (vm->mem_size - addr) / 8)
+        vm_fault(vm, insn, "heap_info buffer out of range");
+
+    uint64_t info[3 + 3 * HEAP_CLASSES];
+
+    info[0] = stats->live_bytes;
+    info[1] = stats->large_objects;
+    info[2] = stats->large_bytes;
+    for(int c = 0; c < HEAP_CLASSES; c++)
+    {
+        info[3 + 3 * c] = heap_class_size(c);
+        info[4 + 3 * c] = stats->class_live[c];
+        info[5 + 3 * c] = stats->class_slabs[c] * heap_class_blocks(c);
+    }
+    if(n > sizeof(info) / 8)
+        n = sizeof(info) / 8;
+    memcpy(&vm->mem[addr], info, n * 8);
+}
+
+/*
+ * R0 is a new collected object of R1 bytes, or 0 if there is no room. Bit n
+ * of R2 is set if word n of the object holds a pointer, and bit 63 is for
+ * every word from 63 on. See gc.c.
+ */
+static void gc_alloc(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->gc == NULL)
+        vm_fault(vm, insn, "gc_alloc needs the collector, which is turned on with -g");
+    vm->regs[0] = gc_allocate(vm, insn, vm->regs[1], vm->regs[2]);
+}
+
+static void gc_full(vm_t* vm, const vm_insn_t* insn)
+{
+    if(vm->gc != NULL)
+        gc_collect(vm, insn);
+}
+
+static const vm_native_info_t natives[] = {
+    {"print_int", print_int, NATIVE_OUTPUT},
+    {"print_uint", print_uint, NATIVE_OUTPUT},
+    {"print_float", print_float, NATIVE_OUTPUT},
+    {"print_char", print_char, NATIVE_OUTPUT},
+    {"print_str", print_str, NATIVE_OUTPUT},
+    {"read_int", read_int, NATIVE_INPUT},
+    {"clock", clock_ns, NATIVE_INPUT},
+    {"random", random_int, NATIVE_INPUT},
+    {"heap_info", heap_info, 0},
+    [VM_NATIVE_GC_ALLOC] = {"gc_alloc", gc_alloc, 0},
+    [VM_NATIVE_GC_COLLECT] = {"gc_collect", gc_full, 0},
+};
+
+#define NUM_NATIVES (sizeof(natives) / sizeof(natives[0]))
+
+const vm_native_info_t* vm_find_native(uint64_t number)
+{
+    return (number < NUM_NATIVES)? &natives[number]: NULL;
+}
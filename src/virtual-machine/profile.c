@@ -0,0 +1,406 @@
+/*
+ * Profiling with the hardware performance counters.
+ *
+ * The counters for cycles, instructions, branch misses and L1 instruction
+ * cache misses are opened as one perf_event group, counting only user
+ * space, and vm->dispatch is pointed at vm_profile_handlers. Every slot of
+ * that table counts down, and about one instruction in PROFILE_INTERVAL is
+ * a sample: the counters are read just before and just after its handler
+ * runs, and the difference is added to the opcode it ran. Reading the
+ * counters costs the same every time, so the cost of an empty window,
+ * measured when profiling starts, is taken off each sample. The interval
+ * is jittered so that it does not stay in step with a loop in the program.
+ *
+ * Where perf_event_open is not allowed, as in most containers, only the
+ * time stamp counter is read, so there is a cost per opcode but nothing
+ * about why.
+ *
+ * The report gives the totals for the whole run, which include the cost of
+ * sampling, and then the average cost of an instruction in each class and
+ * of each opcode that was sampled. The classes are the groups of the
+ * instruction set.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "virtual_machine.h"
+
+#define PROFILE_INTERVAL    1024     // instructions per sample, on average
+#define CALIBRATE_WINDOWS   256
+
+enum
+{
+    CTR_CYCLES,
+    CTR_INSNS,
+    CTR_BRANCH_MISSES,
+    CTR_L1I_MISSES,
+    NUM_COUNTERS,
+};
+
+static const struct
+{
+    const char* name;
+    uint32_t type;
+    uint64_t config;
+} counter_info[NUM_COUNTERS] = {
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"branch-misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {"L1I-misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1I |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16)},
+};
+
+enum
+{
+    CLASS_DATA,              // arithmetic, conversions, shifts and logic
+    CLASS_COMPARE,
+    CLASS_MOVE,
+    CLASS_BRANCH,
+    CLASS_HEAP,
+    CLASS_SPECIAL,           // flags, PAUSE, RESUME, END and NOP
+    NUM_CLASSES,
+};
+
+static const char* const class_names[NUM_CLASSES] = {
+    "data", "compare", "move", "branch", "heap", "special",
+};
+
+typedef struct
+{
+    uint64_t samples;
+    uint64_t counts[NUM_COUNTERS];
+} profile_stats_t;
+
+typedef struct vm_profile_t
+{
+    int fds[NUM_COUNTERS];   // -1 if the counter could not be opened
+    int slot[NUM_COUNTERS];  // where it is in a group read
+    int nopen;
+    int use_tsc;             // no perf counters, only the time stamp counter
+
+    uint32_t countdown;
+    uint32_t seed;
+    uint64_t overhead[NUM_COUNTERS];     // of an empty window
+    uint64_t start[NUM_COUNTERS];
+    uint64_t total[NUM_COUNTERS];
+
+    profile_stats_t ops[VM_HANDLERS];    // by base opcode
+} vm_profile_t;
+
+vm_handler_t vm_profile_handlers[VM_HANDLERS];
+
+static uint64_t read_tsc(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void read_counters(vm_profile_t* prof, uint64_t* counts)
+{
+    if(prof->use_tsc)
+    {
+        memset(counts, 0, NUM_COUNTERS * sizeof(uint64_t));
+        counts[CTR_CYCLES] = read_tsc();
+        return;
+    }
+
+    // a group read gives the number of counters and then their values
+    uint64_t buf[1 + NUM_COUNTERS];
+
+    if(read(prof->fds[CTR_CYCLES], buf, sizeof(buf)) < (ssize_t)((1 + prof->nopen) * sizeof(uint64_t)))
+    {
+        memset(counts, 0, NUM_COUNTERS * sizeof(uint64_t));
+        return;
+    }
+    for(int i = 0; i < NUM_COUNTERS; i++)
+        counts[i] = (prof->fds[i] >= 0)? buf[1 + prof->slot[i]]: 0;
+}
+
+static uint32_t next_interval(vm_profile_t* prof)
+{
+    prof->seed ^= prof->seed << 13;
+    prof->seed ^= prof->seed >> 17;
+    prof->seed ^= prof->seed << 5;
+    return PROFILE_INTERVAL / 2 + (prof->seed % PROFILE_INTERVAL);
+}
+
+/*
+ * Every slot of vm_profile_handlers. Runs the instruction, and reads the
+ * counters around it if it is a sample.
+ */
+static const vm_insn_t* op_profile(vm_t* vm, const vm_insn_t* insn)
+{
+    vm_profile_t* prof = vm->profile;
+
+    if(--prof->countdown != 0)
+        return vm_handlers[insn->op](vm, insn);
+
+    prof->countdown = next_interval(prof);
+
+    uint64_t before[NUM_COUNTERS];
+    uint64_t after[NUM_COUNTERS];
+
+    read_counters(prof, before);
+    const vm_insn_t* next = vm_handlers[insn->op](vm, insn);
+    read_counters(prof, after);
+
+    profile_stats_t* stats = &prof->ops[opcode_table[insn->insn.opcode].base];
+
+    stats->samples++;
+    for(int i = 0; i < NUM_COUNTERS; i++)
+    {
+        uint64_t delta = after[i] - before[i];
+
+        stats->counts[i] += (delta > prof->overhead[i])? delta - prof->overhead[i]: 0;
+    }
+    return next;
+}
+
+static int open_counters(vm_profile_t* prof)
+{
+    prof->nopen = 0;
+    for(int i = 0; i < NUM_COUNTERS; i++)
+        prof->fds[i] = -1;
+
+    for(int i = 0; i < NUM_COUNTERS; i++)
+    {
+        struct perf_event_attr attr;
+        int group = (i == CTR_CYCLES)? -1: prof->fds[CTR_CYCLES];
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = counter_info[i].type;
+        attr.config = counter_info[i].config;
+        attr.disabled = (group == -1);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_GROUP;
+
+        prof->fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+        if(prof->fds[i] < 0)
+        {
+            // the others are only useful with cycles
+            if(i == CTR_CYCLES)
+                return -1;
+            continue;
+        }
+        prof->slot[i] = prof->nopen++;
+    }
+
+    ioctl(prof->fds[CTR_CYCLES], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(prof->fds[CTR_CYCLES], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return 0;
+}
+
+static void close_counters(vm_profile_t* prof)
+{
+    for(int i = NUM_COUNTERS - 1; i >= 0; i--)
+        if(prof->fds[i] >= 0)
+            close(prof->fds[i]);
+}
+
+/*
+ * The least that reading the counters twice in a row costs.
+ */
+static void calibrate(vm_profile_t* prof)
+{
+    for(int i = 0; i < NUM_COUNTERS; i++)
+        prof->overhead[i] = UINT64_MAX;
+
+    for(int n = 0; n < CALIBRATE_WINDOWS; n++)
+    {
+        uint64_t before[NUM_COUNTERS];
+        uint64_t after[NUM_COUNTERS];
+
+        read_counters(prof, before);
+        read_counters(prof, after);
+        for(int i = 0; i < NUM_COUNTERS; i++)
+            if(after[i] - before[i] < prof->overhead[i])
+                prof->overhead[i] = after[i] - before[i];
+    }
+}
+
+static int class_of(int base)
+{
+    switch (base)
+    {
+        case OP_CMP:
+        case OP_TST:
+            return CLASS_COMPARE;
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_MOV8:
+        case OP_MOV16:
+        case OP_MOV32:
+        case OP_MOV64:
+        case OP_MOV:
+        case OP_MOVB8:
+        case OP_MOVB16:
+        case OP_MOVB32:
+        case OP_MOVB64:
+        case OP_MOVB:
+        case OP_PUSH:
+        case OP_POP:
+            return CLASS_MOVE;
+        case OP_JMP:
+        case OP_CALL:
+        case OP_EXCALL:
+        case OP_RET:
+        case OP_TRAP:
+        case OP_TRET:
+        case OP_RAISE:
+        case OP_ERET:
+            return CLASS_BRANCH;
+        case OP_ALLOCATE:
+        case OP_FREE:
+            return CLASS_HEAP;
+        default:
+            return (base >= OP_IADD && base <= OP_NOT)? CLASS_DATA: CLASS_SPECIAL;
+    }
+}
+
+// one line of the report; counters that were not opened are shown as "-"
+static void report_line(vm_profile_t* prof, FILE* fp, const char* name, const profile_stats_t* stats, uint64_t all)
+{
+    double n = (double)stats->samples;
+
+    fprintf(fp, "%-10s %8lu %6.1f%% %9.1f", name, stats->samples, 100.0 * n / (double)all,
+            (double)stats->counts[CTR_CYCLES] / n);
+    if(prof->use_tsc)
+    {
+        fputc('\n', fp);
+        return;
+    }
+
+    if(prof->fds[CTR_INSNS] >= 0)
+        fprintf(fp, " %9.1f %6.2f", (double)stats->counts[CTR_INSNS] / n,
+                stats->counts[CTR_CYCLES]? (double)stats->counts[CTR_INSNS] / (double)stats->counts[CTR_CYCLES]: 0.0);
+    else
+        fprintf(fp, " %9s %6s", "-", "-");
+    for(int i = CTR_BRANCH_MISSES; i <= CTR_L1I_MISSES; i++)
+    {
+        if(prof->fds[i] >= 0)
+            fprintf(fp, " %11.2f", 1000.0 * (double)stats->counts[i] / n);
+        else
+            fprintf(fp, " %11s", "-");
+    }
+    fputc('\n', fp);
+}
+
+static void report(vm_profile_t* prof, FILE* fp)
+{
+    profile_stats_t classes[NUM_CLASSES];
+    uint64_t all = 0;
+
+    memset(classes, 0, sizeof(classes));
+    for(int op = 0; op < VM_HANDLERS; op++)
+    {
+        profile_stats_t* stats = &classes[class_of(op)];
+
+        all += prof->ops[op].samples;
+        stats->samples += prof->ops[op].samples;
+        for(int i = 0; i < NUM_COUNTERS; i++)
+            stats->counts[i] += prof->ops[op].counts[i];
+    }
+
+    if(prof->use_tsc)
+    {
+        fprintf(fp, "profile: no perf counters, time stamp counter only\n");
+        fprintf(fp, "profile: %lu ticks\n", prof->total[CTR_CYCLES]);
+    }
+    else
+    {
+        for(int i = 0; i < NUM_COUNTERS; i++)
+            if(prof->fds[i] >= 0)
+                fprintf(fp, "profile: %lu %s\n", prof->total[i], counter_info[i].name);
+        if(prof->total[CTR_CYCLES] != 0 && prof->fds[CTR_INSNS] >= 0)
+            fprintf(fp, "profile: %.2f IPC\n", (double)prof->total[CTR_INSNS] / (double)prof->total[CTR_CYCLES]);
+    }
+    fprintf(fp, "profile: %lu samples, 1 in about %d instructions\n", all, PROFILE_INTERVAL);
+    if(all == 0)
+        return;
+
+    // the counts are per sampled instruction; misses are per 1000 of them
+    fprintf(fp, "%-10s %8s %7s %9s", "class", "samples", "share", prof->use_tsc? "ticks": "cycles");
+    if(!prof->use_tsc)
+        fprintf(fp, " %9s %6s %11s %11s", "insns", "IPC", "br-miss/1k", "L1I-miss/1k");
+    fputc('\n', fp);
+
+    for(int c = 0; c < NUM_CLASSES; c++)
+        if(classes[c].samples != 0)
+            report_line(prof, fp, class_names[c], &classes[c], all);
+
+    fputc('\n', fp);
+    for(int op = 0; op < VM_HANDLERS; op++)
+        if(prof->ops[op].samples != 0)
+            report_line(prof, fp, (opcode_table[op].name != NULL)? opcode_table[op].name: "?", &prof->ops[op], all);
+}
+
+/*
+ * Start profiling the VM. It uses vm_profile_handlers from now on.
+ */
+int profile_start(vm_t* vm)
+{
+    vm_profile_t* prof = calloc(1, sizeof(vm_profile_t));
+
+    if(prof == NULL)
+    {
+        fprintf(stderr, "ERROR: out of memory\n");
+        return 1;
+    }
+
+    for(int i = 0; i < VM_HANDLERS; i++)
+        vm_profile_handlers[i] = op_profile;
+
+    if(open_counters(prof))
+    {
+        close_counters(prof);
+        prof->use_tsc = 1;
+    }
+
+    prof->seed = (uint32_t)read_tsc() | 1;
+    prof->countdown = next_interval(prof);
+    calibrate(prof);
+
+    vm->profile = prof;
+    vm->dispatch = vm->handlers = vm_profile_handlers;
+    read_counters(prof, prof->start);
+    return 0;
+}
+
+/*
+ * Stop profiling and write the report.
+ */
+void profile_finish(vm_t* vm, FILE* fp)
+{
+    vm_profile_t* prof = vm->profile;
+
+    if(prof == NULL)
+        return;
+
+    uint64_t end[NUM_COUNTERS];
+
+    read_counters(prof, end);
+    for(int i = 0; i < NUM_COUNTERS; i++)
+        prof->total[i] = end[i] - prof->start[i];
+
+    report(prof, fp);
+
+    if(!prof->use_tsc)
+        close_counters(prof);
+    free(prof);
+    vm->profile = NULL;
+    vm->dispatch = vm->handlers = vm_handlers;
+}
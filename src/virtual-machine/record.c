@@ -0,0 +1,591 @@
+/*
+ * Record and replay.
+ *
+ * The VM does the same thing every time it runs a program, except for the
+ * results of the native routines that read input, such as read_int and
+ * clock, and the points where signals raise exceptions. Recording writes
+ * only those to a log, and replaying the log gives the same run again.
+ *
+ * A point in a run is given by the number of taken branches and the
+ * instruction. No instruction runs twice between two taken branches, so
+ * this finds the same instruction as counting all of them would, but the
+ * VM only has to count branches.
+ *
+ * Replay takes the results of input routines from the log in order. For a
+ * signal, it asks the VM to call record_branch_limit() after the right
+ * number of branches, and then patches the handler slot of the instruction
+ * where the signal was raised to VM_OP_EVENT. When the log runs out, it
+ * starts recording again from there.
+ *
+ * For the debugger, the whole log is kept in memory and a snapshot of the
+ * VM is taken every so many branches, so that it can go back to a snapshot
+ * and replay forward to any point before where it is.
+ *
+ * The log is a log_header_t and then a list of records. Each record is a
+ * type byte and its fields. Numbers are written 7 bits to a byte, low bits
+ * first, with the top bit set on every byte but the last.
+ *
+ *   REC_NATIVE  routine number, 8 byte result
+ *   REC_SIGNAL  branches, code offset, signal number
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "virtual_machine.h"
+
+#define LOG_MAGIC           0x4C525056   // "VPRL"
+#define LOG_VERSION         1
+#define FLUSH_SIZE          (64 * 1024)
+#define MAX_SNAPSHOTS       64
+#define SNAPSHOT_INTERVAL   4096         // branches, to start with
+
+typedef struct
+{
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint64_t code_size;
+    uint64_t data_size;
+    uint64_t entry;          // code offset where the run started
+} __attribute__((packed)) log_header_t;
+
+enum
+{
+    REC_NATIVE = 1,
+    REC_SIGNAL,
+};
+
+typedef struct
+{
+    uint64_t branches;
+    uint32_t offset;         // the instruction about to run
+    size_t pos;              // read position in the log
+    uint64_t regs[VM_NUM_REGS];
+    uint32_t flags;
+    size_t sp;
+    size_t heap_top;
+    uint64_t* stack;         // sp entries
+    uint8_t* mem;            // heap_top bytes
+} snapshot_t;
+
+typedef struct vm_record_t
+{
+    uint8_t* log;            // records, without the header
+    size_t size;
+    size_t cap;
+    size_t pos;              // next record to replay; size when recording
+    int fd;                  // file to write to, or -1
+    int keep;                // keep the log and take snapshots
+    int from_file;           // the log was read from a file
+    int quiet;               // do not run output routines
+
+    // the next signal in the log
+    int event;
+    uint64_t event_branches;
+    uint32_t event_offset;
+    int event_signal;
+    vm_insn_t* event_insn;   // where VM_OP_EVENT is patched in, if it is
+    uint8_t event_op;        // what was in the handler slot there
+
+    snapshot_t* snaps;
+    size_t nsnaps;
+    uint64_t interval;
+} vm_record_t;
+
+static void* alloc_or_die(size_t size)
+{
+    void* ptr = malloc(size);
+
+    if(ptr == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", size);
+        exit(1);
+    }
+
+    return ptr;
+}
+
+/************************
+ * the log
+ */
+static void flush_log(vm_record_t* rec)
+{
+    if(rec->fd < 0 || rec->size == 0)
+        return;
+
+    for(size_t done = 0; done < rec->size;)
+    {
+        ssize_t n = write(rec->fd, &rec->log[done], rec->size - done);
+
+        if(n <= 0)
+        {
+            fprintf(stderr, "ERROR: cannot write the record log\n");
+            close(rec->fd);
+            rec->fd = -1;
+            break;
+        }
+        done += n;
+    }
+
+    // the log is not needed once it is written, unless it is being kept
+    if(!rec->keep)
+        rec->size = rec->pos = 0;
+}
+
+static void put_byte(vm_record_t* rec, uint8_t byte)
+{
+    if(rec->size == rec->cap)
+    {
+        rec->cap = rec->cap? rec->cap * 2: FLUSH_SIZE;
+        rec->log = realloc(rec->log, rec->cap);
+        if(rec->log == NULL)
+        {
+            fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", rec->cap);
+            exit(1);
+        }
+    }
+
+    rec->log[rec->size++] = byte;
+}
+
+static void put_number(vm_record_t* rec, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        put_byte(rec, (uint8_t)(value | 0x80));
+        value >>= 7;
+    }
+    put_byte(rec, (uint8_t)value);
+}
+
+static void end_record(vm_record_t* rec)
+{
+    rec->pos = rec->size;
+    if(!rec->keep && rec->size >= FLUSH_SIZE)
+        flush_log(rec);
+}
+
+/*
+ * Returns non-zero if the log ends in the middle of a number.
+ */
+static int get_number(vm_record_t* rec, size_t* pos, uint64_t* value)
+{
+    *value = 0;
+    for(int shift = 0; *pos < rec->size && shift < 64; shift += 7)
+    {
+        uint8_t byte = rec->log[(*pos)++];
+
+        *value |= (uint64_t)(byte & 0x7F) << shift;
+        if(!(byte & 0x80))
+            return 0;
+    }
+
+    return 1;
+}
+
+/************************
+ * replaying signals
+ */
+static void unpatch_event(vm_record_t* rec)
+{
+    if(rec->event_insn != NULL)
+    {
+        rec->event_insn->op = rec->event_op;
+        rec->event_insn = NULL;
+    }
+}
+
+/*
+ * Returns non-zero if the log does not give an instruction.
+ */
+static int patch_event(vm_t* vm, vm_record_t* rec)
+{
+    vm_insn_t* insn = (vm_insn_t*)vm_find_insn(vm, rec->event_offset);
+
+    if(insn == NULL || insn->op == VM_OP_FELL_OFF)
+        return 1;
+
+    rec->event_insn = insn;
+    rec->event_op = insn->op;
+    insn->op = VM_OP_EVENT;
+    return 0;
+}
+
+/*
+ * Look at the next record, and set the branch limit for the next signal or
+ * snapshot.
+ */
+static void arm(vm_t* vm)
+{
+    vm_record_t* rec = vm->record;
+    uint64_t limit = UINT64_MAX;
+
+    rec->event = 0;
+    if(rec->pos < rec->size && rec->log[rec->pos] == REC_SIGNAL && rec->event_insn == NULL)
+    {
+        size_t pos = rec->pos + 1;
+        uint64_t offset, sig;
+
+        // a log that does not make sense raises nothing more
+        if(!get_number(rec, &pos, &rec->event_branches) && !get_number(rec, &pos, &offset) &&
+           !get_number(rec, &pos, &sig) && sig < VM_MAX_SIGNAL)
+        {
+            rec->event = 1;
+            rec->event_offset = (uint32_t)offset;
+            rec->event_signal = (int)sig;
+
+            // no more branches before it, so it is somewhere straight ahead
+            if(rec->event_branches > vm->branches)
+                limit = rec->event_branches;
+            else if(patch_event(vm, rec))
+                rec->event = 0;
+        }
+    }
+
+    if(rec->keep && rec->nsnaps > 0)
+    {
+        uint64_t next = rec->snaps[rec->nsnaps - 1].branches + rec->interval;
+
+        if(next > vm->branches && next < limit)
+            limit = next;
+    }
+
+    vm->branch_limit = limit;
+}
+
+/************************
+ * snapshots
+ */
+static void free_snapshot(snapshot_t* snap)
+{
+    free(snap->stack);
+    free(snap->mem);
+}
+
+static void take_snapshot(vm_t* vm, const vm_insn_t* pc)
+{
+    vm_record_t* rec = vm->record;
+
+    // keep every other one and take them half as often
+    if(rec->nsnaps == MAX_SNAPSHOTS)
+    {
+        size_t n = 1;
+
+        for(size_t i = 1; i < rec->nsnaps; i++)
+        {
+            if(i % 2 == 0)
+                rec->snaps[n++] = rec->snaps[i];
+            else
+                free_snapshot(&rec->snaps[i]);
+        }
+        rec->nsnaps = n;
+        rec->interval *= 2;
+    }
+
+    snapshot_t* snap = &rec->snaps[rec->nsnaps++];
+
+    snap->branches = vm->branches;
+    snap->offset = pc->offset;
+    snap->pos = rec->pos;
+    memcpy(snap->regs, vm->regs, sizeof(vm->regs));
+    snap->flags = vm->flags;
+    snap->sp = vm->sp;
+    snap->heap_top = vm->heap_top;
+    snap->stack = alloc_or_die(vm->sp * sizeof(uint64_t) + 1);
+    memcpy(snap->stack, vm->stack, vm->sp * sizeof(uint64_t));
+    snap->mem = alloc_or_die(vm->heap_top + 1);
+    memcpy(snap->mem, vm->mem, vm->heap_top);
+}
+
+static const vm_insn_t* restore_snapshot(vm_t* vm, const snapshot_t* snap)
+{
+    vm_record_t* rec = vm->record;
+
+    unpatch_event(rec);
+    vm->branches = snap->branches;
+    rec->pos = snap->pos;
+    memcpy(vm->regs, snap->regs, sizeof(vm->regs));
+    vm->flags = snap->flags;
+    vm->sp = snap->sp;
+    memcpy(vm->stack, snap->stack, snap->sp * sizeof(uint64_t));
+
+    // the heap past the snapshot may have been used since
+    if(vm->heap_top > snap->heap_top)
+        memset(&vm->mem[snap->heap_top], 0, vm->heap_top - snap->heap_top);
+    memcpy(vm->mem, snap->mem, snap->heap_top);
+    vm->heap_top = snap->heap_top;
+
+    vm->status = VM_RUNNING;
+    vm->dispatch = vm->handlers;
+    arm(vm);
+    return vm_find_insn(vm, snap->offset);
+}
+
+/************************
+ * public interface
+ */
+static vm_record_t* new_record(vm_t* vm, int keep)
+{
+    vm_record_t* rec = alloc_or_die(sizeof(vm_record_t));
+
+    memset(rec, 0, sizeof(vm_record_t));
+    rec->fd = -1;
+    rec->keep = keep;
+    rec->interval = SNAPSHOT_INTERVAL;
+    if(keep)
+        rec->snaps = alloc_or_die(MAX_SNAPSHOTS * sizeof(snapshot_t));
+
+    vm->record = rec;
+    return rec;
+}
+
+/*
+ * Start recording a run that starts at entry. The log is written to fname,
+ * or only kept in memory if it is NULL. If keep is set, the log is kept in
+ * memory and snapshots are taken. Returns non-zero if the file cannot be
+ * written.
+ */
+int record_start(vm_t* vm, const char* fname, const vm_insn_t* entry, int keep)
+{
+    vm_record_t* rec = new_record(vm, keep);
+
+    if(fname != NULL)
+    {
+        log_header_t header = {LOG_MAGIC, LOG_VERSION, 0, vm->image.header->code_size,
+                               vm->image.header->data_size, entry->offset};
+
+        rec->fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if(rec->fd < 0 || write(rec->fd, &header, sizeof(header)) != sizeof(header))
+        {
+            fprintf(stderr, "ERROR: cannot write the record log \"%s\"\n", fname);
+            record_finish(vm);
+            return 1;
+        }
+    }
+
+    if(keep)
+        take_snapshot(vm, entry);
+    arm(vm);
+    return 0;
+}
+
+/*
+ * Start replaying the log in fname. The run starts where it did when it was
+ * recorded, which is returned in entry. Returns non-zero if the log cannot
+ * be read or is not for this program.
+ */
+int replay_start(vm_t* vm, const char* fname, const vm_insn_t** entry, int keep)
+{
+    vm_record_t* rec = new_record(vm, keep);
+    log_header_t header;
+    struct stat st;
+    int fd = open(fname, O_RDONLY);
+
+    rec->from_file = 1;
+    if(fd < 0 || fstat(fd, &st) || read(fd, &header, sizeof(header)) != sizeof(header))
+    {
+        fprintf(stderr, "ERROR: cannot read the record log \"%s\"\n", fname);
+        goto fail;
+    }
+
+    if(header.magic != LOG_MAGIC || header.version != LOG_VERSION ||
+       header.code_size != vm->image.header->code_size || header.data_size != vm->image.header->data_size ||
+       (*entry = vm_find_insn(vm, header.entry)) == NULL)
+    {
+        fprintf(stderr, "ERROR: \"%s\" is not a record log for this program\n", fname);
+        goto fail;
+    }
+
+    rec->cap = rec->size = st.st_size - sizeof(header);
+    rec->log = alloc_or_die(rec->cap + 1);
+    if(read(fd, rec->log, rec->size) != (ssize_t)rec->size)
+    {
+        fprintf(stderr, "ERROR: cannot read the record log \"%s\"\n", fname);
+        goto fail;
+    }
+
+    close(fd);
+    if(keep)
+        take_snapshot(vm, *entry);
+    arm(vm);
+    return 0;
+
+fail:
+    if(fd >= 0)
+        close(fd);
+    record_finish(vm);
+    return 1;
+}
+
+void record_finish(vm_t* vm)
+{
+    vm_record_t* rec = vm->record;
+
+    if(rec == NULL)
+        return;
+
+    unpatch_event(rec);
+    if(rec->fd >= 0)
+    {
+        rec->keep = 0;
+        flush_log(rec);
+        close(rec->fd);
+    }
+
+    for(size_t i = 0; i < rec->nsnaps; i++)
+        free_snapshot(&rec->snaps[i]);
+    free(rec->snaps);
+    free(rec->log);
+    free(rec);
+    vm->record = NULL;
+    vm->branch_limit = UINT64_MAX;
+}
+
+void record_set_quiet(vm_t* vm, int quiet)
+{
+    vm->record->quiet = quiet;
+}
+
+/*
+ * The VM has taken the number of branches that arm() asked for. Returns
+ * where the branch goes.
+ */
+const vm_insn_t* record_branch_limit(vm_t* vm, const vm_insn_t* target)
+{
+    vm_record_t* rec = vm->record;
+
+    if(rec->keep && vm->branches == rec->snaps[rec->nsnaps - 1].branches + rec->interval)
+        take_snapshot(vm, target);
+
+    if(rec->event && rec->event_insn == NULL && vm->branches == rec->event_branches)
+        patch_event(vm, rec);   // arm() gives up on it if this fails
+
+    arm(vm);
+    return target;
+}
+
+/*
+ * The handler for VM_OP_EVENT. Raise the signal from the log before insn
+ * runs.
+ */
+const vm_insn_t* record_event(vm_t* vm, const vm_insn_t* insn)
+{
+    vm_record_t* rec = vm->record;
+
+    unpatch_event(rec);
+    if(vm->branches != rec->event_branches)
+        vm_fault(vm, insn, "replay does not match the program");
+
+    // skip the record that arm() read
+    size_t pos = rec->pos + 1;
+    uint64_t value;
+
+    for(int i = 0; i < 3; i++)
+        get_number(rec, &pos, &value);
+    rec->pos = pos;
+
+    const vm_insn_t* next = vm_raise_signal(vm, insn, rec->event_signal);
+
+    arm(vm);
+    return next;
+}
+
+/*
+ * Run a native routine that reads input, or take its result from the log.
+ * Output routines are not run while the debugger is going back.
+ */
+void record_native(vm_t* vm, const vm_insn_t* insn, uint64_t number, const vm_native_info_t* native)
+{
+    vm_record_t* rec = vm->record;
+
+    if(native->flags & NATIVE_OUTPUT)
+    {
+        if(!rec->quiet)
+            native->func(vm, insn);
+        return;
+    }
+
+    if(rec->pos < rec->size)
+    {
+        size_t pos = rec->pos + 1;
+        uint64_t logged;
+
+        if(rec->log[rec->pos] != REC_NATIVE || get_number(rec, &pos, &logged) || logged != number ||
+           pos + 8 > rec->size)
+            vm_fault(vm, insn, "replay does not match the program");
+
+        memcpy(&vm->regs[0], &rec->log[pos], 8);
+        rec->pos = pos + 8;
+        arm(vm);
+        return;
+    }
+
+    native->func(vm, insn);
+    put_byte(rec, REC_NATIVE);
+    put_number(rec, number);
+    for(int i = 0; i < 8; i++)
+        put_byte(rec, (uint8_t)(vm->regs[0] >> (i * 8)));
+    end_record(rec);
+}
+
+/*
+ * A signal is being raised before insn while recording.
+ */
+void record_signal(vm_t* vm, const vm_insn_t* insn, int sig)
+{
+    vm_record_t* rec = vm->record;
+
+    // a replay is driven by the log, not by signals
+    if(rec->pos < rec->size)
+        return;
+
+    put_byte(rec, REC_SIGNAL);
+    put_number(rec, vm->branches);
+    put_number(rec, insn->offset);
+    put_number(rec, (uint64_t)sig);
+    end_record(rec);
+}
+
+/*
+ * Go back to the start of the run. A log that is being replayed is
+ * replayed again; a run that was being recorded starts a new recording.
+ * Returns where the run starts.
+ */
+const vm_insn_t* record_restart(vm_t* vm)
+{
+    vm_record_t* rec = vm->record;
+
+    if(!rec->from_file)
+        rec->size = 0;
+
+    for(size_t i = 1; i < rec->nsnaps; i++)
+        free_snapshot(&rec->snaps[i]);
+    rec->nsnaps = 1;
+    rec->interval = SNAPSHOT_INTERVAL;
+    return restore_snapshot(vm, &rec->snaps[0]);
+}
+
+/*
+ * Go back to the last snapshot before the point in the run given by the
+ * number of branches and the code offset. Returns where the VM is now, or
+ * NULL if the point is the start of the run.
+ */
+const vm_insn_t* record_rewind(vm_t* vm, uint64_t branches, uint32_t offset)
+{
+    vm_record_t* rec = vm->record;
+
+    for(size_t i = rec->nsnaps; i-- > 0;)
+    {
+        const snapshot_t* snap = &rec->snaps[i];
+
+        // a snapshot with the same count is at the start of the same block
+        if(snap->branches < branches || (snap->branches == branches && snap->offset != offset))
+            return restore_snapshot(vm, snap);
+    }
+
+    return NULL;
+}
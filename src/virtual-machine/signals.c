@@ -0,0 +1,134 @@
+/*
+ * Signals from the operating system, raised as exceptions in the VM.
+ *
+ * The vector for a signal is a label in a code section named "signals",
+ * named after the signal, such as "signals.sigusr1". Only the signals that
+ * have a vector are caught. A signal is marked as pending and vm->dispatch
+ * is pointed at vm_signal_handlers, so it is raised before the next
+ * instruction and the dispatch loop does not have to look for it.
+ *
+ * Raising the exception pushes the address of the instruction that was
+ * about to run and sets the E flag, so ERET goes back to it. The other flags
+ * are left alone. If the E flag is already set, the signal is dropped and
+ * the EM flag is set, the same as for RAISE.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+
+#include "virtual_machine.h"
+
+vm_handler_t vm_signal_handlers[VM_HANDLERS];
+
+// the VM that signals go to
+static vm_t* volatile signal_vm;
+
+static const struct
+{
+    const char* name;
+    int sig;
+} signal_names[] = {
+    {"sighup", SIGHUP},
+    {"sigint", SIGINT},
+    {"sigquit", SIGQUIT},
+    {"sigusr1", SIGUSR1},
+    {"sigusr2", SIGUSR2},
+    {"sigpipe", SIGPIPE},
+    {"sigalrm", SIGALRM},
+    {"sigterm", SIGTERM},
+};
+
+#define NUM_SIGNAL_NAMES (sizeof(signal_names) / sizeof(signal_names[0]))
+
+static void on_signal(int sig)
+{
+    vm_t* vm = signal_vm;
+
+    __atomic_or_fetch(&vm->pending_signals, 1u << sig, __ATOMIC_SEQ_CST);
+    vm->dispatch = vm_signal_handlers;
+}
+
+/*
+ * Every slot of vm_signal_handlers. Raise the pending signals before insn
+ * runs.
+ */
+static const vm_insn_t* deliver(vm_t* vm, const vm_insn_t* insn)
+{
+    vm->dispatch = vm->handlers;
+
+    uint32_t pending = __atomic_exchange_n(&vm->pending_signals, 0, __ATOMIC_SEQ_CST);
+
+    for(int sig = 1; sig < VM_MAX_SIGNAL; sig++)
+    {
+        if(!(pending & (1u << sig)))
+            continue;
+
+        if(vm->record != NULL)
+            record_signal(vm, insn, sig);
+        insn = vm_raise_signal(vm, insn, sig);
+    }
+
+    return insn;
+}
+
+const vm_insn_t* vm_raise_signal(vm_t* vm, const vm_insn_t* insn, int sig)
+{
+    if(vm->vectors[sig] == NULL)
+        return insn;
+
+    if(vm->flags & VM_FLAG_E)
+    {
+        vm->flags |= VM_FLAG_EM;
+        return insn;
+    }
+
+    if(vm->sp >= vm->stack_size)
+        vm_fault(vm, insn, "stack overflow");
+    vm->stack[vm->sp++] = insn->offset;
+    vm->flags = (vm->flags & ~VM_FLAG_EM) | VM_FLAG_E;
+    return vm_branch_taken(vm, vm->vectors[sig]);
+}
+
+/*
+ * Find the vectors in the program. This is done when it is loaded, since a
+ * replay raises signals without catching them.
+ */
+void vm_find_vectors(vm_t* vm)
+{
+    for(size_t i = 0; i < NUM_SIGNAL_NAMES; i++)
+    {
+        char name[32];
+        image_symbol_t rec;
+
+        snprintf(name, sizeof(name), "signals.%s", signal_names[i].name);
+        if(!vm_find_symbol(vm, name, &rec) && rec.segment == IMAGE_SEG_CODE)
+            vm->vectors[signal_names[i].sig] = vm_find_insn(vm, rec.offset);
+    }
+}
+
+/*
+ * Catch the signals that have a vector. Returns the number of them.
+ */
+int vm_init_signals(vm_t* vm)
+{
+    int count = 0;
+
+    for(int i = 0; i < VM_HANDLERS; i++)
+        vm_signal_handlers[i] = deliver;
+
+    signal_vm = vm;
+    for(int sig = 1; sig < VM_MAX_SIGNAL; sig++)
+    {
+        if(vm->vectors[sig] == NULL)
+            continue;
+
+        struct sigaction sa;
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_signal;
+        sigaction(sig, &sa, NULL);
+        count++;
+    }
+
+    return count;
+}
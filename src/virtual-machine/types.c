@@ -0,0 +1,237 @@
+/*
+ * Register type inference.
+ *
+ * A register has no type of its own: it takes the type of the instruction
+ * that last wrote it, and the instructions that read it say which type they
+ * take it to be. This works out, for each instruction, the type that each
+ * register was last given on every path to it, I, U or F, or that there is
+ * no one type. An integer that is known to be between 0 and 2^63 is kept as
+ * a type of its own, ABS, which is what ITU gives, and what LOAD of a small
+ * enough immediate and a register that has not been written yet hold.
+ *
+ * The handlers are picked by opcode, so none of them has to look at a type
+ * when it runs. What the types show is which conversions leave the register
+ * as it was: UTI never changes the bits, and ITU of an ABS is the same
+ * value, since the absolute value of one is itself. Those get the UTI
+ * handler, which does nothing, and the compiled code leaves them out, which
+ * it finds from insn->plain.
+ *
+ * Code that is called starts with nothing known, and every register may
+ * have been changed when a call comes back. That only holds if every return
+ * goes back to where it was called from, which is what vm_verify() shows
+ * with VM_VERIFIED_STACK. A signal handler can change a register between
+ * any two instructions, so nothing is dropped in a program that has signal
+ * vectors either.
+ *
+ * The types only hold for a run that starts at the start of the code, so
+ * this is only called then, the same as vm_trust(): not with -e, not for a
+ * replay, and not by the debugger or the aot tool, whose code can be
+ * entered anywhere.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "virtual_machine.h"
+
+enum
+{
+    T_UNSEEN,                // no path has reached here yet
+    T_ABS,                   // an integer from 0 to 2^63
+    T_I,
+    T_U,
+    T_F,
+    T_ANY,                   // not the same on every path
+};
+
+typedef struct
+{
+    vm_t* vm;
+    uint8_t (*types)[VM_NUM_REGS];   // by instruction, before it runs
+    uint8_t* queued;
+    uint32_t* work;
+    size_t nwork;
+} infer_t;
+
+static uint8_t join(uint8_t a, uint8_t b)
+{
+    if(a == T_UNSEEN || a == b)
+        return b;
+    if(b == T_UNSEEN)
+        return a;
+    if((a == T_ABS && b == T_U) || (a == T_U && b == T_ABS))
+        return T_U;
+    return T_ANY;
+}
+
+static void reach(infer_t* t, const vm_insn_t* insn, const uint8_t* regs)
+{
+    uint32_t k = (uint32_t)(insn - t->vm->insns);
+    int changed = 0;
+
+    if(k == t->vm->ninsns)
+        return;
+
+    for(int r = 0; r < VM_NUM_REGS; r++)
+    {
+        uint8_t type = join(t->types[k][r], regs[r]);
+
+        changed |= type != t->types[k][r];
+        t->types[k][r] = type;
+    }
+
+    if(changed && !t->queued[k])
+    {
+        t->queued[k] = 1;
+        t->work[t->nwork++] = k;
+    }
+}
+
+static uint8_t immediate_type(const decoded_operand_t* opnd)
+{
+    if(opnd->kind == OPND_FLOAT)
+        return T_F;
+    return ((int64_t)opnd->value >= 0)? T_ABS: T_ANY;
+}
+
+/*
+ * The type that an instruction gives the register that it has just written;
+ * regs are the types before it ran.
+ */
+static uint8_t result_type(const vm_insn_t* insn, int base, const uint8_t* regs)
+{
+    const decoded_operand_t* src = &insn->insn.operands[1];
+    uint8_t own = regs[insn->insn.operands[0].reg];
+
+    switch (base)
+    {
+        case OP_STORE:
+            return own;      // a copy of its first operand
+        case OP_LOAD:
+            if(src->kind == OPND_REG)
+                return regs[src->reg];
+            if(src->kind == OPND_IMM || src->kind == OPND_FLOAT)
+                return immediate_type(src);
+            return T_ANY;
+        case OP_ITU:
+            return T_ABS;
+        case OP_UTI:
+            return (own == T_ABS)? T_ABS: T_I;
+        case OP_IADD: case OP_ISUB: case OP_IMUL: case OP_IDIV: case OP_IMOD: case OP_INEG:
+        case OP_INC: case OP_DEC: case OP_FTI:
+            return T_I;
+        case OP_UADD: case OP_USUB: case OP_UMUL: case OP_UDIV: case OP_UMOD: case OP_UNEG:
+        case OP_SHL: case OP_SHR: case OP_ROL: case OP_ROR:
+        case OP_AND: case OP_OR: case OP_XOR: case OP_NOT:
+        case OP_FTU: case OP_ALLOCATE:
+            return T_U;
+        case OP_FADD: case OP_FSUB: case OP_FMUL: case OP_FDIV: case OP_FMOD: case OP_FNEG:
+        case OP_ITF: case OP_UTF:
+            return T_F;
+        default:
+            return T_ANY;
+    }
+}
+
+static void step(infer_t* t, uint32_t k)
+{
+    const vm_insn_t* insn = &t->vm->insns[k];
+    const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+    uint8_t regs[VM_NUM_REGS];
+    uint8_t any[VM_NUM_REGS];
+
+    memcpy(regs, t->types[k], sizeof(regs));
+    memset(any, T_ANY, sizeof(any));
+    t->queued[k] = 0;
+
+    switch (info->base)
+    {
+        case OP_JMP:
+            if(insn->target != NULL)
+                reach(t, insn->target, regs);
+            if(info->cond != 0)
+                reach(t, insn + 1, regs);
+            break;
+        case OP_CALL:
+        case OP_TRAP:
+        case OP_RAISE:
+            if(insn->target != NULL)
+                reach(t, insn->target, any);
+            reach(t, insn + 1, any);
+            break;
+        case OP_EXCALL:
+            reach(t, insn + 1, any);
+            break;
+        case OP_RET:
+        case OP_TRET:
+        case OP_ERET:
+        case OP_END:
+            if(info->cond != 0)
+                reach(t, insn + 1, regs);
+            break;
+        default:
+        {
+            int r = cgen_dest_reg(insn);
+
+            if(r >= 0)
+                regs[r] = result_type(insn, info->base, regs);
+            reach(t, insn + 1, regs);
+            break;
+        }
+    }
+}
+
+/*
+ * Whether the types can be trusted everywhere in the code.
+ */
+static int sound(vm_t* vm)
+{
+    for(int sig = 0; sig < VM_MAX_SIGNAL; sig++)
+        if(vm->vectors[sig] != NULL)
+            return 0;
+
+    return vm->ninsns > 0 && (vm->verified & VM_VERIFIED_STACK);
+}
+
+/*
+ * Infer the register types of a loaded program that will run from the
+ * start of its code, and give the conversions that do not change anything
+ * the UTI handler.
+ */
+void vm_infer_types(vm_t* vm)
+{
+    if(!sound(vm))
+        return;
+
+    infer_t t;
+    uint8_t zero[VM_NUM_REGS];
+
+    t.vm = vm;
+    t.types = calloc(vm->ninsns, sizeof(*t.types));
+    t.queued = calloc(vm->ninsns, 1);
+    t.work = malloc(vm->ninsns * sizeof(uint32_t));
+    t.nwork = 0;
+    if(t.types == NULL || t.queued == NULL || t.work == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", vm->ninsns * sizeof(*t.types));
+        exit(1);
+    }
+
+    // the registers start out 0; each instruction is on the list at most once
+    memset(zero, T_ABS, sizeof(zero));
+    reach(&t, vm->insns, zero);
+    while(t.nwork > 0)
+        step(&t, t.work[--t.nwork]);
+
+    for(size_t k = 0; k < vm->ninsns; k++)
+    {
+        vm_insn_t* insn = &vm->insns[k];
+
+        if(insn->insn.opcode == OP_ITU && t.types[k][insn->insn.operands[0].reg] == T_ABS)
+            insn->op = insn->plain = OP_UTI;
+    }
+
+    free(t.types);
+    free(t.queued);
+    free(t.work);
+}
@@ -0,0 +1,235 @@
+/*
+ * Load time verifier.
+ *
+ * The decoder already makes sure that every opcode is valid, that each
+ * operand is of a kind that the opcode takes and that register numbers fit
+ * in their 5 bits, and the loader that every branch to a fixed address lands
+ * on an instruction. This goes through the decoded code once more and
+ * rejects what is sure to fault if it is run: an EXCALL of a routine that
+ * does not exist, or a divide by an immediate 0 that the code can reach.
+ *
+ * It then works out the depth of the stack at each instruction, counted
+ * from the start of the function that it is in. A function starts at the
+ * start of the code, at a signal vector and at each fixed address that is
+ * called with CALL, TRAP or RAISE. PUSH adds one, POP takes one, and a call
+ * leaves the depth as it was, since the function that it calls returns
+ * with the stack as it found it. If every instruction has the same depth on
+ * every path to it, no POP is at depth 0 and every RET, TRET and ERET is at
+ * depth 0, then a POP always has something to pop, and a return always
+ * pops the address that a call or a signal pushed. The program can then run
+ * on the trusted handlers, which leave those checks out; see vm_trust(). A
+ * jump or call through a register could go anywhere, so a program with one
+ * is never trusted.
+ *
+ * The same walk shows which instructions can be reached at all, but only
+ * if the stack is balanced: otherwise a return could go anywhere, and so
+ * could a jump through a register. Code that cannot be reached may divide
+ * by 0, since it never runs from the start, and if it is run some other
+ * way the handler still faults.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "virtual_machine.h"
+
+#define UNSEEN  INT32_MIN
+
+typedef struct
+{
+    vm_t* vm;
+    int32_t* depths;         // by instruction
+    uint32_t* work;
+    size_t nwork;
+    int balanced;
+} verifier_t;
+
+static int error(const char* fname, const vm_insn_t* insn, const char* msg)
+{
+    fprintf(stderr, "ERROR: \"%s\": code offset 0x%08x: %s\n", fname, insn->offset, msg);
+    return 1;
+}
+
+/*
+ * The checks on a single instruction.
+ */
+static int check_insn(const char* fname, const vm_insn_t* insn)
+{
+    const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+    const decoded_operand_t* opnds = insn->insn.operands;
+
+    if(info->name == NULL || insn->insn.noperands != info->noperands)
+        return error(fname, insn, "invalid instruction");
+
+    for(int i = 0; i < insn->insn.noperands; i++)
+    {
+        if(!(info->operands[i] & OPND_MASK(opnds[i].kind)))
+            return error(fname, insn, "invalid operand");
+        if(opnds[i].kind <= OPND_REG_OFS16 && opnds[i].reg >= VM_NUM_REGS)
+            return error(fname, insn, "invalid register");
+    }
+
+    switch (info->base)
+    {
+        case OP_EXCALL:
+            if(opnds[0].kind == OPND_IMM && vm_find_native((uint64_t)opnds[0].value) == NULL)
+                return error(fname, insn, "call to an external routine that does not exist");
+            break;
+        case OP_JMP:
+        case OP_CALL:
+        case OP_TRAP:
+        case OP_RAISE:
+            if(opnds[0].kind == OPND_IMM && insn->target == NULL)
+                return error(fname, insn, "branch to an address that is not an instruction");
+            break;
+    }
+
+    return 0;
+}
+
+static int divides_by_zero(const vm_insn_t* insn)
+{
+    const decoded_operand_t* divisor = &insn->insn.operands[2];
+
+    switch (opcode_table[insn->insn.opcode].base)
+    {
+        case OP_IDIV:
+        case OP_UDIV:
+        case OP_IMOD:
+        case OP_UMOD:
+            return divisor->kind == OPND_IMM && divisor->value == 0;
+        default:
+            return 0;
+    }
+}
+
+static void reach(verifier_t* v, const vm_insn_t* insn, int32_t depth)
+{
+    uint32_t k = (uint32_t)(insn - v->vm->insns);
+
+    // running off the end stops the program
+    if(k == v->vm->ninsns)
+        return;
+
+    if(v->depths[k] == UNSEEN)
+    {
+        v->depths[k] = depth;
+        v->work[v->nwork++] = k;
+    }
+    else if(v->depths[k] != depth)
+        v->balanced = 0;
+}
+
+/*
+ * Follow the code from instruction k, which is at depth.
+ */
+static void step(verifier_t* v, uint32_t k)
+{
+    const vm_insn_t* insn = &v->vm->insns[k];
+    const opcode_info_t* info = &opcode_table[insn->insn.opcode];
+    int32_t depth = v->depths[k];
+    int cond = info->cond != 0;
+
+    switch (info->base)
+    {
+        case OP_PUSH:
+            reach(v, insn + 1, depth + 1);
+            break;
+        case OP_POP:
+            if(depth == 0)
+                v->balanced = 0;
+            reach(v, insn + 1, depth - 1);
+            break;
+        case OP_JMP:
+            if(insn->target == NULL)
+                v->balanced = 0;
+            else
+                reach(v, insn->target, depth);
+            if(cond)
+                reach(v, insn + 1, depth);
+            break;
+        case OP_CALL:
+        case OP_TRAP:
+        case OP_RAISE:
+            if(insn->target == NULL)
+                v->balanced = 0;
+            else
+                reach(v, insn->target, 0);
+            reach(v, insn + 1, depth);
+            break;
+        case OP_RET:
+        case OP_TRET:
+        case OP_ERET:
+            if(depth != 0)
+                v->balanced = 0;
+            if(cond)
+                reach(v, insn + 1, depth);
+            break;
+        case OP_END:
+            if(cond)
+                reach(v, insn + 1, depth);
+            break;
+        default:
+            reach(v, insn + 1, depth);
+            break;
+    }
+}
+
+/*
+ * Check the code of a loaded program, and set vm->verified to what could be
+ * shown about it. Returns non-zero and prints the reason if the program
+ * cannot be run.
+ */
+int vm_verify(vm_t* vm, const char* fname)
+{
+    int natives = 1;
+
+    for(size_t k = 0; k < vm->ninsns; k++)
+    {
+        const vm_insn_t* insn = &vm->insns[k];
+
+        if(check_insn(fname, insn))
+            return 1;
+        if(opcode_table[insn->insn.opcode].base == OP_EXCALL && insn->insn.operands[0].kind != OPND_IMM)
+            natives = 0;
+    }
+
+    verifier_t v;
+
+    v.vm = vm;
+    v.depths = malloc((vm->ninsns + 1) * sizeof(int32_t));
+    v.work = malloc((vm->ninsns + 1) * sizeof(uint32_t));
+    v.nwork = 0;
+    v.balanced = 1;
+    if(v.depths == NULL || v.work == NULL)
+    {
+        fprintf(stderr, "FATAL ERROR: cannot allocate %lu bytes\n", (vm->ninsns + 1) * sizeof(int32_t));
+        exit(1);
+    }
+
+    for(size_t k = 0; k <= vm->ninsns; k++)
+        v.depths[k] = UNSEEN;
+
+    // each instruction goes on the list once, so it cannot overflow
+    reach(&v, vm->insns, 0);
+    for(int sig = 0; sig < VM_MAX_SIGNAL; sig++)
+        if(vm->vectors[sig] != NULL)
+            reach(&v, vm->vectors[sig], 0);
+    while(v.nwork > 0 && v.balanced)
+        step(&v, v.work[--v.nwork]);
+
+    // the walk stops early if the stack is not balanced
+    for(size_t k = 0; k < vm->ninsns; k++)
+    {
+        if((!v.balanced || v.depths[k] != UNSEEN) && divides_by_zero(&vm->insns[k]))
+        {
+            free(v.depths);
+            free(v.work);
+            return error(fname, &vm->insns[k], "divide by zero");
+        }
+    }
+
+    vm->verified = (v.balanced? VM_VERIFIED_STACK: 0) | (natives? VM_VERIFIED_NATIVES: 0);
+    free(v.depths);
+    free(v.work);
+    return 0;
+}
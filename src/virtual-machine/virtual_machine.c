@@ -1,9 +1,154 @@
-
 #include <stdio.h>
+#include <unistd.h>
 
 #include "virtual_machine.h"
 
-int main(void) {
-    printf("%d\n", NOP_LAST_OP);
-    return 0;
+static void usage(const char* name)
+{
+    fprintf(stderr, "usage: %s [-c | -P | -a lib | -j | -J dir] [-g] [-e label] [-r log | -p log] image\n", name);
+}
+
+/*
+ * Run a program. It starts at the start of the code, or at the label given
+ * with -e. The exit code is the value in R0 when it ends. With -r the run is
+ * recorded to a log, and with -p a log is replayed; see record.c. With -c
+ * the instructions are counted, which is slower, and the count is printed.
+ * With -P the run is profiled with the hardware counters; see profile.c.
+ * With -g the heap is garbage collected, and the pause times are printed;
+ * see gc.c. With -a the code is run from a library that the aot tool
+ * compiled from the image, which cannot be combined with the options that
+ * need to see every instruction; see aot.c. With -j the loops that are run
+ * most are compiled while the program runs, with the same limits, and with
+ * -J they are also kept in a code cache directory for the next run; see
+ * jit.c.
+ */
+int main(int argc, char** argv)
+{
+    vm_t vm;
+    const char* entry = NULL;
+    const char* record = NULL;
+    const char* replay = NULL;
+    const char* compiled = NULL;
+    const char* cache = NULL;
+    int count = 0;
+    int profile = 0;
+    int collect = 0;
+    int trace = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "cPa:jJ:ge:r:p:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                count = 1;
+                break;
+            case 'P':
+                profile = 1;
+                break;
+            case 'a':
+                compiled = optarg;
+                break;
+            case 'j':
+                trace = 1;
+                break;
+            case 'J':
+                trace = 1;
+                cache = optarg;
+                break;
+            case 'g':
+                collect = 1;
+                break;
+            case 'e':
+                entry = optarg;
+                break;
+            case 'r':
+                record = optarg;
+                break;
+            case 'p':
+                replay = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if(optind != argc - 1 || (record != NULL && replay != NULL) || (count && profile) ||
+       ((compiled != NULL || trace) && (count || profile || collect || record != NULL || replay != NULL)) ||
+       (compiled != NULL && trace))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    vm_init_dispatch();
+    if(vm_load(&vm, argv[optind]))
+        return 1;
+
+    // the verifier and the type pass followed the code from the start of it
+    if(entry == NULL && replay == NULL)
+    {
+        vm_infer_types(&vm);
+        vm_trust(&vm);
+    }
+    if((collect && gc_start(&vm)) || (compiled != NULL && aot_load(&vm, compiled)) ||
+       (trace && jit_start(&vm, cache)))
+    {
+        vm_unload(&vm);
+        return 1;
+    }
+
+    const vm_insn_t* start = vm.insns;
+
+    if(entry != NULL)
+    {
+        image_symbol_t rec;
+
+        if(vm_find_symbol(&vm, entry, &rec) || rec.segment != IMAGE_SEG_CODE ||
+           (start = vm_find_insn(&vm, rec.offset)) == NULL)
+        {
+            fprintf(stderr, "ERROR: \"%s\" is not a label in the code\n", entry);
+            vm_unload(&vm);
+            return 1;
+        }
+    }
+
+    // a replay gets its signals from the log
+    if((record != NULL && record_start(&vm, record, start, 0)) ||
+       (replay != NULL && replay_start(&vm, replay, &start, 0)))
+    {
+        vm_unload(&vm);
+        return 1;
+    }
+    if(replay == NULL)
+        vm_init_signals(&vm);
+
+    if(count)
+        vm.dispatch = vm.handlers = vm_count_handlers;
+    if(profile && profile_start(&vm))
+    {
+        record_finish(&vm);
+        vm_unload(&vm);
+        return 1;
+    }
+
+    const vm_insn_t* insn = vm_run(&vm, start);
+    int ret = (int)vm.regs[0];
+
+    fflush(stdout);
+    if(vm.status == VM_ERROR)
+    {
+        fprintf(stderr, "ERROR: code offset 0x%08x: %s\n", vm_source_offset(&vm, insn), vm.error);
+        ret = 1;
+    }
+    if(count)
+        fprintf(stderr, "instructions: %lu\n", vm.insns_run);
+    profile_finish(&vm, stderr);
+    gc_finish(&vm, stderr);
+    jit_finish(&vm, stderr);
+
+    record_finish(&vm);
+    vm_unload(&vm);
+    return ret;
 }
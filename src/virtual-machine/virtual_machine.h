@@ -1,4 +1,277 @@
 #ifndef _VIRTUAL_MACHINE_H_
 #define _VIRTUAL_MACHINE_H_
 
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <setjmp.h>
+
+#include "opcodes.h"
+#include "decode.h"
+#include "image.h"
+
+struct vm_t;
+struct vm_insn_t;
+struct vm_record_t;
+struct vm_profile_t;
+struct vm_gc_t;
+struct vm_aot_t;
+struct vm_jit_t;
+
+/*
+ * Every instruction is run by a handler, which returns the next instruction
+ * to run, or NULL to stop the VM.
+ */
+typedef const struct vm_insn_t* (*vm_handler_t)(struct vm_t* vm, const struct vm_insn_t* insn);
+
+/*
+ * The loader decodes every instruction once, when the image is loaded, into
+ * this form. The VM runs the decoded instructions and never looks at the
+ * instruction bytes again.
+ */
+typedef struct vm_insn_t
+{
+    uint8_t op;              // handler to run: the opcode, unless it was patched
+    uint8_t cond;            // condition of a conditional instruction
+    uint8_t plain;           // handler to put back when a patch is taken out
+    uint32_t offset;         // where the instruction starts in the code segment
+    const struct vm_insn_t* target;  // where an immediate branch goes, if it does
+    decoded_insn_t insn;
+} vm_insn_t;
+
+#define VM_NO_INSN UINT32_MAX
+
+// handler slots that are not opcodes; opcode 0 is never valid
+#define VM_OP_BREAK     0x00    // a breakpoint was patched in
+#define VM_OP_TRACE     0xFC    // a compiled trace starts here
+#define VM_OP_AOT       0xFD    // compiled code can be entered here
+#define VM_OP_EVENT     0xFE    // a replayed event happens here
+#define VM_OP_FELL_OFF  0xFF    // after the last instruction
+
+#define VM_HANDLERS 256
+
+// flags
+#define VM_FLAG_Z   0x01     // zero
+#define VM_FLAG_N   0x02     // negative
+#define VM_FLAG_C   0x04     // carry, or unsigned overflow
+#define VM_FLAG_V   0x08     // signed overflow
+#define VM_FLAG_T   0x10     // in a trap
+#define VM_FLAG_E   0x20     // in an exception
+#define VM_FLAG_TM  0x40     // trap missed
+#define VM_FLAG_EM  0x80     // exception missed
+#define VM_FLAG_NZCV (VM_FLAG_Z | VM_FLAG_N | VM_FLAG_C | VM_FLAG_V)
+
+#define VM_NUM_REGS 32
+
+#define VM_HEAP_SIZE    (64ul * 1024 * 1024)   // reserved, not committed
+#define VM_GC_HEAP_SIZE (4ul << 30)            // the same, with the collector
+#define VM_STACK_SIZE   (1024 * 1024)          // entries
+
+#define VM_MAX_SIGNAL   32
+
+// what vm_verify() could show about the code
+#define VM_VERIFIED_STACK   0x01     // the stack depth is the same on every path
+#define VM_VERIFIED_NATIVES 0x02     // every EXCALL is of a routine that exists
+
+// why the VM stopped
+enum
+{
+    VM_RUNNING,
+    VM_ENDED,                // END, or RET with nothing to return to
+    VM_ERROR,                // a runtime error; see vm->error
+    VM_BREAK,                // hit a breakpoint
+    VM_STOPPED,              // stopped by the stop table, e.g. for a watchpoint
+};
+
+typedef struct vm_t
+{
+    uint64_t regs[VM_NUM_REGS];
+    uint32_t flags;
+    uint32_t verified;                   // VM_VERIFIED_STACK, etc.
+    int trusted;                         // running on the trusted handlers
+
+    vm_handler_t* volatile dispatch;     // handler table in use
+    vm_handler_t* handlers;              // table to go back to after a swap
+    int status;
+    const char* error;
+    const vm_insn_t* stop_insn;          // where it stopped
+    jmp_buf fault_jmp;
+
+    // memory: the data segment and then the heap, in one mapping
+    uint8_t* mem;
+    size_t mem_size;
+    size_t heap_base;
+    size_t heap_top;         // end of the part of the heap in use
+
+    uint64_t* stack;
+    size_t stack_size;       // in entries
+    size_t sp;               // next free entry
+
+    image_file_t image;
+    vm_insn_t* insns;        // the decoded code, in order, then one to stop
+    size_t ninsns;
+    uint32_t* insn_index;    // code offset to index in insns, or VM_NO_INSN
+    size_t noffsets;         // in insn_index: the code, its end, then inlined copies
+    uint32_t* sources;       // by offset past the end, the code offset it is a copy of
+
+    // a point in the run is the number of taken branches and the instruction
+    uint64_t branches;
+    uint64_t branch_limit;   // call record_branch_limit() when branches gets here
+    uint64_t insns_run;      // only counted with vm_count_handlers
+    struct vm_record_t* record;          // NULL unless recording or replaying
+    struct vm_profile_t* profile;        // NULL unless profiling
+    struct vm_gc_t* gc;                  // NULL unless the heap is collected
+    struct vm_aot_t* aot;                // NULL unless running compiled code
+    struct vm_jit_t* jit;                // NULL unless compiling traces
+
+    // exception vectors for signals, see signals.c
+    const vm_insn_t* vectors[VM_MAX_SIGNAL];
+    volatile uint32_t pending_signals;
+} vm_t;
+
+/*
+ * A routine outside of the VM that EXCALL can call. It takes its arguments
+ * from R1 and up and returns its result in R0.
+ */
+typedef void (*vm_native_t)(vm_t* vm, const vm_insn_t* insn);
+
+// natives that allocate collected objects, which need pointer maps
+#define VM_NATIVE_GC_ALLOC      9
+#define VM_NATIVE_GC_COLLECT    10
+
+// kinds of native routines, for record and replay
+#define NATIVE_INPUT    0x01     // the result can be different each run
+#define NATIVE_OUTPUT   0x02     // only has an effect outside of the VM
+
+typedef struct
+{
+    const char* name;
+    vm_native_t func;
+    int flags;
+} vm_native_info_t;
+
+// loader.c
+int vm_load(vm_t* vm, const char* fname);
+int vm_remap(vm_t* vm, size_t heap_size);
+void vm_unload(vm_t* vm);
+const vm_insn_t* vm_find_insn(vm_t* vm, uint64_t offset);
+uint32_t vm_source_offset(vm_t* vm, const vm_insn_t* insn);
+int vm_find_symbol(vm_t* vm, const char* name, image_symbol_t* rec);
+
+// execute.c
+extern vm_handler_t vm_handlers[VM_HANDLERS];
+extern vm_handler_t vm_stop_handlers[VM_HANDLERS];
+extern vm_handler_t vm_count_handlers[VM_HANDLERS];
+void vm_init_dispatch(void);
+void vm_reset(vm_t* vm);
+const vm_insn_t* vm_run(vm_t* vm, const vm_insn_t* insn);
+const vm_insn_t* vm_step(vm_t* vm, const vm_insn_t* insn);
+void vm_fault(vm_t* vm, const vm_insn_t* insn, const char* msg) __attribute__((noreturn));
+void vm_trust(vm_t* vm);
+void vm_untrust(vm_t* vm);
+
+// verify.c
+int vm_verify(vm_t* vm, const char* fname);
+
+// inline.c
+void vm_inline(vm_t* vm);
+
+// types.c
+void vm_infer_types(vm_t* vm);
+
+// natives.c
+const vm_native_info_t* vm_find_native(uint64_t number);
+
+// record.c
+int record_start(vm_t* vm, const char* fname, const vm_insn_t* entry, int keep);
+int replay_start(vm_t* vm, const char* fname, const vm_insn_t** entry, int keep);
+void record_finish(vm_t* vm);
+void record_set_quiet(vm_t* vm, int quiet);
+const vm_insn_t* record_branch_limit(vm_t* vm, const vm_insn_t* target);
+const vm_insn_t* record_event(vm_t* vm, const vm_insn_t* insn);
+void record_native(vm_t* vm, const vm_insn_t* insn, uint64_t number, const vm_native_info_t* native);
+void record_signal(vm_t* vm, const vm_insn_t* insn, int sig);
+const vm_insn_t* record_restart(vm_t* vm);
+const vm_insn_t* record_rewind(vm_t* vm, uint64_t branches, uint32_t offset);
+
+// signals.c
+extern vm_handler_t vm_signal_handlers[VM_HANDLERS];
+void vm_find_vectors(vm_t* vm);
+int vm_init_signals(vm_t* vm);
+const vm_insn_t* vm_raise_signal(vm_t* vm, const vm_insn_t* insn, int sig);
+
+/*
+ * Count a taken branch. Record and replay use the count to find their way
+ * around a run, and ask to be told when it reaches vm->branch_limit.
+ */
+static inline const vm_insn_t* vm_branch_taken(vm_t* vm, const vm_insn_t* target)
+{
+    if(__builtin_expect(++vm->branches == vm->branch_limit, 0))
+        return record_branch_limit(vm, target);
+    return target;
+}
+
+// profile.c
+extern vm_handler_t vm_profile_handlers[VM_HANDLERS];
+int profile_start(vm_t* vm);
+void profile_finish(vm_t* vm, FILE* fp);
+
+// heap.c
+#define HEAP_CLASSES    24
+
+// kept in the VM memory with the rest of the heap
+typedef struct
+{
+    uint64_t live_bytes;     // in blocks in use, by the size of their class
+    uint64_t large_objects;
+    uint64_t large_bytes;
+    uint64_t class_live[HEAP_CLASSES];   // blocks in use
+    uint64_t class_slabs[HEAP_CLASSES];
+} heap_stats_t;
+
+void heap_init(vm_t* vm);
+void heap_destroy(vm_t* vm);
+uint64_t heap_allocate(vm_t* vm, uint64_t size);
+int heap_free(vm_t* vm, uint64_t addr);
+const heap_stats_t* heap_stats(vm_t* vm);
+uint32_t heap_class_size(int c);
+uint32_t heap_class_blocks(int c);
+
+// gc.c
+int gc_start(vm_t* vm);
+void gc_reset(vm_t* vm);
+void gc_finish(vm_t* vm, FILE* fp);
+void gc_destroy(vm_t* vm);
+uint64_t gc_allocate(vm_t* vm, const vm_insn_t* insn, uint64_t size, uint64_t mask);
+void gc_collect(vm_t* vm, const vm_insn_t* insn);
+uint64_t gc_heap_bytes(vm_t* vm);
+
+// cgen.c
+typedef struct
+{
+    uint32_t known;          // registers with known values
+    uint64_t values[VM_NUM_REGS];
+} cgen_consts_t;
+
+int cgen_data_op(FILE* out, const char* in, vm_t* vm, size_t k, const char* flags, const cgen_consts_t* consts);
+const char* cgen_value(vm_t* vm, size_t k, int n, const cgen_consts_t* consts);
+int cgen_sets_reg(int base);
+int cgen_dest_reg(const vm_insn_t* insn);
+uint32_t cgen_regs(const vm_insn_t* insn);
+void cgen_spill(FILE* out, const char* in, uint32_t regs);
+void cgen_reload(FILE* out, const char* in, uint32_t regs);
+int cgen_compile(const char* cfile, const char* outfile);
+
+// aot.c
+const vm_insn_t* aot_enter(vm_t* vm, const vm_insn_t* insn);
+uint64_t aot_code_hash(const uint8_t* code, size_t size);
+int aot_load(vm_t* vm, const char* fname);
+void aot_unload(vm_t* vm);
+
+// jit.c
+int jit_start(vm_t* vm, const char* cache_dir);
+const vm_insn_t* jit_enter(vm_t* vm, const vm_insn_t* insn);
+void jit_finish(vm_t* vm, FILE* fp);
+void jit_destroy(vm_t* vm);
+
 #endif /* _VIRTUAL_MACHINE_H_ */